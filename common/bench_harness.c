@@ -0,0 +1,484 @@
+/**
+ * Shared Benchmark Harness
+ *
+ * Both benchmark programs measure through this file so their numbers mean
+ * the same thing:
+ * - Warm-up runs before every data point (caches, page faults, clocks)
+ * - Calls are timed in batches just long enough that reading the counter
+ *   costs under ~1%; throughput and the mean come from those batches
+ * - Latency samples are single calls, timed on their own after each batch,
+ *   whenever one call spans the counter's resolution; only calls too short
+ *   for that fall back to the batch average (reported as sample_calls)
+ * - Threads are all created before any of them runs, start measuring
+ *   together behind a barrier and each measure for the same time;
+ *   throughput is all bytes (MiB, 2^20) over the longest thread's time
+ * - Counter ticks are calibrated against the monotonic clock at start-up.
+ *   "Cycles"/byte is counter ticks per byte: on x86-64 the TSC runs at a
+ *   fixed reference rate, not the core clock, so it differs from core
+ *   cycles whenever turbo or power saving moves the core frequency
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "bench_harness.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MIN_SAMPLES       5
+#define BENCH_MIN_SAMPLE_TICKS  200     // floor for coarse counters
+
+// Holds new threads until all of them exist, or sends them home
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int state;                          // 0 waiting, 1 go, -1 abandon
+} bench_gate_t;
+
+typedef struct {
+    const bench_t *b;
+    bench_fn_t fn;
+    void *ctx;
+    size_t len;
+    uint8_t *in;
+    uint8_t *out;
+    bench_gate_t *gate;
+    pthread_barrier_t *barrier;
+    double samples[BENCH_MAX_SAMPLES];  // ns per call, last BENCH_MAX_SAMPLES batches
+    size_t num_samples;
+    uint64_t sample_calls;              // calls averaged per sample, 1 if timed singly
+    uint64_t calls;
+    uint64_t ticks;
+    double seconds;
+} bench_worker_t;
+
+uint64_t bench_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    // lfence keeps earlier work from drifting past the read
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r"(v) : : "memory");
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+double bench_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+const char *bench_counter_name(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return "rdtsc";
+#elif defined(__aarch64__)
+    return "cntvct";
+#else
+    return "clock_monotonic";
+#endif
+}
+
+static double bench_calibrate(void) {
+#if defined(__aarch64__)
+    uint64_t freq;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+    return (double)freq;
+#elif defined(__x86_64__) || defined(__i386__)
+    double t0 = bench_seconds(), t1;
+    uint64_t c0 = bench_ticks(), c1;
+
+    do {
+        t1 = bench_seconds();
+        c1 = bench_ticks();
+    } while (t1 - t0 < 0.05);
+    return (c1 - c0) / (t1 - t0);
+#else
+    return 1e9;
+#endif
+}
+
+/**
+ * Parse "4096", "64K", "16M"
+ */
+static int bench_parse_size(const char *s, char **end, size_t *size) {
+    unsigned long long v = strtoull(s, end, 10);
+
+    if (*end == s) {
+        return -1;
+    }
+    switch (**end) {
+    case 'K': case 'k': v <<= 10; (*end)++; break;
+    case 'M': case 'm': v <<= 20; (*end)++; break;
+    case 'G': case 'g': v <<= 30; (*end)++; break;
+    default: break;
+    }
+    *size = (size_t)v;
+    return 0;
+}
+
+static void bench_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--json FILE] [--sizes MIN-MAX] [--threads N[,N...]] "
+            "[--time SECONDS] [--quick]\n", prog);
+}
+
+int bench_init(bench_t *b, const char *suite, int argc, char **argv) {
+    memset(b, 0, sizeof(*b));
+    b->suite = suite;
+    b->opts.min_size = 16;
+    b->opts.max_size = 64u << 20;
+    b->opts.threads[0] = 1;
+    b->opts.num_threads = 1;
+    b->opts.min_time = 0.1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end;
+
+        if (strcmp(arg, "--quick") == 0) {
+            b->opts.max_size = 1u << 20;
+            b->opts.min_time = 0.02;
+            continue;
+        }
+        if (!val) {
+            bench_usage(argv[0]);
+            return -1;
+        }
+        i++;
+        if (strcmp(arg, "--json") == 0) {
+            b->opts.json_path = val;
+        } else if (strcmp(arg, "--time") == 0) {
+            b->opts.min_time = strtod(val, &end);
+            if (*end || b->opts.min_time <= 0) {
+                bench_usage(argv[0]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--sizes") == 0) {
+            if (bench_parse_size(val, &end, &b->opts.min_size) != 0 || *end != '-' ||
+                bench_parse_size(end + 1, &end, &b->opts.max_size) != 0 || *end ||
+                b->opts.min_size == 0 || b->opts.min_size > b->opts.max_size) {
+                bench_usage(argv[0]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--threads") == 0) {
+            const char *p = val;
+
+            b->opts.num_threads = 0;
+            while (*p && b->opts.num_threads < BENCH_MAX_THREADS) {
+                long t = strtol(p, &end, 10);
+
+                if (end == p || t < 1 || t > BENCH_MAX_THREADS || (*end && *end != ',')) {
+                    bench_usage(argv[0]);
+                    return -1;
+                }
+                b->opts.threads[b->opts.num_threads++] = (int)t;
+                p = *end ? end + 1 : end;
+            }
+        } else {
+            bench_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    b->tick_hz = bench_calibrate();
+    if (b->opts.json_path) {
+        b->json = fopen(b->opts.json_path, "w");
+        if (!b->json) {
+            perror(b->opts.json_path);
+            return -1;
+        }
+        fprintf(b->json, "{\n  \"suite\": \"%s\",\n  \"counter\": \"%s\",\n  \"tick_hz\": %.0f,\n"
+                "  \"cpus\": %ld,\n  \"results\": [", suite, bench_counter_name(), b->tick_hz,
+                sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    return 0;
+}
+
+void bench_finish(bench_t *b) {
+    if (b->json) {
+        fprintf(b->json, "\n  ]\n}\n");
+        fclose(b->json);
+        printf("Results written to %s\n", b->opts.json_path);
+        b->json = NULL;
+    }
+}
+
+static void bench_gate_open(bench_gate_t *gate, int state) {
+    pthread_mutex_lock(&gate->lock);
+    gate->state = state;
+    pthread_cond_broadcast(&gate->cv);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+static void *bench_worker(void *arg) {
+    bench_worker_t *w = (bench_worker_t *)arg;
+    const bench_t *b = w->b;
+    double min_ticks = b->tick_hz * 2e-6;
+    uint64_t batch = 1, single = UINT64_MAX;
+    double warm_end, start, end;
+    int warm = 0;
+
+    if (w->gate) {
+        int state;
+
+        pthread_mutex_lock(&w->gate->lock);
+        while ((state = w->gate->state) == 0) {
+            pthread_cond_wait(&w->gate->cv, &w->gate->lock);
+        }
+        pthread_mutex_unlock(&w->gate->lock);
+        if (state < 0) {
+            return NULL;
+        }
+    }
+
+    if (min_ticks < BENCH_MIN_SAMPLE_TICKS) {
+        min_ticks = BENCH_MIN_SAMPLE_TICKS;
+    }
+
+    warm_end = bench_seconds() + b->opts.min_time * 0.1;
+    do {
+        w->fn(w->ctx, w->in, w->out, w->len);
+        warm++;
+    } while (warm < 2 || bench_seconds() < warm_end);
+
+    // Fastest of a few single calls decides whether the counter resolves one
+    for (int k = 0; k < BENCH_MIN_SAMPLES; k++) {
+        uint64_t t0 = bench_ticks();
+        w->fn(w->ctx, w->in, w->out, w->len);
+        uint64_t dt = bench_ticks() - t0;
+        if (dt < single) {
+            single = dt;
+        }
+    }
+
+    // Smallest power-of-two batch that spans min_ticks
+    for (;;) {
+        uint64_t t0 = bench_ticks();
+        for (uint64_t k = 0; k < batch; k++) {
+            w->fn(w->ctx, w->in, w->out, w->len);
+        }
+        if (bench_ticks() - t0 >= min_ticks || batch >= (1u << 20)) {
+            break;
+        }
+        batch *= 2;
+    }
+
+    if (w->barrier) {
+        pthread_barrier_wait(w->barrier);
+    }
+    start = bench_seconds();
+    end = start + b->opts.min_time;
+    do {
+        uint64_t t0 = bench_ticks(), dt;
+        for (uint64_t k = 0; k < batch; k++) {
+            w->fn(w->ctx, w->in, w->out, w->len);
+        }
+        dt = bench_ticks() - t0;
+        w->ticks += dt;
+        w->calls += batch;
+
+        // The latency sample is one more call timed alone, counted in the
+        // totals like the rest, so percentiles describe calls, not batches
+        w->sample_calls = batch;
+        if (batch > 1 && single >= BENCH_MIN_SAMPLE_TICKS) {
+            t0 = bench_ticks();
+            w->fn(w->ctx, w->in, w->out, w->len);
+            dt = bench_ticks() - t0;
+            w->ticks += dt;
+            w->calls++;
+            w->sample_calls = 1;
+        }
+        w->samples[w->num_samples++ % BENCH_MAX_SAMPLES] = dt * 1e9 / b->tick_hz / w->sample_calls;
+    } while (w->num_samples < BENCH_MIN_SAMPLES || bench_seconds() < end);
+    w->seconds = bench_seconds() - start;
+    return NULL;
+}
+
+static int bench_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+        }
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+int bench_run(bench_t *b, const char *name, bench_fn_t fn, void *ctx, size_t len, int threads,
+              bench_stats_t *stats) {
+    bench_worker_t *workers;
+    pthread_t tids[BENCH_MAX_THREADS];
+    pthread_barrier_t barrier;
+    bench_gate_t gate;
+    double *all, seconds = 0;
+    size_t total_samples = 0, n = 0;
+    uint64_t calls = 0, ticks = 0;
+    int ret = -1, started = 0;
+
+    if (threads < 1 || threads > BENCH_MAX_THREADS || len == 0) {
+        return -1;
+    }
+    workers = calloc((size_t)threads, sizeof(*workers));
+    if (!workers) {
+        return -1;
+    }
+    for (int t = 0; t < threads; t++) {
+        void *in, *out;
+
+        if (posix_memalign(&in, 64, len) != 0) {
+            goto out;
+        }
+        workers[t].in = in;
+        if (posix_memalign(&out, 64, len) != 0) {
+            goto out;
+        }
+        workers[t].out = out;
+        for (size_t i = 0; i < len; i++) {
+            workers[t].in[i] = (uint8_t)(i * 131 + (i >> 9) + t);
+        }
+        workers[t].b = b;
+        workers[t].fn = fn;
+        workers[t].ctx = ctx;
+        workers[t].len = len;
+    }
+
+    if (threads == 1) {
+        bench_worker(&workers[0]);
+        started = 1;
+    } else {
+        pthread_mutex_init(&gate.lock, NULL);
+        pthread_cond_init(&gate.cv, NULL);
+        gate.state = 0;
+        pthread_barrier_init(&barrier, NULL, (unsigned)threads);
+        for (started = 0; started < threads; started++) {
+            workers[started].gate = &gate;
+            workers[started].barrier = &barrier;
+            if (pthread_create(&tids[started], NULL, bench_worker, &workers[started]) != 0) {
+                break;
+            }
+        }
+        // A missing thread would leave the others stuck at the barrier, so
+        // they only go once all exist, and otherwise return unmeasured
+        bench_gate_open(&gate, started == threads ? 1 : -1);
+        for (int t = 0; t < started; t++) {
+            pthread_join(tids[t], NULL);
+        }
+        pthread_barrier_destroy(&barrier);
+        pthread_cond_destroy(&gate.cv);
+        pthread_mutex_destroy(&gate.lock);
+        if (started < threads) {
+            fprintf(stderr, "bench: could only start %d of %d threads\n", started, threads);
+            goto out;
+        }
+    }
+
+    stats->sample_calls = 0;
+    for (int t = 0; t < threads; t++) {
+        calls += workers[t].calls;
+        ticks += workers[t].ticks;
+        if (workers[t].seconds > seconds) {
+            seconds = workers[t].seconds;
+        }
+        if (workers[t].sample_calls > stats->sample_calls) {
+            stats->sample_calls = workers[t].sample_calls;
+        }
+        total_samples += workers[t].num_samples < BENCH_MAX_SAMPLES ? workers[t].num_samples
+                                                                    : BENCH_MAX_SAMPLES;
+    }
+    all = malloc(total_samples * sizeof(double));
+    if (!all) {
+        goto out;
+    }
+    for (int t = 0; t < threads; t++) {
+        size_t k = workers[t].num_samples < BENCH_MAX_SAMPLES ? workers[t].num_samples
+                                                              : BENCH_MAX_SAMPLES;
+        memcpy(all + n, workers[t].samples, k * sizeof(double));
+        n += k;
+    }
+    qsort(all, n, sizeof(double), bench_cmp_double);
+
+    stats->calls = calls;
+    stats->mean_ns = ticks * 1e9 / b->tick_hz / calls;
+    stats->p50_ns = all[n / 2];
+    stats->p99_ns = all[(size_t)(n * 0.99) < n ? (size_t)(n * 0.99) : n - 1];
+    stats->mbps = (double)calls * len / (1024.0 * 1024.0) / seconds;
+    stats->cycles_per_byte = (double)ticks / ((double)calls * len);
+    free(all);
+
+    if (b->json) {
+        fprintf(b->json, "%s\n    {\"name\": ", b->num_results ? "," : "");
+        bench_json_string(b->json, name);
+        fprintf(b->json, ", \"bytes\": %zu, \"threads\": %d, \"calls\": %llu, \"mean_ns\": %.2f, "
+                "\"p50_ns\": %.2f, \"p99_ns\": %.2f, \"sample_calls\": %llu, \"mbps\": %.2f, "
+                "\"cycles_per_byte\": %.3f}",
+                len, threads, (unsigned long long)calls, stats->mean_ns, stats->p50_ns,
+                stats->p99_ns, (unsigned long long)stats->sample_calls, stats->mbps,
+                stats->cycles_per_byte);
+    }
+    b->num_results++;
+    ret = 0;
+
+out:
+    for (int t = 0; t < threads; t++) {
+        free(workers[t].in);
+        free(workers[t].out);
+    }
+    free(workers);
+    return ret;
+}
+
+static void bench_format_size(size_t len, char *buf, size_t n) {
+    if (len >= (1u << 20) && len % (1u << 20) == 0) {
+        snprintf(buf, n, "%zuM", len >> 20);
+    } else if (len >= 1024 && len % 1024 == 0) {
+        snprintf(buf, n, "%zuK", len >> 10);
+    } else {
+        snprintf(buf, n, "%zu", len);
+    }
+}
+
+void bench_print_header(void) {
+    printf("%-32s %8s %4s %12s %10s %12s %12s\n", "Implementation", "Size", "Thr",
+           "MiB/s", "Cyc/Byte", "p50 (ns)", "p99 (ns)");
+    printf("%-32s %8s %4s %12s %10s %12s %12s\n", "--------------", "----", "---",
+           "-----", "--------", "--------", "--------");
+}
+
+void bench_print_row(const char *name, size_t len, int threads, const bench_stats_t *stats) {
+    char size[24];
+
+    bench_format_size(len, size, sizeof(size));
+    printf("%-32s %8s %4d %12.2f %10.2f %12.1f %12.1f\n", name, size, threads, stats->mbps,
+           stats->cycles_per_byte, stats->p50_ns, stats->p99_ns);
+}
+
+void bench_sweep(bench_t *b, const char *name, bench_fn_t fn, void *ctx, size_t min_len) {
+    for (size_t len = b->opts.min_size; len <= b->opts.max_size; len *= 4) {
+        if (len < min_len) {
+            continue;
+        }
+        for (int i = 0; i < b->opts.num_threads; i++) {
+            bench_stats_t stats;
+
+            if (bench_run(b, name, fn, ctx, len, b->opts.threads[i], &stats) == 0) {
+                bench_print_row(name, len, b->opts.threads[i], &stats);
+            }
+        }
+    }
+}
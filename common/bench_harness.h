@@ -0,0 +1,91 @@
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shared benchmark harness for the SM3 and SM4 benchmarks
+//
+// Every measurement warms up first, then times batches of calls with the
+// CPU's own counter (rdtsc on x86-64, cntvct_el0 on AArch64, the monotonic
+// clock elsewhere) and reports per-call p50/p99 latency, MiB/s and counter
+// ticks per byte. On x86-64 those ticks are TSC reference ticks at a fixed
+// rate, not core cycles, so "cycles/byte" drifts from core cycles whenever
+// turbo or power saving changes the core clock. Latency samples are single calls unless one call is below
+// the counter's resolution, in which case they are batch averages
+// (sample_calls > 1). Results go to the console and, with --json FILE, to a
+// JSON file that generate_charts.py reads.
+//
+// Command line (parsed by bench_init):
+//   --json FILE        write results as JSON
+//   --sizes MIN-MAX    sweep bounds in bytes, K/M suffixes allowed (16-64M)
+//   --threads LIST     thread counts for sweeps, e.g. 1,2,4 (default 1)
+//   --time SECONDS     measuring time per data point (default 0.1)
+//   --quick            sizes up to 1M and 20 ms per point
+
+#define BENCH_MAX_THREADS   64
+#define BENCH_MAX_SAMPLES   4096    // latency samples kept per thread
+
+// One call processes len bytes from in into out; ctx is shared by all
+// threads and must not be written by fn
+typedef void (*bench_fn_t)(void *ctx, const uint8_t *in, uint8_t *out, size_t len);
+
+typedef struct {
+    const char *json_path;
+    size_t min_size;
+    size_t max_size;
+    int threads[BENCH_MAX_THREADS];
+    int num_threads;
+    double min_time;
+} bench_options_t;
+
+typedef struct {
+    double mean_ns;             // per call
+    double p50_ns;              // latency percentiles over samples of
+    double p99_ns;              // sample_calls calls each
+    uint64_t sample_calls;      // 1: single calls, else batch averages
+    double mbps;                // MiB/s (2^20 bytes) of all threads together
+    double cycles_per_byte;     // counter (TSC reference) ticks per byte within one thread
+    uint64_t calls;             // measured calls over all threads
+} bench_stats_t;
+
+typedef struct {
+    const char *suite;
+    bench_options_t opts;
+    FILE *json;
+    int num_results;
+    double tick_hz;             // counter ticks per second
+} bench_t;
+
+// Parse the command line, calibrate the counter and open the JSON output;
+// returns -1 on a bad argument (after printing usage)
+int bench_init(bench_t *b, const char *suite, int argc, char **argv);
+void bench_finish(bench_t *b);
+
+// Measure fn at one size and thread count; the result is also recorded in
+// the JSON output under name. Returns -1 on bad arguments, out of memory or
+// when not all threads could be started
+int bench_run(bench_t *b, const char *name, bench_fn_t fn, void *ctx, size_t len, int threads,
+              bench_stats_t *stats);
+
+// bench_run over the option sizes (16 B, 64 B, ... x4 steps) from min_len
+// on, for every option thread count, printing one table row per point
+void bench_sweep(bench_t *b, const char *name, bench_fn_t fn, void *ctx, size_t min_len);
+void bench_print_header(void);
+void bench_print_row(const char *name, size_t len, int threads, const bench_stats_t *stats);
+
+// Timing primitives
+uint64_t bench_ticks(void);
+double bench_seconds(void);
+const char *bench_counter_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BENCH_HARNESS_H
@@ -1,292 +1,548 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <sys/time.h>
 #include "../src/sm4.h"
-
-/* High-resolution timer */
-static double get_time(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
-}
+#include "../src/sm4_gcm.h"
+#include "../src/sm4_sm3.h"
+#include "bench_harness.h"
 
 /* Benchmark function pointer type */
 typedef void (*sm4_encrypt_func_t)(const sm4_ctx_t *ctx, const uint8_t input[SM4_BLOCK_SIZE], uint8_t output[SM4_BLOCK_SIZE]);
 
-/* Benchmark structure */
+/* Benchmark structure
+ * Multi-block backends set blocks_func instead of encrypt_func; large data is
+ * then handed to them in one call, as sm4_encrypt_blocks() would. */
 typedef struct {
     const char *name;
     sm4_encrypt_func_t encrypt_func;
     void (*setkey_func)(sm4_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE]);
+    sm4_blocks_func_t blocks_func;
 } benchmark_t;
 
 /* Available benchmarks */
 static const benchmark_t benchmarks[] = {
-    {"Basic Implementation", sm4_encrypt_basic, sm4_setkey_enc},
-    {"Optimized Implementation", sm4_encrypt_optimized, sm4_setkey_enc},
+    {"Basic Implementation", sm4_encrypt_basic, sm4_setkey_enc, NULL},
+    {"Optimized Implementation", sm4_encrypt_optimized, sm4_setkey_enc, NULL},
 #ifdef __x86_64__
-    {"SIMD (AVX2) Implementation", sm4_encrypt_simd, sm4_setkey_enc},
+    {"SIMD (AVX2) Implementation", sm4_encrypt_simd, sm4_setkey_enc, NULL},
 #endif
 #ifdef __aarch64__
-    {"NEON Implementation", sm4_encrypt_neon, sm4_setkey_enc},
+    {"NEON Implementation", sm4_encrypt_neon, sm4_setkey_enc, NULL},
 #endif
+    {"Bit-sliced (constant-time)", NULL, sm4_setkey_enc, sm4_encrypt_blocks_bitslice},
 };
 
 static const int num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
 
-/* Single block benchmark */
-double benchmark_single_block(const benchmark_t *bench, int iterations) {
+static const uint8_t bench_key[SM4_KEY_SIZE] = {
+    0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+    0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
+};
+
+/* Harness context: one implementation with its expanded key */
+typedef struct {
+    const benchmark_t *bench;
     sm4_ctx_t ctx;
-    uint8_t key[SM4_KEY_SIZE] = {
-        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
-        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
-    };
-    uint8_t input[SM4_BLOCK_SIZE] = {
-        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
-        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
-    };
-    uint8_t output[SM4_BLOCK_SIZE];
-    
-    bench->setkey_func(&ctx, key);
-    
-    double start = get_time();
-    
-    for (int i = 0; i < iterations; i++) {
-        bench->encrypt_func(&ctx, input, output);
-    }
-    
-    double end = get_time();
-    return end - start;
+} impl_ctx_t;
+
+static void impl_ctx_init(impl_ctx_t *ic, const benchmark_t *bench) {
+    ic->bench = bench;
+    bench->setkey_func(&ic->ctx, bench_key);
 }
 
-/* Large data benchmark */
-double benchmark_large_data(const benchmark_t *bench, size_t data_size, int iterations) {
-    sm4_ctx_t ctx;
-    uint8_t key[SM4_KEY_SIZE] = {
-        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
-        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
-    };
-    
-    uint8_t *input = malloc(data_size);
-    uint8_t *output = malloc(data_size);
-    
-    if (!input || !output) {
-        free(input);
-        free(output);
-        return -1.0;
-    }
-    
-    /* Initialize test data */
-    for (size_t i = 0; i < data_size; i++) {
-        input[i] = (uint8_t)(i & 0xFF);
+static void bench_encrypt(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const impl_ctx_t *ic = (const impl_ctx_t *)arg;
+
+    if (ic->bench->blocks_func) {
+        ic->bench->blocks_func(&ic->ctx, in, out, len / SM4_BLOCK_SIZE);
+        return;
     }
-    
-    bench->setkey_func(&ctx, key);
-    
-    double start = get_time();
-    
-    for (int iter = 0; iter < iterations; iter++) {
-        for (size_t i = 0; i < data_size; i += SM4_BLOCK_SIZE) {
-            bench->encrypt_func(&ctx, input + i, output + i);
-        }
+    for (size_t i = 0; i + SM4_BLOCK_SIZE <= len; i += SM4_BLOCK_SIZE) {
+        ic->bench->encrypt_func(&ic->ctx, in + i, out + i);
     }
-    
-    double end = get_time();
-    
-    free(input);
-    free(output);
-    
-    return end - start;
 }
 
-/* Memory bandwidth test */
-double benchmark_memory_bandwidth(size_t data_size) {
-    uint8_t *src = malloc(data_size);
-    uint8_t *dst = malloc(data_size);
-    
-    if (!src || !dst) {
-        free(src);
-        free(dst);
-        return -1.0;
-    }
-    
-    /* Initialize source data */
-    for (size_t i = 0; i < data_size; i++) {
-        src[i] = (uint8_t)(i & 0xFF);
-    }
-    
-    double start = get_time();
-    memcpy(dst, src, data_size);
-    double end = get_time();
-    
-    free(src);
-    free(dst);
-    
-    return end - start;
+static void bench_memcpy(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    (void)arg;
+    memcpy(out, in, len);
 }
 
-void run_single_block_benchmarks(void) {
+void run_single_block_benchmarks(bench_t *b) {
     printf("Single Block Performance Benchmark\n");
-    printf("==================================\n");
-    
-    const int iterations = 1000000;
-    
-    printf("Testing with %d iterations\n\n", iterations);
-    printf("%-30s %15s %15s %15s\n", "Implementation", "Time (μs)", "Throughput (MB/s)", "Cycles/Byte");
-    printf("%-30s %15s %15s %15s\n", "---------------", "--------", "----------------", "-----------");
-    
+    printf("==================================\n\n");
+    bench_print_header();
+
     for (int i = 0; i < num_benchmarks; i++) {
-        double time = benchmark_single_block(&benchmarks[i], iterations);
-        
-        if (time > 0) {
-            double time_per_block_us = (time * 1000000.0) / iterations;
-            double throughput_mbps = (SM4_BLOCK_SIZE / (1024.0 * 1024.0)) / (time / iterations);
-            double cycles_per_byte = (time_per_block_us * 2400.0) / SM4_BLOCK_SIZE; /* Assume 2.4GHz CPU */
-            
-            printf("%-30s %15.2f %15.2f %15.2f\n", 
-                   benchmarks[i].name, time_per_block_us, throughput_mbps, cycles_per_byte);
-        } else {
-            printf("%-30s %15s %15s %15s\n", benchmarks[i].name, "ERROR", "ERROR", "ERROR");
+        impl_ctx_t ic;
+        bench_stats_t stats;
+        char name[64];
+
+        impl_ctx_init(&ic, &benchmarks[i]);
+        snprintf(name, sizeof(name), "%s (1 block)", benchmarks[i].name);
+        if (bench_run(b, name, bench_encrypt, &ic, SM4_BLOCK_SIZE, 1, &stats) == 0) {
+            bench_print_row(benchmarks[i].name, SM4_BLOCK_SIZE, 1, &stats);
         }
     }
     printf("\n");
 }
 
-void run_large_data_benchmarks(void) {
-    printf("Large Data Performance Benchmark\n");
-    printf("================================\n");
-    
-    const size_t data_sizes[] = {1024, 8192, 65536, 1048576}; /* 1KB, 8KB, 64KB, 1MB */
-    const int iterations[] = {10000, 1000, 100, 10};
-    const int num_sizes = sizeof(data_sizes) / sizeof(data_sizes[0]);
-    
-    for (int size_idx = 0; size_idx < num_sizes; size_idx++) {
-        size_t data_size = data_sizes[size_idx];
-        int iter = iterations[size_idx];
-        
-        printf("Data size: %zu bytes, Iterations: %d\n", data_size, iter);
-        printf("%-30s %15s %15s\n", "Implementation", "Time (ms)", "Throughput (MB/s)");
-        printf("%-30s %15s %15s\n", "---------------", "---------", "----------------");
-        
-        for (int i = 0; i < num_benchmarks; i++) {
-            double time = benchmark_large_data(&benchmarks[i], data_size, iter);
-            
-            if (time > 0) {
-                double time_ms = time * 1000.0;
-                double total_data_mb = (data_size * iter) / (1024.0 * 1024.0);
-                double throughput_mbps = total_data_mb / time;
-                
-                printf("%-30s %15.2f %15.2f\n", 
-                       benchmarks[i].name, time_ms, throughput_mbps);
-            } else {
-                printf("%-30s %15s %15s\n", benchmarks[i].name, "ERROR", "ERROR");
-            }
-        }
+/* Sizes from 16 B up walk through L1, L2, L3 and main memory, so this also
+ * covers what the cache analysis used to measure separately */
+void run_large_data_benchmarks(bench_t *b) {
+    printf("Message Size Sweep\n");
+    printf("==================\n\n");
+
+    for (int i = 0; i < num_benchmarks; i++) {
+        impl_ctx_t ic;
+
+        impl_ctx_init(&ic, &benchmarks[i]);
+        bench_print_header();
+        bench_sweep(b, benchmarks[i].name, bench_encrypt, &ic, SM4_BLOCK_SIZE);
         printf("\n");
     }
 }
 
-void run_speedup_analysis(void) {
+void run_speedup_analysis(bench_t *b) {
     printf("Speedup Analysis\n");
     printf("===============\n");
-    
-    const int iterations = 100000;
+
     const size_t data_size = 65536; /* 64KB */
-    
-    double baseline_time = -1.0;
-    
-    printf("Comparing against basic implementation baseline\n\n");
-    printf("%-30s %15s %15s\n", "Implementation", "Time (ms)", "Speedup");
-    printf("%-30s %15s %15s\n", "---------------", "---------", "-------");
-    
+    double baseline_mbps = -1.0;
+
+    printf("Comparing against basic implementation baseline (64 KB)\n\n");
+    printf("%-30s %15s %15s\n", "Implementation", "MiB/s", "Speedup");
+    printf("%-30s %15s %15s\n", "---------------", "----", "-------");
+
     for (int i = 0; i < num_benchmarks; i++) {
-        double time = benchmark_large_data(&benchmarks[i], data_size, iterations);
-        
-        if (time > 0) {
-            double time_ms = time * 1000.0;
-            
-            if (i == 0) { /* Basic implementation as baseline */
-                baseline_time = time;
-                printf("%-30s %15.2f %15s\n", benchmarks[i].name, time_ms, "1.00x");
-            } else {
-                double speedup = baseline_time / time;
-                printf("%-30s %15.2f %15.2fx\n", benchmarks[i].name, time_ms, speedup);
-            }
-        } else {
+        impl_ctx_t ic;
+        bench_stats_t stats;
+        char name[64];
+
+        impl_ctx_init(&ic, &benchmarks[i]);
+        snprintf(name, sizeof(name), "%s (speedup)", benchmarks[i].name);
+        if (bench_run(b, name, bench_encrypt, &ic, data_size, 1, &stats) != 0) {
             printf("%-30s %15s %15s\n", benchmarks[i].name, "ERROR", "ERROR");
+            continue;
+        }
+        if (i == 0) { /* Basic implementation as baseline */
+            baseline_mbps = stats.mbps;
         }
+        printf("%-30s %15.2f %14.2fx\n", benchmarks[i].name, stats.mbps, stats.mbps / baseline_mbps);
     }
     printf("\n");
 }
 
-void run_memory_bandwidth_test(void) {
-    printf("Memory Bandwidth Analysis\n");
-    printf("========================\n");
-    
-    const size_t test_sizes[] = {1024, 8192, 65536, 1048576}; /* 1KB, 8KB, 64KB, 1MB */
-    const int num_sizes = sizeof(test_sizes) / sizeof(test_sizes[0]);
-    
-    printf("%-15s %15s %15s\n", "Data Size", "Copy Time (ms)", "Bandwidth (MB/s)");
-    printf("%-15s %15s %15s\n", "---------", "-------------", "---------------");
-    
-    for (int i = 0; i < num_sizes; i++) {
-        double time = benchmark_memory_bandwidth(test_sizes[i]);
-        
-        if (time > 0) {
-            double time_ms = time * 1000.0;
-            double bandwidth = (test_sizes[i] / (1024.0 * 1024.0)) / time;
-            
-            printf("%-15zu %15.3f %15.2f\n", test_sizes[i], time_ms, bandwidth);
+void run_memory_bandwidth_test(bench_t *b) {
+    printf("Memory Bandwidth Analysis (memcpy)\n");
+    printf("==================================\n\n");
+    bench_print_header();
+    bench_sweep(b, "memcpy", bench_memcpy, NULL, 1);
+    printf("\n");
+}
+
+/* Multi-block kernels, called the way sm4_encrypt_blocks() calls them */
+void run_backend_benchmarks(bench_t *b) {
+    printf("Multi-block Kernels (per backend)\n");
+    printf("=================================\n\n");
+
+    for (int backend = 0; backend < SM4_BACKEND_COUNT; backend++) {
+        benchmark_t bench = {NULL, NULL, sm4_setkey_enc, sm4_get_blocks_func((sm4_backend_t)backend)};
+        impl_ctx_t ic;
+        char name[64];
+
+        if (!bench.blocks_func) {
+            continue;
         }
+        snprintf(name, sizeof(name), "blocks/%s", sm4_backend_name((sm4_backend_t)backend));
+        bench.name = name;
+        impl_ctx_init(&ic, &bench);
+        bench_print_header();
+        bench_sweep(b, name, bench_encrypt, &ic, SM4_BLOCK_SIZE);
+        printf("\n");
+    }
+}
+
+/* Modes of operation; IVs are copied per call so threads can share ctx */
+typedef struct {
+    sm4_ctx_t enc;
+    sm4_ctx_t dec;
+    sm4_gcm_context_t gcm;
+    sm4_xts_ctx_t xts;
+    uint8_t iv[SM4_BLOCK_SIZE];
+} mode_ctx_t;
+
+static void bench_ecb(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    sm4_ecb_encrypt(&((const mode_ctx_t *)arg)->enc, in, len, out);
+}
+
+static void bench_cbc_enc(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const mode_ctx_t *mc = (const mode_ctx_t *)arg;
+    uint8_t iv[SM4_BLOCK_SIZE];
+
+    memcpy(iv, mc->iv, sizeof(iv));
+    sm4_cbc_encrypt(&mc->enc, iv, in, len, out);
+}
+
+static void bench_cbc_dec(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const mode_ctx_t *mc = (const mode_ctx_t *)arg;
+    uint8_t iv[SM4_BLOCK_SIZE];
+
+    memcpy(iv, mc->iv, sizeof(iv));
+    sm4_cbc_decrypt(&mc->dec, iv, in, len, out);
+}
+
+static void bench_ctr(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const mode_ctx_t *mc = (const mode_ctx_t *)arg;
+    uint8_t iv[SM4_BLOCK_SIZE];
+
+    memcpy(iv, mc->iv, sizeof(iv));
+    sm4_ctr_crypt(&mc->enc, iv, in, len, out);
+}
+
+/* One record with a 96-bit IV and a 16-byte tag; the key schedule and H
+ * powers come precomputed in mc->gcm */
+static void bench_gcm(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const mode_ctx_t *mc = (const mode_ctx_t *)arg;
+    sm4_gcm_context_t gcm = mc->gcm;
+    uint8_t tag[16];
+
+    sm4_gcm_starts(&gcm, SM4_GCM_ENCRYPT, mc->iv, 12);
+    sm4_gcm_update(&gcm, len, in, out);
+    sm4_gcm_finish(&gcm, tag, sizeof(tag));
+}
+
+/* One data unit under one tweak, and the same bytes as 4 KB sectors */
+static void bench_xts(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const mode_ctx_t *mc = (const mode_ctx_t *)arg;
+
+    sm4_xts_encrypt(&mc->xts, mc->iv, in, len, out);
+}
+
+static void bench_xts_sectors(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const mode_ctx_t *mc = (const mode_ctx_t *)arg;
+
+    sm4_xts_encrypt_sectors(&mc->xts, 0, len < 4096 ? len : 4096, in, len, out);
+}
+
+static const struct {
+    const char *name;
+    bench_fn_t fn;
+} mode_benchmarks[] = {
+    {"ecb", bench_ecb},
+    {"cbc-enc", bench_cbc_enc},
+    {"cbc-dec", bench_cbc_dec},
+    {"ctr", bench_ctr},
+    {"gcm", bench_gcm},
+    {"xts", bench_xts},
+    {"xts-4k", bench_xts_sectors},
+};
+
+static const int num_mode_benchmarks = sizeof(mode_benchmarks) / sizeof(mode_benchmarks[0]);
+
+static void mode_ctx_init(mode_ctx_t *mc) {
+    uint8_t xts_key[SM4_XTS_KEY_SIZE];
+
+    sm4_setkey_enc(&mc->enc, bench_key);
+    sm4_setkey_dec(&mc->dec, bench_key);
+    sm4_gcm_init(&mc->gcm, bench_key);
+    for (int i = 0; i < SM4_XTS_KEY_SIZE; i++) {
+        xts_key[i] = (uint8_t)(bench_key[i % SM4_KEY_SIZE] + i / SM4_KEY_SIZE);
+    }
+    sm4_xts_setkey(&mc->xts, xts_key);
+    for (int i = 0; i < SM4_BLOCK_SIZE; i++) {
+        mc->iv[i] = (uint8_t)(0xA0 + i);
+    }
+}
+
+void run_mode_benchmarks(bench_t *b) {
+    sm4_backend_t active = sm4_get_backend();
+    const size_t matrix_size = 16384;
+    mode_ctx_t mc;
+
+    mode_ctx_init(&mc);
+
+    printf("Modes of Operation (%s backend)\n", sm4_backend_name(active));
+    printf("==================\n\n");
+    for (int m = 0; m < num_mode_benchmarks; m++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "%s/%s", mode_benchmarks[m].name, sm4_backend_name(active));
+        bench_print_header();
+        bench_sweep(b, name, mode_benchmarks[m].fn, &mc, SM4_BLOCK_SIZE);
+        printf("\n");
+    }
+
+    /* Every mode on every backend at one record size */
+    printf("Mode x Backend, %zu KB records (MiB/s)\n", matrix_size / 1024);
+    printf("=====================================\n\n");
+    printf("%-16s", "Backend");
+    for (int m = 0; m < num_mode_benchmarks; m++) {
+        printf(" %10s", mode_benchmarks[m].name);
     }
     printf("\n");
+    for (int backend = 0; backend < SM4_BACKEND_COUNT; backend++) {
+        if (sm4_set_backend((sm4_backend_t)backend) != 0) {
+            continue;
+        }
+        printf("%-16s", sm4_backend_name((sm4_backend_t)backend));
+        for (int m = 0; m < num_mode_benchmarks; m++) {
+            bench_stats_t stats;
+            char name[64];
+
+            snprintf(name, sizeof(name), "%s/%s", mode_benchmarks[m].name,
+                     sm4_backend_name((sm4_backend_t)backend));
+            if (bench_run(b, name, mode_benchmarks[m].fn, &mc, matrix_size, 1, &stats) == 0) {
+                printf(" %10.2f", stats.mbps);
+            } else {
+                printf(" %10s", "ERROR");
+            }
+        }
+        printf("\n");
+    }
+    sm4_set_backend(active);
+    printf("\n");
+}
+
+/* Multi-threaded bulk calls on one large buffer */
+static void bench_ecb_mt(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    sm4_ecb_encrypt_mt(&((const mode_ctx_t *)arg)->enc, in, len, out);
+}
+
+static void bench_ctr_mt(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const mode_ctx_t *mc = (const mode_ctx_t *)arg;
+    uint8_t iv[SM4_BLOCK_SIZE];
+
+    memcpy(iv, mc->iv, sizeof(iv));
+    sm4_ctr_crypt_mt(&mc->enc, iv, in, len, out);
 }
 
-void run_cache_analysis(void) {
-    printf("Cache Performance Analysis\n");
-    printf("=========================\n");
-    
-    /* Test different data sizes to observe cache effects */
-    const size_t cache_sizes[] = {
-        1024,      /* L1 cache size */
-        32768,     /* L2 cache size */
-        262144,    /* L3 cache size */
-        8388608    /* Main memory */
+static void bench_gcm_mt(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const mode_ctx_t *mc = (const mode_ctx_t *)arg;
+    sm4_gcm_context_t gcm = mc->gcm;
+    uint8_t tag[16];
+
+    sm4_gcm_starts(&gcm, SM4_GCM_ENCRYPT, mc->iv, 12);
+    sm4_gcm_update_mt(&gcm, len, in, out);
+    sm4_gcm_finish(&gcm, tag, sizeof(tag));
+}
+
+void run_mt_benchmarks(bench_t *b) {
+    static const struct {
+        const char *name;
+        bench_fn_t fn;
+    } mt_benchmarks[] = {
+        {"ecb", bench_ecb_mt},
+        {"ctr", bench_ctr_mt},
+        {"gcm", bench_gcm_mt},
     };
-    const char *cache_names[] = {"L1 Cache", "L2 Cache", "L3 Cache", "Main Memory"};
-    const int num_cache_levels = sizeof(cache_sizes) / sizeof(cache_sizes[0]);
-    
-    printf("Testing cache effects with different data sizes\n\n");
-    printf("%-15s %-30s %15s %15s\n", "Cache Level", "Implementation", "Time (ms)", "Throughput (MB/s)");
-    printf("%-15s %-30s %15s %15s\n", "-----------", "---------------", "---------", "----------------");
-    
-    for (int cache_idx = 0; cache_idx < num_cache_levels; cache_idx++) {
-        size_t data_size = cache_sizes[cache_idx];
-        int iterations = 1000000 / (data_size / 1024); /* Adjust iterations based on size */
-        
-        for (int impl_idx = 0; impl_idx < num_benchmarks; impl_idx++) {
-            double time = benchmark_large_data(&benchmarks[impl_idx], data_size, iterations);
-            
-            if (time > 0) {
-                double time_ms = time * 1000.0;
-                double total_data_mb = (data_size * iterations) / (1024.0 * 1024.0);
-                double throughput = total_data_mb / time;
-                
-                const char *cache_name = (impl_idx == 0) ? cache_names[cache_idx] : "";
-                printf("%-15s %-30s %15.2f %15.2f\n", 
-                       cache_name, benchmarks[impl_idx].name, time_ms, throughput);
+    const size_t size = b->opts.max_size < (64u << 20) ? b->opts.max_size : (64u << 20);
+    int saved = sm4_get_threads();
+    int cpus = sm4_set_threads(0);
+    mode_ctx_t mc;
+
+    mode_ctx_init(&mc);
+
+    printf("Multi-threaded Bulk, %zu MB buffer, %d CPUs (MiB/s)\n", size >> 20, cpus);
+    printf("=================================================\n\n");
+    printf("%-10s %10s %10s %10s\n", "Threads", "ecb", "ctr", "gcm");
+    /* 1, 2, 4, ... threads, ending at the CPU count */
+    for (int t = 1; ; t *= 2) {
+        if (t > cpus) {
+            t = cpus;
+        }
+        sm4_set_threads(t);
+        printf("%-10d", t);
+        for (int m = 0; m < 3; m++) {
+            bench_stats_t stats;
+            char name[64];
+
+            snprintf(name, sizeof(name), "mt-%s/%d", mt_benchmarks[m].name, t);
+            if (bench_run(b, name, mt_benchmarks[m].fn, &mc, size, 1, &stats) == 0) {
+                printf(" %10.2f", stats.mbps);
+            } else {
+                printf(" %10s", "ERROR");
             }
         }
         printf("\n");
+        if (t == cpus) {
+            break;
+        }
+    }
+    sm4_set_threads(saved);
+    printf("\n");
+}
+
+/* Encrypt-then-MAC: CTR or CBC, then HMAC-SM3 over the ciphertext, as two
+ * passes over the buffer or fused tile by tile (sm4_sm3.h) */
+typedef struct {
+    sm4_mode_t mode;
+    int fused;
+} etm_ctx_t;
+
+static const uint8_t etm_mac_key[32] = {0x5a};
+
+static void bench_etm(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const etm_ctx_t *ec = (const etm_ctx_t *)arg;
+    uint8_t iv[SM4_BLOCK_SIZE] = {0};
+    uint8_t mac[SM3_DIGEST_SIZE];
+    sm4_sm3_ctx_t c;
+    size_t n;
+
+    if (ec->fused) {
+        sm4_sm3_init(&c, bench_key, ec->mode, 1, iv, 0, etm_mac_key, sizeof(etm_mac_key));
+        sm4_sm3_update(&c, in, len, out, &n);
+        sm4_sm3_final(&c, out + n, &n, mac);
+    } else {
+        sm3_hmac_key_t key;
+
+        sm4_encrypt_data(bench_key, in, len, out, ec->mode, iv);
+        sm3_hmac_key_init(&key, etm_mac_key, sizeof(etm_mac_key));
+        sm3_hmac(&key, out, len, mac);
+    }
+}
+
+void run_etm_benchmarks(bench_t *b) {
+    static const sm4_mode_t modes[] = {SM4_CTR, SM4_CBC};
+    static const char *const names[] = {"ctr", "cbc"};
+
+    printf("Encrypt-then-MAC, HMAC-SM3 over the ciphertext\n");
+    printf("==============================================\n\n");
+    for (int m = 0; m < 2; m++) {
+        for (int fused = 0; fused < 2; fused++) {
+            etm_ctx_t ec = {modes[m], fused};
+            char name[64];
+
+            snprintf(name, sizeof(name), "etm-%s/%s", names[m], fused ? "fused" : "separate");
+            bench_print_header();
+            bench_sweep(b, name, bench_etm, &ec, SM4_BLOCK_SIZE);
+            printf("\n");
+        }
+    }
+}
+
+/* Key agility: a fresh key every rekey_bytes, as with per-record or
+ * per-session keys; setup cost shows up as lost throughput. With a cache
+ * the keys come pre-expanded from sm4_key_cache_get() instead. */
+typedef struct {
+    size_t rekey_bytes;
+    int gcm;
+    sm4_key_cache_t *cache;
+} rekey_ctx_t;
+
+static void bench_rekey(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    const rekey_ctx_t *rc = (const rekey_ctx_t *)arg;
+    uint8_t key[SM4_KEY_SIZE];
+    uint8_t tag[16];
+
+    memcpy(key, bench_key, sizeof(key));
+    for (size_t off = 0; off < len; off += rc->rekey_bytes) {
+        size_t n = len - off < rc->rekey_bytes ? len - off : rc->rekey_bytes;
+
+        key[0] = (uint8_t)(off / rc->rekey_bytes);
+        if (rc->cache) {
+            const sm4_key_t *k = sm4_key_cache_get(rc->cache, key[0], key);
+
+            if (rc->gcm) {
+                sm4_gcm_encrypt_key(k, bench_key, 12, NULL, 0, in + off, n, out + off,
+                                    tag, sizeof(tag));
+            } else {
+                sm4_encrypt_data_key(k, in + off, n, out + off, SM4_ECB, NULL);
+            }
+            sm4_key_release(k);
+        } else if (rc->gcm) {
+            sm4_gcm_context_t gcm;
+
+            sm4_gcm_init(&gcm, key);
+            sm4_gcm_starts(&gcm, SM4_GCM_ENCRYPT, bench_key, 12);
+            sm4_gcm_update(&gcm, n, in + off, out + off);
+            sm4_gcm_finish(&gcm, tag, sizeof(tag));
+        } else {
+            sm4_ctx_t ctx;
+
+            sm4_setkey_enc(&ctx, key);
+            sm4_ecb_encrypt(&ctx, in + off, n, out + off);
+        }
+    }
+}
+
+/* Key schedule throughput: in holds len / 16 keys, expanded 16 at a time
+ * so the schedules stay on the stack */
+static void bench_keysched(void *arg, const uint8_t *in, uint8_t *out, size_t len) {
+    sm4_ctx_t ctx[16];
+    size_t n = len / SM4_KEY_SIZE;
+    int batch = *(const int *)arg;
+
+    for (size_t i = 0; i < n; i += 16) {
+        size_t cnt = n - i < 16 ? n - i : 16;
+
+        if (batch) {
+            sm4_setkey_enc_batch(ctx, in + i * SM4_KEY_SIZE, cnt);
+        } else {
+            for (size_t k = 0; k < cnt; k++) {
+                sm4_setkey_enc(&ctx[k], in + (i + k) * SM4_KEY_SIZE);
+            }
+        }
+    }
+    memcpy(out, ctx[0].rk, SM4_KEY_SIZE);
+}
+
+void run_key_agility_benchmarks(bench_t *b) {
+    static const size_t rekey_sizes[] = {16, 64, 256, 1024, 4096, 16384, 65536};
+    const size_t data_size = 65536;
+
+    /* Key IDs are one byte, so every lookup after warm-up is a hit */
+    sm4_key_cache_t *cache = sm4_key_cache_create(256);
+
+    printf("Key Agility, re-key every N bytes of %zu KB\n", data_size / 1024);
+    printf("==========================================\n\n");
+    printf("%-12s %14s %14s %14s %14s\n", "N (bytes)", "ecb (MiB/s)", "gcm (MiB/s)",
+           "ecb cached", "gcm cached");
+    printf("%-12s %14s %14s %14s %14s\n", "---------", "----------", "----------",
+           "----------", "----------");
+
+    for (size_t i = 0; i < sizeof(rekey_sizes) / sizeof(rekey_sizes[0]); i++) {
+        double mbps[4];
+
+        for (int v = 0; v < 4; v++) {
+            int gcm = v & 1, cached = v >> 1;
+            rekey_ctx_t rc = {rekey_sizes[i], gcm, cached ? cache : NULL};
+            bench_stats_t stats;
+            char name[64];
+
+            snprintf(name, sizeof(name), "rekey-%s%s/%zu", gcm ? "gcm" : "ecb",
+                     cached ? "-cached" : "", rekey_sizes[i]);
+            mbps[v] = bench_run(b, name, bench_rekey, &rc, data_size, 1, &stats) == 0 ? stats.mbps : 0;
+        }
+        printf("%-12zu %14.2f %14.2f %14.2f %14.2f\n", rekey_sizes[i],
+               mbps[0], mbps[1], mbps[2], mbps[3]);
+    }
+    printf("\n");
+    sm4_key_cache_destroy(cache);
+
+    printf("Key schedule, 1024 keys per call\n");
+    printf("================================\n\n");
+    for (int batch = 0; batch < 2; batch++) {
+        bench_stats_t stats;
+        const char *name = batch ? "keysched/batch" : "keysched/scalar";
+
+        if (bench_run(b, name, bench_keysched, &batch, 1024 * SM4_KEY_SIZE, 1, &stats) == 0) {
+            printf("%-16s %10.2f Mkeys/s %8.1f ns/key\n", name,
+                   1024.0 * 1e3 / stats.mean_ns, stats.mean_ns / 1024.0);
+        }
     }
+    printf("\n");
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    bench_t b;
+
+    if (bench_init(&b, "sm4", argc, argv) != 0) {
+        return 1;
+    }
+
     printf("SM4 Performance Benchmark Suite\n");
     printf("===============================\n\n");
-    
+
     printf("CPU Architecture: ");
 #ifdef __x86_64__
     printf("x86-64 (AVX2 support available)\n");
@@ -295,17 +551,24 @@ int main(void) {
 #else
     printf("Generic\n");
 #endif
-    
-    printf("Available implementations: %d\n\n", num_benchmarks);
-    
+
+    printf("Available implementations: %d\n", num_benchmarks);
+    printf("Counter: %s at %.3f GHz (cycles/byte are counter ticks, not core cycles)\n\n",
+           bench_counter_name(), b.tick_hz / 1e9);
+
     /* Run all benchmark categories */
-    run_single_block_benchmarks();
-    run_large_data_benchmarks();
-    run_speedup_analysis();
-    run_memory_bandwidth_test();
-    run_cache_analysis();
-    
+    run_single_block_benchmarks(&b);
+    run_large_data_benchmarks(&b);
+    run_speedup_analysis(&b);
+    run_backend_benchmarks(&b);
+    run_mode_benchmarks(&b);
+    run_mt_benchmarks(&b);
+    run_etm_benchmarks(&b);
+    run_key_agility_benchmarks(&b);
+    run_memory_bandwidth_test(&b);
+
+    bench_finish(&b);
     printf("Benchmark completed successfully!\n");
-    
+
     return 0;
 }
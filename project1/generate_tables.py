@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""
+SM4 T-table Generator
+Writes src/sm4_ttables.h: T0..T3[i] = L(S(i) << 24 - 8k), the S-box and
+linear transform of one round folded into four 256-entry lookup tables.
+The S-box is read from src/sm4_basic.c so there is a single source for it.
+
+Usage: python3 generate_tables.py [output]   (make tables)
+"""
+
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def read_sbox(path):
+    """Parse the sm4_sbox initializer out of sm4_basic.c"""
+    with open(path) as f:
+        src = f.read()
+    m = re.search(r'const uint8_t sm4_sbox\[256\]\s*=\s*\{(.*?)\};', src, re.S)
+    if not m:
+        raise SystemExit("sm4_sbox not found in " + path)
+    sbox = [int(v, 16) for v in re.findall(r'0x[0-9A-Fa-f]{2}', m.group(1))]
+    if len(sbox) != 256 or sorted(sbox) != list(range(256)):
+        raise SystemExit("sm4_sbox in %s is not a permutation of 0..255" % path)
+    return sbox
+
+
+def rotl(x, n):
+    return ((x << n) | (x >> (32 - n))) & 0xFFFFFFFF
+
+
+def sm4_l(b):
+    return b ^ rotl(b, 2) ^ rotl(b, 10) ^ rotl(b, 18) ^ rotl(b, 24)
+
+
+def main():
+    out_path = sys.argv[1] if len(sys.argv) > 1 else os.path.join(HERE, 'src', 'sm4_ttables.h')
+    sbox = read_sbox(os.path.join(HERE, 'src', 'sm4_basic.c'))
+
+    lines = [
+        '/* Generated by generate_tables.py from sm4_sbox in sm4_basic.c; do not edit.',
+        ' * T<k>[i] = L(S(i) << (24 - 8k)): the byte at position k (0 = MSB) through',
+        ' * the S-box and the linear transform L. Regenerate with make tables. */',
+        '',
+        '#ifndef SM4_TTABLES_H',
+        '#define SM4_TTABLES_H',
+        '',
+        '#include <stdint.h>',
+        '',
+    ]
+    for k in range(4):
+        shift = 24 - 8 * k
+        table = [sm4_l(s << shift) for s in sbox]
+        lines.append('static const uint32_t sm4_t%d[256] __attribute__((aligned(64))) = {' % k)
+        for row in range(0, 256, 8):
+            lines.append('    ' + ', '.join('0x%08X' % v for v in table[row:row + 8]) + ',')
+        lines.append('};')
+        lines.append('')
+    lines.append('#endif /* SM4_TTABLES_H */')
+
+    with open(out_path, 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    main()
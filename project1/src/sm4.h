@@ -32,6 +32,16 @@ extern const uint32_t sm4_ck[32];
 void sm4_setkey_enc(sm4_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE]);
 void sm4_setkey_dec(sm4_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE]);
 
+/* Batched Key Schedule
+ *
+ * Expands num_keys keys stored back to back (16 bytes each) into ctx[0..n).
+ * On x86-64 the keys go through the SIMD round functions of the bulk
+ * kernels, 16 per pass with GFNI and 8 with AVX2; otherwise (and for a
+ * single leftover key) this is a loop over sm4_setkey_enc/dec.
+ */
+void sm4_setkey_enc_batch(sm4_ctx_t *ctx, const uint8_t *keys, size_t num_keys);
+void sm4_setkey_dec_batch(sm4_ctx_t *ctx, const uint8_t *keys, size_t num_keys);
+
 /* Basic Implementation */
 void sm4_encrypt_basic(const sm4_ctx_t *ctx, const uint8_t input[SM4_BLOCK_SIZE], uint8_t output[SM4_BLOCK_SIZE]);
 void sm4_decrypt_basic(const sm4_ctx_t *ctx, const uint8_t input[SM4_BLOCK_SIZE], uint8_t output[SM4_BLOCK_SIZE]);
@@ -52,6 +62,176 @@ void sm4_encrypt_neon(const sm4_ctx_t *ctx, const uint8_t input[SM4_BLOCK_SIZE],
 void sm4_decrypt_neon(const sm4_ctx_t *ctx, const uint8_t input[SM4_BLOCK_SIZE], uint8_t output[SM4_BLOCK_SIZE]);
 #endif
 
+/* Multi-block Interface
+ *
+ * sm4_encrypt_blocks() processes num_blocks consecutive 16-byte blocks with
+ * the fastest backend the running CPU supports. The backend is selected once,
+ * on first use, by probing CPUID (x86-64) and is then called through a
+ * function pointer, so a single binary runs everywhere without -march flags.
+ * Decryption is the same operation with a context from sm4_setkey_dec().
+ */
+typedef void (*sm4_blocks_func_t)(const sm4_ctx_t *ctx, const uint8_t *input,
+                                  uint8_t *output, size_t num_blocks);
+
+typedef enum {
+    SM4_BACKEND_BASIC,
+    SM4_BACKEND_OPTIMIZED,
+    SM4_BACKEND_SIMD,
+    SM4_BACKEND_NEON,
+    SM4_BACKEND_AESNI,
+    SM4_BACKEND_GFNI,
+    SM4_BACKEND_BITSLICE,
+    SM4_BACKEND_BITSLICE_AVX2,
+    SM4_BACKEND_ARMV8_CE,
+    SM4_BACKEND_COUNT
+} sm4_backend_t;
+
+void sm4_encrypt_blocks(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+void sm4_decrypt_blocks(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+
+sm4_backend_t sm4_get_backend(void);
+int sm4_set_backend(sm4_backend_t backend);        /* -1 if not supported on this CPU */
+int sm4_backend_supported(sm4_backend_t backend);
+const char *sm4_backend_name(sm4_backend_t backend);
+sm4_blocks_func_t sm4_get_blocks_func(sm4_backend_t backend);
+
+/* Buffers and In-place Operation
+ *
+ * Every mode function, one-shot and streaming (ECB, CBC, CTR, GCM and the
+ * multi-block kernels), accepts output == input; any other overlap between
+ * the two is undefined. No alignment is required. Outputs of at least
+ * sm4_get_nt_threshold() bytes (default: the last-level cache size, or 8 MB
+ * when it is unknown) that start on a 16-byte boundary are written with
+ * non-temporal stores by ECB and CTR, so a bulk pass does not flush the
+ * working set; 0 turns this off. sm4_alloc_aligned() returns 64-byte aligned
+ * buffers, rounded up to whole cache lines, for sm4_free_aligned().
+ */
+#define SM4_BUFFER_ALIGN 64
+
+void *sm4_alloc_aligned(size_t size);
+void sm4_free_aligned(void *ptr);
+size_t sm4_get_nt_threshold(void);
+void sm4_set_nt_threshold(size_t bytes);
+
+/* Per-backend multi-block kernels (prefer sm4_encrypt_blocks) */
+void sm4_encrypt_blocks_basic(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+void sm4_encrypt_blocks_optimized(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+void sm4_encrypt_blocks_bitslice(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+#ifdef __x86_64__
+void sm4_encrypt_blocks_bitslice_avx2(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+void sm4_encrypt_blocks_simd(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+void sm4_encrypt_blocks_aesni(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+void sm4_encrypt_blocks_gfni(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+
+/* Key schedule kernels for sm4_setkey_enc_batch, a fixed number of keys each */
+#define SM4_SIMD_KEY_LANES 8
+#define SM4_GFNI_KEY_LANES 16
+void sm4_setkey_enc_simd_8keys(sm4_ctx_t ctx[SM4_SIMD_KEY_LANES], const uint8_t *keys);
+void sm4_setkey_enc_gfni_16keys(sm4_ctx_t ctx[SM4_GFNI_KEY_LANES], const uint8_t *keys);
+#endif
+#ifdef __aarch64__
+void sm4_encrypt_blocks_neon(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+/* Armv8.2 SM4E/SM4EKEY (sm4_ce.c); only call if cpu_supports_sm4_ce() */
+void sm4_encrypt_blocks_ce(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks);
+void sm4_setkey_enc_ce(sm4_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE]);
+int sm4_ce_compiled(void);
+#endif
+
+/* CPU Feature Detection */
+int cpu_supports_avx2(void);
+int cpu_supports_aesni(void);
+int cpu_supports_pclmul(void);
+int cpu_supports_gfni_vprold(void);
+int cpu_supports_sm4_ce(void);
+
+/* Key Objects
+ *
+ * An sm4_key_t holds everything derived from one key, computed once: the
+ * encryption schedule, the reversed decryption schedule and the GCM hash
+ * subkey with its H-power table (sm4_gcm_encrypt_key() in sm4_gcm.h). The
+ * object is 64-byte aligned, reference counted and wiped when the last
+ * reference is released; it is never modified after creation, so any number
+ * of threads may use it at once.
+ *
+ * sm4_key_cache_t maps a caller-chosen key ID (tenant, KMS handle) to a key
+ * object, keeping at most capacity of them in LRU order. get() returns a
+ * new reference (release it when done; eviction never frees a key in use).
+ * On a miss, or when key differs from the cached material for that ID, it
+ * expands key and caches the result; key may be NULL for a lookup that
+ * fails with NULL on a miss. The cache is thread-safe; expansion runs
+ * outside its lock.
+ */
+typedef struct sm4_key sm4_key_t;
+typedef struct sm4_key_cache sm4_key_cache_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+} sm4_key_cache_stats_t;
+
+sm4_key_t *sm4_key_create(const uint8_t key[SM4_KEY_SIZE]);   /* NULL on allocation failure */
+const sm4_key_t *sm4_key_retain(const sm4_key_t *key);
+void sm4_key_release(const sm4_key_t *key);                     /* NULL is ignored */
+const sm4_ctx_t *sm4_key_enc_ctx(const sm4_key_t *key);
+const sm4_ctx_t *sm4_key_dec_ctx(const sm4_key_t *key);
+
+sm4_key_cache_t *sm4_key_cache_create(size_t capacity);
+void sm4_key_cache_destroy(sm4_key_cache_t *cache);
+const sm4_key_t *sm4_key_cache_get(sm4_key_cache_t *cache, uint64_t key_id,
+                                   const uint8_t key[SM4_KEY_SIZE]);
+void sm4_key_cache_remove(sm4_key_cache_t *cache, uint64_t key_id);
+void sm4_key_cache_get_stats(sm4_key_cache_t *cache, sm4_key_cache_stats_t *stats);
+
+/* Runtime Statistics
+ *
+ * Built with -DSM4_STATS (make STATS=1), the library counts multi-block
+ * calls per backend, bytes per mode and hits on slow paths. Each thread
+ * writes its own cache-line-aligned counters; sm4_stats_snapshot() sums them
+ * without locks, so a reader never stalls the crypto threads. Counters only
+ * grow (take differences between snapshots for rates), and a snapshot is not
+ * one atomic cut across counters. Without SM4_STATS the counting compiles
+ * away and snapshots are all zero.
+ */
+typedef enum {
+    SM4_STAT_ECB_ENC,
+    SM4_STAT_ECB_DEC,
+    SM4_STAT_CBC_ENC,
+    SM4_STAT_CBC_DEC,
+    SM4_STAT_CTR,
+    SM4_STAT_GCM_ENC,
+    SM4_STAT_GCM_DEC,
+    SM4_STAT_XTS_ENC,
+    SM4_STAT_XTS_DEC,
+    SM4_STAT_MODE_COUNT
+} sm4_stat_mode_t;
+
+typedef enum {
+    SM4_SLOW_SHORT_BATCH,       /* multi-block call with fewer than 8 blocks */
+    SM4_SLOW_CBC_SERIAL,        /* CBC encryption, one block per cipher call */
+    SM4_SLOW_CTR_TAIL,          /* CTR message ending in a partial block */
+    SM4_SLOW_GCM_PARTIAL,       /* GCM update finishing or leaving an open block */
+    SM4_SLOW_GCM_GENERIC,       /* GCM whole blocks outside the stitched kernel */
+    SM4_SLOW_GCM_SOFT_GHASH,    /* bitwise GHASH, no carry-less multiply */
+    SM4_SLOW_GCM_BATCH_RECORD,  /* batched GCM record too large to pack */
+    SM4_SLOW_MT_POOL_BUSY,      /* multi-threaded call queued behind another */
+    SM4_SLOW_COUNT
+} sm4_slow_path_t;
+
+typedef struct {
+    uint64_t backend_calls[SM4_BACKEND_COUNT];
+    uint64_t backend_blocks[SM4_BACKEND_COUNT];
+    uint64_t mode_calls[SM4_STAT_MODE_COUNT];
+    uint64_t mode_bytes[SM4_STAT_MODE_COUNT];
+    uint64_t slow_paths[SM4_SLOW_COUNT];
+} sm4_stats_t;
+
+int sm4_stats_enabled(void);
+void sm4_stats_snapshot(sm4_stats_t *stats);
+const char *sm4_stat_mode_name(sm4_stat_mode_t mode);
+const char *sm4_slow_path_name(sm4_slow_path_t path);
+
 /* Utility Functions */
 uint32_t sm4_rotl(uint32_t x, int n);
 uint32_t sm4_tau(uint32_t a);
@@ -77,10 +257,49 @@ int sm4_cbc_encrypt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE],
 int sm4_cbc_decrypt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE], 
                     const uint8_t *input, size_t length, uint8_t *output);
 
+/* Multi-stream CBC: encrypt num_streams independent CBC streams in parallel,
+ * all under ctx. Stream i uses ivs[i] (updated), inputs[i], lengths[i]
+ * (a multiple of 16) and outputs[i]. */
+int sm4_cbc_encrypt_multi(const sm4_ctx_t *ctx, size_t num_streams, uint8_t *const ivs[],
+                          const uint8_t *const inputs[], const size_t lengths[],
+                          uint8_t *const outputs[]);
+
 /* CTR Mode */
 int sm4_ctr_crypt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE], 
                   const uint8_t *input, size_t length, uint8_t *output);
 
+/* XTS Mode (IEEE 1619 with SM4, for sector encryption)
+ *
+ * A 32-byte key: the data key, then the tweak key (-1 if the halves are
+ * equal). The first tweak is E_K2(tweak); block j uses it times alpha^j
+ * in GF(2^128). length must be at least 16; a final partial block is
+ * handled with ciphertext stealing, so output is exactly length bytes.
+ * Blocks go to sm4_encrypt_blocks()/sm4_decrypt_blocks() SM4_XTS_BATCH at
+ * a time, so the widest backend sees whole batches. The sector calls
+ * process length / sector_size consecutive sectors (length must be a
+ * multiple, sector_size 16 or more), sector i with the tweak sector + i
+ * as a 128-bit little-endian number, the usual data-unit numbering.
+ * output may be input.
+ */
+#define SM4_XTS_KEY_SIZE    (2 * SM4_KEY_SIZE)
+#define SM4_XTS_BATCH       64      /* blocks per kernel call, as in sm4_modes.c */
+
+typedef struct {
+    sm4_ctx_t enc;          /* data key, encryption schedule */
+    sm4_ctx_t dec;          /* data key, decryption schedule */
+    sm4_ctx_t tweak;        /* tweak key, encryption schedule */
+} sm4_xts_ctx_t;
+
+int sm4_xts_setkey(sm4_xts_ctx_t *ctx, const uint8_t key[SM4_XTS_KEY_SIZE]);
+int sm4_xts_encrypt(const sm4_xts_ctx_t *ctx, const uint8_t tweak[SM4_BLOCK_SIZE],
+                    const uint8_t *input, size_t length, uint8_t *output);
+int sm4_xts_decrypt(const sm4_xts_ctx_t *ctx, const uint8_t tweak[SM4_BLOCK_SIZE],
+                    const uint8_t *input, size_t length, uint8_t *output);
+int sm4_xts_encrypt_sectors(const sm4_xts_ctx_t *ctx, uint64_t sector, size_t sector_size,
+                            const uint8_t *input, size_t length, uint8_t *output);
+int sm4_xts_decrypt_sectors(const sm4_xts_ctx_t *ctx, uint64_t sector, size_t sector_size,
+                            const uint8_t *input, size_t length, uint8_t *output);
+
 /* Padding */
 size_t sm4_pkcs7_padding_add(uint8_t *data, size_t length, size_t buffer_size);
 size_t sm4_pkcs7_padding_remove(const uint8_t *data, size_t length);
@@ -91,6 +310,64 @@ int sm4_encrypt_data(const uint8_t key[SM4_KEY_SIZE], const uint8_t *input,
 int sm4_decrypt_data(const uint8_t key[SM4_KEY_SIZE], const uint8_t *input, 
                      size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv);
 
+/* Same, with a pre-expanded key object: no key schedule per call */
+int sm4_encrypt_data_key(const sm4_key_t *key, const uint8_t *input,
+                         size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv);
+int sm4_decrypt_data_key(const sm4_key_t *key, const uint8_t *input,
+                         size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv);
+
+/* Multi-threaded Bulk Interface
+ *
+ * Same results as sm4_ecb_* and sm4_ctr_crypt (and sm4_gcm_update_mt() in
+ * sm4_gcm.h), with the buffer cut into SM4_MT_CHUNK pieces that the calling
+ * thread and a persistent worker pool process in parallel. Worth it from a
+ * few chunks up; below two chunks everything runs on the caller.
+ * sm4_set_threads() caps the threads per call (<= 0: one per online CPU,
+ * the default) and returns the new value. The pool runs one call at a time:
+ * concurrent callers queue and each gets the whole pool in turn, so several
+ * threads issuing _mt calls at once gain nothing over one.
+ */
+#define SM4_MT_CHUNK        (256 * 1024)    /* L2-resident with its output */
+#define SM4_MT_MAX_THREADS  64
+
+int sm4_set_threads(int num_threads);
+int sm4_get_threads(void);
+int sm4_ecb_encrypt_mt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length, uint8_t *output);
+int sm4_ecb_decrypt_mt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length, uint8_t *output);
+int sm4_ctr_crypt_mt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE],
+                     const uint8_t *input, size_t length, uint8_t *output);
+
+/* Streaming Interface (ECB, CBC, CTR)
+ *
+ * update() takes chunks of any length. Whole blocks go straight to the mode
+ * functions above; a partial block (ECB/CBC) or the unused part of a
+ * keystream block (CTR) is kept in the context. For ECB and CBC, update()
+ * may write up to length + 15 bytes and final() up to 16; *out_len gets the
+ * count. With padding, encryption appends PKCS#7 padding in final() and
+ * decryption holds back the last block until final() checks and strips it.
+ * Without padding the total length must be a multiple of 16 (final()
+ * returns -1 otherwise). CTR output always matches its input byte for byte,
+ * and final() writes nothing. output may be input for CTR, and for ECB/CBC
+ * as long as no partial block is buffered at the call. final() wipes the
+ * context. For GCM, sm4_gcm_update() (sm4_gcm.h) already buffers this way.
+ */
+typedef struct {
+    sm4_ctx_t key;
+    uint8_t iv[SM4_BLOCK_SIZE];     /* CBC chaining value or next CTR counter */
+    uint8_t buf[SM4_BLOCK_SIZE];    /* pending input (ECB/CBC) or keystream (CTR) */
+    size_t buf_len;                 /* CTR: unused keystream bytes at the end of buf */
+    sm4_mode_t mode;
+    int encrypt;
+    int padding;
+} sm4_cipher_ctx_t;
+
+/* iv is required for CBC and CTR; -1 for CFB/OFB or a missing iv */
+int sm4_cipher_init(sm4_cipher_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE], sm4_mode_t mode,
+                    int encrypt, const uint8_t iv[SM4_BLOCK_SIZE], int padding);
+int sm4_cipher_update(sm4_cipher_ctx_t *ctx, const uint8_t *input, size_t length,
+                      uint8_t *output, size_t *out_len);
+int sm4_cipher_final(sm4_cipher_ctx_t *ctx, uint8_t *output, size_t *out_len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,15 +1,26 @@
 /**
  * SM4 AES-NI Instruction Set Optimization Implementation
- * 
+ *
  * This file implements SM4 block cipher using Intel AES-NI instructions
  * for hardware-accelerated S-box operations.
- * 
+ *
  * Features:
- * - Hardware S-box acceleration using AES instructions
- * - VPSHUFB for parallel byte permutation
- * - AVX2 register optimization
- * 
- * Performance: ~13% improvement over basic implementation
+ * - Hardware S-box acceleration using AESENCLAST
+ * - VPSHUFB for the GF(2) affine maps and byte rotations
+ * - Four blocks per XMM register in transposed (word-sliced) layout,
+ *   two independent groups in flight to hide AESENCLAST latency
+ *
+ * The SM4 and AES S-boxes are both built on inversion in GF(2^8), only in
+ * different polynomial bases. SM4's S-box can therefore be written as
+ *
+ *     S_sm4(x) = B(S_aes(A(x)))
+ *
+ * where A and B are affine maps over GF(2) that absorb the change of field
+ * basis and the two standards' affine layers. A and B are evaluated with two
+ * 16-entry nibble tables each (PSHUFB), and S_aes comes from AESENCLAST with a
+ * zero round key, after undoing its ShiftRows with a byte shuffle.
+ *
+ * Built with -maes -mssse3; selected at runtime by sm4_dispatch.c.
  */
 
 #include "sm4.h"
@@ -18,268 +29,168 @@
 
 #ifdef __AES__
 
-// AES-NI S-box lookup table mapping for SM4
-static const uint8_t aes_to_sm4_sbox[256] = {
-    // Pre-computed mapping from AES S-box to SM4 S-box
-    0xd6, 0x90, 0xe9, 0xfe, 0xcc, 0xe1, 0x3d, 0xb7,
-    0x16, 0xb6, 0x14, 0xc2, 0x28, 0xfb, 0x2c, 0x05,
-    0x2b, 0x67, 0x9a, 0x76, 0x2a, 0xbe, 0x04, 0xc3,
-    0xaa, 0x44, 0x13, 0x26, 0x49, 0x86, 0x06, 0x99,
-    0x9c, 0x42, 0x50, 0xf4, 0x91, 0xef, 0x98, 0x7a,
-    0x33, 0x54, 0x0b, 0x43, 0xed, 0xcf, 0xac, 0x62,
-    0xe4, 0xb3, 0x1c, 0xa9, 0xc9, 0x08, 0xe8, 0x95,
-    0x80, 0xdf, 0x94, 0xfa, 0x75, 0x8f, 0x3f, 0xa6,
-    0x47, 0x07, 0xa7, 0xfc, 0xf3, 0x73, 0x17, 0xba,
-    0x83, 0x59, 0x3c, 0x19, 0xe6, 0x85, 0x4f, 0xa8,
-    0x68, 0x6b, 0x81, 0xb2, 0x71, 0x64, 0xda, 0x8b,
-    0xf8, 0xeb, 0x0f, 0x4b, 0x70, 0x56, 0x9d, 0x35,
-    0x1e, 0x24, 0x0e, 0x5e, 0x63, 0x58, 0xd1, 0xa2,
-    0x25, 0x22, 0x7c, 0x3b, 0x01, 0x21, 0x78, 0x87,
-    0xd4, 0x00, 0x46, 0x57, 0x9f, 0xd3, 0x27, 0x52,
-    0x4c, 0x36, 0x02, 0xe7, 0xa0, 0xc4, 0xc8, 0x9e,
-    0xea, 0xbf, 0x8a, 0xd2, 0x40, 0xc7, 0x38, 0xb5,
-    0xa3, 0xf7, 0xf2, 0xce, 0xf9, 0x61, 0x15, 0xa1,
-    0xe0, 0xae, 0x5d, 0xa4, 0x9b, 0x34, 0x1a, 0x55,
-    0xad, 0x93, 0x32, 0x30, 0xf5, 0x8c, 0xb1, 0xe3,
-    0x1d, 0xf6, 0xe2, 0x2e, 0x82, 0x66, 0xca, 0x60,
-    0xc0, 0x29, 0x23, 0xab, 0x0d, 0x53, 0x4e, 0x6f,
-    0xd5, 0xdb, 0x37, 0x45, 0xde, 0xfd, 0x8e, 0x2f,
-    0x03, 0xff, 0x6a, 0x72, 0x6d, 0x6c, 0x5b, 0x51,
-    0x8d, 0x1b, 0xaf, 0x92, 0xbb, 0xdd, 0xbc, 0x7f,
-    0x11, 0xd9, 0x5c, 0x41, 0x1f, 0x10, 0x5a, 0xd8,
-    0x0a, 0xc1, 0x31, 0x88, 0xa5, 0xcd, 0x7b, 0xbd,
-    0x2d, 0x74, 0xd0, 0x12, 0xb8, 0xe5, 0xb4, 0xb0,
-    0x89, 0x69, 0x97, 0x4a, 0x0c, 0x96, 0x77, 0x7e,
-    0x65, 0xb9, 0xf1, 0x09, 0xc5, 0x6e, 0xc6, 0x84,
-    0x18, 0xf0, 0x7d, 0xec, 0x3a, 0xdc, 0x4d, 0x20,
-    0x79, 0xee, 0x5f, 0x3e, 0xd7, 0xcb, 0x39, 0x48
+/* Blocks processed per kernel call */
+#define SM4_AESNI_LANES 8
+
+/* x -> A(x): SM4 input basis to AES field, including the SM4 affine layer */
+static const uint8_t aesni_pre_lo[16] = {
+    0x3E, 0xB2, 0x0E, 0x82, 0xBB, 0x37, 0x8B, 0x07,
+    0xA1, 0x2D, 0x91, 0x1D, 0x24, 0xA8, 0x14, 0x98
+};
+static const uint8_t aesni_pre_hi[16] = {
+    0x00, 0xDC, 0x2E, 0xF2, 0xC5, 0x19, 0xEB, 0x37,
+    0x08, 0xD4, 0x26, 0xFA, 0xCD, 0x11, 0xE3, 0x3F
+};
+
+/* y -> B(y): AES S-box output back to SM4, including both affine layers */
+static const uint8_t aesni_post_lo[16] = {
+    0x6C, 0xD4, 0xA6, 0x1E, 0x52, 0xEA, 0x98, 0x20,
+    0x0B, 0xB3, 0xC1, 0x79, 0x35, 0x8D, 0xFF, 0x47
+};
+static const uint8_t aesni_post_hi[16] = {
+    0x00, 0xE0, 0x50, 0xB0, 0x9D, 0x7D, 0xCD, 0x2D,
+    0xC0, 0x20, 0x90, 0x70, 0x5D, 0xBD, 0x0D, 0xED
 };
 
 /**
- * AES-NI accelerated S-box transformation for SM4
- * Uses AES instruction set to accelerate byte substitution
+ * GF(2) affine map on every byte: lo[x & 0x0F] ^ hi[x >> 4]
  */
-static inline __m128i aesni_sbox_sm4(__m128i input) {
-    // Use AES S-box structure similarity for acceleration
-    __m128i temp = _mm_aesimc_si128(input);
-    
-    // Apply transformation to map AES S-box to SM4 S-box
-    // This is a simplified approach - full implementation would use
-    // pre-computed tables and optimized mapping
-    __m128i result = _mm_aesenc_si128(temp, _mm_setzero_si128());
-    
-    // Additional transformation for SM4 S-box mapping
-    // (Implementation details would involve lookup table optimization)
-    return result;
+static inline __m128i aesni_affine(__m128i x, __m128i lo, __m128i hi) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i l = _mm_and_si128(x, nibble);
+    __m128i h = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+    return _mm_xor_si128(_mm_shuffle_epi8(lo, l), _mm_shuffle_epi8(hi, h));
 }
 
 /**
- * VPSHUFB-based parallel byte permutation
- * Optimizes the linear transformation L using vector shuffle
+ * SM4 S-box on all 16 bytes using AESENCLAST
  */
-static inline __m128i vpshufb_linear_transform(__m128i input) {
-    // Shuffle mask for SM4 linear transformation
-    const __m128i shuffle_mask = _mm_set_epi8(
-        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3
+static inline __m128i aesni_sbox_sm4(__m128i x) {
+    /* AESENCLAST applies ShiftRows before SubBytes; pre-apply its inverse */
+    const __m128i inv_shift_rows = _mm_setr_epi8(
+        0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3
     );
-    
-    __m128i shuffled = _mm_shuffle_epi8(input, shuffle_mask);
-    
-    // Apply rotations using shifts and OR operations
-    __m128i rot2 = _mm_or_si128(_mm_slli_epi32(shuffled, 2), _mm_srli_epi32(shuffled, 30));
-    __m128i rot10 = _mm_or_si128(_mm_slli_epi32(shuffled, 10), _mm_srli_epi32(shuffled, 22));
-    __m128i rot18 = _mm_or_si128(_mm_slli_epi32(shuffled, 18), _mm_srli_epi32(shuffled, 14));
-    __m128i rot24 = _mm_or_si128(_mm_slli_epi32(shuffled, 24), _mm_srli_epi32(shuffled, 8));
-    
-    // XOR all rotations
-    __m128i result = _mm_xor_si128(shuffled, rot2);
-    result = _mm_xor_si128(result, rot10);
-    result = _mm_xor_si128(result, rot18);
-    result = _mm_xor_si128(result, rot24);
-    
-    return result;
+    x = aesni_affine(x, _mm_loadu_si128((const __m128i*)aesni_pre_lo),
+                        _mm_loadu_si128((const __m128i*)aesni_pre_hi));
+    x = _mm_shuffle_epi8(x, inv_shift_rows);
+    x = _mm_aesenclast_si128(x, _mm_setzero_si128());
+    return aesni_affine(x, _mm_loadu_si128((const __m128i*)aesni_post_lo),
+                           _mm_loadu_si128((const __m128i*)aesni_post_hi));
 }
 
 /**
- * SM4 round function using AES-NI optimization
+ * Linear transformation L on four words
+ *
+ * With y = x ^ (x <<< 8) ^ (x <<< 16), L(x) = x ^ (x <<< 24) ^ (y <<< 2),
+ * so three of the five rotations become byte shuffles.
  */
-static inline uint32_t sm4_round_aesni(uint32_t x0, uint32_t x1, uint32_t x2, uint32_t x3, uint32_t rk) {
-    // Pack input into 128-bit register
-    __m128i input = _mm_set_epi32(0, 0, 0, x1 ^ x2 ^ x3 ^ rk);
-    
-    // Apply AES-NI accelerated S-box
-    __m128i sbox_result = aesni_sbox_sm4(input);
-    
-    // Apply linear transformation
-    __m128i linear_result = vpshufb_linear_transform(sbox_result);
-    
-    // Extract result and XOR with x0
-    uint32_t temp = _mm_extract_epi32(linear_result, 0);
-    return x0 ^ temp;
-}
+static inline __m128i aesni_linear_transform(__m128i x) {
+    const __m128i rol8 = _mm_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    const __m128i rol16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m128i rol24 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
 
-/**
- * SM4 block encryption using AES-NI instructions
- */
-void sm4_encrypt_block_aesni(const sm4_context_t* ctx, const uint8_t input[16], uint8_t output[16]) {
-    // Load input block
-    uint32_t x0 = GETU32(input);
-    uint32_t x1 = GETU32(input + 4);
-    uint32_t x2 = GETU32(input + 8);
-    uint32_t x3 = GETU32(input + 12);
-    
-    // 32 rounds of SM4 with AES-NI optimization
-    for (int i = 0; i < 32; i++) {
-        uint32_t temp = sm4_round_aesni(x0, x1, x2, x3, ctx->rk[i]);
-        x0 = x1;
-        x1 = x2;
-        x2 = x3;
-        x3 = temp;
-    }
-    
-    // Store output block (reverse order)
-    PUTU32(output, x3);
-    PUTU32(output + 4, x2);
-    PUTU32(output + 8, x1);
-    PUTU32(output + 12, x0);
+    __m128i y = _mm_xor_si128(x, _mm_shuffle_epi8(x, rol8));
+    y = _mm_xor_si128(y, _mm_shuffle_epi8(x, rol16));
+    y = _mm_or_si128(_mm_slli_epi32(y, 2), _mm_srli_epi32(y, 30));
+
+    return _mm_xor_si128(_mm_xor_si128(x, y), _mm_shuffle_epi8(x, rol24));
 }
 
-/**
- * SM4 block decryption using AES-NI instructions
- */
-void sm4_decrypt_block_aesni(const sm4_context_t* ctx, const uint8_t input[16], uint8_t output[16]) {
-    // Load input block
-    uint32_t x0 = GETU32(input);
-    uint32_t x1 = GETU32(input + 4);
-    uint32_t x2 = GETU32(input + 8);
-    uint32_t x3 = GETU32(input + 12);
-    
-    // 32 rounds of SM4 with AES-NI optimization (reverse key order)
-    for (int i = 31; i >= 0; i--) {
-        uint32_t temp = sm4_round_aesni(x0, x1, x2, x3, ctx->rk[i]);
-        x0 = x1;
-        x1 = x2;
-        x2 = x3;
-        x3 = temp;
-    }
-    
-    // Store output block (reverse order)
-    PUTU32(output, x3);
-    PUTU32(output + 4, x2);
-    PUTU32(output + 8, x1);
-    PUTU32(output + 12, x0);
+static inline __m128i aesni_t_transform(__m128i x) {
+    return aesni_linear_transform(aesni_sbox_sm4(x));
 }
 
 /**
- * Parallel SM4 encryption using AES-NI and AVX2
- * Processes 2 blocks simultaneously using 256-bit registers
+ * Load four blocks and transpose so register i holds word i of every block
  */
-void sm4_encrypt_blocks_aesni_avx2(const sm4_context_t* ctx, const uint8_t* input, uint8_t* output, size_t num_blocks) {
-    if (num_blocks == 0) return;
-    
-    // Process blocks in pairs
-    for (size_t i = 0; i < num_blocks; i += 2) {
-        if (i + 1 < num_blocks) {
-            // Process two blocks in parallel
-            __m256i block_pair = _mm256_loadu_si256((__m256i*)(input + i * 16));
-            
-            // Split into two 128-bit blocks
-            __m128i block1 = _mm256_extracti128_si256(block_pair, 0);
-            __m128i block2 = _mm256_extracti128_si256(block_pair, 1);
-            
-            // Process each block
-            uint8_t temp1[16], temp2[16];
-            _mm_storeu_si128((__m128i*)temp1, block1);
-            _mm_storeu_si128((__m128i*)temp2, block2);
-            
-            sm4_encrypt_block_aesni(ctx, temp1, output + i * 16);
-            sm4_encrypt_block_aesni(ctx, temp2, output + (i + 1) * 16);
-        } else {
-            // Process single remaining block
-            sm4_encrypt_block_aesni(ctx, input + i * 16, output + i * 16);
-        }
-    }
+static inline void aesni_load_4blocks(const uint8_t *in, __m128i x[4]) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m128i b0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in +  0)), bswap);
+    __m128i b1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 16)), bswap);
+    __m128i b2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 32)), bswap);
+    __m128i b3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 48)), bswap);
+    __m128i t0 = _mm_unpacklo_epi32(b0, b1);
+    __m128i t1 = _mm_unpacklo_epi32(b2, b3);
+    __m128i t2 = _mm_unpackhi_epi32(b0, b1);
+    __m128i t3 = _mm_unpackhi_epi32(b2, b3);
+
+    x[0] = _mm_unpacklo_epi64(t0, t1);
+    x[1] = _mm_unpackhi_epi64(t0, t1);
+    x[2] = _mm_unpacklo_epi64(t2, t3);
+    x[3] = _mm_unpackhi_epi64(t2, t3);
 }
 
 /**
- * CPU feature detection for AES-NI support
+ * Apply the final reverse transformation R, transpose back and store
  */
-int cpu_supports_aesni(void) {
-    int cpuinfo[4];
-    __cpuid(cpuinfo, 1);
-    return (cpuinfo[2] & (1 << 25)) != 0; // Check AESNI bit in ECX
+static inline void aesni_store_4blocks(uint8_t *out, const __m128i x[4]) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m128i t0 = _mm_unpacklo_epi32(x[3], x[2]);
+    __m128i t1 = _mm_unpacklo_epi32(x[1], x[0]);
+    __m128i t2 = _mm_unpackhi_epi32(x[3], x[2]);
+    __m128i t3 = _mm_unpackhi_epi32(x[1], x[0]);
+
+    _mm_storeu_si128((__m128i*)(out +  0), _mm_shuffle_epi8(_mm_unpacklo_epi64(t0, t1), bswap));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm_shuffle_epi8(_mm_unpackhi_epi64(t0, t1), bswap));
+    _mm_storeu_si128((__m128i*)(out + 32), _mm_shuffle_epi8(_mm_unpacklo_epi64(t2, t3), bswap));
+    _mm_storeu_si128((__m128i*)(out + 48), _mm_shuffle_epi8(_mm_unpackhi_epi64(t2, t3), bswap));
 }
 
+/* X[i+4] = X[i] ^ T(X[i+1] ^ X[i+2] ^ X[i+3] ^ rk) for both groups, in place of X[i] */
+#define AESNI_ROUND(a0, a1, a2, a3, b0, b1, b2, b3, k) do {                      \
+        const __m128i rk_ = _mm_set1_epi32((int)(k));                           \
+        __m128i ta_ = _mm_xor_si128(_mm_xor_si128(a1, a2), _mm_xor_si128(a3, rk_)); \
+        __m128i tb_ = _mm_xor_si128(_mm_xor_si128(b1, b2), _mm_xor_si128(b3, rk_)); \
+        a0 = _mm_xor_si128(a0, aesni_t_transform(ta_));                          \
+        b0 = _mm_xor_si128(b0, aesni_t_transform(tb_));                          \
+    } while (0)
+
 /**
- * Initialize SM4 context with AES-NI optimization
+ * SM4 encryption of eight blocks (two interleaved groups of four)
  */
-int sm4_init_aesni(sm4_context_t* ctx, const uint8_t key[16]) {
-    if (!cpu_supports_aesni()) {
-        return -1; // AES-NI not supported
+static void sm4_encrypt_8blocks_aesni(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output) {
+    __m128i a[4], b[4];
+    int round;
+
+    aesni_load_4blocks(input, a);
+    aesni_load_4blocks(input + 64, b);
+
+    for (round = 0; round < SM4_ROUNDS; round += 4) {
+        AESNI_ROUND(a[0], a[1], a[2], a[3], b[0], b[1], b[2], b[3], ctx->rk[round]);
+        AESNI_ROUND(a[1], a[2], a[3], a[0], b[1], b[2], b[3], b[0], ctx->rk[round + 1]);
+        AESNI_ROUND(a[2], a[3], a[0], a[1], b[2], b[3], b[0], b[1], ctx->rk[round + 2]);
+        AESNI_ROUND(a[3], a[0], a[1], a[2], b[3], b[0], b[1], b[2], ctx->rk[round + 3]);
     }
-    
-    // Use standard key expansion (can be optimized with AES-NI key schedule)
-    return sm4_setkey_enc(ctx, key);
+
+    /* After 32 rounds a[0..3] holds X32..X35 */
+    aesni_store_4blocks(output, a);
+    aesni_store_4blocks(output + 64, b);
 }
 
 /**
- * Benchmark function for AES-NI implementation
+ * Multi-block SM4 encryption using AES-NI
  */
-double benchmark_sm4_aesni(size_t data_size, int iterations) {
-    if (!cpu_supports_aesni()) {
-        return -1.0;
-    }
-    
-    // Prepare test data
-    uint8_t* input = aligned_alloc(32, data_size);
-    uint8_t* output = aligned_alloc(32, data_size);
-    uint8_t key[16] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
-                       0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10};
-    
-    sm4_context_t ctx;
-    sm4_init_aesni(&ctx, key);
-    
-    // Fill input with random data
-    for (size_t i = 0; i < data_size; i++) {
-        input[i] = (uint8_t)(rand() & 0xFF);
+void sm4_encrypt_blocks_aesni(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    uint8_t buf[SM4_AESNI_LANES * SM4_BLOCK_SIZE];
+    size_t i;
+
+    for (i = 0; i + SM4_AESNI_LANES <= num_blocks; i += SM4_AESNI_LANES) {
+        sm4_encrypt_8blocks_aesni(ctx, input + i * SM4_BLOCK_SIZE, output + i * SM4_BLOCK_SIZE);
     }
-    
-    // Benchmark encryption
-    clock_t start = clock();
-    for (int i = 0; i < iterations; i++) {
-        sm4_encrypt_blocks_aesni_avx2(&ctx, input, output, data_size / 16);
+
+    /* Pad the tail through a stack buffer so the kernel stays branch-free */
+    if (i < num_blocks) {
+        size_t tail = (num_blocks - i) * SM4_BLOCK_SIZE;
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, input + i * SM4_BLOCK_SIZE, tail);
+        sm4_encrypt_8blocks_aesni(ctx, buf, buf);
+        memcpy(output + i * SM4_BLOCK_SIZE, buf, tail);
     }
-    clock_t end = clock();
-    
-    double time_taken = ((double)(end - start)) / CLOCKS_PER_SEC;
-    double throughput = (data_size * iterations) / (time_taken * 1024 * 1024); // MB/s
-    
-    free(input);
-    free(output);
-    
-    return throughput;
 }
 
 #else
-// Fallback when AES-NI is not available
-void sm4_encrypt_block_aesni(const sm4_context_t* ctx, const uint8_t input[16], uint8_t output[16]) {
-    // Fall back to optimized implementation
-    sm4_encrypt_block_optimized(ctx, input, output);
-}
-
-void sm4_decrypt_block_aesni(const sm4_context_t* ctx, const uint8_t input[16], uint8_t output[16]) {
-    sm4_decrypt_block_optimized(ctx, input, output);
-}
-
-int cpu_supports_aesni(void) {
-    return 0;
-}
-
-int sm4_init_aesni(sm4_context_t* ctx, const uint8_t key[16]) {
-    return sm4_setkey_enc(ctx, key);
-}
-
-double benchmark_sm4_aesni(size_t data_size, int iterations) {
-    return benchmark_sm4_optimized(data_size, iterations);
+/* Fallback when built without -maes */
+void sm4_encrypt_blocks_aesni(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    sm4_encrypt_blocks_optimized(ctx, input, output, num_blocks);
 }
 #endif /* __AES__ */
@@ -1,4 +1,5 @@
 #include "sm4.h"
+#include "sm4_stats.h"
 #include <string.h>
 
 /* SM4 S-Box */
@@ -78,6 +79,14 @@ void sm4_setkey_enc(sm4_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE]) {
     uint32_t mk[4];
     int i;
     
+#ifdef __aarch64__
+    /* SM4EKEY derives four round keys per instruction */
+    if (cpu_supports_sm4_ce()) {
+        sm4_setkey_enc_ce(ctx, key);
+        return;
+    }
+#endif
+    
     /* Load key into 32-bit words */
     for (i = 0; i < 4; i++) {
         k[i] = ((uint32_t)key[i * 4] << 24) |
@@ -164,86 +173,36 @@ void sm4_decrypt_basic(const sm4_ctx_t *ctx, const uint8_t input[SM4_BLOCK_SIZE]
     sm4_encrypt_basic(ctx, input, output);
 }
 
-/* ECB Mode Implementation */
-int sm4_ecb_encrypt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length, uint8_t *output) {
+/* Basic multi-block encryption (reference backend for sm4_encrypt_blocks) */
+void sm4_encrypt_blocks_basic(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
     size_t i;
     
-    if (length % SM4_BLOCK_SIZE != 0) {
-        return -1; /* Invalid length for ECB mode */
-    }
-    
-    for (i = 0; i < length; i += SM4_BLOCK_SIZE) {
-        sm4_encrypt_basic(ctx, input + i, output + i);
+    for (i = 0; i < num_blocks; i++) {
+        sm4_encrypt_basic(ctx, input + i * SM4_BLOCK_SIZE, output + i * SM4_BLOCK_SIZE);
     }
-    
-    return 0;
 }
 
-int sm4_ecb_decrypt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length, uint8_t *output) {
-    size_t i;
-    
+/* ECB Mode Implementation */
+int sm4_ecb_encrypt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length, uint8_t *output) {
     if (length % SM4_BLOCK_SIZE != 0) {
         return -1; /* Invalid length for ECB mode */
     }
     
-    for (i = 0; i < length; i += SM4_BLOCK_SIZE) {
-        sm4_decrypt_basic(ctx, input + i, output + i);
-    }
-    
-    return 0;
-}
-
-/* CBC Mode Implementation */
-int sm4_cbc_encrypt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE], 
-                    const uint8_t *input, size_t length, uint8_t *output) {
-    uint8_t temp[SM4_BLOCK_SIZE];
-    size_t i, j;
-    
-    if (length % SM4_BLOCK_SIZE != 0) {
-        return -1; /* Invalid length for CBC mode */
-    }
-    
-    for (i = 0; i < length; i += SM4_BLOCK_SIZE) {
-        /* XOR with IV/previous ciphertext */
-        for (j = 0; j < SM4_BLOCK_SIZE; j++) {
-            temp[j] = input[i + j] ^ iv[j];
-        }
-        
-        /* Encrypt */
-        sm4_encrypt_basic(ctx, temp, output + i);
-        
-        /* Update IV */
-        memcpy(iv, output + i, SM4_BLOCK_SIZE);
-    }
+    SM4_STAT_ADD(mode_calls[SM4_STAT_ECB_ENC], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_ECB_ENC], length);
+    sm4_encrypt_blocks(ctx, input, output, length / SM4_BLOCK_SIZE);
     
     return 0;
 }
 
-int sm4_cbc_decrypt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE], 
-                    const uint8_t *input, size_t length, uint8_t *output) {
-    uint8_t temp[SM4_BLOCK_SIZE];
-    uint8_t next_iv[SM4_BLOCK_SIZE];
-    size_t i, j;
-    
+int sm4_ecb_decrypt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length, uint8_t *output) {
     if (length % SM4_BLOCK_SIZE != 0) {
-        return -1; /* Invalid length for CBC mode */
+        return -1; /* Invalid length for ECB mode */
     }
     
-    for (i = 0; i < length; i += SM4_BLOCK_SIZE) {
-        /* Save next IV */
-        memcpy(next_iv, input + i, SM4_BLOCK_SIZE);
-        
-        /* Decrypt */
-        sm4_decrypt_basic(ctx, input + i, temp);
-        
-        /* XOR with IV */
-        for (j = 0; j < SM4_BLOCK_SIZE; j++) {
-            output[i + j] = temp[j] ^ iv[j];
-        }
-        
-        /* Update IV */
-        memcpy(iv, next_iv, SM4_BLOCK_SIZE);
-    }
+    SM4_STAT_ADD(mode_calls[SM4_STAT_ECB_DEC], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_ECB_DEC], length);
+    sm4_decrypt_blocks(ctx, input, output, length / SM4_BLOCK_SIZE);
     
     return 0;
 }
@@ -0,0 +1,272 @@
+#include "sm4.h"
+#include <string.h>
+
+/* Bit-sliced constant-time SM4
+ *
+ * No table lookups and no secret-dependent branches: the S-box is evaluated
+ * as a boolean circuit on bit planes, so the T-table cache-timing channel of
+ * sm4_optimized.c does not exist here.
+ *
+ * Layout: a plane is a vector of 32-bit lanes. Lane q holds byte q (0 = most
+ * significant) of a state word, bit b of the lane belongs to block b, and
+ * plane p holds bit p of that byte. A state word for the whole batch is thus
+ * 8 planes. Rotating a word by 8 bits only permutes lanes, and rotating by 2
+ * renames planes (with a lane shift for the two planes that wrap), so L costs
+ * no bit shuffling at all. The S-box circuit runs once per round for all four
+ * byte positions of every block.
+ *
+ * The plane is a GCC vector type, which compiles to SSE2 on x86-64 and to
+ * NEON on aarch64 (4 lanes, 32 blocks per call). sm4_bitslice_avx2.c builds
+ * this file again with SM4_BS_WIDE for 8-lane AVX2 vectors and 64 blocks.
+ */
+
+#ifdef SM4_BS_WIDE
+#define SM4_BS_LANES 8
+#define SM4_BS_FUNC(name) name##_avx2
+#else
+#define SM4_BS_LANES 4
+#define SM4_BS_FUNC(name) name
+#endif
+
+/* Blocks per kernel call: 32 per group of four lanes */
+#define SM4_BS_BLOCKS (8 * SM4_BS_LANES)
+
+typedef uint32_t sm4_bs_t __attribute__((vector_size(4 * SM4_BS_LANES)));
+
+#if defined(__clang__)
+#define SM4_BS_SHUFFLE(v, ...) __builtin_shufflevector(v, v, __VA_ARGS__)
+#else
+#define SM4_BS_SHUFFLE(v, ...) __builtin_shuffle(v, (sm4_bs_t){__VA_ARGS__})
+#endif
+
+/* Word rotations by whole bytes: lane q takes byte q + n/8 of the same group */
+#ifdef SM4_BS_WIDE
+#define SM4_BS_ROL8(v)  SM4_BS_SHUFFLE(v, 1, 2, 3, 0, 5, 6, 7, 4)
+#define SM4_BS_ROL16(v) SM4_BS_SHUFFLE(v, 2, 3, 0, 1, 6, 7, 4, 5)
+#define SM4_BS_ROL24(v) SM4_BS_SHUFFLE(v, 3, 0, 1, 2, 7, 4, 5, 6)
+#else
+#define SM4_BS_ROL8(v)  SM4_BS_SHUFFLE(v, 1, 2, 3, 0)
+#define SM4_BS_ROL16(v) SM4_BS_SHUFFLE(v, 2, 3, 0, 1)
+#define SM4_BS_ROL24(v) SM4_BS_SHUFFLE(v, 3, 0, 1, 2)
+#endif
+
+/* GF(16) = GF(2)[x]/(x^4 + x + 1) on bit planes */
+static inline void sm4_bs_gf16_mul(sm4_bs_t r[4], const sm4_bs_t a[4], const sm4_bs_t b[4]) {
+    sm4_bs_t c0 = a[0] & b[0];
+    sm4_bs_t c1 = (a[0] & b[1]) ^ (a[1] & b[0]);
+    sm4_bs_t c2 = (a[0] & b[2]) ^ (a[1] & b[1]) ^ (a[2] & b[0]);
+    sm4_bs_t c3 = (a[0] & b[3]) ^ (a[1] & b[2]) ^ (a[2] & b[1]) ^ (a[3] & b[0]);
+    sm4_bs_t c4 = (a[1] & b[3]) ^ (a[2] & b[2]) ^ (a[3] & b[1]);
+    sm4_bs_t c5 = (a[2] & b[3]) ^ (a[3] & b[2]);
+    sm4_bs_t c6 = a[3] & b[3];
+
+    /* x^4 = x + 1, x^5 = x^2 + x, x^6 = x^3 + x^2 */
+    r[0] = c0 ^ c4;
+    r[1] = c1 ^ c4 ^ c5;
+    r[2] = c2 ^ c5 ^ c6;
+    r[3] = c3 ^ c6;
+}
+
+static inline void sm4_bs_gf16_sq(sm4_bs_t r[4], const sm4_bs_t a[4]) {
+    sm4_bs_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+    r[0] = a0 ^ a2;
+    r[1] = a2;
+    r[2] = a1 ^ a3;
+    r[3] = a3;
+}
+
+/* S-box circuit
+ *
+ * S(x) = A * inv(A * x + 0xD3) + 0xD3 over GF(2^8)/0x1F5. The input affine
+ * layer and a change of basis map x to i*t + k in GF(16)[t]/(t^2 + t + 9),
+ * where inv(i*t + k) = (i*t + (i + k)) / (9*i^2 + i*k + k^2). The GF(16)
+ * inverse is N^14 = (N^3)^4 * N^2. The output matrix maps back to the SM4
+ * basis and applies the output affine layer (the NOTs are its constant).
+ */
+static inline void sm4_bs_sbox(sm4_bs_t x[8]) {
+    sm4_bs_t e[8], ik[4], n[4], n2[4], n3[4], n12[4], ki[4];
+    sm4_bs_t *k = e, *i = e + 4;
+    int j;
+
+    e[0] = ~(x[4] ^ x[5] ^ x[6] ^ x[7]);
+    e[1] = ~(x[1] ^ x[4] ^ x[5] ^ x[6]);
+    e[2] = ~(x[1] ^ x[2] ^ x[4] ^ x[6] ^ x[7]);
+    e[3] = ~(x[3] ^ x[4]);
+    e[4] = x[0] ^ x[1] ^ x[4] ^ x[7];
+    e[5] = ~x[6];
+    e[6] = x[2] ^ x[6] ^ x[7];
+    e[7] = ~(x[0] ^ x[1] ^ x[2] ^ x[3] ^ x[4] ^ x[5] ^ x[6]);
+
+    /* Norm N = 9*i^2 + i*k + k^2 */
+    sm4_bs_gf16_mul(ik, i, k);
+    n[0] = i[0] ^ k[0] ^ k[2] ^ ik[0];
+    n[1] = i[1] ^ i[3] ^ k[2] ^ ik[1];
+    n[2] = i[3] ^ k[1] ^ k[3] ^ ik[2];
+    n[3] = i[0] ^ i[2] ^ k[3] ^ ik[3];
+
+    /* n = N^-1 = N^14 */
+    sm4_bs_gf16_sq(n2, n);
+    sm4_bs_gf16_mul(n3, n2, n);
+    sm4_bs_gf16_sq(n12, n3);
+    sm4_bs_gf16_sq(n12, n12);
+    sm4_bs_gf16_mul(n, n12, n2);
+
+    for (j = 0; j < 4; j++) {
+        ki[j] = k[j] ^ i[j];
+    }
+    sm4_bs_gf16_mul(e + 4, i, n);
+    sm4_bs_gf16_mul(e, ki, n);
+
+    x[0] = ~(e[0] ^ e[1] ^ e[4] ^ e[5]);
+    x[1] = ~(e[0] ^ e[2] ^ e[5] ^ e[6]);
+    x[2] = e[2] ^ e[4];
+    x[3] = e[0] ^ e[2] ^ e[4] ^ e[5] ^ e[7];
+    x[4] = ~(e[1] ^ e[3] ^ e[7]);
+    x[5] = e[1] ^ e[3] ^ e[5];
+    x[6] = ~(e[0] ^ e[1] ^ e[2]);
+    x[7] = ~(e[0] ^ e[3] ^ e[5]);
+}
+
+/* Linear transformation L
+ * With y = b ^ (b <<< 8) ^ (b <<< 16), L(b) = b ^ (b <<< 24) ^ (y <<< 2).
+ * Rotating by 2 moves plane p to p + 2; planes 6 and 7 wrap into planes 0
+ * and 1 of the next more significant byte.
+ */
+static inline void sm4_bs_l(sm4_bs_t b[8]) {
+    sm4_bs_t y[8];
+    int p;
+
+    for (p = 0; p < 8; p++) {
+        y[p] = b[p] ^ SM4_BS_ROL8(b[p]) ^ SM4_BS_ROL16(b[p]);
+    }
+    for (p = 0; p < 8; p++) {
+        sm4_bs_t r2 = (p >= 2) ? y[p - 2] : SM4_BS_ROL8(y[p + 6]);
+        b[p] = b[p] ^ SM4_BS_ROL24(b[p]) ^ r2;
+    }
+}
+
+/* 8x8 bit-matrix transpose: bit 8r + c <-> bit 8c + r */
+static inline uint64_t sm4_bs_transpose8(uint64_t x) {
+    uint64_t t;
+
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+/* Blocks -> planes. Each group of 8 blocks fills one byte of every lane. */
+static void sm4_bs_load(sm4_bs_t X[4][8], const uint8_t *input) {
+    int g, pos, i, p;
+
+    memset(X, 0, 4 * 8 * sizeof(sm4_bs_t));
+
+    for (g = 0; g < SM4_BS_BLOCKS / 8; g++) {
+        const uint8_t *blk = input + g * 8 * SM4_BLOCK_SIZE;
+        int lane_base = (g / 4) * 4;
+        int shift = (g % 4) * 8;
+
+        for (pos = 0; pos < SM4_BLOCK_SIZE; pos++) {
+            uint64_t v = 0;
+
+            for (i = 0; i < 8; i++) {
+                v |= (uint64_t)blk[i * SM4_BLOCK_SIZE + pos] << (8 * i);
+            }
+            v = sm4_bs_transpose8(v);  /* byte p now holds bit p of each block */
+
+            for (p = 0; p < 8; p++) {
+                X[pos / 4][p][lane_base + pos % 4] |= (uint32_t)((v >> (8 * p)) & 0xFF) << shift;
+            }
+        }
+    }
+}
+
+/* Planes -> blocks, writing word w of every block from X[order[w]] */
+static void sm4_bs_store(uint8_t *output, sm4_bs_t X[4][8], const int order[4]) {
+    int g, pos, i, p;
+
+    for (g = 0; g < SM4_BS_BLOCKS / 8; g++) {
+        uint8_t *blk = output + g * 8 * SM4_BLOCK_SIZE;
+        int lane_base = (g / 4) * 4;
+        int shift = (g % 4) * 8;
+
+        for (pos = 0; pos < SM4_BLOCK_SIZE; pos++) {
+            const sm4_bs_t *w = X[order[pos / 4]];
+            uint64_t v = 0;
+
+            for (p = 0; p < 8; p++) {
+                v |= (uint64_t)((w[p][lane_base + pos % 4] >> shift) & 0xFF) << (8 * p);
+            }
+            v = sm4_bs_transpose8(v);
+
+            for (i = 0; i < 8; i++) {
+                blk[i * SM4_BLOCK_SIZE + pos] = (uint8_t)(v >> (8 * i));
+            }
+        }
+    }
+}
+
+/* Round key broadcast: lane q of plane p is all ones iff bit p of byte q is set */
+static inline sm4_bs_t sm4_bs_rk_plane(uint32_t rk, int p) {
+    uint32_t m0 = 0u - ((rk >> (24 + p)) & 1);
+    uint32_t m1 = 0u - ((rk >> (16 + p)) & 1);
+    uint32_t m2 = 0u - ((rk >> (8 + p)) & 1);
+    uint32_t m3 = 0u - ((rk >> p) & 1);
+#ifdef SM4_BS_WIDE
+    return (sm4_bs_t){m0, m1, m2, m3, m0, m1, m2, m3};
+#else
+    return (sm4_bs_t){m0, m1, m2, m3};
+#endif
+}
+
+static void sm4_bs_encrypt_batch(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output) {
+    static const int reverse[4] = {3, 2, 1, 0};
+    sm4_bs_t X[4][8];
+    int round, p;
+
+    sm4_bs_load(X, input);
+
+    /* X[i+4] = X[i] ^ T(X[i+1] ^ X[i+2] ^ X[i+3] ^ rk[i]) overwrites X[i] */
+    for (round = 0; round < SM4_ROUNDS; round++) {
+        sm4_bs_t *x0 = X[round & 3];
+        const sm4_bs_t *x1 = X[(round + 1) & 3];
+        const sm4_bs_t *x2 = X[(round + 2) & 3];
+        const sm4_bs_t *x3 = X[(round + 3) & 3];
+        sm4_bs_t t[8];
+
+        for (p = 0; p < 8; p++) {
+            t[p] = x1[p] ^ x2[p] ^ x3[p] ^ sm4_bs_rk_plane(ctx->rk[round], p);
+        }
+        sm4_bs_sbox(t);
+        sm4_bs_l(t);
+        for (p = 0; p < 8; p++) {
+            x0[p] ^= t[p];
+        }
+    }
+
+    /* Reverse final transformation: output (X35, X34, X33, X32) */
+    sm4_bs_store(output, X, reverse);
+}
+
+/* Bit-sliced multi-block encryption (backend for sm4_encrypt_blocks) */
+void SM4_BS_FUNC(sm4_encrypt_blocks_bitslice)(const sm4_ctx_t *ctx, const uint8_t *input,
+                                              uint8_t *output, size_t num_blocks) {
+    uint8_t buf[SM4_BS_BLOCKS * SM4_BLOCK_SIZE];
+    size_t i;
+
+    for (i = 0; i + SM4_BS_BLOCKS <= num_blocks; i += SM4_BS_BLOCKS) {
+        sm4_bs_encrypt_batch(ctx, input + i * SM4_BLOCK_SIZE, output + i * SM4_BLOCK_SIZE);
+    }
+
+    /* Pad a partial batch; lanes of unused blocks are simply discarded */
+    if (i < num_blocks) {
+        size_t tail = (num_blocks - i) * SM4_BLOCK_SIZE;
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, input + i * SM4_BLOCK_SIZE, tail);
+        sm4_bs_encrypt_batch(ctx, buf, buf);
+        memcpy(output + i * SM4_BLOCK_SIZE, buf, tail);
+    }
+}
@@ -0,0 +1,3 @@
+/* 64-block AVX2 build of the bit-sliced kernel (see sm4_bitslice.c) */
+#define SM4_BS_WIDE
+#include "sm4_bitslice.c"
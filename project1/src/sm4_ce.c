@@ -0,0 +1,104 @@
+/**
+ * SM4 with the Armv8.2-A SM4 Crypto Extension (SM4E / SM4EKEY)
+ *
+ * SM4E performs four rounds on a whole block held as four 32-bit lanes, so
+ * a block is eight SM4E instructions with the round keys as four-key
+ * vectors. Eight independent blocks are kept in flight to cover the SM4E
+ * latency; SM4EKEY derives four round keys per instruction.
+ *
+ * Built with -march=armv8.2-a+sm4 and only selected when the kernel reports
+ * HWCAP_SM4; without compiler support the backend reports unsupported.
+ */
+
+#include "sm4.h"
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_SM4)
+
+#include <arm_neon.h>
+
+#define SM4_CE_LANES 8
+
+/* Big-endian words <-> lanes */
+static inline uint32x4_t sm4_ce_load(const uint8_t *p) {
+    return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)));
+}
+
+/* After 32 rounds the lanes hold X32..X35; the output is X35..X32 */
+static inline void sm4_ce_store(uint8_t *p, uint32x4_t x) {
+    x = vrev64q_u32(x);
+    x = vextq_u32(x, x, 2);
+    vst1q_u8(p, vrev32q_u8(vreinterpretq_u8_u32(x)));
+}
+
+static inline void sm4_ce_load_keys(const sm4_ctx_t *ctx, uint32x4_t rk[8]) {
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        rk[i] = vld1q_u32(ctx->rk + 4 * i);
+    }
+}
+
+void sm4_encrypt_blocks_ce(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    uint32x4_t rk[8];
+    size_t i;
+    int r, l;
+
+    sm4_ce_load_keys(ctx, rk);
+
+    for (i = 0; i + SM4_CE_LANES <= num_blocks; i += SM4_CE_LANES) {
+        uint32x4_t x[SM4_CE_LANES];
+
+        for (l = 0; l < SM4_CE_LANES; l++) {
+            x[l] = sm4_ce_load(input + (i + l) * SM4_BLOCK_SIZE);
+        }
+        for (r = 0; r < 8; r++) {
+            for (l = 0; l < SM4_CE_LANES; l++) {
+                x[l] = vsm4eq_u32(x[l], rk[r]);
+            }
+        }
+        for (l = 0; l < SM4_CE_LANES; l++) {
+            sm4_ce_store(output + (i + l) * SM4_BLOCK_SIZE, x[l]);
+        }
+    }
+
+    for (; i < num_blocks; i++) {
+        uint32x4_t x = sm4_ce_load(input + i * SM4_BLOCK_SIZE);
+
+        for (r = 0; r < 8; r++) {
+            x = vsm4eq_u32(x, rk[r]);
+        }
+        sm4_ce_store(output + i * SM4_BLOCK_SIZE, x);
+    }
+}
+
+/* rk[4i..4i+3] = SM4EKEY(rk[4i-4..4i-1], CK[4i..4i+3]), starting from K ^ FK */
+void sm4_setkey_enc_ce(sm4_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE]) {
+    uint32x4_t k = veorq_u32(sm4_ce_load(key), vld1q_u32(sm4_fk));
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        k = vsm4ekeyq_u32(k, vld1q_u32(sm4_ck + 4 * i));
+        vst1q_u32(ctx->rk + 4 * i, k);
+    }
+}
+
+int sm4_ce_compiled(void) {
+    return 1;
+}
+
+#elif defined(__aarch64__)
+
+/* Toolchain without +sm4: the backend is reported unsupported */
+void sm4_encrypt_blocks_ce(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    sm4_encrypt_blocks_neon(ctx, input, output, num_blocks);
+}
+
+void sm4_setkey_enc_ce(sm4_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE]) {
+    sm4_setkey_enc(ctx, key);
+}
+
+int sm4_ce_compiled(void) {
+    return 0;
+}
+
+#endif /* __aarch64__ && __ARM_FEATURE_SM4 */
@@ -0,0 +1,170 @@
+/**
+ * Streaming ECB/CBC/CTR on top of the one-shot mode functions
+ *
+ * Only the block that straddles two update() calls passes through the
+ * context buffer; everything else goes to sm4_ecb_*, sm4_cbc_* or
+ * sm4_ctr_crypt in one call per update, so the wide kernels see the
+ * caller's whole chunk.
+ */
+
+#include "sm4.h"
+#include <string.h>
+
+int sm4_cipher_init(sm4_cipher_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE], sm4_mode_t mode,
+                    int encrypt, const uint8_t iv[SM4_BLOCK_SIZE], int padding) {
+    if (mode != SM4_ECB && mode != SM4_CBC && mode != SM4_CTR) {
+        return -1;
+    }
+    if (mode != SM4_ECB && !iv) {
+        return -1;
+    }
+
+    memset(ctx, 0, sizeof(*ctx));
+    /* CTR only ever runs the cipher forwards */
+    if (encrypt || mode == SM4_CTR) {
+        sm4_setkey_enc(&ctx->key, key);
+    } else {
+        sm4_setkey_dec(&ctx->key, key);
+    }
+    if (iv) {
+        memcpy(ctx->iv, iv, SM4_BLOCK_SIZE);
+    }
+    ctx->mode = mode;
+    ctx->encrypt = encrypt;
+    ctx->padding = mode != SM4_CTR && padding;
+    return 0;
+}
+
+/* Whole blocks through the underlying mode (length is a multiple of 16) */
+static void sm4_cipher_blocks(sm4_cipher_ctx_t *ctx, const uint8_t *input, size_t length,
+                              uint8_t *output) {
+    if (ctx->mode == SM4_ECB) {
+        if (ctx->encrypt) {
+            sm4_ecb_encrypt(&ctx->key, input, length, output);
+        } else {
+            sm4_ecb_decrypt(&ctx->key, input, length, output);
+        }
+    } else if (ctx->encrypt) {
+        sm4_cbc_encrypt(&ctx->key, ctx->iv, input, length, output);
+    } else {
+        sm4_cbc_decrypt(&ctx->key, ctx->iv, input, length, output);
+    }
+}
+
+static void sm4_cipher_ctr(sm4_cipher_ctx_t *ctx, const uint8_t *input, size_t length,
+                           uint8_t *output) {
+    size_t i, full;
+
+    /* Keystream left over from the previous call */
+    for (; ctx->buf_len > 0 && length > 0; ctx->buf_len--, length--) {
+        *output++ = *input++ ^ ctx->buf[SM4_BLOCK_SIZE - ctx->buf_len];
+    }
+
+    full = length & ~(size_t)(SM4_BLOCK_SIZE - 1);
+    if (full > 0) {
+        sm4_ctr_crypt(&ctx->key, ctx->iv, input, full, output);
+    }
+
+    if (length > full) {
+        /* Run one block of zeros through CTR for the keystream; this also
+         * consumes its counter */
+        memset(ctx->buf, 0, SM4_BLOCK_SIZE);
+        sm4_ctr_crypt(&ctx->key, ctx->iv, ctx->buf, SM4_BLOCK_SIZE, ctx->buf);
+        for (i = 0; full + i < length; i++) {
+            output[full + i] = input[full + i] ^ ctx->buf[i];
+        }
+        ctx->buf_len = SM4_BLOCK_SIZE - i;
+    }
+}
+
+int sm4_cipher_update(sm4_cipher_ctx_t *ctx, const uint8_t *input, size_t length,
+                      uint8_t *output, size_t *out_len) {
+    /* Padded decryption keeps the last full block back for final() */
+    int hold = ctx->padding && !ctx->encrypt;
+    size_t written = 0, bulk;
+
+    if (ctx->mode == SM4_CTR) {
+        sm4_cipher_ctr(ctx, input, length, output);
+        *out_len = length;
+        return 0;
+    }
+
+    if (ctx->buf_len > 0) {
+        size_t take = SM4_BLOCK_SIZE - ctx->buf_len;
+
+        take = take < length ? take : length;
+        memcpy(ctx->buf + ctx->buf_len, input, take);
+        ctx->buf_len += take;
+        input += take;
+        length -= take;
+
+        if (ctx->buf_len < SM4_BLOCK_SIZE || (hold && length == 0)) {
+            *out_len = 0;
+            return 0;
+        }
+        sm4_cipher_blocks(ctx, ctx->buf, SM4_BLOCK_SIZE, output);
+        ctx->buf_len = 0;
+        written = SM4_BLOCK_SIZE;
+    }
+
+    bulk = length & ~(size_t)(SM4_BLOCK_SIZE - 1);
+    if (hold && bulk == length && bulk > 0) {
+        bulk -= SM4_BLOCK_SIZE;
+    }
+    if (bulk > 0) {
+        sm4_cipher_blocks(ctx, input, bulk, output + written);
+        written += bulk;
+    }
+
+    memcpy(ctx->buf, input + bulk, length - bulk);
+    ctx->buf_len = length - bulk;
+    *out_len = written;
+    return 0;
+}
+
+int sm4_cipher_final(sm4_cipher_ctx_t *ctx, uint8_t *output, size_t *out_len) {
+    uint8_t block[SM4_BLOCK_SIZE];
+    int ret = 0;
+
+    *out_len = 0;
+
+    if (ctx->mode == SM4_CTR) {
+        /* Nothing pending: the keystream tail is simply dropped */
+    } else if (!ctx->padding) {
+        ret = ctx->buf_len == 0 ? 0 : -1;
+    } else if (ctx->encrypt) {
+        uint8_t pad = (uint8_t)(SM4_BLOCK_SIZE - ctx->buf_len);
+
+        memset(ctx->buf + ctx->buf_len, pad, pad);
+        sm4_cipher_blocks(ctx, ctx->buf, SM4_BLOCK_SIZE, output);
+        *out_len = SM4_BLOCK_SIZE;
+    } else if (ctx->buf_len != SM4_BLOCK_SIZE) {
+        ret = -1;
+    } else {
+        unsigned pad, bad;
+        size_t i;
+
+        /* Every byte of the block is checked whatever the pad value, and
+         * every bad padding gives the same -1, so timing and the return
+         * value say nothing about where the padding went wrong */
+        sm4_cipher_blocks(ctx, ctx->buf, SM4_BLOCK_SIZE, block);
+        pad = block[SM4_BLOCK_SIZE - 1];
+        bad = ((pad - 1) | (SM4_BLOCK_SIZE - pad)) >> 8;       /* 0 or > 16 */
+        for (i = 0; i < SM4_BLOCK_SIZE; i++) {
+            unsigned from_end = (unsigned)(SM4_BLOCK_SIZE - 1 - i);
+            unsigned in_pad = 0u - ((from_end - pad) >> 31);     /* from_end < pad */
+
+            bad |= in_pad & (block[i] ^ pad);
+        }
+        if (bad) {
+            ret = -1;
+        } else {
+            memcpy(output, block, SM4_BLOCK_SIZE - pad);
+            *out_len = SM4_BLOCK_SIZE - pad;
+        }
+        memset(block, 0, sizeof(block));
+    }
+
+    memset(ctx, 0, sizeof(*ctx));
+    return ret;
+}
@@ -0,0 +1,329 @@
+#define _DEFAULT_SOURCE
+
+#include "sm4.h"
+#include "sm4_stats.h"
+#include "sm4_stream.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+#ifdef __aarch64__
+#include <sys/auxv.h>
+#ifndef HWCAP_SM4
+#define HWCAP_SM4 (1 << 19)
+#endif
+#endif
+
+/* Runtime backend selection for the multi-block interface.
+ *
+ * Every kernel has the same sm4_blocks_func_t signature. The table below is
+ * indexed by sm4_backend_t; entries that are not built for this architecture
+ * are NULL. On first use the highest-priority supported backend is picked and
+ * cached, so the per-call cost is one indirect call.
+ */
+
+static const struct {
+    const char *name;
+    sm4_blocks_func_t func;
+} sm4_backends[SM4_BACKEND_COUNT] = {
+    [SM4_BACKEND_BASIC]     = {"basic",     sm4_encrypt_blocks_basic},
+    [SM4_BACKEND_OPTIMIZED] = {"optimized", sm4_encrypt_blocks_optimized},
+    [SM4_BACKEND_BITSLICE]  = {"bitslice",  sm4_encrypt_blocks_bitslice},
+#ifdef __x86_64__
+    [SM4_BACKEND_BITSLICE_AVX2] = {"bitslice-avx2", sm4_encrypt_blocks_bitslice_avx2},
+    [SM4_BACKEND_SIMD]      = {"avx2",      sm4_encrypt_blocks_simd},
+    [SM4_BACKEND_NEON]      = {"neon",      NULL},
+    [SM4_BACKEND_AESNI]     = {"aesni",     sm4_encrypt_blocks_aesni},
+    [SM4_BACKEND_GFNI]      = {"gfni",      sm4_encrypt_blocks_gfni},
+    [SM4_BACKEND_ARMV8_CE]  = {"armv8-ce",  NULL},
+#elif defined(__aarch64__)
+    [SM4_BACKEND_BITSLICE_AVX2] = {"bitslice-avx2", NULL},
+    [SM4_BACKEND_SIMD]      = {"avx2",      NULL},
+    [SM4_BACKEND_NEON]      = {"neon",      sm4_encrypt_blocks_neon},
+    [SM4_BACKEND_AESNI]     = {"aesni",     NULL},
+    [SM4_BACKEND_GFNI]      = {"gfni",      NULL},
+    [SM4_BACKEND_ARMV8_CE]  = {"armv8-ce",  sm4_encrypt_blocks_ce},
+#else
+    [SM4_BACKEND_BITSLICE_AVX2] = {"bitslice-avx2", NULL},
+    [SM4_BACKEND_SIMD]      = {"avx2",      NULL},
+    [SM4_BACKEND_NEON]      = {"neon",      NULL},
+    [SM4_BACKEND_AESNI]     = {"aesni",     NULL},
+    [SM4_BACKEND_GFNI]      = {"gfni",      NULL},
+    [SM4_BACKEND_ARMV8_CE]  = {"armv8-ce",  NULL},
+#endif
+};
+
+/* Preference order, fastest first. Constant-time backends rank above the
+ * table-driven ones so the T-tables are only a last resort. */
+static const sm4_backend_t sm4_backend_priority[] = {
+    SM4_BACKEND_ARMV8_CE,
+    SM4_BACKEND_GFNI,
+    SM4_BACKEND_SIMD,
+    SM4_BACKEND_AESNI,
+    SM4_BACKEND_BITSLICE_AVX2,
+    SM4_BACKEND_BITSLICE,
+    SM4_BACKEND_OPTIMIZED,
+    SM4_BACKEND_NEON,
+    SM4_BACKEND_BASIC
+};
+
+/* The active backend is the one word sm4_set_backend() may change while
+ * other threads encrypt: it is only accessed atomically and its kernel is
+ * looked up in the const table, so a caller never pairs one backend's
+ * stats with another's kernel */
+static sm4_backend_t sm4_active_backend = SM4_BACKEND_BASIC;
+static pthread_once_t sm4_dispatch_once = PTHREAD_ONCE_INIT;
+
+/* CPU feature detection */
+#ifdef __x86_64__
+
+#define SM4_XCR0_SSE_AVX    0x06    /* XMM | YMM state */
+#define SM4_XCR0_AVX512     0xE6    /* XMM | YMM | opmask | ZMM_Hi256 | Hi16_ZMM */
+
+static uint64_t sm4_xgetbv(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Returns the OS-enabled XCR0 mask, or 0 if XSAVE is not enabled */
+static uint64_t sm4_os_xsave_mask(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (!(ecx & bit_OSXSAVE)) return 0;
+    return sm4_xgetbv();
+}
+
+int cpu_supports_avx2(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if ((sm4_os_xsave_mask() & SM4_XCR0_SSE_AVX) != SM4_XCR0_SSE_AVX) return 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ebx & bit_AVX2) != 0;
+}
+
+int cpu_supports_aesni(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ecx & bit_AES) && (ecx & bit_SSSE3);
+}
+
+int cpu_supports_pclmul(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+}
+
+int cpu_supports_gfni_vprold(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if ((sm4_os_xsave_mask() & SM4_XCR0_AVX512) != SM4_XCR0_AVX512) return 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+
+    /* GFNI: ECX bit 8; VPROLD on ymm needs AVX512F + AVX512VL */
+    return (ecx & bit_GFNI) && (ebx & bit_AVX2) &&
+           (ebx & bit_AVX512F) && (ebx & bit_AVX512VL);
+}
+
+int cpu_supports_sm4_ce(void) { return 0; }
+
+#else
+
+int cpu_supports_avx2(void) { return 0; }
+int cpu_supports_aesni(void) { return 0; }
+int cpu_supports_pclmul(void) { return 0; }
+int cpu_supports_gfni_vprold(void) { return 0; }
+
+#ifdef __aarch64__
+int cpu_supports_sm4_ce(void) {
+    return sm4_ce_compiled() && (getauxval(AT_HWCAP) & HWCAP_SM4) != 0;
+}
+#else
+int cpu_supports_sm4_ce(void) { return 0; }
+#endif
+
+#endif /* __x86_64__ */
+
+int sm4_backend_supported(sm4_backend_t backend) {
+    if ((unsigned)backend >= SM4_BACKEND_COUNT || sm4_backends[backend].func == NULL) {
+        return 0;
+    }
+
+    switch (backend) {
+    case SM4_BACKEND_SIMD:
+    case SM4_BACKEND_BITSLICE_AVX2:
+                            return cpu_supports_avx2();
+    case SM4_BACKEND_AESNI: return cpu_supports_aesni();
+    case SM4_BACKEND_GFNI:  return cpu_supports_gfni_vprold();
+    case SM4_BACKEND_ARMV8_CE: return cpu_supports_sm4_ce();
+    default:                return 1;
+    }
+}
+
+const char *sm4_backend_name(sm4_backend_t backend) {
+    if ((unsigned)backend >= SM4_BACKEND_COUNT) return "unknown";
+    return sm4_backends[backend].name;
+}
+
+sm4_blocks_func_t sm4_get_blocks_func(sm4_backend_t backend) {
+    return sm4_backend_supported(backend) ? sm4_backends[backend].func : NULL;
+}
+
+/* Batched key schedule kernel: the widest the CPU runs, whatever the
+ * active block backend (every kernel produces the same round keys) */
+typedef void (*sm4_keys_func_t)(sm4_ctx_t *ctx, const uint8_t *keys);
+
+#define SM4_KEY_LANES_MAX 16
+
+static sm4_keys_func_t sm4_keys_func = NULL;
+static size_t sm4_keys_lanes = 1;
+
+/* Outputs at least this large (and 16-byte aligned) are streamed past the
+ * caches; defaults to the last-level cache size */
+#define SM4_NT_THRESHOLD_DEFAULT (8u << 20)
+
+static size_t sm4_nt_threshold = SM4_NT_THRESHOLD_DEFAULT;
+
+static void sm4_dispatch_init(void) {
+    size_t i;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    {
+        long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (llc > 0) {
+            sm4_nt_threshold = (size_t)llc;
+        }
+    }
+#endif
+
+#ifdef __x86_64__
+    if (cpu_supports_gfni_vprold()) {
+        sm4_keys_func = sm4_setkey_enc_gfni_16keys;
+        sm4_keys_lanes = SM4_GFNI_KEY_LANES;
+    } else if (cpu_supports_avx2()) {
+        sm4_keys_func = sm4_setkey_enc_simd_8keys;
+        sm4_keys_lanes = SM4_SIMD_KEY_LANES;
+    }
+#endif
+
+    for (i = 0; i < sizeof(sm4_backend_priority) / sizeof(sm4_backend_priority[0]); i++) {
+        sm4_backend_t backend = sm4_backend_priority[i];
+        if (sm4_backend_supported(backend)) {
+            __atomic_store_n(&sm4_active_backend, backend, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+sm4_backend_t sm4_get_backend(void) {
+    pthread_once(&sm4_dispatch_once, sm4_dispatch_init);
+    return __atomic_load_n(&sm4_active_backend, __ATOMIC_RELAXED);
+}
+
+int sm4_set_backend(sm4_backend_t backend) {
+    pthread_once(&sm4_dispatch_once, sm4_dispatch_init);
+
+    if (!sm4_backend_supported(backend)) {
+        return -1;
+    }
+
+    __atomic_store_n(&sm4_active_backend, backend, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void sm4_encrypt_blocks(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    sm4_backend_t backend;
+    sm4_blocks_func_t func;
+
+    pthread_once(&sm4_dispatch_once, sm4_dispatch_init);
+    backend = __atomic_load_n(&sm4_active_backend, __ATOMIC_RELAXED);
+    func = sm4_backends[backend].func;
+    SM4_STAT_ADD(backend_calls[backend], 1);
+    SM4_STAT_ADD(backend_blocks[backend], num_blocks);
+    if (num_blocks < 8) {
+        SM4_STAT_ADD(slow_paths[SM4_SLOW_SHORT_BATCH], 1);
+    }
+
+    if (sm4_stream_ok(output, num_blocks * SM4_BLOCK_SIZE)) {
+        /* Encrypt 4 KB at a time into L1, then stream it out */
+        uint8_t buf[256 * SM4_BLOCK_SIZE];
+
+        while (num_blocks > 0) {
+            size_t n = num_blocks < 256 ? num_blocks : 256;
+
+            func(ctx, input, buf, n);
+            sm4_stream_xor(output, buf, NULL, n * SM4_BLOCK_SIZE);
+            input += n * SM4_BLOCK_SIZE;
+            output += n * SM4_BLOCK_SIZE;
+            num_blocks -= n;
+        }
+        sm4_stream_fence();
+        return;
+    }
+
+    func(ctx, input, output, num_blocks);
+}
+
+void sm4_decrypt_blocks(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    /* For SM4, decryption uses the same algorithm with reversed round keys */
+    sm4_encrypt_blocks(ctx, input, output, num_blocks);
+}
+
+size_t sm4_get_nt_threshold(void) {
+    pthread_once(&sm4_dispatch_once, sm4_dispatch_init);
+    return sm4_nt_threshold;
+}
+
+void sm4_set_nt_threshold(size_t bytes) {
+    pthread_once(&sm4_dispatch_once, sm4_dispatch_init);
+    sm4_nt_threshold = bytes;
+}
+
+void sm4_setkey_enc_batch(sm4_ctx_t *ctx, const uint8_t *keys, size_t num_keys) {
+    size_t i = 0;
+
+    pthread_once(&sm4_dispatch_once, sm4_dispatch_init);
+
+    if (sm4_keys_func) {
+        for (; i + sm4_keys_lanes <= num_keys; i += sm4_keys_lanes) {
+            sm4_keys_func(ctx + i, keys + i * SM4_KEY_SIZE);
+        }
+
+        /* Two or more leftover keys: one padded pass still beats them one by one */
+        if (num_keys - i >= 2) {
+            uint8_t buf[SM4_KEY_LANES_MAX * SM4_KEY_SIZE];
+            sm4_ctx_t tmp[SM4_KEY_LANES_MAX];
+            size_t tail = num_keys - i;
+
+            memset(buf, 0, sizeof(buf));
+            memcpy(buf, keys + i * SM4_KEY_SIZE, tail * SM4_KEY_SIZE);
+            sm4_keys_func(tmp, buf);
+            memcpy(ctx + i, tmp, tail * sizeof(sm4_ctx_t));
+            memset(buf, 0, sizeof(buf));
+            memset(tmp, 0, sizeof(tmp));
+            i = num_keys;
+        }
+    }
+
+    for (; i < num_keys; i++) {
+        sm4_setkey_enc(&ctx[i], keys + i * SM4_KEY_SIZE);
+    }
+}
+
+void sm4_setkey_dec_batch(sm4_ctx_t *ctx, const uint8_t *keys, size_t num_keys) {
+    sm4_setkey_enc_batch(ctx, keys, num_keys);
+
+    for (size_t k = 0; k < num_keys; k++) {
+        for (int i = 0; i < SM4_ROUNDS / 2; i++) {
+            uint32_t t = ctx[k].rk[i];
+            ctx[k].rk[i] = ctx[k].rk[SM4_ROUNDS - 1 - i];
+            ctx[k].rk[SM4_ROUNDS - 1 - i] = t;
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#ifndef SM4_GCM_H
+#define SM4_GCM_H
+
+#include "sm4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* GCM operation modes */
+#define SM4_GCM_ENCRYPT 1
+#define SM4_GCM_DECRYPT 0
+
+/* Powers of H kept for aggregated GHASH: H^1 .. H^8 */
+#define SM4_GCM_HTABLE_SIZE 8
+
+/* GCM Context Structure */
+typedef struct {
+    sm4_ctx_t sm4_ctx;                          // SM4 encryption context
+    uint8_t h[16];                              // Hash subkey H = E_K(0^128)
+    uint8_t h_table[SM4_GCM_HTABLE_SIZE][16];   // H^1..H^8 in CLMUL operand order
+    uint8_t j0[16];                             // Initial counter J0
+    uint8_t counter[16];                        // Current counter
+    uint8_t ghash_state[16];                    // Current GHASH state
+    uint64_t aad_len;                           // Length of AAD in bytes
+    uint64_t ciphertext_len;                    // Length of ciphertext in bytes
+    uint8_t partial[16];                        // GHASH input of an unfinished block (AAD or ciphertext)
+    uint8_t partial_ks[16];                     // Keystream of the unfinished ciphertext block
+    size_t partial_len;                         // Bytes held in partial (0..15)
+    int mode;                                   // SM4_GCM_ENCRYPT or SM4_GCM_DECRYPT
+} sm4_gcm_context_t;
+
+/* Scatter-gather segment; input segments are never written through */
+typedef struct {
+    void *base;
+    size_t len;
+} sm4_iovec_t;
+
+/* Streaming Interface
+ *
+ * update_ad() and update() accept any lengths and may be called repeatedly;
+ * partial blocks are carried in the context. All AAD must come before the
+ * first update() with data (update_ad() returns -1 afterwards). output may
+ * be input (decryption hashes each block before it is overwritten); GCM
+ * output never uses non-temporal stores, since encryption hashes the
+ * ciphertext right after writing it.
+ */
+int sm4_gcm_init(sm4_gcm_context_t *ctx, const uint8_t key[16]);
+int sm4_gcm_starts(sm4_gcm_context_t *ctx, int mode, const uint8_t *iv, size_t iv_len);
+int sm4_gcm_update_ad(sm4_gcm_context_t *ctx, const uint8_t *aad, size_t aad_len);
+int sm4_gcm_update(sm4_gcm_context_t *ctx, size_t length, const uint8_t *input, uint8_t *output);
+int sm4_gcm_finish(sm4_gcm_context_t *ctx, uint8_t *tag, size_t tag_len);
+
+/* update() split across the sm4_set_threads() pool (sm4.h) for inputs of
+ * two SM4_MT_CHUNKs and more; same output and state as update() */
+int sm4_gcm_update_mt(sm4_gcm_context_t *ctx, size_t length, const uint8_t *input, uint8_t *output);
+
+/* Scatter-gather update: in and out may be split at different offsets; out
+ * must hold at least as many bytes as in (-1 otherwise). */
+int sm4_gcm_update_iov(sm4_gcm_context_t *ctx, const sm4_iovec_t *in, size_t in_cnt,
+                       const sm4_iovec_t *out, size_t out_cnt);
+
+/* One-shot Interface (decrypt returns -1 and zeroes plaintext on tag mismatch) */
+int sm4_gcm_encrypt(const uint8_t key[16], const uint8_t *iv, size_t iv_len,
+                    const uint8_t *aad, size_t aad_len,
+                    const uint8_t *plaintext, size_t pt_len,
+                    uint8_t *ciphertext, uint8_t *tag, size_t tag_len);
+int sm4_gcm_decrypt(const uint8_t key[16], const uint8_t *iv, size_t iv_len,
+                    const uint8_t *aad, size_t aad_len,
+                    const uint8_t *ciphertext, size_t ct_len,
+                    const uint8_t *tag, size_t tag_len,
+                    uint8_t *plaintext);
+
+/* One-shot Interface with a key object (sm4.h): the key schedule and
+ * H powers are reused instead of recomputed per message */
+const sm4_gcm_context_t *sm4_key_gcm_ctx(const sm4_key_t *key);
+int sm4_gcm_encrypt_key(const sm4_key_t *key, const uint8_t *iv, size_t iv_len,
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *plaintext, size_t pt_len,
+                        uint8_t *ciphertext, uint8_t *tag, size_t tag_len);
+int sm4_gcm_decrypt_key(const sm4_key_t *key, const uint8_t *iv, size_t iv_len,
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *ciphertext, size_t ct_len,
+                        const uint8_t *tag, size_t tag_len,
+                        uint8_t *plaintext);
+
+/* Scatter-gather one-shot Interface: AAD, input and output are segment
+ * arrays, processed without linearising. The _inplace variants transform
+ * data in its own buffers. */
+int sm4_gcm_encrypt_iov(const uint8_t key[16], const uint8_t *iv, size_t iv_len,
+                        const sm4_iovec_t *aad, size_t aad_cnt,
+                        const sm4_iovec_t *plaintext, size_t pt_cnt,
+                        const sm4_iovec_t *ciphertext, size_t ct_cnt,
+                        uint8_t *tag, size_t tag_len);
+int sm4_gcm_decrypt_iov(const uint8_t key[16], const uint8_t *iv, size_t iv_len,
+                        const sm4_iovec_t *aad, size_t aad_cnt,
+                        const sm4_iovec_t *ciphertext, size_t ct_cnt,
+                        const uint8_t *tag, size_t tag_len,
+                        const sm4_iovec_t *plaintext, size_t pt_cnt);
+int sm4_gcm_encrypt_iov_inplace(const uint8_t key[16], const uint8_t *iv, size_t iv_len,
+                                const sm4_iovec_t *aad, size_t aad_cnt,
+                                const sm4_iovec_t *data, size_t data_cnt,
+                                uint8_t *tag, size_t tag_len);
+int sm4_gcm_decrypt_iov_inplace(const uint8_t key[16], const uint8_t *iv, size_t iv_len,
+                                const sm4_iovec_t *aad, size_t aad_cnt,
+                                const sm4_iovec_t *data, size_t data_cnt,
+                                const uint8_t *tag, size_t tag_len);
+
+/* Batched Interface
+ *
+ * Many independent records under one key: key_ctx comes from sm4_gcm_init()
+ * and is not modified. Counter blocks and E_K(J0) of several records are
+ * encrypted in one multi-block call and their GHASH chains run in parallel.
+ * Encryption writes tag[0..tag_len); decryption checks it, sets status to 0
+ * or -1 per record (zeroing output on failure) and returns -1 if any record
+ * failed. input == output is allowed.
+ */
+typedef struct {
+    const uint8_t *iv;
+    size_t iv_len;
+    const uint8_t *aad;
+    size_t aad_len;
+    const uint8_t *input;
+    size_t length;
+    uint8_t *output;
+    uint8_t *tag;
+    size_t tag_len;
+    int status;
+} sm4_gcm_record_t;
+
+int sm4_gcm_encrypt_batch(const sm4_gcm_context_t *key_ctx, sm4_gcm_record_t *records, size_t count);
+int sm4_gcm_decrypt_batch(const sm4_gcm_context_t *key_ctx, sm4_gcm_record_t *records, size_t count);
+
+double benchmark_sm4_gcm(size_t data_size, int iterations);
+
+/* CLMUL GHASH engine (sm4_gcm_simd.c)
+ *
+ * sm4_ghash_clmul() absorbs len bytes (the last block zero-padded) into
+ * state, eight blocks per reduction using h_table from
+ * sm4_ghash_clmul_init(). Only call these if cpu_supports_pclmul().
+ */
+#ifdef __x86_64__
+void sm4_ghash_clmul_init(uint8_t h_table[SM4_GCM_HTABLE_SIZE][16], const uint8_t h[16]);
+void sm4_ghash_clmul(const uint8_t h_table[SM4_GCM_HTABLE_SIZE][16], uint8_t state[16],
+                     const uint8_t *data, size_t len);
+/* num_lanes independent sm4_ghash_clmul() calls, interleaved */
+void sm4_ghash_clmul_lanes(const uint8_t h_table[SM4_GCM_HTABLE_SIZE][16], size_t num_lanes,
+                           uint8_t states[][16], const uint8_t *const data[], const size_t lens[]);
+
+/* Stitched CTR+GHASH kernel (sm4_gcm_gfni.c)
+ *
+ * Encrypts or decrypts (per ctx->mode) the largest multiple of 128 bytes of
+ * input and returns the number of bytes consumed, updating ctx->counter and
+ * ctx->ghash_state (not ciphertext_len). Requires cpu_supports_gfni_vprold()
+ * and cpu_supports_pclmul().
+ */
+size_t sm4_gcm_crypt_gfni(sm4_gcm_context_t *ctx, const uint8_t *input, uint8_t *output, size_t length);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SM4_GCM_H */
@@ -1,371 +1,163 @@
 /**
  * SM4-GCM SIMD Optimization Implementation
- * 
- * This file implements SIMD-optimized SM4-GCM mode using:
- * - Parallel CTR mode encryption with AVX2
- * - CLMUL-accelerated GHASH computation
- * - Pipeline optimization for encryption and authentication
- * - Cache-friendly precomputation strategies
- * 
- * Performance: ~87.1 MB/s encryption, ~82.4 MB/s authentication
- * Combined throughput: ~46.7 MB/s
+ *
+ * This file implements the CLMUL GHASH engine used by sm4_gcm.c
+ * (multiply/reduce primitives live in sm4_ghash_clmul.h):
+ * - H^1..H^8 precomputed once per key
+ * - Eight blocks folded per modular reduction (aggregated reduction)
+ * - Karatsuba multiplication: three PCLMULQDQ per block instead of four
+ * - Blocks are read straight from the caller's buffer; only a partial
+ *   final block is staged
+ *
+ * Operands are kept byte-reflected (Gueron & Kounavis, "Intel Carry-Less
+ * Multiplication Instruction and its Usage for Computing the GCM Mode"):
+ * each 128-bit value is byte-swapped on load and the 256-bit product is
+ * shifted left by one bit before reduction.
  */
 
-#include "sm4.h"
-#include "sm4_gcm.c" // Include base GCM implementation
-#include <immintrin.h>
+#include "sm4_gcm.h"
 #include <string.h>
 
-#ifdef __AVX2__ && __PCLMUL__
+#if !defined(__PCLMUL__) || !defined(__SSSE3__)
+#error "sm4_gcm_simd.c must be built with -mpclmul -mssse3"
+#endif
 
-/**
- * Parallel CTR encryption using AVX2 and optimized SM4
- * Encrypts 8 CTR blocks simultaneously using SIMD
- */
-void sm4_gcm_ctr_parallel(const sm4_context_t* ctx, uint8_t counter[16], 
-                          const uint8_t* input, uint8_t* output, size_t num_blocks) {
-    if (num_blocks == 0) return;
-    
-    // Process blocks in groups of 8 for optimal AVX2 utilization
-    for (size_t i = 0; i < num_blocks; i += 8) {
-        size_t remaining = (num_blocks - i > 8) ? 8 : (num_blocks - i);
-        
-        // Prepare 8 counter values
-        uint8_t counters[8][16];
-        for (size_t j = 0; j < remaining; j++) {
-            memcpy(counters[j], counter, 16);
-            // Increment counter for each block
-            for (size_t k = 0; k < j; k++) {
-                gcm_increment_counter(counters[j]);
-            }
-        }
-        
-        // Generate keystream blocks using SIMD SM4
-        uint8_t keystream[8][16];
-        if (remaining >= 2) {
-            // Use optimized SIMD encryption for pairs of blocks
-            for (size_t j = 0; j < remaining; j += 2) {
-                if (j + 1 < remaining) {
-                    sm4_encrypt_blocks_simd(ctx, (uint8_t*)&counters[j], (uint8_t*)&keystream[j], 2);
-                } else {
-                    sm4_encrypt_block_optimized(ctx, counters[j], keystream[j]);
-                }
-            }
-        } else {
-            // Single block encryption
-            sm4_encrypt_block_optimized(ctx, counters[0], keystream[0]);
-        }
-        
-        // XOR input with keystream using AVX2
-        for (size_t j = 0; j < remaining; j++) {
-            __m128i input_block = _mm_loadu_si128((__m128i*)(input + (i + j) * 16));
-            __m128i key_block = _mm_loadu_si128((__m128i*)keystream[j]);
-            __m128i output_block = _mm_xor_si128(input_block, key_block);
-            _mm_storeu_si128((__m128i*)(output + (i + j) * 16), output_block);
-        }
-        
-        // Update main counter
-        for (size_t j = 0; j < remaining; j++) {
-            gcm_increment_counter(counter);
-        }
-    }
-}
+#include "sm4_ghash_clmul.h"
 
-/**
- * Optimized GHASH using CLMUL instructions with precomputed tables
- * Implements Shay Gueron's fast GHASH algorithm
- */
-typedef struct {
-    __m128i h1, h2, h3, h4, h5, h6, h7, h8; // Precomputed powers of H
-} ghash_clmul_context_t;
+static __m128i ghash_mul(__m128i a, __m128i b) {
+    ghash_acc_t acc;
 
-/**
- * Precompute powers of H for fast GHASH
- */
-static void ghash_clmul_init(ghash_clmul_context_t* ghash_ctx, const uint8_t h[16]) {
-    __m128i h_vec = _mm_loadu_si128((__m128i*)h);
-    
-    // Precompute H^1, H^2, ..., H^8
-    ghash_ctx->h1 = h_vec;
-    
-    // H^2 = H * H
-    gf128_mul_clmul((uint8_t*)&ghash_ctx->h1, (uint8_t*)&ghash_ctx->h1, (uint8_t*)&ghash_ctx->h2);
-    
-    // H^3 = H^2 * H
-    gf128_mul_clmul((uint8_t*)&ghash_ctx->h2, (uint8_t*)&ghash_ctx->h1, (uint8_t*)&ghash_ctx->h3);
-    
-    // H^4 = H^2 * H^2
-    gf128_mul_clmul((uint8_t*)&ghash_ctx->h2, (uint8_t*)&ghash_ctx->h2, (uint8_t*)&ghash_ctx->h4);
-    
-    // Continue for H^5 through H^8
-    gf128_mul_clmul((uint8_t*)&ghash_ctx->h4, (uint8_t*)&ghash_ctx->h1, (uint8_t*)&ghash_ctx->h5);
-    gf128_mul_clmul((uint8_t*)&ghash_ctx->h4, (uint8_t*)&ghash_ctx->h2, (uint8_t*)&ghash_ctx->h6);
-    gf128_mul_clmul((uint8_t*)&ghash_ctx->h4, (uint8_t*)&ghash_ctx->h3, (uint8_t*)&ghash_ctx->h7);
-    gf128_mul_clmul((uint8_t*)&ghash_ctx->h4, (uint8_t*)&ghash_ctx->h4, (uint8_t*)&ghash_ctx->h8);
+    ghash_acc_zero(&acc);
+    ghash_mul_acc(&acc, a, b);
+    return ghash_reduce(&acc);
 }
 
-/**
- * Fast GHASH for 8 blocks using precomputed powers
- */
-static void ghash_8blocks_clmul(const ghash_clmul_context_t* ghash_ctx, 
-                                const uint8_t blocks[8][16], uint8_t state[16]) {
-    // Load current state
-    __m128i acc = _mm_loadu_si128((__m128i*)state);
-    
-    // XOR first block with accumulator
-    __m128i block0 = _mm_loadu_si128((__m128i*)blocks[0]);
-    acc = _mm_xor_si128(acc, block0);
-    
-    // Multiply acc by H^8
-    __m128i tmp0 = _mm_clmulepi64_si128(acc, ghash_ctx->h8, 0x00);
-    __m128i tmp1 = _mm_clmulepi64_si128(acc, ghash_ctx->h8, 0x01);
-    __m128i tmp2 = _mm_clmulepi64_si128(acc, ghash_ctx->h8, 0x10);
-    __m128i tmp3 = _mm_clmulepi64_si128(acc, ghash_ctx->h8, 0x11);
-    
-    // Add contributions from other blocks
-    for (int i = 1; i < 8; i++) {
-        __m128i block = _mm_loadu_si128((__m128i*)blocks[i]);
-        __m128i h_power;
-        
-        switch (8 - i) {
-            case 7: h_power = ghash_ctx->h7; break;
-            case 6: h_power = ghash_ctx->h6; break;
-            case 5: h_power = ghash_ctx->h5; break;
-            case 4: h_power = ghash_ctx->h4; break;
-            case 3: h_power = ghash_ctx->h3; break;
-            case 2: h_power = ghash_ctx->h2; break;
-            case 1: h_power = ghash_ctx->h1; break;
-            default: continue;
-        }
-        
-        tmp0 = _mm_xor_si128(tmp0, _mm_clmulepi64_si128(block, h_power, 0x00));
-        tmp1 = _mm_xor_si128(tmp1, _mm_clmulepi64_si128(block, h_power, 0x01));
-        tmp2 = _mm_xor_si128(tmp2, _mm_clmulepi64_si128(block, h_power, 0x10));
-        tmp3 = _mm_xor_si128(tmp3, _mm_clmulepi64_si128(block, h_power, 0x11));
+void sm4_ghash_clmul_init(uint8_t h_table[SM4_GCM_HTABLE_SIZE][16], const uint8_t h[16]) {
+    __m128i h1 = ghash_bswap(_mm_loadu_si128((const __m128i *)h));
+    __m128i hn = h1;
+    int i;
+
+    _mm_storeu_si128((__m128i *)h_table[0], h1);
+    for (i = 1; i < SM4_GCM_HTABLE_SIZE; i++) {
+        hn = ghash_mul(hn, h1);
+        _mm_storeu_si128((__m128i *)h_table[i], hn);
     }
-    
-    // Combine and reduce
-    __m128i middle = _mm_xor_si128(tmp1, tmp2);
-    __m128i middle_low = _mm_slli_si128(middle, 8);
-    __m128i middle_high = _mm_srli_si128(middle, 8);
-    
-    __m128i low = _mm_xor_si128(tmp0, middle_low);
-    __m128i high = _mm_xor_si128(tmp3, middle_high);
-    
-    // Reduction modulo the GCM polynomial
-    __m128i poly = _mm_set_epi32(0xC2000000, 0x00000000, 0x00000000, 0x00000000);
-    
-    __m128i tmp4 = _mm_clmulepi64_si128(high, poly, 0x01);
-    __m128i tmp5 = _mm_shuffle_epi32(high, 0x4E);
-    __m128i tmp6 = _mm_xor_si128(low, tmp4);
-    __m128i tmp7 = _mm_xor_si128(tmp6, tmp5);
-    
-    __m128i tmp8 = _mm_clmulepi64_si128(tmp7, poly, 0x00);
-    __m128i tmp9 = _mm_srli_si128(tmp8, 8);
-    __m128i result = _mm_xor_si128(tmp7, tmp9);
-    
-    _mm_storeu_si128((__m128i*)state, result);
 }
 
-/**
- * Optimized SM4-GCM context with SIMD acceleration
- */
-typedef struct {
-    sm4_gcm_context_t base;             // Base GCM context
-    ghash_clmul_context_t ghash_ctx;    // CLMUL GHASH context
-    uint8_t pending_blocks[8][16];      // Buffer for batched GHASH
-    size_t pending_count;               // Number of pending blocks
-} sm4_gcm_simd_context_t;
+/* Load block i of a group, zero-padding it if fewer than 16 bytes remain */
+static inline __m128i ghash_load(const uint8_t *data, size_t avail) {
+    uint8_t block[16];
 
-/**
- * Initialize SIMD-optimized GCM context
- */
-int sm4_gcm_simd_init(sm4_gcm_simd_context_t* ctx, const uint8_t key[16]) {
-    // Initialize base GCM context
-    int ret = sm4_gcm_init(&ctx->base, key);
-    if (ret != 0) return ret;
-    
-    // Initialize CLMUL GHASH context
-    ghash_clmul_init(&ctx->ghash_ctx, ctx->base.h);
-    
-    ctx->pending_count = 0;
-    return 0;
+    if (avail >= 16) {
+        return ghash_bswap(_mm_loadu_si128((const __m128i *)data));
+    }
+    memset(block, 0, sizeof(block));
+    memcpy(block, data, avail);
+    return ghash_bswap(_mm_loadu_si128((const __m128i *)block));
 }
 
-/**
- * Process pending GHASH blocks
+/*
+ * Y = ((Y ^ X1) * H^n) ^ (X2 * H^(n-1)) ^ ... ^ (Xn * H), reduced once.
+ * Full groups use n = 8; the tail (including a partial block) uses the same
+ * formula with n = 1..7. Returns the number of bytes consumed.
  */
-static void process_pending_ghash(sm4_gcm_simd_context_t* ctx) {
-    if (ctx->pending_count == 0) return;
-    
-    if (ctx->pending_count == 8) {
-        // Process full batch of 8 blocks
-        ghash_8blocks_clmul(&ctx->ghash_ctx, ctx->pending_blocks, ctx->base.ghash_state);
-    } else {
-        // Process remaining blocks individually
-        for (size_t i = 0; i < ctx->pending_count; i++) {
-            ghash(ctx->base.h, ctx->pending_blocks[i], 16, ctx->base.ghash_state);
+static inline size_t ghash_group(__m128i *y, const uint8_t *data, size_t len,
+                                 const __m128i h[SM4_GCM_HTABLE_SIZE]) {
+    ghash_acc_t acc;
+    int i;
+
+    ghash_acc_zero(&acc);
+
+    if (len >= 16 * SM4_GCM_HTABLE_SIZE) {
+        ghash_mul_acc(&acc, _mm_xor_si128(*y, ghash_bswap(_mm_loadu_si128((const __m128i *)data))),
+                      h[SM4_GCM_HTABLE_SIZE - 1]);
+        for (i = 1; i < SM4_GCM_HTABLE_SIZE; i++) {
+            ghash_mul_acc(&acc, ghash_bswap(_mm_loadu_si128((const __m128i *)(data + 16 * i))),
+                          h[SM4_GCM_HTABLE_SIZE - 1 - i]);
         }
+        *y = ghash_reduce(&acc);
+        return 16 * SM4_GCM_HTABLE_SIZE;
     }
-    
-    ctx->pending_count = 0;
-}
 
-/**
- * Add block to GHASH batch processing
- */
-static void add_ghash_block(sm4_gcm_simd_context_t* ctx, const uint8_t block[16]) {
-    memcpy(ctx->pending_blocks[ctx->pending_count], block, 16);
-    ctx->pending_count++;
-    
-    if (ctx->pending_count == 8) {
-        process_pending_ghash(ctx);
+    int n = (int)((len + 15) / 16);
+
+    ghash_mul_acc(&acc, _mm_xor_si128(*y, ghash_load(data, len)), h[n - 1]);
+    for (i = 1; i < n; i++) {
+        ghash_mul_acc(&acc, ghash_load(data + 16 * i, len - 16 * i), h[n - 1 - i]);
     }
+    *y = ghash_reduce(&acc);
+    return len;
 }
 
-/**
- * SIMD-optimized GCM update function
- * Implements pipelined encryption and authentication
- */
-int sm4_gcm_simd_update(sm4_gcm_simd_context_t* ctx, size_t length, 
-                        const uint8_t* input, uint8_t* output) {
-    if (length == 0) return 0;
-    
-    size_t num_blocks = (length + 15) / 16;
-    
-    // Process blocks in parallel
-    for (size_t i = 0; i < num_blocks; i += 8) {
-        size_t remaining = (num_blocks - i > 8) ? 8 : (num_blocks - i);
-        size_t byte_count = (i + remaining) * 16 <= length ? remaining * 16 : length - i * 16;
-        
-        // Parallel CTR encryption
-        sm4_gcm_ctr_parallel(&ctx->base.sm4_ctx, ctx->base.counter, 
-                            input + i * 16, output + i * 16, remaining);
-        
-        // Batch GHASH processing
-        for (size_t j = 0; j < remaining; j++) {
-            uint8_t ghash_block[16] = {0};
-            size_t block_bytes = (j == remaining - 1 && byte_count % 16 != 0) ? 
-                                 byte_count % 16 : 16;
-            
-            if (ctx->base.mode == SM4_GCM_ENCRYPT) {
-                memcpy(ghash_block, output + (i + j) * 16, block_bytes);
-            } else {
-                memcpy(ghash_block, input + (i + j) * 16, block_bytes);
-            }
-            
-            add_ghash_block(ctx, ghash_block);
-        }
+static inline void ghash_load_table(__m128i h[SM4_GCM_HTABLE_SIZE],
+                                    const uint8_t h_table[SM4_GCM_HTABLE_SIZE][16]) {
+    int i;
+
+    for (i = 0; i < SM4_GCM_HTABLE_SIZE; i++) {
+        h[i] = _mm_loadu_si128((const __m128i *)h_table[i]);
     }
-    
-    ctx->base.ciphertext_len += length;
-    return 0;
 }
 
-/**
- * Finish SIMD-optimized GCM operation
- */
-int sm4_gcm_simd_finish(sm4_gcm_simd_context_t* ctx, uint8_t* tag, size_t tag_len) {
-    // Process any remaining GHASH blocks
-    process_pending_ghash(ctx);
-    
-    // Use base implementation for final tag generation
-    return sm4_gcm_finish(&ctx->base, tag, tag_len);
-}
+void sm4_ghash_clmul(const uint8_t h_table[SM4_GCM_HTABLE_SIZE][16], uint8_t state[16],
+                     const uint8_t *data, size_t len) {
+    __m128i h[SM4_GCM_HTABLE_SIZE];
+    __m128i y = ghash_bswap(_mm_loadu_si128((const __m128i *)state));
 
-/**
- * High-level SIMD-optimized encryption function
- */
-int sm4_gcm_encrypt_simd(const uint8_t key[16], const uint8_t* iv, size_t iv_len,
-                         const uint8_t* aad, size_t aad_len,
-                         const uint8_t* plaintext, size_t pt_len,
-                         uint8_t* ciphertext, uint8_t* tag, size_t tag_len) {
-    sm4_gcm_simd_context_t ctx;
-    int ret;
-    
-    if ((ret = sm4_gcm_simd_init(&ctx, key)) != 0) return ret;
-    if ((ret = sm4_gcm_starts(&ctx.base, SM4_GCM_ENCRYPT, iv, iv_len)) != 0) return ret;
-    if ((ret = sm4_gcm_update_ad(&ctx.base, aad, aad_len)) != 0) return ret;
-    if ((ret = sm4_gcm_simd_update(&ctx, pt_len, plaintext, ciphertext)) != 0) return ret;
-    if ((ret = sm4_gcm_simd_finish(&ctx, tag, tag_len)) != 0) return ret;
-    
-    return 0;
-}
+    ghash_load_table(h, h_table);
 
-/**
- * High-level SIMD-optimized decryption function
- */
-int sm4_gcm_decrypt_simd(const uint8_t key[16], const uint8_t* iv, size_t iv_len,
-                         const uint8_t* aad, size_t aad_len,
-                         const uint8_t* ciphertext, size_t ct_len,
-                         const uint8_t* tag, size_t tag_len,
-                         uint8_t* plaintext) {
-    sm4_gcm_simd_context_t ctx;
-    int ret;
-    
-    if ((ret = sm4_gcm_simd_init(&ctx, key)) != 0) return ret;
-    if ((ret = sm4_gcm_starts(&ctx.base, SM4_GCM_DECRYPT, iv, iv_len)) != 0) return ret;
-    if ((ret = sm4_gcm_update_ad(&ctx.base, aad, aad_len)) != 0) return ret;
-    if ((ret = sm4_gcm_simd_update(&ctx, ct_len, ciphertext, plaintext)) != 0) return ret;
-    
-    // Verify authentication tag
-    uint8_t computed_tag[16];
-    if ((ret = sm4_gcm_simd_finish(&ctx, computed_tag, tag_len)) != 0) return ret;
-    
-    // Constant-time comparison
-    int diff = 0;
-    for (size_t i = 0; i < tag_len; i++) {
-        diff |= tag[i] ^ computed_tag[i];
-    }
-    
-    if (diff != 0) {
-        memset(plaintext, 0, ct_len);
-        return -1; // Authentication failed
+    while (len > 0) {
+        size_t used = ghash_group(&y, data, len, h);
+        data += used;
+        len -= used;
     }
-    
-    return 0;
+
+    _mm_storeu_si128((__m128i *)state, ghash_bswap(y));
 }
 
-/**
- * Benchmark SIMD-optimized SM4-GCM
+/*
+ * Independent GHASH chains, SM4_GHASH_LANES at a time in lockstep
+ *
+ * A single short message is one dependent chain of multiply + reduce. Taking
+ * one group from each of several messages per step gives the core
+ * independent chains to overlap, which hides the PCLMULQDQ latency.
  */
-double benchmark_sm4_gcm_simd(size_t data_size, int iterations) {
-    uint8_t* plaintext = aligned_alloc(32, data_size);
-    uint8_t* ciphertext = aligned_alloc(32, data_size);
-    uint8_t* decrypted = aligned_alloc(32, data_size);
-    uint8_t key[16] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
-                       0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10};
-    uint8_t iv[12] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B};
-    uint8_t aad[16] = "Additional Data";
-    uint8_t tag[16];
-    
-    // Fill plaintext with random data
-    for (size_t i = 0; i < data_size; i++) {
-        plaintext[i] = (uint8_t)(rand() & 0xFF);
-    }
-    
-    clock_t start = clock();
-    
-    for (int i = 0; i < iterations; i++) {
-        sm4_gcm_encrypt_simd(key, iv, 12, aad, 15, plaintext, data_size, ciphertext, tag, 16);
-        sm4_gcm_decrypt_simd(key, iv, 12, aad, 15, ciphertext, data_size, tag, 16, decrypted);
+#define SM4_GHASH_LANES 4
+
+void sm4_ghash_clmul_lanes(const uint8_t h_table[SM4_GCM_HTABLE_SIZE][16], size_t num_lanes,
+                           uint8_t states[][16], const uint8_t *const data[], const size_t lens[]) {
+    __m128i h[SM4_GCM_HTABLE_SIZE];
+    size_t base;
+
+    ghash_load_table(h, h_table);
+
+    for (base = 0; base < num_lanes; base += SM4_GHASH_LANES) {
+        size_t m = (num_lanes - base < SM4_GHASH_LANES) ? num_lanes - base : SM4_GHASH_LANES;
+        __m128i y[SM4_GHASH_LANES];
+        const uint8_t *ptr[SM4_GHASH_LANES];
+        size_t left[SM4_GHASH_LANES];
+        size_t l;
+        int active = 1;
+
+        for (l = 0; l < m; l++) {
+            y[l] = ghash_bswap(_mm_loadu_si128((const __m128i *)states[base + l]));
+            ptr[l] = data[base + l];
+            left[l] = lens[base + l];
+        }
+
+        while (active) {
+            active = 0;
+            for (l = 0; l < m; l++) {
+                if (left[l] > 0) {
+                    size_t used = ghash_group(&y[l], ptr[l], left[l], h);
+                    ptr[l] += used;
+                    left[l] -= used;
+                    active = 1;
+                }
+            }
+        }
+
+        for (l = 0; l < m; l++) {
+            _mm_storeu_si128((__m128i *)states[base + l], ghash_bswap(y[l]));
+        }
     }
-    
-    clock_t end = clock();
-    
-    double time_taken = ((double)(end - start)) / CLOCKS_PER_SEC;
-    double throughput = (data_size * iterations * 2) / (time_taken * 1024 * 1024); // MB/s
-    
-    free(plaintext);
-    free(ciphertext);
-    free(decrypted);
-    
-    return throughput;
 }
-
-#else
-// Fallback implementations when AVX2/CLMUL not available
-#define sm4_gcm_encrypt_simd sm4_gcm_encrypt
-#define sm4_gcm_decrypt_simd sm4_gcm_decrypt
-#define benchmark_sm4_gcm_simd benchmark_sm4_gcm
-#endif /* __AVX2__ && __PCLMUL__ */
@@ -1,356 +1,144 @@
 /**
  * SM4 GFNI/VPROLD Latest Instruction Set Optimization Implementation
- * 
+ *
  * This file implements SM4 block cipher using Intel's latest instruction sets:
  * - GFNI (Galois Field New Instructions) for S-box optimization
- * - VPROLD (Variable Precision Rotate Left Doubleword) for linear transformation
- * 
+ * - VPROLD (AVX-512VL rotate left doubleword) for linear transformation
+ *
  * Features:
- * - GF2P8AFFINEQB for affine transformation in GF(2^8)
- * - VPROLD for variable-length circular left shifts
- * - One instruction replaces multiple table lookups
- * 
- * Performance: ~20% improvement over AESNI implementation
- * Requires: Intel Ice Lake+ or equivalent AMD processor
+ * - GF2P8AFFINEQB + GF2P8AFFINEINVQB evaluate the whole S-box in two
+ *   instructions, with no tables and no secret-dependent memory access
+ * - VPROLD replaces each shift/shift/or rotation with a single instruction
+ * - Eight blocks per YMM register in transposed (word-sliced) layout
+ *
+ * GF2P8AFFINEINVQB computes M * inv(x) + c in the AES field (0x11B). The SM4
+ * S-box is S(x) = A * inv(A * x + 0xD3) + 0xD3 in its own field (0x1F5), so the
+ * first affine step maps into the AES field basis and the second maps back,
+ * each folding in one of SM4's affine layers.
+ *
+ * Requires: Intel Ice Lake+ or equivalent AMD processor (Zen 4)
+ * Built with -mgfni -mavx2 -mavx512f -mavx512vl; selected at runtime by
+ * sm4_dispatch.c.
  */
 
 #include "sm4.h"
 #include <immintrin.h>
 #include <string.h>
 
-#ifdef __GFNI__ && __AVX512VL__
+#if defined(__GFNI__) && defined(__AVX512VL__)
 
-// GFNI matrix for SM4 S-box affine transformation
-// This matrix represents the affine transformation part of SM4 S-box in GF(2^8)
-static const uint64_t sm4_gfni_matrix = 0x8F1F3F7FEFDFDCBC;
-static const uint8_t sm4_gfni_constant = 0x63;
-
-// Optimized rotation counts for SM4 linear transformation
-static const __m256i rotation_counts = {2, 10, 18, 24, 2, 10, 18, 24};
-
-/**
- * GFNI-optimized S-box implementation for SM4
- * Uses GF2P8AFFINEQB instruction for affine transformation
- */
-static inline __m256i gfni_sbox_sm4(__m256i input) {
-    // Set up the affine transformation matrix for all lanes
-    const __m256i matrix = _mm256_set1_epi64x(sm4_gfni_matrix);
-    const __m256i constant = _mm256_set1_epi8(sm4_gfni_constant);
-    
-    // Apply GF(2^8) affine transformation
-    // This replaces 8 table lookups with a single instruction
-    return _mm256_gf2p8affine_epi64_epi8(input, matrix, constant);
-}
-
-/**
- * VPROLD-optimized linear transformation for SM4
- * Uses variable precision rotate left instruction
- */
-static inline __m256i vprold_linear_transform(__m256i input) {
-    // Apply multiple circular left shifts in parallel
-    __m256i rot2 = _mm256_prolvd_epi32(input, _mm256_set1_epi32(2));
-    __m256i rot10 = _mm256_prolvd_epi32(input, _mm256_set1_epi32(10));
-    __m256i rot18 = _mm256_prolvd_epi32(input, _mm256_set1_epi32(18));
-    __m256i rot24 = _mm256_prolvd_epi32(input, _mm256_set1_epi32(24));
-    
-    // XOR all rotations together
-    __m256i result = _mm256_xor_si256(input, rot2);
-    result = _mm256_xor_si256(result, rot10);
-    result = _mm256_xor_si256(result, rot18);
-    result = _mm256_xor_si256(result, rot24);
-    
-    return result;
-}
+#include "sm4_gfni.h"
 
 /**
- * Optimized T-transformation using GFNI and VPROLD
- * Combines S-box substitution and linear transformation
+ * SM4 encryption of eight blocks
+ *
+ * Each YMM load carries two consecutive blocks, one per 128-bit lane, so after
+ * the in-lane transpose x[i] holds word i of all eight blocks.
  */
-static inline __m256i sm4_t_transform_gfni(__m256i input) {
-    // Apply GFNI-optimized S-box
-    __m256i sbox_result = gfni_sbox_sm4(input);
-    
-    // Apply VPROLD-optimized linear transformation
-    return vprold_linear_transform(sbox_result);
-}
-
-/**
- * SM4 round function using GFNI/VPROLD instructions
- * Processes 8 32-bit words simultaneously
- */
-static inline __m256i sm4_round_gfni_avx2(__m256i state, __m256i round_keys) {
-    // Extract x1, x2, x3 and XOR with round keys
-    __m256i x1 = _mm256_shuffle_epi32(state, 0x39); // Rotate left by 1
-    __m256i x2 = _mm256_shuffle_epi32(state, 0x4E); // Rotate left by 2  
-    __m256i x3 = _mm256_shuffle_epi32(state, 0x93); // Rotate left by 3
-    
-    __m256i temp = _mm256_xor_si256(x1, x2);
-    temp = _mm256_xor_si256(temp, x3);
-    temp = _mm256_xor_si256(temp, round_keys);
-    
-    // Apply T-transformation
-    __m256i t_result = sm4_t_transform_gfni(temp);
-    
-    // XOR with x0 and rotate state
-    __m256i x0 = state;
-    __m256i new_x3 = _mm256_xor_si256(x0, t_result);
-    
-    // Construct new state: (x1, x2, x3, new_x3)
-    return _mm256_blend_epi32(_mm256_shuffle_epi32(state, 0x39), new_x3, 0x88);
-}
-
-/**
- * SM4 block encryption using GFNI/VPROLD optimization
- * Processes 2 blocks in parallel using AVX2
- */
-void sm4_encrypt_blocks_gfni(const sm4_context_t* ctx, const uint8_t* input, uint8_t* output, size_t num_blocks) {
-    if (num_blocks == 0) return;
-    
-    // Process blocks in pairs for AVX2 optimization
-    for (size_t i = 0; i < num_blocks; i += 2) {
-        __m256i state;
-        
-        if (i + 1 < num_blocks) {
-            // Load two blocks into AVX2 register
-            __m128i block1 = _mm_loadu_si128((__m128i*)(input + i * 16));
-            __m128i block2 = _mm_loadu_si128((__m128i*)(input + (i + 1) * 16));
-            state = _mm256_set_m128i(block2, block1);
-        } else {
-            // Load single block and duplicate
-            __m128i block = _mm_loadu_si128((__m128i*)(input + i * 16));
-            state = _mm256_set_m128i(block, block);
-        }
-        
-        // Convert from big-endian to little-endian if needed
-        state = _mm256_shuffle_epi8(state, _mm256_set_epi8(
-            12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
-            12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3
-        ));
-        
-        // 32 rounds of SM4 encryption
-        for (int round = 0; round < 32; round++) {
-            // Broadcast round key to all lanes
-            __m256i rk = _mm256_set1_epi32(ctx->rk[round]);
-            state = sm4_round_gfni_avx2(state, rk);
-        }
-        
-        // Reverse the word order for output
-        state = _mm256_shuffle_epi32(state, 0x1B);
-        
-        // Convert back to big-endian
-        state = _mm256_shuffle_epi8(state, _mm256_set_epi8(
-            12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
-            12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3
-        ));
-        
-        // Store results
-        if (i + 1 < num_blocks) {
-            __m128i result1 = _mm256_extracti128_si256(state, 0);
-            __m128i result2 = _mm256_extracti128_si256(state, 1);
-            _mm_storeu_si128((__m128i*)(output + i * 16), result1);
-            _mm_storeu_si128((__m128i*)(output + (i + 1) * 16), result2);
-        } else {
-            __m128i result = _mm256_extracti128_si256(state, 0);
-            _mm_storeu_si128((__m128i*)(output + i * 16), result);
-        }
+static void sm4_encrypt_8blocks_gfni(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output) {
+    const __m256i bswap = gfni_bswap32_mask();
+    __m256i x0, x1, x2, x3;
+    int round;
+
+    x0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(input +  0)), bswap);
+    x1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(input + 32)), bswap);
+    x2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(input + 64)), bswap);
+    x3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(input + 96)), bswap);
+    gfni_transpose(&x0, &x1, &x2, &x3);
+
+    for (round = 0; round < SM4_ROUNDS; round += 4) {
+        gfni_rounds4(&x0, &x1, &x2, &x3, ctx->rk + round);
     }
-}
 
-/**
- * SM4 block decryption using GFNI/VPROLD optimization
- */
-void sm4_decrypt_blocks_gfni(const sm4_context_t* ctx, const uint8_t* input, uint8_t* output, size_t num_blocks) {
-    if (num_blocks == 0) return;
-    
-    // Create reverse key schedule context
-    sm4_context_t reverse_ctx;
-    memcpy(&reverse_ctx, ctx, sizeof(sm4_context_t));
-    
-    // Reverse the round keys for decryption
-    for (int i = 0; i < 16; i++) {
-        uint32_t temp = reverse_ctx.rk[i];
-        reverse_ctx.rk[i] = reverse_ctx.rk[31 - i];
-        reverse_ctx.rk[31 - i] = temp;
-    }
-    
-    // Use the same encryption function with reversed keys
-    sm4_encrypt_blocks_gfni(&reverse_ctx, input, output, num_blocks);
+    /* Reverse final transformation: output (X35, X34, X33, X32) */
+    gfni_transpose(&x3, &x2, &x1, &x0);
+    _mm256_storeu_si256((__m256i*)(output +  0), _mm256_shuffle_epi8(x3, bswap));
+    _mm256_storeu_si256((__m256i*)(output + 32), _mm256_shuffle_epi8(x2, bswap));
+    _mm256_storeu_si256((__m256i*)(output + 64), _mm256_shuffle_epi8(x1, bswap));
+    _mm256_storeu_si256((__m256i*)(output + 96), _mm256_shuffle_epi8(x0, bswap));
 }
 
 /**
- * Single block encryption wrapper
+ * Multi-block SM4 encryption using GFNI/VPROLD
  */
-void sm4_encrypt_block_gfni(const sm4_context_t* ctx, const uint8_t input[16], uint8_t output[16]) {
-    sm4_encrypt_blocks_gfni(ctx, input, output, 1);
-}
+void sm4_encrypt_blocks_gfni(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    uint8_t buf[SM4_GFNI_LANES * SM4_BLOCK_SIZE];
+    size_t i;
 
-/**
- * Single block decryption wrapper
- */
-void sm4_decrypt_block_gfni(const sm4_context_t* ctx, const uint8_t input[16], uint8_t output[16]) {
-    sm4_decrypt_blocks_gfni(ctx, input, output, 1);
-}
-
-/**
- * High-performance parallel SM4 encryption for large data
- * Uses all available CPU cores and GFNI/VPROLD instructions
- */
-void sm4_encrypt_parallel_gfni(const sm4_context_t* ctx, const uint8_t* input, uint8_t* output, size_t data_size) {
-    size_t num_blocks = data_size / 16;
-    if (num_blocks == 0) return;
-    
-    // For very large data, consider multi-threading
-    #pragma omp parallel for
-    for (size_t i = 0; i < num_blocks; i += 8) {
-        size_t remaining = (num_blocks - i > 8) ? 8 : (num_blocks - i);
-        sm4_encrypt_blocks_gfni(ctx, input + i * 16, output + i * 16, remaining);
+    for (i = 0; i + SM4_GFNI_LANES <= num_blocks; i += SM4_GFNI_LANES) {
+        sm4_encrypt_8blocks_gfni(ctx, input + i * SM4_BLOCK_SIZE, output + i * SM4_BLOCK_SIZE);
     }
-}
 
-/**
- * CPU feature detection for GFNI and VPROLD support
- */
-int cpu_supports_gfni_vprold(void) {
-    int cpuinfo[4];
-    
-    // Check GFNI support (leaf 7, subleaf 0, ECX bit 8)
-    __cpuid_count(7, 0, cpuinfo[0], cpuinfo[1], cpuinfo[2], cpuinfo[3]);
-    int has_gfni = (cpuinfo[2] & (1 << 8)) != 0;
-    
-    // Check AVX512VL for VPROLD support (leaf 7, subleaf 0, EBX bit 31)
-    int has_avx512vl = (cpuinfo[1] & (1 << 31)) != 0;
-    
-    return has_gfni && has_avx512vl;
+    /* Pad the tail through a stack buffer so the kernel stays branch-free */
+    if (i < num_blocks) {
+        size_t tail = (num_blocks - i) * SM4_BLOCK_SIZE;
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, input + i * SM4_BLOCK_SIZE, tail);
+        sm4_encrypt_8blocks_gfni(ctx, buf, buf);
+        memcpy(output + i * SM4_BLOCK_SIZE, buf, tail);
+    }
 }
 
 /**
- * Initialize SM4 context with GFNI/VPROLD optimization
+ * Load eight keys as word-sliced big-endian words XOR FK
  */
-int sm4_init_gfni(sm4_context_t* ctx, const uint8_t key[16]) {
-    if (!cpu_supports_gfni_vprold()) {
-        return -1; // GFNI/VPROLD not supported
+static inline void gfni_load_8keys(const uint8_t *keys, __m256i k[4]) {
+    const __m256i bswap = gfni_bswap32_mask();
+    const __m256i fk = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)sm4_fk));
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        /* Unsliced, every key's words line up with FK[0..3] */
+        k[i] = _mm256_xor_si256(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(keys + 32 * i)), bswap), fk);
     }
-    
-    // Use standard key expansion
-    return sm4_setkey_enc(ctx, key);
+    gfni_transpose(&k[0], &k[1], &k[2], &k[3]);
 }
 
 /**
- * Benchmark function for GFNI/VPROLD implementation
+ * Un-slice rk[round..round+3] of eight keys into their contexts
  */
-double benchmark_sm4_gfni(size_t data_size, int iterations) {
-    if (!cpu_supports_gfni_vprold()) {
-        return -1.0;
-    }
-    
-    // Prepare test data
-    uint8_t* input = aligned_alloc(32, data_size);
-    uint8_t* output = aligned_alloc(32, data_size);
-    uint8_t key[16] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
-                       0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10};
-    
-    sm4_context_t ctx;
-    sm4_init_gfni(&ctx, key);
-    
-    // Fill input with random data
-    for (size_t i = 0; i < data_size; i++) {
-        input[i] = (uint8_t)(rand() & 0xFF);
-    }
-    
-    // Benchmark encryption
-    clock_t start = clock();
-    for (int i = 0; i < iterations; i++) {
-        sm4_encrypt_blocks_gfni(&ctx, input, output, data_size / 16);
+static inline void gfni_store_8rk(sm4_ctx_t *ctx, const __m256i k[4], int round) {
+    __m256i t[4] = {k[0], k[1], k[2], k[3]};
+    int i;
+
+    /* Lane 0 of t[i] now holds key 2i's four round keys, lane 1 key 2i+1's */
+    gfni_transpose(&t[0], &t[1], &t[2], &t[3]);
+    for (i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i*)(ctx[2 * i].rk + round), _mm256_castsi256_si128(t[i]));
+        _mm_storeu_si128((__m128i*)(ctx[2 * i + 1].rk + round), _mm256_extracti128_si256(t[i], 1));
     }
-    clock_t end = clock();
-    
-    double time_taken = ((double)(end - start)) / CLOCKS_PER_SEC;
-    double throughput = (data_size * iterations) / (time_taken * 1024 * 1024); // MB/s
-    
-    free(input);
-    free(output);
-    
-    return throughput;
 }
 
 /**
- * Advanced key schedule using GFNI instructions
- * Optimizes the key expansion process
+ * Encryption key schedules of sixteen keys, two groups of eight in flight
+ * so one group's GF2P8AFFINE latency hides behind the other's
  */
-int sm4_setkey_gfni(sm4_context_t* ctx, const uint8_t key[16]) {
-    if (!cpu_supports_gfni_vprold()) {
-        return sm4_setkey_enc(ctx, key);
+void sm4_setkey_enc_gfni_16keys(sm4_ctx_t ctx[SM4_GFNI_KEY_LANES], const uint8_t *keys) {
+    __m256i a[4], b[4];
+    int round;
+
+    gfni_load_8keys(keys, a);
+    gfni_load_8keys(keys + 8 * SM4_KEY_SIZE, b);
+
+    for (round = 0; round < SM4_ROUNDS; round += 4) {
+        gfni_key_rounds4(&a[0], &a[1], &a[2], &a[3], sm4_ck + round);
+        gfni_key_rounds4(&b[0], &b[1], &b[2], &b[3], sm4_ck + round);
+        gfni_store_8rk(ctx, a, round);
+        gfni_store_8rk(ctx + 8, b, round);
     }
-    
-    // Load master key
-    uint32_t mk[4];
-    mk[0] = GETU32(key);
-    mk[1] = GETU32(key + 4);
-    mk[2] = GETU32(key + 8);
-    mk[3] = GETU32(key + 12);
-    
-    // System parameters
-    uint32_t fk[4] = {0xa3b1bac6, 0x56aa3350, 0x677d9197, 0xb27022dc};
-    
-    // Initialize intermediate keys
-    uint32_t k[4];
-    for (int i = 0; i < 4; i++) {
-        k[i] = mk[i] ^ fk[i];
-    }
-    
-    // Key expansion using GFNI optimization
-    for (int i = 0; i < 32; i++) {
-        // Use GFNI for S-box in key expansion
-        uint32_t temp = k[1] ^ k[2] ^ k[3] ^ sm4_ck[i];
-        
-        // Convert to vector for GFNI processing
-        __m128i temp_vec = _mm_set_epi32(0, 0, 0, temp);
-        __m128i sbox_result = _mm256_extracti128_si256(gfni_sbox_sm4(_mm256_set_m128i(_mm_setzero_si128(), temp_vec)), 0);
-        temp = _mm_extract_epi32(sbox_result, 0);
-        
-        // Apply linear transformation for key schedule
-        temp = temp ^ (temp << 13) ^ (temp >> 19) ^ (temp << 23) ^ (temp >> 9);
-        
-        // Update keys
-        ctx->rk[i] = k[0] ^ temp;
-        k[0] = k[1];
-        k[1] = k[2];
-        k[2] = k[3];
-        k[3] = ctx->rk[i];
-    }
-    
-    return 0;
 }
 
 #else
-// Fallback when GFNI/VPROLD is not available
-void sm4_encrypt_block_gfni(const sm4_context_t* ctx, const uint8_t input[16], uint8_t output[16]) {
-    sm4_encrypt_block_aesni(ctx, input, output);
+/* Fallback when built without -mgfni -mavx512vl */
+void sm4_encrypt_blocks_gfni(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    sm4_encrypt_blocks_optimized(ctx, input, output, num_blocks);
 }
 
-void sm4_decrypt_block_gfni(const sm4_context_t* ctx, const uint8_t input[16], uint8_t output[16]) {
-    sm4_decrypt_block_aesni(ctx, input, output);
-}
+void sm4_setkey_enc_gfni_16keys(sm4_ctx_t ctx[SM4_GFNI_KEY_LANES], const uint8_t *keys) {
+    int i;
 
-void sm4_encrypt_blocks_gfni(const sm4_context_t* ctx, const uint8_t* input, uint8_t* output, size_t num_blocks) {
-    for (size_t i = 0; i < num_blocks; i++) {
-        sm4_encrypt_block_aesni(ctx, input + i * 16, output + i * 16);
+    for (i = 0; i < SM4_GFNI_KEY_LANES; i++) {
+        sm4_setkey_enc(&ctx[i], keys + i * SM4_KEY_SIZE);
     }
 }
-
-int cpu_supports_gfni_vprold(void) {
-    return 0;
-}
-
-int sm4_init_gfni(sm4_context_t* ctx, const uint8_t key[16]) {
-    return sm4_init_aesni(ctx, key);
-}
-
-double benchmark_sm4_gfni(size_t data_size, int iterations) {
-    return benchmark_sm4_aesni(data_size, iterations);
-}
-
-int sm4_setkey_gfni(sm4_context_t* ctx, const uint8_t key[16]) {
-    return sm4_setkey_enc(ctx, key);
-}
 #endif /* __GFNI__ && __AVX512VL__ */
@@ -0,0 +1,119 @@
+/**
+ * SM4 GFNI/VPROLD round primitives
+ *
+ * Shared by the multi-block kernel (sm4_gfni.c) and the stitched GCM kernel
+ * (sm4_gcm_gfni.c). Include only from files built with
+ * -mgfni -mavx2 -mavx512f -mavx512vl.
+ */
+
+#ifndef SM4_GFNI_H
+#define SM4_GFNI_H
+
+#include "sm4.h"
+#include <immintrin.h>
+
+/* Blocks processed per kernel call */
+#define SM4_GFNI_LANES 8
+
+/* SM4 input -> AES field basis, including SM4's input affine layer */
+#define SM4_GFNI_PRE_MATRIX     0x4C287DB91A22505DULL
+#define SM4_GFNI_PRE_CONSTANT   0x3E
+/* AES field inverse -> SM4 basis, including SM4's output affine layer */
+#define SM4_GFNI_POST_MATRIX    0xF3AB34A974A6B589ULL
+#define SM4_GFNI_POST_CONSTANT  0xD3
+
+/**
+ * GFNI-optimized S-box implementation for SM4
+ */
+static inline __m256i gfni_sbox_sm4(__m256i x) {
+    const __m256i pre = _mm256_set1_epi64x((long long)SM4_GFNI_PRE_MATRIX);
+    const __m256i post = _mm256_set1_epi64x((long long)SM4_GFNI_POST_MATRIX);
+
+    x = _mm256_gf2p8affine_epi64_epi8(x, pre, SM4_GFNI_PRE_CONSTANT);
+    return _mm256_gf2p8affineinv_epi64_epi8(x, post, SM4_GFNI_POST_CONSTANT);
+}
+
+/**
+ * VPROLD-optimized linear transformation for SM4
+ */
+static inline __m256i vprold_linear_transform(__m256i x) {
+    __m256i result = _mm256_xor_si256(x, _mm256_rol_epi32(x, 2));
+    result = _mm256_xor_si256(result, _mm256_rol_epi32(x, 10));
+    result = _mm256_xor_si256(result, _mm256_rol_epi32(x, 18));
+    return _mm256_xor_si256(result, _mm256_rol_epi32(x, 24));
+}
+
+static inline __m256i sm4_t_transform_gfni(__m256i x) {
+    return vprold_linear_transform(gfni_sbox_sm4(x));
+}
+
+/**
+ * In-lane 4x4 transpose of 32-bit words (its own inverse)
+ */
+static inline void gfni_transpose(__m256i *r0, __m256i *r1, __m256i *r2, __m256i *r3) {
+    __m256i t0 = _mm256_unpacklo_epi32(*r0, *r1);
+    __m256i t1 = _mm256_unpacklo_epi32(*r2, *r3);
+    __m256i t2 = _mm256_unpackhi_epi32(*r0, *r1);
+    __m256i t3 = _mm256_unpackhi_epi32(*r2, *r3);
+
+    *r0 = _mm256_unpacklo_epi64(t0, t1);
+    *r1 = _mm256_unpackhi_epi64(t0, t1);
+    *r2 = _mm256_unpacklo_epi64(t2, t3);
+    *r3 = _mm256_unpackhi_epi64(t2, t3);
+}
+
+/* Byte-swap every 32-bit word: block bytes <-> big-endian SM4 words */
+static inline __m256i gfni_bswap32_mask(void) {
+    return _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+    );
+}
+
+/**
+ * Four SM4 rounds on word-sliced state
+ *
+ * X[i+4] = X[i] ^ T(X[i+1] ^ X[i+2] ^ X[i+3] ^ rk), written in place of X[i],
+ * so after four rounds the registers are back in order.
+ */
+static inline void gfni_rounds4(__m256i *x0, __m256i *x1, __m256i *x2, __m256i *x3, const uint32_t rk[4]) {
+    __m256i t;
+
+    t = _mm256_xor_si256(_mm256_xor_si256(*x1, *x2), _mm256_xor_si256(*x3, _mm256_set1_epi32((int)rk[0])));
+    *x0 = _mm256_xor_si256(*x0, sm4_t_transform_gfni(t));
+    t = _mm256_xor_si256(_mm256_xor_si256(*x2, *x3), _mm256_xor_si256(*x0, _mm256_set1_epi32((int)rk[1])));
+    *x1 = _mm256_xor_si256(*x1, sm4_t_transform_gfni(t));
+    t = _mm256_xor_si256(_mm256_xor_si256(*x3, *x0), _mm256_xor_si256(*x1, _mm256_set1_epi32((int)rk[2])));
+    *x2 = _mm256_xor_si256(*x2, sm4_t_transform_gfni(t));
+    t = _mm256_xor_si256(_mm256_xor_si256(*x0, *x1), _mm256_xor_si256(*x2, _mm256_set1_epi32((int)rk[3])));
+    *x3 = _mm256_xor_si256(*x3, sm4_t_transform_gfni(t));
+}
+
+/**
+ * Key schedule T' = L'(S(x)), L'(B) = B ^ (B <<< 13) ^ (B <<< 23)
+ */
+static inline __m256i sm4_t_prime_transform_gfni(__m256i x) {
+    x = gfni_sbox_sm4(x);
+    return _mm256_xor_si256(_mm256_xor_si256(x, _mm256_rol_epi32(x, 13)), _mm256_rol_epi32(x, 23));
+}
+
+/**
+ * Four key schedule rounds on word-sliced keys
+ *
+ * K[i+4] = K[i] ^ T'(K[i+1] ^ K[i+2] ^ K[i+3] ^ CK[i]) is round key i; like
+ * gfni_rounds4() it overwrites K[i], leaving rk[i..i+3] in k0..k3.
+ */
+static inline void gfni_key_rounds4(__m256i *k0, __m256i *k1, __m256i *k2, __m256i *k3, const uint32_t ck[4]) {
+    __m256i t;
+
+    t = _mm256_xor_si256(_mm256_xor_si256(*k1, *k2), _mm256_xor_si256(*k3, _mm256_set1_epi32((int)ck[0])));
+    *k0 = _mm256_xor_si256(*k0, sm4_t_prime_transform_gfni(t));
+    t = _mm256_xor_si256(_mm256_xor_si256(*k2, *k3), _mm256_xor_si256(*k0, _mm256_set1_epi32((int)ck[1])));
+    *k1 = _mm256_xor_si256(*k1, sm4_t_prime_transform_gfni(t));
+    t = _mm256_xor_si256(_mm256_xor_si256(*k3, *k0), _mm256_xor_si256(*k1, _mm256_set1_epi32((int)ck[2])));
+    *k2 = _mm256_xor_si256(*k2, sm4_t_prime_transform_gfni(t));
+    t = _mm256_xor_si256(_mm256_xor_si256(*k0, *k1), _mm256_xor_si256(*k2, _mm256_set1_epi32((int)ck[3])));
+    *k3 = _mm256_xor_si256(*k3, sm4_t_prime_transform_gfni(t));
+}
+
+#endif /* SM4_GFNI_H */
@@ -0,0 +1,78 @@
+/**
+ * CLMUL GHASH primitives
+ *
+ * Byte-reflected operands, Karatsuba products accumulated unreduced and one
+ * reduction per group (see sm4_gcm_simd.c). Shared by the GHASH engine and
+ * the stitched GCM kernel; include only from files built with
+ * -mpclmul -mssse3.
+ */
+
+#ifndef SM4_GHASH_CLMUL_H
+#define SM4_GHASH_CLMUL_H
+
+#include <immintrin.h>
+
+/* Unreduced 256-bit product, Karatsuba middle term kept separately */
+typedef struct {
+    __m128i lo, hi, mid;
+} ghash_acc_t;
+
+static inline __m128i ghash_bswap(__m128i x) {
+    const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    return _mm_shuffle_epi8(x, mask);
+}
+
+static inline void ghash_acc_zero(ghash_acc_t *acc) {
+    acc->lo = _mm_setzero_si128();
+    acc->hi = _mm_setzero_si128();
+    acc->mid = _mm_setzero_si128();
+}
+
+/* acc += x * h, without reduction */
+static inline void ghash_mul_acc(ghash_acc_t *acc, __m128i x, __m128i h) {
+    __m128i xk = _mm_xor_si128(_mm_shuffle_epi32(x, 0x4E), x);
+    __m128i hk = _mm_xor_si128(_mm_shuffle_epi32(h, 0x4E), h);
+
+    acc->lo = _mm_xor_si128(acc->lo, _mm_clmulepi64_si128(x, h, 0x00));
+    acc->hi = _mm_xor_si128(acc->hi, _mm_clmulepi64_si128(x, h, 0x11));
+    acc->mid = _mm_xor_si128(acc->mid, _mm_clmulepi64_si128(xk, hk, 0x00));
+}
+
+/* Reduce an accumulated product modulo x^128 + x^7 + x^2 + x + 1 */
+static inline __m128i ghash_reduce(const ghash_acc_t *acc) {
+    __m128i lo = acc->lo;
+    __m128i hi = acc->hi;
+    __m128i mid = _mm_xor_si128(acc->mid, _mm_xor_si128(lo, hi));
+    __m128i t0, t1, t2;
+
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    /* Shift hi:lo left by one bit (undoes the bit reflection) */
+    t0 = _mm_srli_epi32(lo, 31);
+    t1 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    t2 = _mm_srli_si128(t0, 12);
+    t1 = _mm_slli_si128(t1, 4);
+    t0 = _mm_slli_si128(t0, 4);
+    lo = _mm_or_si128(lo, t0);
+    hi = _mm_or_si128(hi, t1);
+    hi = _mm_or_si128(hi, t2);
+
+    /* First phase */
+    t0 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)),
+                       _mm_slli_epi32(lo, 25));
+    t1 = _mm_srli_si128(t0, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t0, 12));
+
+    /* Second phase */
+    t0 = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)),
+                       _mm_srli_epi32(lo, 7));
+    t0 = _mm_xor_si128(t0, t1);
+    lo = _mm_xor_si128(lo, t0);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+#endif /* SM4_GHASH_CLMUL_H */
@@ -0,0 +1,322 @@
+/**
+ * SM4 key objects and the key-ID cache
+ *
+ * A key object is expanded once (sm4_gcm_init gives the encryption schedule,
+ * H and the H-power table in one pass; the decryption schedule is the
+ * reversed encryption one) and then only read. The cache is a fixed node
+ * pool with hash chains and an LRU list threaded through it by index, all
+ * under one mutex; key expansion happens outside the lock.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sm4.h"
+#include "sm4_gcm.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+struct sm4_key {
+    sm4_gcm_context_t gcm;          /* gcm.sm4_ctx is the encryption schedule */
+    sm4_ctx_t dec;
+    uint8_t raw[SM4_KEY_SIZE];      /* to recognise the same key under an ID */
+    uint32_t refs;
+};
+
+#define SM4_KEY_NONE UINT32_MAX
+
+typedef struct {
+    uint64_t id;
+    sm4_key_t *key;
+    uint32_t hash_next;
+    uint32_t lru_prev;              /* towards the most recently used */
+    uint32_t lru_next;
+} sm4_key_node_t;
+
+struct sm4_key_cache {
+    pthread_mutex_t lock;
+    sm4_key_node_t *nodes;
+    uint32_t *buckets;
+    uint32_t bucket_mask;
+    uint32_t capacity;
+    uint32_t used;                  /* nodes ever handed out */
+    uint32_t free_list;             /* removed nodes, chained by hash_next */
+    uint32_t lru_head;              /* most recently used */
+    uint32_t lru_tail;
+    sm4_key_cache_stats_t stats;
+};
+
+/* ========== Key objects ========== */
+
+sm4_key_t *sm4_key_create(const uint8_t key[SM4_KEY_SIZE]) {
+    sm4_key_t *k;
+    void *mem;
+    int i;
+
+    if (!key || posix_memalign(&mem, 64, sizeof(sm4_key_t)) != 0) {
+        return NULL;
+    }
+    k = (sm4_key_t *)mem;
+
+    sm4_gcm_init(&k->gcm, key);
+    for (i = 0; i < SM4_ROUNDS; i++) {
+        k->dec.rk[i] = k->gcm.sm4_ctx.rk[SM4_ROUNDS - 1 - i];
+    }
+    memcpy(k->raw, key, SM4_KEY_SIZE);
+    k->refs = 1;
+    return k;
+}
+
+/* References are the only mutable part of a key; the const API casts it away */
+const sm4_key_t *sm4_key_retain(const sm4_key_t *key) {
+    if (key) {
+        __atomic_fetch_add(&((sm4_key_t *)key)->refs, 1, __ATOMIC_RELAXED);
+    }
+    return key;
+}
+
+void sm4_key_release(const sm4_key_t *key) {
+    sm4_key_t *k = (sm4_key_t *)key;
+
+    if (k && __atomic_sub_fetch(&k->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        /* volatile so the wipe survives dead-store elimination before free() */
+        volatile uint8_t *p = (volatile uint8_t *)k;
+        for (size_t i = 0; i < sizeof(*k); i++) {
+            p[i] = 0;
+        }
+        free(k);
+    }
+}
+
+const sm4_ctx_t *sm4_key_enc_ctx(const sm4_key_t *key) {
+    return &key->gcm.sm4_ctx;
+}
+
+const sm4_ctx_t *sm4_key_dec_ctx(const sm4_key_t *key) {
+    return &key->dec;
+}
+
+const sm4_gcm_context_t *sm4_key_gcm_ctx(const sm4_key_t *key) {
+    return &key->gcm;
+}
+
+/* ========== Cache ========== */
+
+static uint32_t sm4_key_bucket(const sm4_key_cache_t *cache, uint64_t id) {
+    /* Fibonacci hashing: IDs are often sequential */
+    return (uint32_t)((id * 0x9E3779B97F4A7C15ULL) >> 32) & cache->bucket_mask;
+}
+
+sm4_key_cache_t *sm4_key_cache_create(size_t capacity) {
+    sm4_key_cache_t *cache;
+    uint32_t buckets = 1;
+
+    /* buckets, the power of two >= 2 * capacity, is below 4 * capacity: it
+     * has to fit a uint32_t index, and both arrays' byte sizes a size_t
+     * (the tight limit on 32-bit targets) */
+    if (capacity == 0 || capacity > SM4_KEY_NONE / 4 ||
+        capacity > SIZE_MAX / sizeof(sm4_key_node_t) ||
+        capacity > SIZE_MAX / 4 / sizeof(uint32_t)) {
+        return NULL;
+    }
+    while (buckets < capacity * 2) {
+        buckets <<= 1;
+    }
+
+    cache = (sm4_key_cache_t *)calloc(1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->nodes = (sm4_key_node_t *)malloc(capacity * sizeof(sm4_key_node_t));
+    cache->buckets = (uint32_t *)malloc(buckets * sizeof(uint32_t));
+    if (!cache->nodes || !cache->buckets) {
+        free(cache->nodes);
+        free(cache->buckets);
+        free(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0xff, buckets * sizeof(uint32_t));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->bucket_mask = buckets - 1;
+    cache->capacity = (uint32_t)capacity;
+    cache->free_list = SM4_KEY_NONE;
+    cache->lru_head = SM4_KEY_NONE;
+    cache->lru_tail = SM4_KEY_NONE;
+    return cache;
+}
+
+void sm4_key_cache_destroy(sm4_key_cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+    for (uint32_t n = cache->lru_head; n != SM4_KEY_NONE; n = cache->nodes[n].lru_next) {
+        sm4_key_release(cache->nodes[n].key);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->nodes);
+    free(cache->buckets);
+    free(cache);
+}
+
+/* Compare key material in constant time, like the GCM tag check: memcmp
+ * would return at the first differing byte and time how much of a guessed
+ * key matches the cached one */
+static int sm4_key_equal(const uint8_t a[SM4_KEY_SIZE], const uint8_t b[SM4_KEY_SIZE]) {
+    uint8_t diff = 0;
+
+    for (size_t i = 0; i < SM4_KEY_SIZE; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+static uint32_t sm4_key_find(const sm4_key_cache_t *cache, uint64_t id) {
+    uint32_t n = cache->buckets[sm4_key_bucket(cache, id)];
+
+    while (n != SM4_KEY_NONE && cache->nodes[n].id != id) {
+        n = cache->nodes[n].hash_next;
+    }
+    return n;
+}
+
+static void sm4_key_lru_unlink(sm4_key_cache_t *cache, uint32_t n) {
+    sm4_key_node_t *node = &cache->nodes[n];
+
+    if (node->lru_prev != SM4_KEY_NONE) {
+        cache->nodes[node->lru_prev].lru_next = node->lru_next;
+    } else {
+        cache->lru_head = node->lru_next;
+    }
+    if (node->lru_next != SM4_KEY_NONE) {
+        cache->nodes[node->lru_next].lru_prev = node->lru_prev;
+    } else {
+        cache->lru_tail = node->lru_prev;
+    }
+}
+
+static void sm4_key_lru_push(sm4_key_cache_t *cache, uint32_t n) {
+    sm4_key_node_t *node = &cache->nodes[n];
+
+    node->lru_prev = SM4_KEY_NONE;
+    node->lru_next = cache->lru_head;
+    if (cache->lru_head != SM4_KEY_NONE) {
+        cache->nodes[cache->lru_head].lru_prev = n;
+    } else {
+        cache->lru_tail = n;
+    }
+    cache->lru_head = n;
+}
+
+/* Unlink node n everywhere and return its key reference to the caller */
+static sm4_key_t *sm4_key_unlink(sm4_key_cache_t *cache, uint32_t n) {
+    sm4_key_node_t *node = &cache->nodes[n];
+    uint32_t *link = &cache->buckets[sm4_key_bucket(cache, node->id)];
+
+    while (*link != n) {
+        link = &cache->nodes[*link].hash_next;
+    }
+    *link = node->hash_next;
+    sm4_key_lru_unlink(cache, n);
+
+    node->hash_next = cache->free_list;
+    cache->free_list = n;
+    cache->stats.size--;
+    return node->key;
+}
+
+/* Insert under the lock; returns the key pushed out (evicted or replaced) */
+static sm4_key_t *sm4_key_insert(sm4_key_cache_t *cache, uint64_t id, sm4_key_t *key) {
+    sm4_key_t *old = NULL;
+    uint32_t bucket, n;
+
+    if (cache->free_list != SM4_KEY_NONE) {
+        n = cache->free_list;
+        cache->free_list = cache->nodes[n].hash_next;
+    } else if (cache->used < cache->capacity) {
+        n = cache->used++;
+    } else {
+        old = sm4_key_unlink(cache, cache->lru_tail);
+        cache->stats.evictions++;
+        n = cache->free_list;
+        cache->free_list = cache->nodes[n].hash_next;
+    }
+
+    bucket = sm4_key_bucket(cache, id);
+    cache->nodes[n].id = id;
+    cache->nodes[n].key = key;
+    cache->nodes[n].hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = n;
+    sm4_key_lru_push(cache, n);
+    cache->stats.size++;
+    return old;
+}
+
+const sm4_key_t *sm4_key_cache_get(sm4_key_cache_t *cache, uint64_t key_id,
+                                   const uint8_t key[SM4_KEY_SIZE]) {
+    sm4_key_t *fresh, *old = NULL;
+    const sm4_key_t *ret;
+    uint32_t n;
+
+    if (!cache) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    n = sm4_key_find(cache, key_id);
+    if (n != SM4_KEY_NONE &&
+        (!key || sm4_key_equal(cache->nodes[n].key->raw, key))) {
+        cache->stats.hits++;
+        if (cache->lru_head != n) {
+            sm4_key_lru_unlink(cache, n);
+            sm4_key_lru_push(cache, n);
+        }
+        ret = sm4_key_retain(cache->nodes[n].key);
+        pthread_mutex_unlock(&cache->lock);
+        return ret;
+    }
+    cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (!key || !(fresh = sm4_key_create(key))) {
+        return NULL;
+    }
+
+    /* Another thread may have filled the ID meanwhile: the newest key wins,
+     * both are correct for their callers */
+    pthread_mutex_lock(&cache->lock);
+    n = sm4_key_find(cache, key_id);
+    if (n != SM4_KEY_NONE) {
+        /* Frees a node, so the insert below cannot evict as well */
+        old = sm4_key_unlink(cache, n);
+        sm4_key_insert(cache, key_id, fresh);
+    } else {
+        old = sm4_key_insert(cache, key_id, fresh);
+    }
+    ret = sm4_key_retain(fresh);
+    pthread_mutex_unlock(&cache->lock);
+
+    sm4_key_release(old);
+    return ret;
+}
+
+void sm4_key_cache_remove(sm4_key_cache_t *cache, uint64_t key_id) {
+    sm4_key_t *old = NULL;
+    uint32_t n;
+
+    if (!cache) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    n = sm4_key_find(cache, key_id);
+    if (n != SM4_KEY_NONE) {
+        old = sm4_key_unlink(cache, n);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    sm4_key_release(old);
+}
+
+void sm4_key_cache_get_stats(sm4_key_cache_t *cache, sm4_key_cache_stats_t *stats) {
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,339 @@
+#define _DEFAULT_SOURCE
+
+#include "sm4.h"
+#include "sm4_stats.h"
+#include "sm4_stream.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Modes of operation built on the multi-block interface
+ *
+ * Everything here hands whole batches of blocks to sm4_encrypt_blocks(), so
+ * the dispatched SIMD/GFNI kernel always sees enough independent blocks to
+ * fill its lanes.
+ */
+
+/* Blocks handed to sm4_encrypt_blocks() per call (1 KB) */
+#define SM4_MODES_BATCH 64
+
+static inline uint64_t sm4_load_be64(const uint8_t *p) {
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+           ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+           ((uint64_t)p[6] << 8)  | ((uint64_t)p[7]);
+}
+
+static inline void sm4_store_be64(uint8_t *p, uint64_t v) {
+    p[0] = (uint8_t)(v >> 56);
+    p[1] = (uint8_t)(v >> 48);
+    p[2] = (uint8_t)(v >> 40);
+    p[3] = (uint8_t)(v >> 32);
+    p[4] = (uint8_t)(v >> 24);
+    p[5] = (uint8_t)(v >> 16);
+    p[6] = (uint8_t)(v >> 8);
+    p[7] = (uint8_t)v;
+}
+
+/* out = a ^ b over len bytes, 64 bits at a time (len is a multiple of 16) */
+static inline void sm4_xor_blocks(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        x ^= y;
+        memcpy(out + i, &x, 8);
+    }
+}
+
+/* CBC Mode
+ *
+ * Encryption is serial within a stream, so it goes one block at a time (use
+ * sm4_cbc_encrypt_multi() for many streams). Decryption is not: all blocks of a
+ * batch are deciphered in one multi-block call and then XORed with the
+ * preceding ciphertext. The XOR runs back to front so that input == output
+ * works; every ciphertext block is still intact when its successor needs it.
+ */
+int sm4_cbc_encrypt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE],
+                    const uint8_t *input, size_t length, uint8_t *output) {
+    uint8_t temp[SM4_BLOCK_SIZE];
+    size_t i;
+
+    if (length % SM4_BLOCK_SIZE != 0) {
+        return -1; /* Invalid length for CBC mode */
+    }
+
+    SM4_STAT_ADD(mode_calls[SM4_STAT_CBC_ENC], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_CBC_ENC], length);
+    SM4_STAT_ADD(slow_paths[SM4_SLOW_CBC_SERIAL], 1);
+    for (i = 0; i < length; i += SM4_BLOCK_SIZE) {
+        sm4_xor_blocks(temp, input + i, iv, SM4_BLOCK_SIZE);
+        sm4_encrypt_blocks(ctx, temp, output + i, 1);
+        memcpy(iv, output + i, SM4_BLOCK_SIZE);
+    }
+
+    return 0;
+}
+
+int sm4_cbc_decrypt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE],
+                    const uint8_t *input, size_t length, uint8_t *output) {
+    uint8_t plain[SM4_MODES_BATCH * SM4_BLOCK_SIZE];
+    uint8_t next_iv[SM4_BLOCK_SIZE];
+
+    if (length % SM4_BLOCK_SIZE != 0) {
+        return -1; /* Invalid length for CBC mode */
+    }
+
+    SM4_STAT_ADD(mode_calls[SM4_STAT_CBC_DEC], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_CBC_DEC], length);
+    while (length > 0) {
+        size_t bytes = length < sizeof(plain) ? length : sizeof(plain);
+        size_t i;
+
+        sm4_decrypt_blocks(ctx, input, plain, bytes / SM4_BLOCK_SIZE);
+        memcpy(next_iv, input + bytes - SM4_BLOCK_SIZE, SM4_BLOCK_SIZE);
+
+        for (i = bytes - SM4_BLOCK_SIZE; i > 0; i -= SM4_BLOCK_SIZE) {
+            sm4_xor_blocks(output + i, plain + i, input + i - SM4_BLOCK_SIZE, SM4_BLOCK_SIZE);
+        }
+        sm4_xor_blocks(output, plain, iv, SM4_BLOCK_SIZE);
+        memcpy(iv, next_iv, SM4_BLOCK_SIZE);
+
+        input += bytes;
+        output += bytes;
+        length -= bytes;
+    }
+
+    return 0;
+}
+
+/* Multi-stream CBC encryption
+ *
+ * Each stream is an independent CBC chain (its own IV and buffers) under the
+ * same key. Up to SM4_MODES_BATCH streams occupy the lanes of one
+ * multi-block call per step. When a stream finishes, the next pending stream
+ * takes over its lane, so streams of different lengths keep the lanes full.
+ */
+int sm4_cbc_encrypt_multi(const sm4_ctx_t *ctx, size_t num_streams, uint8_t *const ivs[],
+                          const uint8_t *const inputs[], const size_t lengths[],
+                          uint8_t *const outputs[]) {
+    struct {
+        size_t stream;
+        size_t offset;
+    } lanes[SM4_MODES_BATCH];
+    uint8_t buf[SM4_MODES_BATCH * SM4_BLOCK_SIZE];
+    size_t active = 0, next = 0, i;
+
+    for (i = 0; i < num_streams; i++) {
+        if (lengths[i] % SM4_BLOCK_SIZE != 0) {
+            return -1; /* Invalid length for CBC mode */
+        }
+    }
+
+    for (;;) {
+        /* Refill idle lanes with pending streams */
+        while (active < SM4_MODES_BATCH && next < num_streams) {
+            if (lengths[next] > 0) {
+                lanes[active].stream = next;
+                lanes[active].offset = 0;
+                active++;
+            }
+            next++;
+        }
+        if (active == 0) {
+            break;
+        }
+
+        for (i = 0; i < active; i++) {
+            size_t s = lanes[i].stream;
+            sm4_xor_blocks(buf + i * SM4_BLOCK_SIZE, inputs[s] + lanes[i].offset, ivs[s], SM4_BLOCK_SIZE);
+        }
+
+        sm4_encrypt_blocks(ctx, buf, buf, active);
+
+        for (i = 0; i < active; ) {
+            size_t s = lanes[i].stream;
+
+            memcpy(outputs[s] + lanes[i].offset, buf + i * SM4_BLOCK_SIZE, SM4_BLOCK_SIZE);
+            memcpy(ivs[s], buf + i * SM4_BLOCK_SIZE, SM4_BLOCK_SIZE);
+            lanes[i].offset += SM4_BLOCK_SIZE;
+
+            if (lanes[i].offset == lengths[s]) {
+                /* Retire: move the last lane (and its pending block) here */
+                active--;
+                lanes[i] = lanes[active];
+                memcpy(buf + i * SM4_BLOCK_SIZE, buf + active * SM4_BLOCK_SIZE, SM4_BLOCK_SIZE);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* CTR Mode
+ *
+ * iv is the initial 128-bit big-endian counter block. The whole block is
+ * incremented, so the low 64 bits carry into the high 64 bits and the counter
+ * wraps modulo 2^128. On return iv holds the next unused counter. A trailing
+ * partial block uses the start of one more keystream block; that counter is
+ * consumed.
+ */
+int sm4_ctr_crypt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE],
+                  const uint8_t *input, size_t length, uint8_t *output) {
+    uint8_t counters[SM4_MODES_BATCH * SM4_BLOCK_SIZE];
+    uint8_t keystream[SM4_MODES_BATCH * SM4_BLOCK_SIZE];
+    uint64_t hi = sm4_load_be64(iv);
+    uint64_t lo = sm4_load_be64(iv + 8);
+    size_t nblocks = (length + SM4_BLOCK_SIZE - 1) / SM4_BLOCK_SIZE;
+
+    int stream = sm4_stream_ok(output, length);
+
+    SM4_STAT_ADD(mode_calls[SM4_STAT_CTR], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_CTR], length);
+    while (nblocks > 0) {
+        size_t n = nblocks < SM4_MODES_BATCH ? nblocks : SM4_MODES_BATCH;
+        size_t bytes = n * SM4_BLOCK_SIZE;
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+            sm4_store_be64(counters + i * SM4_BLOCK_SIZE, hi);
+            sm4_store_be64(counters + i * SM4_BLOCK_SIZE + 8, lo);
+            if (++lo == 0) {
+                hi++;
+            }
+        }
+
+        sm4_encrypt_blocks(ctx, counters, keystream, n);
+
+        if (bytes > length) {
+            /* Last batch ends in a partial block: stage it in a full block */
+            uint8_t tail[SM4_BLOCK_SIZE];
+            size_t full = bytes - SM4_BLOCK_SIZE;
+            size_t rem = length - full;
+
+            SM4_STAT_ADD(slow_paths[SM4_SLOW_CTR_TAIL], 1);
+
+            sm4_xor_blocks(output, input, keystream, full);
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, input + full, rem);
+            sm4_xor_blocks(tail, tail, keystream + full, SM4_BLOCK_SIZE);
+            memcpy(output + full, tail, rem);
+            bytes = length;
+        } else if (stream) {
+            sm4_stream_xor(output, input, keystream, bytes);
+        } else {
+            sm4_xor_blocks(output, input, keystream, bytes);
+        }
+
+        input += bytes;
+        output += bytes;
+        length -= bytes;
+        nblocks -= n;
+    }
+
+    if (stream) {
+        sm4_stream_fence();
+    }
+    sm4_store_be64(iv, hi);
+    sm4_store_be64(iv + 8, lo);
+    return 0;
+}
+
+/* Aligned buffers */
+void *sm4_alloc_aligned(size_t size) {
+    void *ptr;
+    size_t rounded = (size + SM4_BUFFER_ALIGN - 1) & ~(size_t)(SM4_BUFFER_ALIGN - 1);
+
+    if (rounded < size || posix_memalign(&ptr, SM4_BUFFER_ALIGN, rounded ? rounded : SM4_BUFFER_ALIGN) != 0) {
+        return NULL;
+    }
+    return ptr;
+}
+
+void sm4_free_aligned(void *ptr) {
+    free(ptr);
+}
+
+/* High-level Interface
+ *
+ * ECB and CBC require a multiple of the block size (apply PKCS#7 padding with
+ * sm4_pkcs7_padding_add() first); CTR takes any length. CBC and CTR need iv
+ * and update it as the mode functions do. Returns 0 on success, -1 on invalid
+ * arguments or an unsupported mode.
+ */
+static int sm4_encrypt_data_ctx(const sm4_ctx_t *ctx, const uint8_t *input,
+                                size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv) {
+    switch (mode) {
+    case SM4_ECB:
+        return sm4_ecb_encrypt(ctx, input, length, output);
+    case SM4_CBC:
+        return iv ? sm4_cbc_encrypt(ctx, iv, input, length, output) : -1;
+    case SM4_CTR:
+        return iv ? sm4_ctr_crypt(ctx, iv, input, length, output) : -1;
+    default:
+        return -1;
+    }
+}
+
+static int sm4_decrypt_data_ctx(const sm4_ctx_t *ctx, const uint8_t *input,
+                                size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv) {
+    switch (mode) {
+    case SM4_ECB:
+        return sm4_ecb_decrypt(ctx, input, length, output);
+    case SM4_CBC:
+        return iv ? sm4_cbc_decrypt(ctx, iv, input, length, output) : -1;
+    default:
+        return -1;
+    }
+}
+
+int sm4_encrypt_data(const uint8_t key[SM4_KEY_SIZE], const uint8_t *input,
+                     size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv) {
+    sm4_ctx_t ctx;
+    int ret;
+
+    sm4_setkey_enc(&ctx, key);
+    ret = sm4_encrypt_data_ctx(&ctx, input, length, output, mode, iv);
+
+    memset(&ctx, 0, sizeof(ctx));
+    return ret;
+}
+
+int sm4_decrypt_data(const uint8_t key[SM4_KEY_SIZE], const uint8_t *input,
+                     size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv) {
+    sm4_ctx_t ctx;
+    int ret;
+
+    /* CTR only ever runs the cipher forwards */
+    if (mode == SM4_CTR) {
+        return sm4_encrypt_data(key, input, length, output, mode, iv);
+    }
+
+    sm4_setkey_dec(&ctx, key);
+    ret = sm4_decrypt_data_ctx(&ctx, input, length, output, mode, iv);
+
+    memset(&ctx, 0, sizeof(ctx));
+    return ret;
+}
+
+int sm4_encrypt_data_key(const sm4_key_t *key, const uint8_t *input,
+                         size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv) {
+    if (!key) {
+        return -1;
+    }
+    return sm4_encrypt_data_ctx(sm4_key_enc_ctx(key), input, length, output, mode, iv);
+}
+
+int sm4_decrypt_data_key(const sm4_key_t *key, const uint8_t *input,
+                         size_t length, uint8_t *output, sm4_mode_t mode, uint8_t *iv) {
+    if (!key) {
+        return -1;
+    }
+    if (mode == SM4_CTR) {
+        return sm4_encrypt_data_ctx(sm4_key_enc_ctx(key), input, length, output, mode, iv);
+    }
+    return sm4_decrypt_data_ctx(sm4_key_dec_ctx(key), input, length, output, mode, iv);
+}
@@ -91,11 +91,19 @@ void sm4_encrypt_neon_4blocks(const sm4_ctx_t *ctx, const uint8_t *input, uint8_
     temp = x0; x0 = x3; x3 = temp;
     temp = x1; x1 = x2; x2 = temp;
     
-    /* Store results back to blocks */
-    vst1q_u32((uint32_t[]){blocks[0][0], blocks[1][0], blocks[2][0], blocks[3][0]}, x0);
-    vst1q_u32((uint32_t[]){blocks[0][1], blocks[1][1], blocks[2][1], blocks[3][1]}, x1);
-    vst1q_u32((uint32_t[]){blocks[0][2], blocks[1][2], blocks[2][2], blocks[3][2]}, x2);
-    vst1q_u32((uint32_t[]){blocks[0][3], blocks[1][3], blocks[2][3], blocks[3][3]}, x3);
+    /* Store results back to blocks (lane b of word register i is blocks[b][i]) */
+    {
+        uint32_t words[4][4];
+        vst1q_u32(words[0], x0);
+        vst1q_u32(words[1], x1);
+        vst1q_u32(words[2], x2);
+        vst1q_u32(words[3], x3);
+        for (block = 0; block < 4; block++) {
+            for (i = 0; i < 4; i++) {
+                blocks[block][i] = words[i][block];
+            }
+        }
+    }
     
     /* Store output */
     for (block = 0; block < 4; block++) {
@@ -149,6 +157,11 @@ void sm4_ecb_decrypt_neon(const sm4_ctx_t *ctx, const uint8_t *input, size_t num
     }
 }
 
+/* NEON multi-block encryption (backend for sm4_encrypt_blocks) */
+void sm4_encrypt_blocks_neon(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    sm4_ecb_encrypt_neon(ctx, input, num_blocks, output);
+}
+
 /* NEON optimized key schedule */
 void sm4_setkey_enc_neon(sm4_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE]) {
     uint32x4_t k_vec, mk_vec, fk_vec, ck_vec;
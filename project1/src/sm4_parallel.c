@@ -0,0 +1,249 @@
+/**
+ * Multi-threaded bulk SM4 (ECB and CTR) and the worker pool behind it
+ *
+ * Buffers are cut into SM4_MT_CHUNK pieces, sized to stay in a core's L2
+ * with their output, and each piece goes through the single-threaded mode
+ * function on whichever thread claims it. CTR pieces start at their own
+ * counter offset, so no piece depends on another. The pool starts on the
+ * first multi-threaded call; its workers sleep on a condition variable
+ * between jobs. It runs one job at a time, and other callers wait for it.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sm4.h"
+#include "sm4_parallel.h"
+#include "sm4_stats.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    sm4_task_fn_t fn;
+    void *arg;
+    size_t num_tasks;
+    size_t next;                    /* next unclaimed task */
+    size_t completed;
+    int max_helpers;                /* workers allowed to join */
+    int helpers;                    /* workers currently inside the job */
+} sm4_job_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;
+    pthread_cond_t done_cv;
+    pthread_mutex_t job_lock;       /* held by the thread running a job */
+    pthread_t workers[SM4_MT_MAX_THREADS];
+    int num_workers;
+    int threads;                    /* sm4_get_threads() */
+    sm4_job_t *job;
+    unsigned long generation;
+} sm4_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_cv = PTHREAD_COND_INITIALIZER,
+    .done_cv = PTHREAD_COND_INITIALIZER,
+    .job_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_once_t sm4_pool_once = PTHREAD_ONCE_INIT;
+
+static int sm4_default_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cpus < 1 ? 1 : cpus > SM4_MT_MAX_THREADS ? SM4_MT_MAX_THREADS : (int)cpus;
+}
+
+static void sm4_pool_init(void) {
+    sm4_pool.threads = sm4_default_threads();
+}
+
+int sm4_get_threads(void) {
+    pthread_once(&sm4_pool_once, sm4_pool_init);
+    return __atomic_load_n(&sm4_pool.threads, __ATOMIC_RELAXED);
+}
+
+int sm4_set_threads(int num_threads) {
+    pthread_once(&sm4_pool_once, sm4_pool_init);
+    if (num_threads <= 0) {
+        num_threads = sm4_default_threads();
+    }
+    if (num_threads > SM4_MT_MAX_THREADS) {
+        num_threads = SM4_MT_MAX_THREADS;
+    }
+    __atomic_store_n(&sm4_pool.threads, num_threads, __ATOMIC_RELAXED);
+    return num_threads;
+}
+
+static void sm4_job_work(sm4_job_t *job) {
+    size_t task;
+
+    while ((task = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->num_tasks) {
+        job->fn(job->arg, task);
+        __atomic_fetch_add(&job->completed, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void *sm4_worker_main(void *unused) {
+    unsigned long seen = 0;
+
+    (void)unused;
+    pthread_mutex_lock(&sm4_pool.lock);
+    for (;;) {
+        sm4_job_t *job;
+
+        while (sm4_pool.generation == seen) {
+            pthread_cond_wait(&sm4_pool.work_cv, &sm4_pool.lock);
+        }
+        seen = sm4_pool.generation;
+        job = sm4_pool.job;
+        if (!job || job->helpers >= job->max_helpers) {
+            continue;
+        }
+
+        job->helpers++;
+        pthread_mutex_unlock(&sm4_pool.lock);
+        sm4_job_work(job);
+        pthread_mutex_lock(&sm4_pool.lock);
+        if (--job->helpers == 0) {
+            pthread_cond_signal(&sm4_pool.done_cv);
+        }
+    }
+    return NULL;
+}
+
+void sm4_parallel_run(size_t num_tasks, sm4_task_fn_t fn, void *arg) {
+    int threads = sm4_get_threads();
+    sm4_job_t job;
+    size_t i;
+
+    if ((size_t)threads > num_tasks) {
+        threads = (int)num_tasks;
+    }
+    if (threads <= 1) {
+        for (i = 0; i < num_tasks; i++) {
+            fn(arg, i);
+        }
+        return;
+    }
+
+    /* Queue behind a job already in the pool rather than run alone */
+    if (pthread_mutex_trylock(&sm4_pool.job_lock) != 0) {
+        SM4_STAT_ADD(slow_paths[SM4_SLOW_MT_POOL_BUSY], 1);
+        pthread_mutex_lock(&sm4_pool.job_lock);
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.fn = fn;
+    job.arg = arg;
+    job.num_tasks = num_tasks;
+    job.max_helpers = threads - 1;
+
+    pthread_mutex_lock(&sm4_pool.lock);
+    while (sm4_pool.num_workers < threads - 1 &&
+           pthread_create(&sm4_pool.workers[sm4_pool.num_workers], NULL, sm4_worker_main, NULL) == 0) {
+        pthread_detach(sm4_pool.workers[sm4_pool.num_workers]);
+        sm4_pool.num_workers++;
+    }
+    sm4_pool.job = &job;
+    sm4_pool.generation++;
+    pthread_cond_broadcast(&sm4_pool.work_cv);
+    pthread_mutex_unlock(&sm4_pool.lock);
+
+    sm4_job_work(&job);
+
+    /* Every task done and no worker still holding a pointer to the job */
+    pthread_mutex_lock(&sm4_pool.lock);
+    while (__atomic_load_n(&job.completed, __ATOMIC_ACQUIRE) < num_tasks || job.helpers > 0) {
+        pthread_cond_wait(&sm4_pool.done_cv, &sm4_pool.lock);
+    }
+    sm4_pool.job = NULL;
+    pthread_mutex_unlock(&sm4_pool.lock);
+    pthread_mutex_unlock(&sm4_pool.job_lock);
+}
+
+/* ========== ECB and CTR ========== */
+
+typedef struct {
+    const sm4_ctx_t *ctx;
+    const uint8_t *input;
+    uint8_t *output;
+    size_t length;
+    int decrypt;
+    uint8_t iv[SM4_BLOCK_SIZE];     /* CTR: counter of the first block */
+} sm4_mt_job_t;
+
+static void sm4_ecb_task(void *arg, size_t task) {
+    const sm4_mt_job_t *j = (const sm4_mt_job_t *)arg;
+    size_t off = task * SM4_MT_CHUNK;
+    size_t n = j->length - off < SM4_MT_CHUNK ? j->length - off : SM4_MT_CHUNK;
+
+    if (j->decrypt) {
+        sm4_ecb_decrypt(j->ctx, j->input + off, n, j->output + off);
+    } else {
+        sm4_ecb_encrypt(j->ctx, j->input + off, n, j->output + off);
+    }
+}
+
+/* 128-bit big-endian counter += blocks, as sm4_ctr_crypt() counts */
+static void sm4_ctr_add(uint8_t ctr[SM4_BLOCK_SIZE], uint64_t blocks) {
+    unsigned carry = 0;
+    int i;
+
+    for (i = SM4_BLOCK_SIZE - 1; i >= 0; i--) {
+        unsigned sum = ctr[i] + (unsigned)(blocks & 0xFF) + carry;
+        ctr[i] = (uint8_t)sum;
+        carry = sum >> 8;
+        blocks >>= 8;
+    }
+}
+
+static void sm4_ctr_task(void *arg, size_t task) {
+    const sm4_mt_job_t *j = (const sm4_mt_job_t *)arg;
+    size_t off = task * SM4_MT_CHUNK;
+    size_t n = j->length - off < SM4_MT_CHUNK ? j->length - off : SM4_MT_CHUNK;
+    uint8_t iv[SM4_BLOCK_SIZE];
+
+    memcpy(iv, j->iv, sizeof(iv));
+    sm4_ctr_add(iv, off / SM4_BLOCK_SIZE);
+    sm4_ctr_crypt(j->ctx, iv, j->input + off, n, j->output + off);
+}
+
+static int sm4_ecb_mt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length,
+                      uint8_t *output, int decrypt) {
+    sm4_mt_job_t job;
+
+    if (length % SM4_BLOCK_SIZE != 0) {
+        return -1; /* Invalid length for ECB mode */
+    }
+    job.ctx = ctx;
+    job.input = input;
+    job.output = output;
+    job.length = length;
+    job.decrypt = decrypt;
+    sm4_parallel_run((length + SM4_MT_CHUNK - 1) / SM4_MT_CHUNK, sm4_ecb_task, &job);
+    return 0;
+}
+
+int sm4_ecb_encrypt_mt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length, uint8_t *output) {
+    return sm4_ecb_mt(ctx, input, length, output, 0);
+}
+
+int sm4_ecb_decrypt_mt(const sm4_ctx_t *ctx, const uint8_t *input, size_t length, uint8_t *output) {
+    return sm4_ecb_mt(ctx, input, length, output, 1);
+}
+
+int sm4_ctr_crypt_mt(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE],
+                     const uint8_t *input, size_t length, uint8_t *output) {
+    sm4_mt_job_t job;
+
+    job.ctx = ctx;
+    job.input = input;
+    job.output = output;
+    job.length = length;
+    job.decrypt = 0;
+    memcpy(job.iv, iv, SM4_BLOCK_SIZE);
+    sm4_parallel_run((length + SM4_MT_CHUNK - 1) / SM4_MT_CHUNK, sm4_ctr_task, &job);
+
+    sm4_ctr_add(iv, (length + SM4_BLOCK_SIZE - 1) / SM4_BLOCK_SIZE);
+    return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * SM4 worker pool (internal)
+ *
+ * sm4_parallel_run() calls fn(arg, i) for every i in [0, num_tasks) on the
+ * calling thread plus up to sm4_get_threads() - 1 persistent workers, and
+ * returns when all tasks are done. Tasks are claimed one at a time from a
+ * shared counter, so they should be of similar size. One job runs at a
+ * time; a caller that finds the pool busy waits for it (counted as
+ * SM4_SLOW_MT_POOL_BUSY). Tasks must not call back into the pool.
+ */
+
+#ifndef SM4_PARALLEL_H
+#define SM4_PARALLEL_H
+
+#include "sm4.h"
+
+typedef void (*sm4_task_fn_t)(void *arg, size_t task);
+
+void sm4_parallel_run(size_t num_tasks, sm4_task_fn_t fn, void *arg);
+
+#endif /* SM4_PARALLEL_H */
@@ -2,6 +2,7 @@
 
 #ifdef __x86_64__
 #include <immintrin.h>
+#include <string.h>
 
 /* SIMD optimized implementation for x86-64 with AVX2 */
 
@@ -10,30 +11,102 @@ static inline __m256i sm4_rotl_256(const __m256i x, int n) {
     return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
 }
 
+/* Blocks processed per kernel call */
+#define SM4_SIMD_LANES 8
+
+/* Constant-time S-box via a GF(16)^2 tower field, using only VPSHUFB
+ *
+ * The S-box is S(x) = A * inv(A * x + 0xD3) + 0xD3 over GF(2^8). The input
+ * affine map is merged with an isomorphism into GF(16)[t]/(t^2 + 2t + 2),
+ * giving x = i*t + k with 4-bit i, k. Its inverse only needs GF(16)
+ * inversions and constant multiplies, each a 16-entry table:
+ *
+ *   iak = 1/i + 2/k,  io = 1/iak + (i ^ k)
+ *   jak = 1/(i ^ k) + 2/k,  jo = 1/jak + i
+ *
+ * 1/io and 1/jo are linear in the inverse, so the output tables fold them
+ * together with the map back to the SM4 basis and the output affine layer.
+ * "1/0" is 0x80: XORed into an index, it makes VPSHUFB return 0, which is
+ * exactly the value the algebra needs.
+ */
+static const uint8_t sm4_tower_pre_lo[16] = {
+    0x55, 0x8C, 0x8A, 0x53, 0x3D, 0xE4, 0xE2, 0x3B,
+    0x15, 0xCC, 0xCA, 0x13, 0x7D, 0xA4, 0xA2, 0x7B
+};
+static const uint8_t sm4_tower_pre_hi[16] = {
+    0x00, 0xD6, 0x4B, 0x9D, 0x79, 0xAF, 0x32, 0xE4,
+    0xB0, 0x66, 0xFB, 0x2D, 0xC9, 0x1F, 0x82, 0x54
+};
+static const uint8_t sm4_tower_inv[16] = {      /* 1/x in GF(16) */
+    0x80, 0x01, 0x09, 0x0E, 0x0D, 0x0B, 0x07, 0x06,
+    0x0F, 0x02, 0x0C, 0x05, 0x0A, 0x04, 0x03, 0x08
+};
+static const uint8_t sm4_tower_2inv[16] = {     /* 2/x in GF(16) */
+    0x80, 0x02, 0x01, 0x0F, 0x09, 0x05, 0x0E, 0x0C,
+    0x0D, 0x04, 0x0B, 0x0A, 0x07, 0x08, 0x06, 0x03
+};
+static const uint8_t sm4_tower_out_io[16] = {
+    0x00, 0x63, 0x37, 0xE1, 0xEF, 0x5A, 0xD6, 0xB5,
+    0x82, 0x6D, 0x8C, 0xBB, 0x39, 0xD8, 0x0E, 0x54
+};
+static const uint8_t sm4_tower_out_jo[16] = {
+    0x00, 0x6E, 0x22, 0x50, 0xF8, 0xE4, 0x72, 0x1C,
+    0x3E, 0xC6, 0x96, 0xB4, 0x8A, 0xDA, 0xA8, 0x4C
+};
+
+static inline __m256i sm4_table_256(const uint8_t table[16]) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table));
+}
+
 /* Vectorized S-box lookup */
 static inline __m256i sm4_sbox_256(const __m256i input) {
-    /* Extract bytes and apply S-box transformation */
-    uint8_t bytes[32];
-    uint8_t result[32];
-    int i;
-    
-    _mm256_storeu_si256((__m256i*)bytes, input);
-    
-    for (i = 0; i < 32; i++) {
-        result[i] = sm4_sbox[bytes[i]];
-    }
-    
-    return _mm256_loadu_si256((__m256i*)result);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i inv = sm4_table_256(sm4_tower_inv);
+    __m256i y, i, k, j, ak, iak, jak, io, jo;
+
+    /* Affine input layer + change of basis: y = i*t + k */
+    y = _mm256_xor_si256(
+        _mm256_shuffle_epi8(sm4_table_256(sm4_tower_pre_lo), _mm256_and_si256(input, nibble)),
+        _mm256_shuffle_epi8(sm4_table_256(sm4_tower_pre_hi),
+                            _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+    k = _mm256_and_si256(y, nibble);
+    i = _mm256_and_si256(_mm256_srli_epi16(y, 4), nibble);
+    j = _mm256_xor_si256(i, k);
+
+    /* Inversion in GF(16)^2 */
+    ak = _mm256_shuffle_epi8(sm4_table_256(sm4_tower_2inv), k);
+    iak = _mm256_xor_si256(_mm256_shuffle_epi8(inv, i), ak);
+    jak = _mm256_xor_si256(_mm256_shuffle_epi8(inv, j), ak);
+    io = _mm256_xor_si256(_mm256_shuffle_epi8(inv, iak), j);
+    jo = _mm256_xor_si256(_mm256_shuffle_epi8(inv, jak), i);
+
+    /* Back to the SM4 basis + affine output layer */
+    return _mm256_xor_si256(
+        _mm256_xor_si256(_mm256_shuffle_epi8(sm4_table_256(sm4_tower_out_io), io),
+                         _mm256_shuffle_epi8(sm4_table_256(sm4_tower_out_jo), jo)),
+        _mm256_set1_epi8((char)0xD3));
 }
 
-/* Vectorized linear transformation L */
+/* Vectorized linear transformation L
+ * With y = b ^ (b <<< 8) ^ (b <<< 16), L(b) = b ^ (b <<< 24) ^ (y <<< 2),
+ * so the byte-multiple rotations become shuffles.
+ */
 static inline __m256i sm4_l_256(const __m256i b) {
-    __m256i result = b;
-    result = _mm256_xor_si256(result, sm4_rotl_256(b, 2));
-    result = _mm256_xor_si256(result, sm4_rotl_256(b, 10));
-    result = _mm256_xor_si256(result, sm4_rotl_256(b, 18));
-    result = _mm256_xor_si256(result, sm4_rotl_256(b, 24));
-    return result;
+    const __m256i rol8 = _mm256_setr_epi8(
+        3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+        3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    const __m256i rol16 = _mm256_setr_epi8(
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rol24 = _mm256_setr_epi8(
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    __m256i y;
+
+    y = _mm256_xor_si256(b, _mm256_shuffle_epi8(b, rol8));
+    y = _mm256_xor_si256(y, _mm256_shuffle_epi8(b, rol16));
+    return _mm256_xor_si256(_mm256_xor_si256(b, sm4_rotl_256(y, 2)),
+                            _mm256_shuffle_epi8(b, rol24));
 }
 
 /* Vectorized T transformation */
@@ -41,80 +114,92 @@ static inline __m256i sm4_t_256(const __m256i x) {
     return sm4_l_256(sm4_sbox_256(x));
 }
 
+/* In-lane 4x4 transpose of 32-bit words (its own inverse) */
+static inline void sm4_transpose_256(__m256i *r0, __m256i *r1, __m256i *r2, __m256i *r3) {
+    __m256i t0 = _mm256_unpacklo_epi32(*r0, *r1);
+    __m256i t1 = _mm256_unpacklo_epi32(*r2, *r3);
+    __m256i t2 = _mm256_unpackhi_epi32(*r0, *r1);
+    __m256i t3 = _mm256_unpackhi_epi32(*r2, *r3);
+
+    *r0 = _mm256_unpacklo_epi64(t0, t1);
+    *r1 = _mm256_unpackhi_epi64(t0, t1);
+    *r2 = _mm256_unpacklo_epi64(t2, t3);
+    *r3 = _mm256_unpackhi_epi64(t2, t3);
+}
+
 /* SIMD SM4 encryption for 8 blocks in parallel */
 void sm4_encrypt_simd_8blocks(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output) {
+    const __m256i bswap = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
     __m256i x0, x1, x2, x3;
-    __m256i temp, rk_vec;
+    __m256i temp;
     int round;
     
-    /* Load 8 blocks (32 bytes each, but we process 4x32-bit words per block) */
-    /* This is a simplified version - actual implementation would need careful data layout */
+    /* Load 8 blocks, two per register (one per 128-bit lane), as big-endian
+     * words; after the transpose xi holds word i of every block */
+    x0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(input +  0)), bswap);
+    x1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(input + 32)), bswap);
+    x2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(input + 64)), bswap);
+    x3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(input + 96)), bswap);
+    sm4_transpose_256(&x0, &x1, &x2, &x3);
     
-    /* For demonstration, we'll process 2 blocks in parallel using 256-bit vectors */
-    uint32_t blocks[2][4];
-    int block, i;
-    
-    /* Load 2 blocks */
-    for (block = 0; block < 2; block++) {
-        for (i = 0; i < 4; i++) {
-            blocks[block][i] = ((uint32_t)input[block * 16 + i * 4] << 24) |
-                              ((uint32_t)input[block * 16 + i * 4 + 1] << 16) |
-                              ((uint32_t)input[block * 16 + i * 4 + 2] << 8) |
-                              ((uint32_t)input[block * 16 + i * 4 + 3]);
-        }
+    /* 32 rounds of SM4, four per iteration so the registers stay in place:
+     * X[i+4] = X[i] ^ T(X[i+1] ^ X[i+2] ^ X[i+3] ^ rk[i]) overwrites X[i] */
+    for (round = 0; round < SM4_ROUNDS; round += 4) {
+        temp = _mm256_xor_si256(_mm256_xor_si256(x1, x2), _mm256_xor_si256(x3, _mm256_set1_epi32((int)ctx->rk[round])));
+        x0 = _mm256_xor_si256(x0, sm4_t_256(temp));
+        temp = _mm256_xor_si256(_mm256_xor_si256(x2, x3), _mm256_xor_si256(x0, _mm256_set1_epi32((int)ctx->rk[round + 1])));
+        x1 = _mm256_xor_si256(x1, sm4_t_256(temp));
+        temp = _mm256_xor_si256(_mm256_xor_si256(x3, x0), _mm256_xor_si256(x1, _mm256_set1_epi32((int)ctx->rk[round + 2])));
+        x2 = _mm256_xor_si256(x2, sm4_t_256(temp));
+        temp = _mm256_xor_si256(_mm256_xor_si256(x0, x1), _mm256_xor_si256(x2, _mm256_set1_epi32((int)ctx->rk[round + 3])));
+        x3 = _mm256_xor_si256(x3, sm4_t_256(temp));
     }
     
-    /* Load into SIMD registers (2 blocks interleaved) */
-    x0 = _mm256_setr_epi32(blocks[0][0], blocks[1][0], 0, 0, 0, 0, 0, 0);
-    x1 = _mm256_setr_epi32(blocks[0][1], blocks[1][1], 0, 0, 0, 0, 0, 0);
-    x2 = _mm256_setr_epi32(blocks[0][2], blocks[1][2], 0, 0, 0, 0, 0, 0);
-    x3 = _mm256_setr_epi32(blocks[0][3], blocks[1][3], 0, 0, 0, 0, 0, 0);
+    /* Reverse final transformation (X35, X34, X33, X32) and store */
+    sm4_transpose_256(&x3, &x2, &x1, &x0);
+    _mm256_storeu_si256((__m256i*)(output +  0), _mm256_shuffle_epi8(x3, bswap));
+    _mm256_storeu_si256((__m256i*)(output + 32), _mm256_shuffle_epi8(x2, bswap));
+    _mm256_storeu_si256((__m256i*)(output + 64), _mm256_shuffle_epi8(x1, bswap));
+    _mm256_storeu_si256((__m256i*)(output + 96), _mm256_shuffle_epi8(x0, bswap));
+}
+
+/* Key schedule T' = L'(S(x)), L'(B) = B ^ (B <<< 13) ^ (B <<< 23) */
+static inline __m256i sm4_t_prime_256(const __m256i x) {
+    __m256i b = sm4_sbox_256(x);
+    return _mm256_xor_si256(_mm256_xor_si256(b, sm4_rotl_256(b, 13)), sm4_rotl_256(b, 23));
+}
+
+/* Encryption key schedules of eight keys, word-sliced like the blocks above */
+void sm4_setkey_enc_simd_8keys(sm4_ctx_t ctx[SM4_SIMD_KEY_LANES], const uint8_t *keys) {
+    const __m256i bswap = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i fk = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)sm4_fk));
+    __m256i k[4], t[4];
+    int round, i;
     
-    /* 32 rounds of SM4 */
-    for (round = 0; round < SM4_ROUNDS; round++) {
-        /* Broadcast round key */
-        rk_vec = _mm256_set1_epi32(ctx->rk[round]);
-        
-        /* Compute x1 ^ x2 ^ x3 ^ rk */
-        temp = _mm256_xor_si256(x1, x2);
-        temp = _mm256_xor_si256(temp, x3);
-        temp = _mm256_xor_si256(temp, rk_vec);
-        
-        /* Apply T transformation */
-        temp = sm4_t_256(temp);
-        
-        /* x0 ^= T(x1 ^ x2 ^ x3 ^ rk) */
-        x0 = _mm256_xor_si256(x0, temp);
-        
-        /* Rotate registers */
-        __m256i temp_reg = x0;
-        x0 = x1;
-        x1 = x2;
-        x2 = x3;
-        x3 = temp_reg;
+    for (i = 0; i < 4; i++) {
+        k[i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(keys + 32 * i)), bswap);
+        k[i] = _mm256_xor_si256(k[i], fk);
     }
+    sm4_transpose_256(&k[0], &k[1], &k[2], &k[3]);
     
-    /* Reverse final transformation */
-    temp = x0; x0 = x3; x3 = temp;
-    temp = x1; x1 = x2; x2 = temp;
-    
-    /* Store results back to blocks */
-    _mm256_storeu_si256((__m256i*)blocks[0], x0);
-    blocks[1][0] = _mm256_extract_epi32(x0, 1);
-    blocks[0][1] = _mm256_extract_epi32(x1, 0);
-    blocks[1][1] = _mm256_extract_epi32(x1, 1);
-    blocks[0][2] = _mm256_extract_epi32(x2, 0);
-    blocks[1][2] = _mm256_extract_epi32(x2, 1);
-    blocks[0][3] = _mm256_extract_epi32(x3, 0);
-    blocks[1][3] = _mm256_extract_epi32(x3, 1);
-    
-    /* Store output */
-    for (block = 0; block < 2; block++) {
+    /* rk[i] = K[i+4] = K[i] ^ T'(K[i+1] ^ K[i+2] ^ K[i+3] ^ CK[i]) */
+    for (round = 0; round < SM4_ROUNDS; round += 4) {
         for (i = 0; i < 4; i++) {
-            output[block * 16 + i * 4] = (blocks[block][i] >> 24) & 0xFF;
-            output[block * 16 + i * 4 + 1] = (blocks[block][i] >> 16) & 0xFF;
-            output[block * 16 + i * 4 + 2] = (blocks[block][i] >> 8) & 0xFF;
-            output[block * 16 + i * 4 + 3] = blocks[block][i] & 0xFF;
+            __m256i temp = _mm256_xor_si256(_mm256_xor_si256(k[(i + 1) & 3], k[(i + 2) & 3]),
+                                            _mm256_xor_si256(k[(i + 3) & 3], _mm256_set1_epi32((int)sm4_ck[round + i])));
+            k[i] = _mm256_xor_si256(k[i], sm4_t_prime_256(temp));
+        }
+        
+        /* Un-slice: lane 0 of t[i] is key 2i's rk[round..round+3], lane 1 key 2i+1's */
+        for (i = 0; i < 4; i++) t[i] = k[i];
+        sm4_transpose_256(&t[0], &t[1], &t[2], &t[3]);
+        for (i = 0; i < 4; i++) {
+            _mm_storeu_si128((__m128i*)(ctx[2 * i].rk + round), _mm256_castsi256_si128(t[i]));
+            _mm_storeu_si128((__m128i*)(ctx[2 * i + 1].rk + round), _mm256_extracti128_si256(t[i], 1));
         }
     }
 }
@@ -133,32 +218,33 @@ void sm4_decrypt_simd(const sm4_ctx_t *ctx, const uint8_t input[SM4_BLOCK_SIZE],
 
 /* Parallel ECB encryption using SIMD */
 void sm4_ecb_encrypt_simd(const sm4_ctx_t *ctx, const uint8_t *input, size_t num_blocks, uint8_t *output) {
+    uint8_t buf[SM4_SIMD_LANES * SM4_BLOCK_SIZE];
     size_t i;
     
-    /* Process blocks in groups of 8 where possible */
-    for (i = 0; i + 1 < num_blocks; i += 2) {
+    /* Process blocks in groups of 8 */
+    for (i = 0; i + SM4_SIMD_LANES <= num_blocks; i += SM4_SIMD_LANES) {
         sm4_encrypt_simd_8blocks(ctx, input + i * SM4_BLOCK_SIZE, output + i * SM4_BLOCK_SIZE);
     }
     
-    /* Handle remaining blocks */
-    for (; i < num_blocks; i++) {
-        sm4_encrypt_optimized(ctx, input + i * SM4_BLOCK_SIZE, output + i * SM4_BLOCK_SIZE);
+    /* Pad remaining blocks through a stack buffer, keeping the tail
+     * table-free as well */
+    if (i < num_blocks) {
+        size_t tail = (num_blocks - i) * SM4_BLOCK_SIZE;
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, input + i * SM4_BLOCK_SIZE, tail);
+        sm4_encrypt_simd_8blocks(ctx, buf, buf);
+        memcpy(output + i * SM4_BLOCK_SIZE, buf, tail);
     }
 }
 
 void sm4_ecb_decrypt_simd(const sm4_ctx_t *ctx, const uint8_t *input, size_t num_blocks, uint8_t *output) {
-    size_t i;
-    
-    /* Process blocks in groups of 8 where possible */
-    for (i = 0; i + 1 < num_blocks; i += 2) {
-        /* Note: For decryption, we need to use decryption round keys */
-        sm4_encrypt_simd_8blocks(ctx, input + i * SM4_BLOCK_SIZE, output + i * SM4_BLOCK_SIZE);
-    }
-    
-    /* Handle remaining blocks */
-    for (; i < num_blocks; i++) {
-        sm4_decrypt_optimized(ctx, input + i * SM4_BLOCK_SIZE, output + i * SM4_BLOCK_SIZE);
-    }
+    /* Decryption is encryption under the reversed (sm4_setkey_dec) round keys */
+    sm4_ecb_encrypt_simd(ctx, input, num_blocks, output);
+}
+
+/* AVX2 multi-block encryption (backend for sm4_encrypt_blocks) */
+void sm4_encrypt_blocks_simd(const sm4_ctx_t *ctx, const uint8_t *input, uint8_t *output, size_t num_blocks) {
+    sm4_ecb_encrypt_simd(ctx, input, num_blocks, output);
 }
 
 #else
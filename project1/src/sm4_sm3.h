@@ -0,0 +1,44 @@
+#ifndef SM4_SM3_H
+#define SM4_SM3_H
+
+#include "sm4.h"
+#include "sm3.h"    /* ../project4/src */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Fused Encrypt-then-MAC (SM4-CBC/CTR + SM3 or HMAC-SM3)
+ *
+ * One pass over the data: each SM4_SM3_TILE of input is encrypted with the
+ * streaming interface (sm4.h) and the ciphertext it produced is hashed
+ * right away, while it is still in L1/L2. Decryption hashes each ciphertext
+ * tile first and then decrypts it, so the digest always covers the
+ * ciphertext and matches a separate encrypt + sm3_hash() (or HMAC-SM3 over
+ * the ciphertext) byte for byte. With mac_key == NULL final() returns the
+ * plain SM3 digest, otherwise HMAC-SM3 under mac_key (any length, keys
+ * longer than a block are hashed first). Output sizes and in-place rules
+ * are those of sm4_cipher_update()/final(). final() wipes the context.
+ */
+#define SM4_SM3_TILE    (16 * 1024)     /* tile plus its output stay in L1/L2 */
+
+typedef struct {
+    sm4_cipher_ctx_t cipher;
+    sm3_hmac_ctx_t hmac;    /* hmac.inner is the plain SM3 context without a MAC key */
+    int keyed;
+} sm4_sm3_ctx_t;
+
+/* mode is SM4_CBC or SM4_CTR; -1 otherwise (see sm4_cipher_init()) */
+int sm4_sm3_init(sm4_sm3_ctx_t *ctx, const uint8_t key[SM4_KEY_SIZE], sm4_mode_t mode,
+                 int encrypt, const uint8_t iv[SM4_BLOCK_SIZE], int padding,
+                 const uint8_t *mac_key, size_t mac_key_len);
+int sm4_sm3_update(sm4_sm3_ctx_t *ctx, const uint8_t *input, size_t length,
+                   uint8_t *output, size_t *out_len);
+int sm4_sm3_final(sm4_sm3_ctx_t *ctx, uint8_t *output, size_t *out_len,
+                  uint8_t digest[SM3_DIGEST_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SM4_SM3_H */
@@ -0,0 +1,122 @@
+/**
+ * SM4 statistics: per-thread counter slots and lock-free snapshots
+ *
+ * Slots live on a push-only list. A thread takes a slot on its first counted
+ * call, preferring one released by an exited thread, and keeps it in TLS.
+ * Readers walk the list and sum every slot with relaxed loads.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sm4_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static const char *const sm4_stat_mode_names[SM4_STAT_MODE_COUNT] = {
+    [SM4_STAT_ECB_ENC] = "ecb-enc",
+    [SM4_STAT_ECB_DEC] = "ecb-dec",
+    [SM4_STAT_CBC_ENC] = "cbc-enc",
+    [SM4_STAT_CBC_DEC] = "cbc-dec",
+    [SM4_STAT_CTR]     = "ctr",
+    [SM4_STAT_GCM_ENC] = "gcm-enc",
+    [SM4_STAT_GCM_DEC] = "gcm-dec",
+    [SM4_STAT_XTS_ENC] = "xts-enc",
+    [SM4_STAT_XTS_DEC] = "xts-dec",
+};
+
+static const char *const sm4_slow_path_names[SM4_SLOW_COUNT] = {
+    [SM4_SLOW_SHORT_BATCH]      = "short-batch",
+    [SM4_SLOW_CBC_SERIAL]       = "cbc-serial",
+    [SM4_SLOW_CTR_TAIL]         = "ctr-tail",
+    [SM4_SLOW_GCM_PARTIAL]      = "gcm-partial",
+    [SM4_SLOW_GCM_GENERIC]      = "gcm-generic",
+    [SM4_SLOW_GCM_SOFT_GHASH]   = "gcm-soft-ghash",
+    [SM4_SLOW_GCM_BATCH_RECORD] = "gcm-batch-record",
+    [SM4_SLOW_MT_POOL_BUSY] = "mt-pool-busy",
+};
+
+#ifdef SM4_STATS
+
+__thread sm4_stats_slot_t *sm4_stats_tls = NULL;
+
+static sm4_stats_slot_t *sm4_stats_head = NULL;
+static pthread_key_t sm4_stats_key;
+static pthread_once_t sm4_stats_once = PTHREAD_ONCE_INIT;
+
+/* Thread exit: hand the slot (and its counts) to the next new thread */
+static void sm4_stats_release(void *arg) {
+    sm4_stats_slot_t *slot = (sm4_stats_slot_t *)arg;
+    __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void sm4_stats_key_init(void) {
+    pthread_key_create(&sm4_stats_key, sm4_stats_release);
+}
+
+sm4_stats_slot_t *sm4_stats_acquire(void) {
+    sm4_stats_slot_t *slot;
+    void *mem;
+
+    pthread_once(&sm4_stats_once, sm4_stats_key_init);
+
+    for (slot = __atomic_load_n(&sm4_stats_head, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&slot->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            goto found;
+        }
+    }
+
+    if (posix_memalign(&mem, 64, sizeof(sm4_stats_slot_t)) != 0) {
+        return NULL;
+    }
+    slot = (sm4_stats_slot_t *)mem;
+    memset(slot, 0, sizeof(*slot));
+    slot->in_use = 1;
+    slot->next = __atomic_load_n(&sm4_stats_head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&sm4_stats_head, &slot->next, slot, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+
+found:
+    sm4_stats_tls = slot;
+    pthread_setspecific(sm4_stats_key, slot);
+    return slot;
+}
+
+#endif /* SM4_STATS */
+
+int sm4_stats_enabled(void) {
+#ifdef SM4_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void sm4_stats_snapshot(sm4_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+#ifdef SM4_STATS
+    {
+        uint64_t *sum = (uint64_t *)stats;
+        const size_t n = sizeof(*stats) / sizeof(uint64_t);
+        const sm4_stats_slot_t *slot;
+
+        for (slot = __atomic_load_n(&sm4_stats_head, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+            const uint64_t *counts = (const uint64_t *)&slot->counts;
+            for (size_t i = 0; i < n; i++) {
+                sum[i] += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+            }
+        }
+    }
+#endif
+}
+
+const char *sm4_stat_mode_name(sm4_stat_mode_t mode) {
+    return (unsigned)mode < SM4_STAT_MODE_COUNT ? sm4_stat_mode_names[mode] : "unknown";
+}
+
+const char *sm4_slow_path_name(sm4_slow_path_t path) {
+    return (unsigned)path < SM4_SLOW_COUNT ? sm4_slow_path_names[path] : "unknown";
+}
@@ -0,0 +1,47 @@
+/**
+ * SM4 statistics counters (internal)
+ *
+ * SM4_STAT_ADD(field, n) adds n to one sm4_stats_t field of the calling
+ * thread's slot. It is a thread-local load and a plain store in the common
+ * case, and expands to nothing unless the library is built with SM4_STATS.
+ */
+
+#ifndef SM4_STATS_H
+#define SM4_STATS_H
+
+#include "sm4.h"
+
+#ifdef SM4_STATS
+
+/* One per thread, on its own cache lines; slots of exited threads are
+ * adopted by new ones, so counts are never lost */
+typedef struct sm4_stats_slot {
+    sm4_stats_t counts;
+    struct sm4_stats_slot *next;
+    int in_use;
+} __attribute__((aligned(64))) sm4_stats_slot_t;
+
+extern __thread sm4_stats_slot_t *sm4_stats_tls;
+sm4_stats_slot_t *sm4_stats_acquire(void);
+
+/* Only the owning thread writes a slot; the atomic store keeps readers from
+ * seeing a torn value */
+static inline void sm4_stat_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+#define SM4_STAT_ADD(field, n) do {                                 \
+        sm4_stats_slot_t *stat_slot_ = sm4_stats_tls;               \
+        if (stat_slot_ == NULL) stat_slot_ = sm4_stats_acquire();   \
+        if (stat_slot_ != NULL) {                                   \
+            sm4_stat_add(&stat_slot_->counts.field, (n));           \
+        }                                                           \
+    } while (0)
+
+#else
+
+#define SM4_STAT_ADD(field, n) ((void)0)
+
+#endif /* SM4_STATS */
+
+#endif /* SM4_STATS_H */
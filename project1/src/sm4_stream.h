@@ -0,0 +1,49 @@
+/**
+ * Non-temporal output for large buffers (internal)
+ *
+ * Used once an output reaches sm4_get_nt_threshold() bytes and is 16-byte
+ * aligned: streaming stores skip the read-for-ownership of every output line
+ * and keep a buffer that will not be read again soon out of the caches.
+ * Call sm4_stream_fence() once the whole output is written.
+ */
+
+#ifndef SM4_STREAM_H
+#define SM4_STREAM_H
+
+#include "sm4.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <emmintrin.h>
+#endif
+
+static inline int sm4_stream_ok(const void *output, size_t length) {
+    size_t threshold = sm4_get_nt_threshold();
+    return threshold != 0 && length >= threshold && ((uintptr_t)output & 15) == 0;
+}
+
+/* out = a ^ b (b may be NULL for a copy); len is a multiple of 16 */
+static inline void sm4_stream_xor(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t len) {
+#ifdef __x86_64__
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(a + i));
+        if (b) {
+            v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i *)(b + i)));
+        }
+        _mm_stream_si128((__m128i *)(out + i), v);
+    }
+#else
+    for (size_t i = 0; i < len; i++) {
+        out[i] = b ? a[i] ^ b[i] : a[i];
+    }
+#endif
+}
+
+static inline void sm4_stream_fence(void) {
+#ifdef __x86_64__
+    _mm_sfence();
+#endif
+}
+
+#endif /* SM4_STREAM_H */
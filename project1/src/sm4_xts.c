@@ -0,0 +1,218 @@
+/**
+ * SM4-XTS (IEEE 1619 construction with SM4 as the block cipher)
+ *
+ * C_j = E_K1(P_j ^ T_j) ^ T_j with T_0 = E_K2(tweak) and T_(j+1) = T_j * alpha
+ * in GF(2^128), the tweak read as a little-endian 128-bit number. Per batch
+ * of SM4_XTS_BATCH blocks:
+ * - the tweaks are generated with one doubling per block, two 64-bit lanes
+ *   shifted at once (SSE2 on x86-64, baseline there, so no extra flags)
+ * - the whitened input goes to sm4_encrypt_blocks() in one call, using the
+ *   output buffer as scratch, and is whitened again on the way out
+ * A final partial block is handled with ciphertext stealing: the last full
+ * block is processed first and lends its tail to the partial one.
+ */
+
+#include "sm4.h"
+#include "sm4_stats.h"
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* T = T * alpha: shift left by one bit, x^128 reduced into 0x87 */
+static inline void sm4_xts_double(uint8_t t[SM4_BLOCK_SIZE]) {
+    unsigned carry = t[15] >> 7;
+    int i;
+
+    for (i = 15; i > 0; i--) {
+        t[i] = (uint8_t)((t[i] << 1) | (t[i - 1] >> 7));
+    }
+    t[0] = (uint8_t)((t[0] << 1) ^ (0x87 & (0u - carry)));
+}
+
+/* tweaks[0..n) = T, T*alpha, ...; T advances past the last one */
+static void sm4_xts_tweaks(uint8_t t[SM4_BLOCK_SIZE], uint8_t *tweaks, size_t n) {
+#ifdef __SSE2__
+    /* The carry out of each 64-bit lane: bit 63 into bit 64, bit 127 back
+     * into the low byte as 0x87 */
+    const __m128i poly = _mm_set_epi32(0, 1, 0, 0x87);
+    __m128i v = _mm_loadu_si128((const __m128i *)t);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        __m128i carry = _mm_shuffle_epi32(_mm_srai_epi32(v, 31), _MM_SHUFFLE(1, 1, 3, 3));
+
+        _mm_storeu_si128((__m128i *)(tweaks + i * SM4_BLOCK_SIZE), v);
+        v = _mm_xor_si128(_mm_slli_epi64(v, 1), _mm_and_si128(carry, poly));
+    }
+    _mm_storeu_si128((__m128i *)t, v);
+#else
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        memcpy(tweaks + i * SM4_BLOCK_SIZE, t, SM4_BLOCK_SIZE);
+        sm4_xts_double(t);
+    }
+#endif
+}
+
+static inline void sm4_xts_xor(uint8_t *out, const uint8_t *a, const uint8_t *b, size_t len) {
+    size_t i;
+    uint64_t x, y;
+
+    for (i = 0; i < len; i += 8) {
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        x ^= y;
+        memcpy(out + i, &x, 8);
+    }
+}
+
+/* Whole blocks under the running tweak t */
+static void sm4_xts_blocks(const sm4_ctx_t *key, uint8_t t[SM4_BLOCK_SIZE],
+                           const uint8_t *input, uint8_t *output, size_t nblocks) {
+    uint8_t tweaks[SM4_XTS_BATCH * SM4_BLOCK_SIZE];
+
+    while (nblocks > 0) {
+        size_t n = nblocks < SM4_XTS_BATCH ? nblocks : SM4_XTS_BATCH;
+        size_t bytes = n * SM4_BLOCK_SIZE;
+
+        sm4_xts_tweaks(t, tweaks, n);
+        sm4_xts_xor(output, input, tweaks, bytes);
+        sm4_encrypt_blocks(key, output, output, n);
+        sm4_xts_xor(output, output, tweaks, bytes);
+
+        input += bytes;
+        output += bytes;
+        nblocks -= n;
+    }
+}
+
+static void sm4_xts_one(const sm4_ctx_t *key, const uint8_t t[SM4_BLOCK_SIZE],
+                        const uint8_t in[SM4_BLOCK_SIZE], uint8_t out[SM4_BLOCK_SIZE]) {
+    uint8_t buf[SM4_BLOCK_SIZE];
+
+    sm4_xts_xor(buf, in, t, SM4_BLOCK_SIZE);
+    sm4_encrypt_blocks(key, buf, buf, 1);
+    sm4_xts_xor(out, buf, t, SM4_BLOCK_SIZE);
+}
+
+int sm4_xts_setkey(sm4_xts_ctx_t *ctx, const uint8_t key[SM4_XTS_KEY_SIZE]) {
+    /* Equal halves turn XTS into a mode with known weaknesses */
+    if (memcmp(key, key + SM4_KEY_SIZE, SM4_KEY_SIZE) == 0) {
+        return -1;
+    }
+    sm4_setkey_enc(&ctx->enc, key);
+    sm4_setkey_dec(&ctx->dec, key);
+    sm4_setkey_enc(&ctx->tweak, key + SM4_KEY_SIZE);
+    return 0;
+}
+
+/* One data unit of length >= 16 from its encrypted tweak T_0 */
+static void sm4_xts_unit(const sm4_xts_ctx_t *ctx, const uint8_t t0[SM4_BLOCK_SIZE],
+                         const uint8_t *input, size_t length, uint8_t *output, int encrypt) {
+    const sm4_ctx_t *key = encrypt ? &ctx->enc : &ctx->dec;
+    size_t full = length / SM4_BLOCK_SIZE;
+    size_t rem = length % SM4_BLOCK_SIZE;
+    uint8_t t[SM4_BLOCK_SIZE], t_next[SM4_BLOCK_SIZE];
+    uint8_t last[SM4_BLOCK_SIZE], tail[SM4_BLOCK_SIZE];
+
+    memcpy(t, t0, SM4_BLOCK_SIZE);
+    if (rem == 0) {
+        sm4_xts_blocks(key, t, input, output, full);
+        return;
+    }
+
+    /* Ciphertext stealing: all but the last full block as usual */
+    sm4_xts_blocks(key, t, input, output, full - 1);
+    input += (full - 1) * SM4_BLOCK_SIZE;
+    output += (full - 1) * SM4_BLOCK_SIZE;
+    memcpy(t_next, t, SM4_BLOCK_SIZE);
+    sm4_xts_double(t_next);
+
+    /* Encryption takes the last full block under T_(m-1) and the stolen
+     * block under T_m; decryption swaps the two tweaks. The first rem
+     * bytes of the middle result become the output's partial block, the
+     * rest is stolen to fill up the partial input. */
+    memcpy(tail, input + SM4_BLOCK_SIZE, rem);
+    sm4_xts_one(key, encrypt ? t : t_next, input, last);
+    memcpy(output + SM4_BLOCK_SIZE, last, rem);
+    memcpy(last, tail, rem);
+    sm4_xts_one(key, encrypt ? t_next : t, last, output);
+}
+
+static int sm4_xts_crypt(const sm4_xts_ctx_t *ctx, const uint8_t tweak[SM4_BLOCK_SIZE],
+                         const uint8_t *input, size_t length, uint8_t *output, int encrypt) {
+    uint8_t t0[SM4_BLOCK_SIZE];
+
+    if (length < SM4_BLOCK_SIZE) {
+        return -1;
+    }
+    sm4_encrypt_blocks(&ctx->tweak, tweak, t0, 1);
+    sm4_xts_unit(ctx, t0, input, length, output, encrypt);
+    return 0;
+}
+
+int sm4_xts_encrypt(const sm4_xts_ctx_t *ctx, const uint8_t tweak[SM4_BLOCK_SIZE],
+                    const uint8_t *input, size_t length, uint8_t *output) {
+    SM4_STAT_ADD(mode_calls[SM4_STAT_XTS_ENC], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_XTS_ENC], length);
+    return sm4_xts_crypt(ctx, tweak, input, length, output, 1);
+}
+
+int sm4_xts_decrypt(const sm4_xts_ctx_t *ctx, const uint8_t tweak[SM4_BLOCK_SIZE],
+                    const uint8_t *input, size_t length, uint8_t *output) {
+    SM4_STAT_ADD(mode_calls[SM4_STAT_XTS_DEC], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_XTS_DEC], length);
+    return sm4_xts_crypt(ctx, tweak, input, length, output, 0);
+}
+
+/* Sector i's tweak is sector + i as a 128-bit little-endian number; the
+ * tweaks of up to SM4_XTS_BATCH sectors are encrypted in one call */
+static int sm4_xts_sectors(const sm4_xts_ctx_t *ctx, uint64_t sector, size_t sector_size,
+                           const uint8_t *input, size_t length, uint8_t *output, int encrypt) {
+    uint8_t numbers[SM4_XTS_BATCH * SM4_BLOCK_SIZE];
+    uint8_t t0[SM4_XTS_BATCH * SM4_BLOCK_SIZE];
+    size_t count, n, k;
+    uint64_t hi = 0;
+    int i;
+
+    if (sector_size < SM4_BLOCK_SIZE || length % sector_size != 0) {
+        return -1;
+    }
+    for (count = length / sector_size; count > 0; count -= n) {
+        n = count < SM4_XTS_BATCH ? count : SM4_XTS_BATCH;
+        k = 0;
+        do {
+            for (i = 0; i < 8; i++) {
+                numbers[k * SM4_BLOCK_SIZE + i] = (uint8_t)(sector >> (8 * i));
+                numbers[k * SM4_BLOCK_SIZE + 8 + i] = (uint8_t)(hi >> (8 * i));
+            }
+            if (++sector == 0) {
+                hi++;
+            }
+        } while (++k < n);
+        sm4_encrypt_blocks(&ctx->tweak, numbers, t0, n);
+        for (k = 0; k < n; k++) {
+            sm4_xts_unit(ctx, t0 + k * SM4_BLOCK_SIZE, input, sector_size, output, encrypt);
+            input += sector_size;
+            output += sector_size;
+        }
+    }
+    return 0;
+}
+
+int sm4_xts_encrypt_sectors(const sm4_xts_ctx_t *ctx, uint64_t sector, size_t sector_size,
+                            const uint8_t *input, size_t length, uint8_t *output) {
+    SM4_STAT_ADD(mode_calls[SM4_STAT_XTS_ENC], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_XTS_ENC], length);
+    return sm4_xts_sectors(ctx, sector, sector_size, input, length, output, 1);
+}
+
+int sm4_xts_decrypt_sectors(const sm4_xts_ctx_t *ctx, uint64_t sector, size_t sector_size,
+                            const uint8_t *input, size_t length, uint8_t *output) {
+    SM4_STAT_ADD(mode_calls[SM4_STAT_XTS_DEC], 1);
+    SM4_STAT_ADD(mode_bytes[SM4_STAT_XTS_DEC], length);
+    return sm4_xts_sectors(ctx, sector, sector_size, input, length, output, 0);
+}
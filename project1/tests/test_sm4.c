@@ -3,7 +3,10 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <pthread.h>
 #include "../src/sm4.h"
+#include "../src/sm4_gcm.h"
+#include "../src/sm4_sm3.h"
 
 /* Test vectors for SM4 */
 typedef struct {
@@ -126,7 +129,25 @@ int test_optimized_encryption(void) {
         }
     }
     
-    printf("\nOptimized Tests: %d/%d passed\n", passed, total);
+    /* Generated T-tables against the S-box + L reference on more blocks;
+     * 256 blocks x 32 rounds reach every entry with near certainty */
+    {
+        sm4_ctx_t ctx;
+        uint8_t block[SM4_BLOCK_SIZE], ref[SM4_BLOCK_SIZE], out[SM4_BLOCK_SIZE];
+        int tables_ok = 1;
+
+        sm4_setkey_enc(&ctx, test_vectors[0].key);
+        for (int j = 0; j < 256; j++) {
+            for (int k = 0; k < SM4_BLOCK_SIZE; k++) block[k] = (uint8_t)(j ^ (k * 0x3B));
+            sm4_encrypt_basic(&ctx, block, ref);
+            sm4_encrypt_optimized(&ctx, block, out);
+            tables_ok &= memcmp(ref, out, SM4_BLOCK_SIZE) == 0;
+        }
+        printf("T-tables vs. reference, 256 blocks: %s\n", tables_ok ? "PASS ✓" : "FAIL ✗");
+        if (!tables_ok) passed = -1;
+    }
+
+    printf("\nOptimized Tests: %d/%d passed\n", passed < 0 ? 0 : passed, total);
     return passed == total;
 }
 
@@ -226,6 +247,666 @@ int test_cbc_mode(void) {
     }
 }
 
+/* Reference CBC decryption: one basic block decryption at a time */
+static void cbc_decrypt_reference(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE],
+                                  const uint8_t *input, size_t length, uint8_t *output) {
+    uint8_t temp[SM4_BLOCK_SIZE];
+    
+    for (size_t i = 0; i < length; i += SM4_BLOCK_SIZE) {
+        sm4_decrypt_basic(ctx, input + i, temp);
+        for (int j = 0; j < SM4_BLOCK_SIZE; j++) {
+            output[i + j] = temp[j] ^ iv[j];
+        }
+        memcpy(iv, input + i, SM4_BLOCK_SIZE);
+    }
+}
+
+int test_cbc_batched(void) {
+    printf("\nTesting Batched CBC\n");
+    printf("==================\n");
+    
+    static const size_t block_counts[] = {1, 2, 7, 8, 9, 63, 64, 65, 128, 200};
+    const size_t max_len = 200 * SM4_BLOCK_SIZE;
+    const size_t num_streams = 150;
+    const uint8_t key[SM4_KEY_SIZE] = {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
+    };
+    uint8_t *plaintext = malloc(max_len);
+    uint8_t *ciphertext = malloc(max_len);
+    uint8_t *decrypted = malloc(max_len);
+    uint8_t *expected = malloc(max_len);
+    uint8_t *stream_out = malloc(num_streams * max_len);
+    uint8_t (*ivs)[SM4_BLOCK_SIZE] = malloc(num_streams * SM4_BLOCK_SIZE);
+    const uint8_t **inputs = malloc(num_streams * sizeof(*inputs));
+    uint8_t **outputs = malloc(num_streams * sizeof(*outputs));
+    uint8_t **iv_ptrs = malloc(num_streams * sizeof(*iv_ptrs));
+    size_t *lengths = malloc(num_streams * sizeof(*lengths));
+    uint8_t iv[SM4_BLOCK_SIZE], iv_ref[SM4_BLOCK_SIZE];
+    sm4_ctx_t enc_ctx, dec_ctx;
+    int ok = 1;
+    
+    if (!plaintext || !ciphertext || !decrypted || !expected || !stream_out ||
+        !ivs || !inputs || !outputs || !iv_ptrs || !lengths) {
+        printf("Memory allocation failed\n");
+        ok = 0;
+        goto cleanup;
+    }
+    
+    for (size_t i = 0; i < max_len; i++) {
+        plaintext[i] = (uint8_t)(i * 29 + 3);
+    }
+    memset(iv, 0xA5, sizeof(iv));
+    
+    sm4_setkey_enc(&enc_ctx, key);
+    sm4_setkey_dec(&dec_ctx, key);
+    sm4_cbc_encrypt(&enc_ctx, iv, plaintext, max_len, ciphertext);
+    
+    /* Pipelined decryption against the serial reference, out of place and in place */
+    for (size_t c = 0; c < sizeof(block_counts) / sizeof(block_counts[0]); c++) {
+        size_t len = block_counts[c] * SM4_BLOCK_SIZE;
+        
+        memset(iv, 0x3C, sizeof(iv));
+        memset(iv_ref, 0x3C, sizeof(iv_ref));
+        cbc_decrypt_reference(&dec_ctx, iv_ref, ciphertext, len, expected);
+        
+        if (sm4_cbc_decrypt(&dec_ctx, iv, ciphertext, len, decrypted) != 0 ||
+            memcmp(decrypted, expected, len) != 0 || memcmp(iv, iv_ref, SM4_BLOCK_SIZE) != 0) {
+            printf("Decrypt mismatch: %zu blocks\n", block_counts[c]);
+            ok = 0;
+        }
+        
+        memset(iv, 0x3C, sizeof(iv));
+        memcpy(decrypted, ciphertext, len);
+        if (sm4_cbc_decrypt(&dec_ctx, iv, decrypted, len, decrypted) != 0 ||
+            memcmp(decrypted, expected, len) != 0 || memcmp(iv, iv_ref, SM4_BLOCK_SIZE) != 0) {
+            printf("In-place decrypt mismatch: %zu blocks\n", block_counts[c]);
+            ok = 0;
+        }
+    }
+    
+    /* Multi-stream encryption: uneven lengths (some empty), each stream vs. serial CBC */
+    for (size_t s = 0; s < num_streams; s++) {
+        lengths[s] = ((s * 37) % 23) * SM4_BLOCK_SIZE;
+        inputs[s] = plaintext + (s % 16) * SM4_BLOCK_SIZE;
+        outputs[s] = stream_out + s * max_len;
+        iv_ptrs[s] = ivs[s];
+        memset(ivs[s], (int)s, SM4_BLOCK_SIZE);
+    }
+    
+    if (sm4_cbc_encrypt_multi(&enc_ctx, num_streams, iv_ptrs, inputs, lengths, outputs) != 0) {
+        printf("Multi-stream encryption failed\n");
+        ok = 0;
+    }
+    
+    for (size_t s = 0; s < num_streams; s++) {
+        memset(iv_ref, (int)s, sizeof(iv_ref));
+        sm4_cbc_encrypt(&enc_ctx, iv_ref, inputs[s], lengths[s], expected);
+        
+        if (memcmp(outputs[s], expected, lengths[s]) != 0 || memcmp(ivs[s], iv_ref, SM4_BLOCK_SIZE) != 0) {
+            printf("Multi-stream mismatch: stream %zu\n", s);
+            ok = 0;
+        }
+    }
+    
+    lengths[0] = 24;
+    if (sm4_cbc_encrypt_multi(&enc_ctx, num_streams, iv_ptrs, inputs, lengths, outputs) != -1) {
+        printf("Multi-stream accepted a partial block\n");
+        ok = 0;
+    }
+    
+cleanup:
+    free(plaintext);
+    free(ciphertext);
+    free(decrypted);
+    free(expected);
+    free(stream_out);
+    free(ivs);
+    free(inputs);
+    free(outputs);
+    free(iv_ptrs);
+    free(lengths);
+    
+    printf("Batched CBC: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+/* Reference CTR: one basic block encryption per counter, full-width increment */
+static void ctr_reference(const sm4_ctx_t *ctx, uint8_t iv[SM4_BLOCK_SIZE],
+                          const uint8_t *input, size_t length, uint8_t *output) {
+    uint8_t keystream[SM4_BLOCK_SIZE];
+    
+    for (size_t i = 0; i < length; i++) {
+        if (i % SM4_BLOCK_SIZE == 0) {
+            sm4_encrypt_basic(ctx, iv, keystream);
+            for (int j = SM4_BLOCK_SIZE - 1; j >= 0 && ++iv[j] == 0; j--) {
+            }
+        }
+        output[i] = input[i] ^ keystream[i % SM4_BLOCK_SIZE];
+    }
+}
+
+int test_ctr_mode(void) {
+    printf("\nTesting CTR Mode\n");
+    printf("===============\n");
+    
+    const uint8_t key[SM4_KEY_SIZE] = {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
+    };
+    const uint8_t iv0[SM4_BLOCK_SIZE] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+        0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F
+    };
+    /* SM4-CTR example from draft-ribose-cfrg-sm4 */
+    const uint8_t vector_pt[64] = {
+        0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB,
+        0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD,
+        0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB
+    };
+    const uint8_t vector_ct[64] = {
+        0xAC, 0x32, 0x36, 0xCB, 0x97, 0x0C, 0xC2, 0x07, 0x91, 0x36, 0x4C, 0x39, 0x5A, 0x13, 0x42, 0xD1,
+        0xA3, 0xCB, 0xC1, 0x87, 0x8C, 0x6F, 0x30, 0xCD, 0x07, 0x4C, 0xCE, 0x38, 0x5C, 0xDD, 0x70, 0xC7,
+        0xF2, 0x34, 0xBC, 0x0E, 0x24, 0xC1, 0x19, 0x80, 0xFD, 0x12, 0x86, 0x31, 0x0C, 0xE3, 0x7B, 0x92,
+        0x6E, 0x02, 0xFC, 0xD0, 0xFA, 0xA0, 0xBA, 0xF3, 0x8B, 0x29, 0x33, 0x85, 0x1D, 0x82, 0x45, 0x14
+    };
+    /* Counter one step before the 64-bit and the 128-bit wrap */
+    const uint8_t iv_wrap[SM4_BLOCK_SIZE] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE
+    };
+    static const size_t lengths[] = {0, 1, 15, 16, 17, 100, 1024, 1040, 2001};
+    const size_t max_len = 2001;
+    uint8_t *plaintext = malloc(max_len);
+    uint8_t *encrypted = malloc(max_len);
+    uint8_t *expected = malloc(max_len);
+    uint8_t iv[SM4_BLOCK_SIZE], iv_ref[SM4_BLOCK_SIZE];
+    uint8_t out[64];
+    sm4_ctx_t ctx;
+    int ok = 1;
+    
+    if (!plaintext || !encrypted || !expected) {
+        printf("Memory allocation failed\n");
+        free(plaintext);
+        free(encrypted);
+        free(expected);
+        return 0;
+    }
+    
+    for (size_t i = 0; i < max_len; i++) {
+        plaintext[i] = (uint8_t)(i * 7 + 3);
+    }
+    
+    sm4_setkey_enc(&ctx, key);
+    
+    /* Known answer */
+    memcpy(iv, iv0, SM4_BLOCK_SIZE);
+    sm4_ctr_crypt(&ctx, iv, vector_pt, sizeof(vector_pt), out);
+    if (memcmp(out, vector_ct, sizeof(vector_ct)) != 0) {
+        printf("Known-answer vector mismatch\n");
+        print_hex("Expected", vector_ct, sizeof(vector_ct));
+        print_hex("Got     ", out, sizeof(vector_ct));
+        ok = 0;
+    }
+    
+    /* Partial blocks, several batches, and counter wrap-around */
+    for (int w = 0; w < 2; w++) {
+        const uint8_t *start = w ? iv_wrap : iv0;
+        
+        for (size_t c = 0; c < sizeof(lengths) / sizeof(lengths[0]); c++) {
+            size_t len = lengths[c];
+            
+            memcpy(iv, start, SM4_BLOCK_SIZE);
+            memcpy(iv_ref, start, SM4_BLOCK_SIZE);
+            sm4_ctr_crypt(&ctx, iv, plaintext, len, encrypted);
+            ctr_reference(&ctx, iv_ref, plaintext, len, expected);
+            
+            if (memcmp(encrypted, expected, len) != 0 || memcmp(iv, iv_ref, SM4_BLOCK_SIZE) != 0) {
+                printf("Mismatch: length %zu%s\n", len, w ? " (wrapping counter)" : "");
+                ok = 0;
+            }
+        }
+    }
+    
+    /* High-level interface round trip */
+    memcpy(iv, iv0, SM4_BLOCK_SIZE);
+    if (sm4_encrypt_data(key, plaintext, 1000, encrypted, SM4_CTR, iv) != 0) {
+        ok = 0;
+    }
+    memcpy(iv, iv0, SM4_BLOCK_SIZE);
+    if (sm4_decrypt_data(key, encrypted, 1000, expected, SM4_CTR, iv) != 0 ||
+        memcmp(expected, plaintext, 1000) != 0) {
+        printf("sm4_encrypt_data/sm4_decrypt_data round trip failed\n");
+        ok = 0;
+    }
+    
+    free(plaintext);
+    free(encrypted);
+    free(expected);
+    
+    printf("CTR Mode: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+/* Reference GHASH: bit-serial multiply by H, one zero-padded block at a time */
+static void ghash_reference(const uint8_t h[16], uint8_t y[16], const uint8_t *data, size_t len) {
+    for (size_t off = 0; off < len; off += 16) {
+        uint8_t z[16] = {0}, v[16];
+        
+        for (size_t j = 0; j < 16 && off + j < len; j++) {
+            y[j] ^= data[off + j];
+        }
+        memcpy(v, h, 16);
+        for (int bit = 0; bit < 128; bit++) {
+            if (y[bit / 8] & (0x80 >> (bit % 8))) {
+                for (int k = 0; k < 16; k++) z[k] ^= v[k];
+            }
+            int lsb = v[15] & 1;
+            for (int k = 15; k > 0; k--) v[k] = (uint8_t)((v[k] >> 1) | (v[k - 1] << 7));
+            v[0] >>= 1;
+            if (lsb) v[0] ^= 0xE1;
+        }
+        memcpy(y, z, 16);
+    }
+}
+
+/* Reference GCM per NIST SP 800-38D, one basic block encryption per counter */
+static void gcm_reference(const uint8_t key[SM4_KEY_SIZE], const uint8_t *iv, size_t iv_len,
+                          const uint8_t *aad, size_t aad_len, const uint8_t *pt, size_t len,
+                          uint8_t *ct, uint8_t tag[16]) {
+    sm4_ctx_t ctx;
+    uint8_t h[16] = {0}, j0[16] = {0}, ctr[16], ks[16], y[16] = {0}, lens[16] = {0};
+    
+    sm4_setkey_enc(&ctx, key);
+    sm4_encrypt_basic(&ctx, h, h);
+    if (iv_len == 12) {
+        memcpy(j0, iv, 12);
+        j0[15] = 1;
+    } else {
+        for (int k = 0; k < 8; k++) lens[15 - k] = (uint8_t)(((uint64_t)iv_len * 8) >> (8 * k));
+        ghash_reference(h, j0, iv, iv_len);
+        ghash_reference(h, j0, lens, 16);
+    }
+    
+    memcpy(ctr, j0, 16);
+    for (size_t i = 0; i < len; i++) {
+        if (i % 16 == 0) {
+            for (int k = 15; k >= 12 && ++ctr[k] == 0; k--) {
+            }
+            sm4_encrypt_basic(&ctx, ctr, ks);
+        }
+        ct[i] = pt[i] ^ ks[i % 16];
+    }
+    
+    ghash_reference(h, y, aad, aad_len);
+    ghash_reference(h, y, ct, len);
+    for (int k = 0; k < 8; k++) {
+        lens[7 - k] = (uint8_t)(((uint64_t)aad_len * 8) >> (8 * k));
+        lens[15 - k] = (uint8_t)(((uint64_t)len * 8) >> (8 * k));
+    }
+    ghash_reference(h, y, lens, 16);
+    sm4_encrypt_basic(&ctx, j0, ks);
+    for (int k = 0; k < 16; k++) tag[k] = y[k] ^ ks[k];
+}
+
+int test_gcm_mode(void) {
+    printf("\nTesting GCM Mode\n");
+    printf("===============\n");
+    
+    /* RFC 8998, Appendix A.1 */
+    const uint8_t key[SM4_KEY_SIZE] = {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
+    };
+    const uint8_t iv[12] = {
+        0x00, 0x00, 0x12, 0x34, 0x56, 0x78, 0x00, 0x00, 0x00, 0x00, 0xAB, 0xCD
+    };
+    const uint8_t aad[20] = {
+        0xFE, 0xED, 0xFA, 0xCE, 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED, 0xFA, 0xCE,
+        0xDE, 0xAD, 0xBE, 0xEF, 0xAB, 0xAD, 0xDA, 0xD2
+    };
+    /* Plaintext is eight runs of eight bytes: AA BB CC DD EE FF EE AA */
+    const uint8_t kat_plaintext_bytes[8] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF, 0xEE, 0xAA};
+    const uint8_t kat_ciphertext[64] = {
+        0x17, 0xF3, 0x99, 0xF0, 0x8C, 0x67, 0xD5, 0xEE, 0x19, 0xD0, 0xDC, 0x99, 0x69, 0xC4, 0xBB, 0x7D,
+        0x5F, 0xD4, 0x6F, 0xD3, 0x75, 0x64, 0x89, 0x06, 0x91, 0x57, 0xB2, 0x82, 0xBB, 0x20, 0x07, 0x35,
+        0xD8, 0x27, 0x10, 0xCA, 0x5C, 0x22, 0xF0, 0xCC, 0xFA, 0x7C, 0xBF, 0x93, 0xD4, 0x96, 0xAC, 0x15,
+        0xA5, 0x68, 0x34, 0xCB, 0xCF, 0x98, 0xC3, 0x97, 0xB4, 0x02, 0x4A, 0x26, 0x91, 0x23, 0x3B, 0x8D
+    };
+    const uint8_t kat_tag[16] = {
+        0x83, 0xDE, 0x35, 0x41, 0xE4, 0xC2, 0xB5, 0x81, 0x77, 0xE0, 0x65, 0xA9, 0xBF, 0x7B, 0x62, 0xEC
+    };
+    static const size_t lengths[] = {0, 1, 15, 16, 17, 64, 127, 128, 129, 1024, 1040, 2001};
+    static const size_t aad_lengths[] = {0, 20, 129};
+    const size_t max_len = 2001;
+    uint8_t *plaintext = malloc(max_len);
+    uint8_t *ciphertext = malloc(max_len);
+    uint8_t *expected = malloc(max_len);
+    uint8_t *decrypted = malloc(max_len);
+    uint8_t big_aad[129], long_iv[16];
+    uint8_t tag[16], expected_tag[16];
+    sm4_backend_t saved = sm4_get_backend();
+    int ok = 1;
+    
+    if (!plaintext || !ciphertext || !expected || !decrypted) {
+        printf("Memory allocation failed\n");
+        ok = 0;
+        goto cleanup;
+    }
+    
+    for (size_t i = 0; i < 64; i++) {
+        plaintext[i] = kat_plaintext_bytes[i / 8];
+    }
+    sm4_gcm_encrypt(key, iv, 12, aad, 20, plaintext, 64, ciphertext, tag, 16);
+    if (memcmp(ciphertext, kat_ciphertext, 64) != 0 || memcmp(tag, kat_tag, 16) != 0) {
+        printf("RFC 8998 vector: FAIL ✗\n");
+        print_hex("Ciphertext", ciphertext, 64);
+        print_hex("Tag       ", tag, 16);
+        ok = 0;
+    }
+    
+    for (size_t i = 0; i < max_len; i++) {
+        plaintext[i] = (uint8_t)(i * 73 + 11);
+    }
+    for (size_t i = 0; i < sizeof(big_aad); i++) {
+        big_aad[i] = (uint8_t)(i * 5 + 1);
+    }
+    for (size_t i = 0; i < sizeof(long_iv); i++) {
+        long_iv[i] = (uint8_t)(0xF0 + i);
+    }
+    
+    /* Lengths around the 8-block GHASH groups and the keystream batch, both IV
+     * forms; with the selected backend (stitched kernel on GFNI CPUs) and with
+     * the table backend (batched CTR, then GHASH) */
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            sm4_set_backend(SM4_BACKEND_OPTIMIZED);
+        }
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            for (size_t a = 0; a < sizeof(aad_lengths) / sizeof(aad_lengths[0]); a++) {
+                for (int v = 0; v < 2; v++) {
+                    size_t len = lengths[l];
+                    const uint8_t *use_iv = v ? long_iv : iv;
+                    size_t iv_len = v ? sizeof(long_iv) : 12;
+                    
+                    gcm_reference(key, use_iv, iv_len, big_aad, aad_lengths[a], plaintext, len,
+                                  expected, expected_tag);
+                    sm4_gcm_encrypt(key, use_iv, iv_len, big_aad, aad_lengths[a], plaintext, len,
+                                    ciphertext, tag, 16);
+                    
+                    if (memcmp(ciphertext, expected, len) != 0 || memcmp(tag, expected_tag, 16) != 0 ||
+                        sm4_gcm_decrypt(key, use_iv, iv_len, big_aad, aad_lengths[a], ciphertext, len,
+                                        tag, 16, decrypted) != 0 ||
+                        memcmp(decrypted, plaintext, len) != 0) {
+                        printf("Mismatch: length %zu, AAD %zu, IV %zu, backend %s\n", len, aad_lengths[a],
+                               iv_len, sm4_backend_name(sm4_get_backend()));
+                        ok = 0;
+                    }
+                }
+            }
+        }
+        
+        /* In place, both directions */
+        memcpy(decrypted, plaintext, max_len);
+        sm4_gcm_encrypt(key, iv, 12, aad, 20, decrypted, max_len, decrypted, tag, 16);
+        gcm_reference(key, iv, 12, aad, 20, plaintext, max_len, expected, expected_tag);
+        if (memcmp(decrypted, expected, max_len) != 0 || memcmp(tag, expected_tag, 16) != 0 ||
+            sm4_gcm_decrypt(key, iv, 12, aad, 20, decrypted, max_len, tag, 16, decrypted) != 0 ||
+            memcmp(decrypted, plaintext, max_len) != 0) {
+            printf("In-place mismatch, backend %s\n", sm4_backend_name(sm4_get_backend()));
+            ok = 0;
+        }
+    }
+    sm4_set_backend(saved);
+    
+    /* A modified tag must be rejected */
+    sm4_gcm_encrypt(key, iv, 12, aad, 20, plaintext, 100, ciphertext, tag, 16);
+    tag[0] ^= 1;
+    if (sm4_gcm_decrypt(key, iv, 12, aad, 20, ciphertext, 100, tag, 16, decrypted) != -1) {
+        printf("Forged tag accepted\n");
+        ok = 0;
+    }
+    
+cleanup:
+    free(plaintext);
+    free(ciphertext);
+    free(expected);
+    free(decrypted);
+    
+    printf("GCM Mode: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+/* Split buf[0..len) into segments whose sizes cycle through sizes[] */
+static size_t gcm_split(uint8_t *buf, size_t len, const size_t *sizes, size_t num_sizes,
+                        sm4_iovec_t *iov, size_t max_iov) {
+    size_t cnt = 0, off = 0;
+    
+    while (off < len && cnt < max_iov) {
+        size_t n = sizes[cnt % num_sizes];
+        if (n > len - off || cnt == max_iov - 1) n = len - off;
+        iov[cnt].base = buf + off;
+        iov[cnt].len = n;
+        off += n;
+        cnt++;
+    }
+    return cnt;
+}
+
+int test_gcm_iov(void) {
+    printf("\nTesting GCM Scatter-Gather\n");
+    printf("=========================\n");
+    
+    const uint8_t key[SM4_KEY_SIZE] = {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
+    };
+    const uint8_t iv[12] = {
+        0xCA, 0xFE, 0xBA, 0xBE, 0xFA, 0xCE, 0xDB, 0xAD, 0xDE, 0xCA, 0xF8, 0x88
+    };
+    /* Input and output cut at different points, including empty segments */
+    static const size_t in_sizes[] = {1, 15, 17, 0, 130, 3, 16, 200, 7};
+    static const size_t out_sizes[] = {64, 5, 0, 33, 129, 1};
+    static const size_t aad_sizes[] = {3, 0, 14, 20};
+    const size_t len = 2001, aad_len = 57;
+    uint8_t *plaintext = malloc(len);
+    uint8_t *ciphertext = malloc(len);
+    uint8_t *expected = malloc(len);
+    uint8_t *work = malloc(len);
+    uint8_t aad[57], tag[16], expected_tag[16];
+    sm4_iovec_t in_iov[256], out_iov[256], aad_iov[32];
+    size_t in_cnt, out_cnt, aad_cnt;
+    sm4_gcm_context_t ctx;
+    int ok = 1;
+    
+    if (!plaintext || !ciphertext || !expected || !work) {
+        printf("Memory allocation failed\n");
+        ok = 0;
+        goto cleanup;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        plaintext[i] = (uint8_t)(i * 41 + 9);
+    }
+    for (size_t i = 0; i < aad_len; i++) {
+        aad[i] = (uint8_t)(0x80 ^ i);
+    }
+    gcm_reference(key, iv, 12, aad, aad_len, plaintext, len, expected, expected_tag);
+    aad_cnt = gcm_split(aad, aad_len, aad_sizes, 4, aad_iov, 32);
+    
+    /* Out of place */
+    in_cnt = gcm_split(plaintext, len, in_sizes, 9, in_iov, 256);
+    out_cnt = gcm_split(ciphertext, len, out_sizes, 6, out_iov, 256);
+    if (sm4_gcm_encrypt_iov(key, iv, 12, aad_iov, aad_cnt, in_iov, in_cnt, out_iov, out_cnt, tag, 16) != 0 ||
+        memcmp(ciphertext, expected, len) != 0 || memcmp(tag, expected_tag, 16) != 0) {
+        printf("Scatter-gather encryption mismatch\n");
+        ok = 0;
+    }
+    
+    in_cnt = gcm_split(ciphertext, len, out_sizes, 6, in_iov, 256);
+    out_cnt = gcm_split(work, len, in_sizes, 9, out_iov, 256);
+    if (sm4_gcm_decrypt_iov(key, iv, 12, aad_iov, aad_cnt, in_iov, in_cnt, expected_tag, 16, out_iov, out_cnt) != 0 ||
+        memcmp(work, plaintext, len) != 0) {
+        printf("Scatter-gather decryption mismatch\n");
+        ok = 0;
+    }
+    
+    /* In place */
+    memcpy(work, plaintext, len);
+    in_cnt = gcm_split(work, len, in_sizes, 9, in_iov, 256);
+    if (sm4_gcm_encrypt_iov_inplace(key, iv, 12, aad_iov, aad_cnt, in_iov, in_cnt, tag, 16) != 0 ||
+        memcmp(work, expected, len) != 0 || memcmp(tag, expected_tag, 16) != 0 ||
+        sm4_gcm_decrypt_iov_inplace(key, iv, 12, aad_iov, aad_cnt, in_iov, in_cnt, tag, 16) != 0 ||
+        memcmp(work, plaintext, len) != 0) {
+        printf("In-place scatter-gather mismatch\n");
+        ok = 0;
+    }
+    
+    /* Streaming with odd chunk sizes matches the one-shot result */
+    sm4_gcm_init(&ctx, key);
+    sm4_gcm_starts(&ctx, SM4_GCM_ENCRYPT, iv, 12);
+    sm4_gcm_update_ad(&ctx, aad, 5);
+    sm4_gcm_update_ad(&ctx, aad + 5, aad_len - 5);
+    for (size_t off = 0, step = 1; off < len; off += step, step = step % 37 + 3) {
+        size_t n = (step < len - off) ? step : len - off;
+        sm4_gcm_update(&ctx, n, plaintext + off, work + off);
+    }
+    sm4_gcm_finish(&ctx, tag, 16);
+    if (memcmp(work, expected, len) != 0 || memcmp(tag, expected_tag, 16) != 0) {
+        printf("Chunked streaming mismatch\n");
+        ok = 0;
+    }
+    if (sm4_gcm_update_ad(&ctx, aad, 1) != -1) {
+        printf("AAD accepted after data\n");
+        ok = 0;
+    }
+    
+    /* Short output list and forged tag are rejected; forged tag clears output */
+    out_cnt = gcm_split(work, len - 1, out_sizes, 6, out_iov, 256);
+    in_cnt = gcm_split(plaintext, len, in_sizes, 9, in_iov, 256);
+    if (sm4_gcm_encrypt_iov(key, iv, 12, aad_iov, aad_cnt, in_iov, in_cnt, out_iov, out_cnt, tag, 16) != -1) {
+        printf("Short output accepted\n");
+        ok = 0;
+    }
+    tag[0] = expected_tag[0] ^ 0x80;
+    memcpy(tag + 1, expected_tag + 1, 15);
+    in_cnt = gcm_split(ciphertext, len, in_sizes, 9, in_iov, 256);
+    out_cnt = gcm_split(work, len, out_sizes, 6, out_iov, 256);
+    memset(expected, 0, len);
+    if (sm4_gcm_decrypt_iov(key, iv, 12, aad_iov, aad_cnt, in_iov, in_cnt, tag, 16, out_iov, out_cnt) != -1 ||
+        memcmp(work, expected, len) != 0) {
+        printf("Forged tag not handled\n");
+        ok = 0;
+    }
+    
+cleanup:
+    free(plaintext);
+    free(ciphertext);
+    free(expected);
+    free(work);
+    
+    printf("GCM Scatter-Gather: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+int test_gcm_batch(void) {
+    printf("\nTesting Batched GCM\n");
+    printf("==================\n");
+    
+    const uint8_t key[SM4_KEY_SIZE] = {
+        0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF,
+        0xFE, 0xDC, 0xBA, 0x98, 0x76, 0x54, 0x32, 0x10
+    };
+    /* Small records, plus one too large to pack (> 128 blocks) */
+    static const size_t lengths[] = {0, 1, 15, 16, 17, 64, 100, 128, 200, 256, 1000, 3000};
+    enum { NUM_RECORDS = 120, MAX_LEN = 3000 };
+    uint8_t *plaintext = malloc(MAX_LEN);
+    uint8_t *out = malloc((size_t)NUM_RECORDS * MAX_LEN);
+    uint8_t *expected = malloc(MAX_LEN);
+    uint8_t (*ivs)[16] = malloc(NUM_RECORDS * 16);
+    uint8_t (*tags)[16] = malloc(NUM_RECORDS * 16);
+    sm4_gcm_record_t *records = malloc(NUM_RECORDS * sizeof(*records));
+    uint8_t aad[40], expected_tag[16];
+    sm4_gcm_context_t key_ctx;
+    int ok = 1;
+    
+    if (!plaintext || !out || !expected || !ivs || !tags || !records) {
+        printf("Memory allocation failed\n");
+        ok = 0;
+        goto cleanup;
+    }
+    
+    for (size_t i = 0; i < MAX_LEN; i++) {
+        plaintext[i] = (uint8_t)(i * 17 + 5);
+    }
+    for (size_t i = 0; i < sizeof(aad); i++) {
+        aad[i] = (uint8_t)(i + 0x30);
+    }
+    
+    sm4_gcm_init(&key_ctx, key);
+    for (size_t r = 0; r < NUM_RECORDS; r++) {
+        for (int k = 0; k < 16; k++) ivs[r][k] = (uint8_t)(r * 7 + k);
+        records[r].iv = ivs[r];
+        records[r].iv_len = (r % 5 == 4) ? 16 : 12;
+        records[r].aad = aad + r % 7;
+        records[r].aad_len = (r * 3) % 34;
+        records[r].input = plaintext + r % 3;
+        records[r].length = lengths[r % (sizeof(lengths) / sizeof(lengths[0]))];
+        records[r].output = out + r * MAX_LEN;
+        records[r].tag = tags[r];
+        records[r].tag_len = 16;
+        records[r].status = 1;
+    }
+    
+    if (sm4_gcm_encrypt_batch(&key_ctx, records, NUM_RECORDS) != 0) {
+        printf("Batch encryption failed\n");
+        ok = 0;
+    }
+    for (size_t r = 0; r < NUM_RECORDS; r++) {
+        gcm_reference(key, records[r].iv, records[r].iv_len, records[r].aad, records[r].aad_len,
+                      records[r].input, records[r].length, expected, expected_tag);
+        if (records[r].status != 0 || memcmp(records[r].output, expected, records[r].length) != 0 ||
+            memcmp(tags[r], expected_tag, 16) != 0) {
+            printf("Encrypt mismatch: record %zu (length %zu)\n", r, records[r].length);
+            ok = 0;
+        }
+    }
+    
+    /* Decrypt in place; one forged tag fails only its own record */
+    for (size_t r = 0; r < NUM_RECORDS; r++) {
+        records[r].input = records[r].output;
+    }
+    tags[9][3] ^= 0x10;
+    if (sm4_gcm_decrypt_batch(&key_ctx, records, NUM_RECORDS) != -1) {
+        printf("Forged record not reported\n");
+        ok = 0;
+    }
+    for (size_t r = 0; r < NUM_RECORDS; r++) {
+        const uint8_t *want = plaintext + r % 3;
+        
+        if (r == 9) {
+            memset(expected, 0, records[r].length);
+            want = expected;
+        }
+        if (records[r].status != (r == 9 ? -1 : 0) || memcmp(records[r].output, want, records[r].length) != 0) {
+            printf("Decrypt mismatch: record %zu (length %zu)\n", r, records[r].length);
+            ok = 0;
+        }
+    }
+    
+cleanup:
+    free(plaintext);
+    free(out);
+    free(expected);
+    free(ivs);
+    free(tags);
+    free(records);
+    
+    printf("Batched GCM: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
 int test_padding(void) {
     printf("\nTesting PKCS#7 Padding\n");
     printf("=====================\n");
@@ -332,6 +1013,827 @@ cleanup:
     return 0;
 }
 
+int test_backend_dispatch(void) {
+    printf("\nTesting Multi-block Backends\n");
+    printf("============================\n");
+    
+    static const size_t block_counts[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 64};
+    const size_t max_blocks = 64;
+    uint8_t *plaintext = malloc(max_blocks * SM4_BLOCK_SIZE);
+    uint8_t *expected = malloc(max_blocks * SM4_BLOCK_SIZE);
+    uint8_t *encrypted = malloc(max_blocks * SM4_BLOCK_SIZE);
+    uint8_t *decrypted = malloc(max_blocks * SM4_BLOCK_SIZE);
+    sm4_backend_t saved = sm4_get_backend();
+    sm4_ctx_t enc_ctx, dec_ctx;
+    int ok = 1;
+    
+    if (!plaintext || !expected || !encrypted || !decrypted) {
+        printf("Memory allocation failed\n");
+        free(plaintext);
+        free(expected);
+        free(encrypted);
+        free(decrypted);
+        return 0;
+    }
+    
+    for (size_t i = 0; i < max_blocks * SM4_BLOCK_SIZE; i++) {
+        plaintext[i] = (uint8_t)(i * 131 + 7);
+    }
+    
+    sm4_setkey_enc(&enc_ctx, test_vectors[0].key);
+    sm4_setkey_dec(&dec_ctx, test_vectors[0].key);
+    sm4_encrypt_blocks_basic(&enc_ctx, plaintext, expected, max_blocks);
+    
+    printf("Selected backend: %s\n", sm4_backend_name(saved));
+    
+    for (int b = 0; b < SM4_BACKEND_COUNT; b++) {
+        if (!sm4_backend_supported((sm4_backend_t)b)) {
+            printf("%-14s: not supported on this CPU\n", sm4_backend_name((sm4_backend_t)b));
+            continue;
+        }
+        
+        int backend_ok = 1;
+        sm4_set_backend((sm4_backend_t)b);
+        
+        /* Standard vector through the dispatcher */
+        sm4_encrypt_blocks(&enc_ctx, test_vectors[0].plaintext, encrypted, 1);
+        if (memcmp(encrypted, test_vectors[0].ciphertext, SM4_BLOCK_SIZE) != 0) {
+            backend_ok = 0;
+        }
+        
+        /* Every tail length against the basic implementation, plus round trip */
+        for (size_t c = 0; c < sizeof(block_counts) / sizeof(block_counts[0]); c++) {
+            size_t n = block_counts[c];
+            size_t len = n * SM4_BLOCK_SIZE;
+            
+            memset(encrypted, 0, max_blocks * SM4_BLOCK_SIZE);
+            sm4_encrypt_blocks(&enc_ctx, plaintext, encrypted, n);
+            sm4_decrypt_blocks(&dec_ctx, encrypted, decrypted, n);
+            
+            if (memcmp(encrypted, expected, len) != 0 || memcmp(decrypted, plaintext, len) != 0) {
+                backend_ok = 0;
+            }
+        }
+        
+        printf("%-14s: %s\n", sm4_backend_name((sm4_backend_t)b), backend_ok ? "PASS ✓" : "FAIL ✗");
+        ok &= backend_ok;
+    }
+    
+    sm4_set_backend(saved);
+    
+    free(plaintext);
+    free(expected);
+    free(encrypted);
+    free(decrypted);
+    
+    printf("Multi-block Backends: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+/* Counted work on another thread; its slot outlives the thread */
+static void *stats_thread(void *arg) {
+    const sm4_ctx_t *ctx = (const sm4_ctx_t *)arg;
+    uint8_t buf[4 * SM4_BLOCK_SIZE] = {0};
+
+    sm4_ecb_encrypt(ctx, buf, sizeof(buf), buf);
+    return NULL;
+}
+
+/* Test runtime statistics */
+int test_stats(void) {
+    printf("\nTesting Runtime Statistics...\n");
+    printf("==============================\n");
+
+    sm4_stats_t before, after;
+    sm4_gcm_context_t gcm;
+    sm4_ctx_t ctx;
+    uint8_t buf[64] = {0}, iv[SM4_BLOCK_SIZE] = {0}, tag[16];
+    sm4_backend_t backend = sm4_get_backend();
+    pthread_t thread;
+    int ok = 1;
+
+    sm4_setkey_enc(&ctx, test_vectors[0].key);
+    sm4_gcm_init(&gcm, test_vectors[0].key);
+    sm4_stats_snapshot(&before);
+
+    sm4_ecb_encrypt(&ctx, buf, 64, buf);                /* 4 blocks: short batch */
+    sm4_ctr_crypt(&ctx, iv, buf, 20, buf);              /* partial last block */
+    sm4_gcm_starts(&gcm, SM4_GCM_ENCRYPT, iv, 12);
+    sm4_gcm_update(&gcm, 20, buf, buf);                 /* leaves a block open */
+    sm4_gcm_update(&gcm, 20, buf, buf);                 /* finishes it */
+    sm4_gcm_finish(&gcm, tag, sizeof(tag));
+    if (pthread_create(&thread, NULL, stats_thread, &ctx) != 0 ||
+        pthread_join(thread, NULL) != 0) {
+        ok = 0;
+    }
+
+    sm4_stats_snapshot(&after);
+
+    if (!sm4_stats_enabled()) {
+        static const sm4_stats_t zero;
+        ok &= memcmp(&after, &zero, sizeof(zero)) == 0;
+        printf("Counters compiled out (build with STATS=1): %s\n", ok ? "PASS ✓" : "FAIL ✗");
+        return ok;
+    }
+
+#define DELTA(field) (after.field - before.field)
+    ok &= DELTA(mode_calls[SM4_STAT_ECB_ENC]) == 2 && DELTA(mode_bytes[SM4_STAT_ECB_ENC]) == 128;
+    ok &= DELTA(mode_calls[SM4_STAT_CTR]) == 1 && DELTA(mode_bytes[SM4_STAT_CTR]) == 20;
+    ok &= DELTA(mode_calls[SM4_STAT_GCM_ENC]) == 2 && DELTA(mode_bytes[SM4_STAT_GCM_ENC]) == 40;
+    ok &= DELTA(slow_paths[SM4_SLOW_CTR_TAIL]) == 1;
+    ok &= DELTA(slow_paths[SM4_SLOW_GCM_PARTIAL]) >= 2;
+    ok &= DELTA(slow_paths[SM4_SLOW_SHORT_BATCH]) >= 2;
+    ok &= DELTA(backend_blocks[backend]) >= 8 + 2;
+#undef DELTA
+
+    for (int m = 0; m < SM4_STAT_MODE_COUNT; m++) {
+        if (after.mode_calls[m]) {
+            printf("%-8s %6llu calls %8llu bytes\n", sm4_stat_mode_name((sm4_stat_mode_t)m),
+                   (unsigned long long)after.mode_calls[m], (unsigned long long)after.mode_bytes[m]);
+        }
+    }
+    for (int p = 0; p < SM4_SLOW_COUNT; p++) {
+        if (after.slow_paths[p]) {
+            printf("%-16s %6llu\n", sm4_slow_path_name((sm4_slow_path_t)p),
+                   (unsigned long long)after.slow_paths[p]);
+        }
+    }
+
+    printf("Runtime Statistics: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+typedef struct {
+    const sm4_ctx_t *ctx;
+    const uint8_t *pt, *ref;
+    size_t len;
+    int ok;
+} mt_caller_t;
+
+/* Second _mt caller, racing the main thread for the pool */
+static void *mt_caller_thread(void *arg) {
+    mt_caller_t *c = (mt_caller_t *)arg;
+    uint8_t *out = malloc(c->len);
+
+    c->ok = out != NULL;
+    for (int i = 0; c->ok && i < 8; i++) {
+        c->ok = sm4_ecb_encrypt_mt(c->ctx, c->pt, c->len, out) == 0 && memcmp(c->ref, out, c->len) == 0;
+    }
+    free(out);
+    return NULL;
+}
+
+int test_multithreaded(void) {
+    printf("\nTesting Multi-threaded Bulk Interface...\n");
+    printf("========================================\n");
+
+    const size_t len = 3 * SM4_MT_CHUNK + 100 * 16 + 9;
+    const size_t ecb_len = len & ~(size_t)15;
+    uint8_t *pt = malloc(len), *ref = malloc(len), *out = malloc(len);
+    uint8_t iv_a[SM4_BLOCK_SIZE], iv_b[SM4_BLOCK_SIZE], tag_a[16], tag_b[16];
+    int saved = sm4_get_threads();
+    sm4_gcm_context_t gcm;
+    sm4_ctx_t ctx;
+    int ok = pt && ref && out;
+
+    if (!ok) {
+        free(pt); free(ref); free(out);
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) pt[i] = (uint8_t)(i * 29 + (i >> 12));
+    sm4_setkey_enc(&ctx, test_vectors[0].key);
+
+    /* More threads than this host may have CPUs still has to be exact */
+    sm4_set_threads(4);
+    ok &= sm4_get_threads() == 4;
+
+    sm4_ecb_encrypt(&ctx, pt, ecb_len, ref);
+    ok &= sm4_ecb_encrypt_mt(&ctx, pt, ecb_len, out) == 0 && memcmp(ref, out, ecb_len) == 0;
+    ok &= sm4_ecb_encrypt_mt(&ctx, pt, 15, out) == -1;
+    printf("ECB: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+
+    /* Counter wraps out of the low 64 bits mid-buffer */
+    memset(iv_a, 0, sizeof(iv_a));
+    memset(iv_a + 8, 0xFF, 8);
+    iv_a[15] = 0x00;
+    memcpy(iv_b, iv_a, sizeof(iv_a));
+    sm4_ctr_crypt(&ctx, iv_a, pt, len, ref);
+    sm4_ctr_crypt_mt(&ctx, iv_b, pt, len, out);
+    ok &= memcmp(ref, out, len) == 0 && memcmp(iv_a, iv_b, SM4_BLOCK_SIZE) == 0;
+    printf("CTR: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+
+    /* GCM with AAD and an open block before the parallel part */
+    memset(iv_a, 0x24, sizeof(iv_a));
+    sm4_gcm_encrypt(test_vectors[0].key, iv_a, 12, pt, 13, pt, len, ref, tag_a, 16);
+    sm4_gcm_init(&gcm, test_vectors[0].key);
+    sm4_gcm_starts(&gcm, SM4_GCM_ENCRYPT, iv_a, 12);
+    sm4_gcm_update_ad(&gcm, pt, 13);
+    sm4_gcm_update(&gcm, 5, pt, out);
+    sm4_gcm_update_mt(&gcm, len - 5, pt + 5, out + 5);
+    sm4_gcm_finish(&gcm, tag_b, 16);
+    ok &= memcmp(ref, out, len) == 0 && memcmp(tag_a, tag_b, 16) == 0;
+
+    sm4_gcm_starts(&gcm, SM4_GCM_DECRYPT, iv_a, 12);
+    sm4_gcm_update_ad(&gcm, pt, 13);
+    sm4_gcm_update_mt(&gcm, len, ref, out);
+    sm4_gcm_finish(&gcm, tag_b, 16);
+    ok &= memcmp(pt, out, len) == 0 && memcmp(tag_a, tag_b, 16) == 0;
+    printf("GCM: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+
+    /* Two callers at once: the second waits for the pool, both exact */
+    {
+        mt_caller_t caller = { &ctx, pt, ref, ecb_len, 0 };
+        uint8_t iv_c[SM4_BLOCK_SIZE] = {0};
+        pthread_t thread;
+
+        sm4_ecb_encrypt(&ctx, pt, ecb_len, ref);
+        if (pthread_create(&thread, NULL, mt_caller_thread, &caller) != 0) {
+            ok = 0;
+        } else {
+            for (int i = 0; i < 8; i++) {
+                memset(iv_a, 0, sizeof(iv_a));
+                sm4_ctr_crypt_mt(&ctx, iv_a, pt, len, out);
+                sm4_ctr_crypt(&ctx, iv_c, out, len, out);
+                memset(iv_c, 0, sizeof(iv_c));
+                ok &= memcmp(pt, out, len) == 0;
+            }
+            pthread_join(thread, NULL);
+            ok &= caller.ok;
+        }
+    }
+    printf("Concurrent callers: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+
+    sm4_set_threads(saved);
+    free(pt);
+    free(ref);
+    free(out);
+    printf("Multi-threaded Bulk Interface: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+int test_streaming(void) {
+    printf("\nTesting Streaming Interface...\n");
+    printf("==============================\n");
+
+    enum { LEN = 1000 };
+    static const size_t chunks[] = {1, 15, 16, 17, 3, 64, 100, 0, 7, 250};
+    static const sm4_mode_t modes[] = {SM4_ECB, SM4_CBC, SM4_CTR};
+    static const char *const names[] = {"ECB", "CBC", "CTR"};
+    uint8_t pt[LEN + 16], ref[LEN + 16], out[LEN + 32], back[LEN + 32];
+    uint8_t iv[SM4_BLOCK_SIZE], tag_a[16], tag_b[16];
+    const uint8_t *key = test_vectors[0].key;
+    sm4_cipher_ctx_t c;
+    sm4_gcm_context_t gcm;
+    size_t n;
+    int ok = 1;
+
+    for (int i = 0; i < LEN; i++) pt[i] = (uint8_t)(i * 31 + 5);
+    memset(iv, 0x42, sizeof(iv));
+
+    for (int m = 0; m < 3; m++) {
+        for (int padding = 0; padding < 2; padding++) {
+            if (modes[m] == SM4_CTR && padding) continue;      /* stream mode, no padding */
+            /* Unpadded block modes need a whole number of blocks */
+            size_t len = (modes[m] != SM4_CTR && !padding) ? LEN - LEN % 16 : LEN;
+            size_t ref_len = len, total = 0, off = 0, k = 0;
+            uint8_t iv2[SM4_BLOCK_SIZE];
+            int mode_ok = 1;
+
+            memcpy(ref, pt, len);
+            if (padding) ref_len = sm4_pkcs7_padding_add(ref, len, sizeof(ref));
+            memcpy(iv2, iv, sizeof(iv));
+            sm4_encrypt_data(key, ref, ref_len, ref, modes[m], iv2);
+
+            mode_ok &= sm4_cipher_init(&c, key, modes[m], 1, iv, padding) == 0;
+            while (off < len) {
+                size_t chunk = chunks[k++ % (sizeof(chunks) / sizeof(chunks[0]))];
+                chunk = chunk < len - off ? chunk : len - off;
+                mode_ok &= sm4_cipher_update(&c, pt + off, chunk, out + total, &n) == 0;
+                total += n;
+                off += chunk;
+            }
+            mode_ok &= sm4_cipher_final(&c, out + total, &n) == 0;
+            total += n;
+            mode_ok &= total == ref_len && memcmp(out, ref, ref_len) == 0;
+
+            /* Decrypt in different chunks */
+            mode_ok &= sm4_cipher_init(&c, key, modes[m], 0, iv, padding) == 0;
+            for (off = 0, total = 0, k = 3; off < ref_len; ) {
+                size_t chunk = chunks[k++ % (sizeof(chunks) / sizeof(chunks[0]))];
+                chunk = chunk < ref_len - off ? chunk : ref_len - off;
+                mode_ok &= sm4_cipher_update(&c, out + off, chunk, back + total, &n) == 0;
+                total += n;
+                off += chunk;
+            }
+            mode_ok &= sm4_cipher_final(&c, back + total, &n) == 0;
+            total += n;
+            mode_ok &= total == len && memcmp(back, pt, len) == 0;
+
+            printf("%s %-8s chunked: %s\n", names[m], padding ? "padded" : "unpadded",
+                   mode_ok ? "PASS ✓" : "FAIL ✗");
+            ok &= mode_ok;
+        }
+    }
+
+    /* Bad padding and unaligned unpadded input are rejected */
+    memset(back, 0, 16);                                 /* pad byte 0 */
+    sm4_encrypt_data(key, back, 16, out, SM4_ECB, NULL);
+    sm4_cipher_init(&c, key, SM4_ECB, 0, NULL, 1);
+    sm4_cipher_update(&c, out, 16, back, &n);
+    ok &= n == 0 && sm4_cipher_final(&c, back, &n) == -1;
+    for (int pad = 1; pad <= 17; pad++) {               /* one wrong byte in the padding */
+        for (int pos = 16 - (pad > 16 ? 16 : pad); pos < 15; pos++) {
+            memset(back, pad, 16);
+            back[pos] ^= pad > 16 ? 0 : 0x40;
+            sm4_encrypt_data(key, back, 16, out, SM4_ECB, NULL);
+            sm4_cipher_init(&c, key, SM4_ECB, 0, NULL, 1);
+            sm4_cipher_update(&c, out, 16, back, &n);
+            ok &= sm4_cipher_final(&c, back, &n) == -1 && n == 0;
+        }
+    }
+    sm4_cipher_init(&c, key, SM4_ECB, 1, NULL, 0);
+    sm4_cipher_update(&c, pt, 20, out, &n);
+    ok &= n == 16 && sm4_cipher_final(&c, out, &n) == -1;
+    ok &= sm4_cipher_init(&c, key, SM4_CBC, 1, NULL, 0) == -1;
+
+    /* GCM fed in the same odd chunks */
+    sm4_gcm_encrypt(key, iv, 12, pt, 13, pt, LEN, ref, tag_a, 16);
+    sm4_gcm_init(&gcm, key);
+    sm4_gcm_starts(&gcm, SM4_GCM_ENCRYPT, iv, 12);
+    sm4_gcm_update_ad(&gcm, pt, 5);
+    sm4_gcm_update_ad(&gcm, pt + 5, 8);
+    for (size_t off = 0, k = 0; off < LEN; ) {
+        size_t chunk = chunks[k++ % (sizeof(chunks) / sizeof(chunks[0]))];
+        chunk = chunk < LEN - off ? chunk : LEN - off;
+        sm4_gcm_update(&gcm, chunk, pt + off, out + off);
+        off += chunk;
+    }
+    sm4_gcm_finish(&gcm, tag_b, 16);
+    ok &= memcmp(out, ref, LEN) == 0 && memcmp(tag_a, tag_b, 16) == 0;
+    printf("GCM chunked: %s\n", memcmp(tag_a, tag_b, 16) == 0 ? "PASS ✓" : "FAIL ✗");
+
+    printf("Streaming Interface: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+int test_in_place(void) {
+    printf("\nTesting In-place and Aligned Buffers...\n");
+    printf("=======================================\n");
+
+    enum { LEN = 4096 + 5 * 16, ODD = 333 };
+    uint8_t *ref = sm4_alloc_aligned(LEN), *buf = sm4_alloc_aligned(LEN);
+    uint8_t pt[LEN], iv[SM4_BLOCK_SIZE], tag_a[16], tag_b[16];
+    sm4_backend_t saved = sm4_get_backend();
+    size_t saved_nt = sm4_get_nt_threshold();
+    sm4_ctx_t enc, dec;
+    sm4_gcm_context_t gcm;
+    int ok = ref && buf && ((uintptr_t)ref % SM4_BUFFER_ALIGN) == 0;
+
+    if (!ok) {
+        printf("sm4_alloc_aligned: FAIL ✗\n");
+        return 0;
+    }
+    for (int i = 0; i < LEN; i++) pt[i] = (uint8_t)(i * 7 + 1);
+    sm4_setkey_enc(&enc, test_vectors[0].key);
+    sm4_setkey_dec(&dec, test_vectors[0].key);
+
+/* Run op out of place into ref and in place in buf, then compare */
+#define IN_PLACE(len, src, op_ref, op_buf) do {                     \
+        op_ref;                                                     \
+        memcpy(buf, src, len);                                      \
+        op_buf;                                                     \
+        ok &= memcmp(ref, buf, len) == 0;                           \
+    } while (0)
+
+    for (int b = 0; b < SM4_BACKEND_COUNT; b++) {
+        if (sm4_set_backend((sm4_backend_t)b) != 0) continue;
+        int before = ok;
+
+        IN_PLACE(LEN, pt, sm4_ecb_encrypt(&enc, pt, LEN, ref), sm4_ecb_encrypt(&enc, buf, LEN, buf));
+        memcpy(pt, ref, LEN);
+        IN_PLACE(LEN, pt, sm4_ecb_decrypt(&dec, pt, LEN, ref), sm4_ecb_decrypt(&dec, buf, LEN, buf));
+        memset(iv, 1, 16);
+        IN_PLACE(LEN, pt, sm4_cbc_encrypt(&enc, iv, pt, LEN, ref), (memset(iv, 1, 16), sm4_cbc_encrypt(&enc, iv, buf, LEN, buf)));
+        memset(iv, 1, 16);
+        IN_PLACE(LEN, pt, sm4_cbc_decrypt(&dec, iv, pt, LEN, ref), (memset(iv, 1, 16), sm4_cbc_decrypt(&dec, iv, buf, LEN, buf)));
+        memset(iv, 2, 16);
+        IN_PLACE(ODD, pt, sm4_ctr_crypt(&enc, iv, pt, ODD, ref), (memset(iv, 2, 16), sm4_ctr_crypt(&enc, iv, buf, ODD, buf)));
+
+        sm4_gcm_init(&gcm, test_vectors[0].key);
+        sm4_gcm_starts(&gcm, SM4_GCM_ENCRYPT, iv, 12);
+        sm4_gcm_update(&gcm, LEN, pt, ref);
+        sm4_gcm_finish(&gcm, tag_a, 16);
+        memcpy(buf, pt, LEN);
+        sm4_gcm_starts(&gcm, SM4_GCM_ENCRYPT, iv, 12);
+        sm4_gcm_update(&gcm, ODD, buf, buf);
+        sm4_gcm_update(&gcm, LEN - ODD, buf + ODD, buf + ODD);
+        sm4_gcm_finish(&gcm, tag_b, 16);
+        ok &= memcmp(ref, buf, LEN) == 0 && memcmp(tag_a, tag_b, 16) == 0;
+        ok &= sm4_gcm_decrypt(test_vectors[0].key, iv, 12, NULL, 0, buf, LEN, tag_a, 16, buf) == 0;
+        ok &= memcmp(buf, pt, LEN) == 0;
+
+        printf("%-14s in-place ECB/CBC/CTR/GCM: %s\n", sm4_backend_name((sm4_backend_t)b),
+               ok == before ? "PASS ✓" : "FAIL ✗");
+    }
+    sm4_set_backend(saved);
+
+    /* Streaming-store paths, forced on for small aligned outputs */
+    sm4_set_nt_threshold(1024);
+    IN_PLACE(LEN, pt, (sm4_set_nt_threshold(0), sm4_ecb_encrypt(&enc, pt, LEN, ref), sm4_set_nt_threshold(1024)),
+             sm4_ecb_encrypt(&enc, buf, LEN, buf));
+    memset(iv, 3, 16);
+    IN_PLACE(LEN - 7, pt, (sm4_set_nt_threshold(0), sm4_ctr_crypt(&enc, iv, pt, LEN - 7, ref), sm4_set_nt_threshold(1024)),
+             (memset(iv, 3, 16), sm4_ctr_crypt(&enc, iv, buf, LEN - 7, buf)));
+    sm4_set_nt_threshold(saved_nt);
+#undef IN_PLACE
+    printf("Non-temporal ECB/CTR (threshold %zu): %s\n", saved_nt, ok ? "PASS ✓" : "FAIL ✗");
+
+    sm4_free_aligned(ref);
+    sm4_free_aligned(buf);
+    printf("In-place and Aligned Buffers: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+int test_key_batch(void) {
+    printf("\nTesting Batched Key Schedule...\n");
+    printf("===============================\n");
+
+    enum { N = 37 };        /* two 16-key passes and a padded tail */
+    static uint8_t keys[N * SM4_KEY_SIZE];
+    static sm4_ctx_t ref[N], got[N];
+    sm4_ctx_t dec;
+    int ok = 1;
+
+    for (size_t i = 0; i < sizeof(keys); i++) keys[i] = (uint8_t)(i * 131 + 7);
+    memcpy(keys, test_vectors[0].key, SM4_KEY_SIZE);
+    for (int i = 0; i < N; i++) sm4_setkey_enc(&ref[i], keys + i * SM4_KEY_SIZE);
+
+    for (int n = 1; n <= N; n += 6) {
+        memset(got, 0, sizeof(got));
+        sm4_setkey_enc_batch(got, keys, (size_t)n);
+        ok &= memcmp(got, ref, n * sizeof(sm4_ctx_t)) == 0;
+    }
+    sm4_setkey_dec_batch(got, keys, N);
+    for (int i = 0; i < N; i++) {
+        sm4_setkey_dec(&dec, keys + i * SM4_KEY_SIZE);
+        ok &= memcmp(&dec, &got[i], sizeof(dec)) == 0;
+    }
+    printf("Batch matches sm4_setkey_enc/dec: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+
+#ifdef __x86_64__
+    /* Both kernels directly, whichever the batch call picked */
+    if (cpu_supports_avx2()) {
+        memset(got, 0, sizeof(got));
+        sm4_setkey_enc_simd_8keys(got, keys);
+        ok &= memcmp(got, ref, SM4_SIMD_KEY_LANES * sizeof(sm4_ctx_t)) == 0;
+        printf("AVX2 8-key kernel: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    }
+    if (cpu_supports_gfni_vprold()) {
+        memset(got, 0, sizeof(got));
+        sm4_setkey_enc_gfni_16keys(got, keys);
+        ok &= memcmp(got, ref, SM4_GFNI_KEY_LANES * sizeof(sm4_ctx_t)) == 0;
+        printf("GFNI 16-key kernel: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    }
+#endif
+
+    printf("Batched Key Schedule: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+int test_key_objects(void) {
+    printf("\nTesting Key Objects and Cache...\n");
+    printf("================================\n");
+
+    uint8_t key[SM4_KEY_SIZE], iv[SM4_BLOCK_SIZE], iv2[SM4_BLOCK_SIZE];
+    uint8_t pt[100], a[112], b[112], tag_a[16], tag_b[16];
+    sm4_key_cache_stats_t st;
+    const sm4_key_t *k1, *k2;
+    sm4_key_t *k;
+    int ok = 1;
+
+    for (int i = 0; i < (int)sizeof(pt); i++) pt[i] = (uint8_t)(i * 13);
+    memcpy(key, test_vectors[0].key, sizeof(key));
+    memset(iv, 0x5a, sizeof(iv));
+
+    k = sm4_key_create(key);
+    ok &= k != NULL;
+    if (!k) return 0;
+
+    /* Same output as the per-call key schedule, every mode */
+    static const sm4_mode_t modes[] = {SM4_ECB, SM4_CBC, SM4_CTR};
+    for (int m = 0; m < 3; m++) {
+        size_t len = modes[m] == SM4_CTR ? sizeof(pt) : 96;
+        memcpy(iv2, iv, sizeof(iv));
+        ok &= sm4_encrypt_data(key, pt, len, a, modes[m], iv2) == 0;
+        memcpy(iv2, iv, sizeof(iv));
+        ok &= sm4_encrypt_data_key(k, pt, len, b, modes[m], iv2) == 0;
+        ok &= memcmp(a, b, len) == 0;
+        memcpy(iv2, iv, sizeof(iv));
+        ok &= sm4_decrypt_data_key(k, b, len, b, modes[m], iv2) == 0;
+        ok &= memcmp(b, pt, len) == 0;
+    }
+
+    sm4_gcm_encrypt(key, iv, 12, pt, 20, pt, sizeof(pt), a, tag_a, 16);
+    sm4_gcm_encrypt_key(k, iv, 12, pt, 20, pt, sizeof(pt), b, tag_b, 16);
+    ok &= memcmp(a, b, sizeof(pt)) == 0 && memcmp(tag_a, tag_b, 16) == 0;
+    ok &= sm4_gcm_decrypt_key(k, iv, 12, pt, 20, b, sizeof(pt), tag_b, 16, b) == 0;
+    ok &= memcmp(b, pt, sizeof(pt)) == 0;
+    tag_b[0] ^= 1;
+    ok &= sm4_gcm_decrypt_key(k, iv, 12, pt, 20, a, sizeof(pt), tag_b, 16, b) != 0;
+    printf("Key object matches per-call setup: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+
+    /* Capacities whose index or byte sizes would wrap are refused */
+    ok &= sm4_key_cache_create(0) == NULL && sm4_key_cache_create(UINT32_MAX / 2 - 1) == NULL &&
+          sm4_key_cache_create(SIZE_MAX / 8) == NULL;
+
+    /* Capacity 2: the third ID evicts the least recently used one */
+    sm4_key_cache_t *cache = sm4_key_cache_create(2);
+    ok &= cache != NULL;
+    if (!cache) {
+        sm4_key_release(k);
+        return 0;
+    }
+    for (uint64_t id = 1; id <= 3; id++) {
+        key[0] = (uint8_t)id;
+        sm4_key_release(sm4_key_cache_get(cache, id, key));
+        if (id == 2) {
+            key[0] = 1;
+            sm4_key_release(sm4_key_cache_get(cache, 1, key));   /* touch 1 */
+        }
+    }
+    k1 = sm4_key_cache_get(cache, 2, NULL);                     /* evicted */
+    k2 = sm4_key_cache_get(cache, 1, NULL);
+    ok &= k1 == NULL && k2 != NULL;
+    sm4_key_cache_get_stats(cache, &st);
+    ok &= st.hits == 2 && st.misses == 4 && st.evictions == 1 && st.size == 2;
+
+    /* New material under a cached ID replaces the key; k2 stays usable */
+    key[0] = 0x77;
+    k1 = sm4_key_cache_get(cache, 1, key);
+    ok &= k1 != NULL && k1 != k2;
+    sm4_encrypt_data(key, pt, 16, a, SM4_ECB, NULL);
+    sm4_encrypt_data_key(k1, pt, 16, b, SM4_ECB, NULL);
+    ok &= memcmp(a, b, 16) == 0;
+    key[0] = 1;
+    sm4_encrypt_data(key, pt, 16, a, SM4_ECB, NULL);
+    sm4_encrypt_data_key(k2, pt, 16, b, SM4_ECB, NULL);
+    ok &= memcmp(a, b, 16) == 0;
+    sm4_key_release(k1);
+    sm4_key_release(k2);
+
+    sm4_key_cache_remove(cache, 3);
+    sm4_key_cache_get_stats(cache, &st);
+    ok &= st.size == 1;
+    sm4_key_cache_destroy(cache);
+    sm4_key_release(k);
+
+    printf("Key cache hits %llu, misses %llu, evictions %llu\n",
+           (unsigned long long)st.hits, (unsigned long long)st.misses,
+           (unsigned long long)st.evictions);
+    printf("Key Objects and Cache: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
+/* XTS straight from IEEE 1619 on the reference cipher, one block at a time */
+static void ref_xts(const uint8_t key[32], const uint8_t tweak[16], const uint8_t *in,
+                    size_t len, uint8_t *out, int encrypt) {
+    sm4_ctx_t k1, k2;
+    uint8_t t[16], t_next[16], buf[16], pp[16];
+    size_t full = len / 16, rem = len % 16, j, i;
+
+    if (encrypt) sm4_setkey_enc(&k1, key);
+    else sm4_setkey_dec(&k1, key);
+    sm4_setkey_enc(&k2, key + 16);
+    sm4_encrypt_basic(&k2, tweak, t);
+
+    for (j = 0; j < full; j++) {
+        int carry;
+        /* With stealing, decryption runs the last full block under T_m */
+        if (rem && j == full - 1) {
+            memcpy(t_next, t, 16);
+            carry = t_next[15] >> 7;
+            for (i = 15; i > 0; i--) t_next[i] = (uint8_t)((t_next[i] << 1) | (t_next[i - 1] >> 7));
+            t_next[0] = (uint8_t)((t_next[0] << 1) ^ (carry ? 0x87 : 0));
+            for (i = 0; i < 16; i++) buf[i] = in[16 * j + i] ^ (encrypt ? t : t_next)[i];
+            sm4_encrypt_basic(&k1, buf, buf);
+            for (i = 0; i < 16; i++) buf[i] ^= (encrypt ? t : t_next)[i];
+            memcpy(pp, in + 16 * full, rem);
+            memcpy(pp + rem, buf + rem, 16 - rem);
+            memcpy(out + 16 * full, buf, rem);
+            for (i = 0; i < 16; i++) pp[i] ^= (encrypt ? t_next : t)[i];
+            sm4_encrypt_basic(&k1, pp, pp);
+            for (i = 0; i < 16; i++) out[16 * j + i] = pp[i] ^ (encrypt ? t_next : t)[i];
+            break;
+        }
+        for (i = 0; i < 16; i++) buf[i] = in[16 * j + i] ^ t[i];
+        sm4_encrypt_basic(&k1, buf, buf);
+        for (i = 0; i < 16; i++) out[16 * j + i] = buf[i] ^ t[i];
+        carry = t[15] >> 7;
+        for (i = 15; i > 0; i--) t[i] = (uint8_t)((t[i] << 1) | (t[i - 1] >> 7));
+        t[0] = (uint8_t)((t[0] << 1) ^ (carry ? 0x87 : 0));
+    }
+}
+
+int test_xts_mode(void) {
+    printf("\nTesting XTS Mode...\n");
+    printf("===================\n");
+
+    /* Independent reference (OpenSSL SM4-ECB + IEEE 1619 XTS in Python) */
+    static const uint8_t ct37[37] = {
+        0xdd, 0xed, 0x98, 0x04, 0x89, 0x0a, 0x9a, 0x1f, 0xc7, 0x1a, 0xf3, 0x00, 0xbd, 0x7f, 0xa3, 0x78,
+        0x7d, 0x8f, 0x74, 0x2c, 0x58, 0x1e, 0xf3, 0x07, 0x1d, 0x04, 0x70, 0xc4, 0xe9, 0x67, 0x3f, 0x1a,
+        0xb1, 0xb1, 0x66, 0x84, 0x5a
+    };
+    static const uint8_t ct64[64] = {
+        0x9a, 0x26, 0x39, 0x54, 0xba, 0x38, 0x80, 0x0e, 0x3e, 0x7c, 0xaa, 0x06, 0xaa, 0x79, 0x41, 0x0e,
+        0x74, 0x8b, 0x28, 0xff, 0x24, 0x37, 0xdb, 0x26, 0x8c, 0x89, 0x8a, 0xe3, 0x3d, 0xb7, 0x7f, 0x4a,
+        0xda, 0x4d, 0x44, 0x6a, 0xe8, 0x19, 0x7a, 0xf1, 0x3a, 0x37, 0x03, 0x3f, 0x3b, 0x08, 0x43, 0x66,
+        0x84, 0xf5, 0x0f, 0x19, 0xea, 0xf6, 0x3f, 0x1c, 0x5e, 0xc7, 0x40, 0xbf, 0x45, 0xb1, 0x89, 0xad
+    };
+    enum { LEN = 2100, SECTOR = 512, SECTORS = 5 };
+    static uint8_t pt[SECTOR * SECTORS], out[SECTOR * SECTORS], back[SECTOR * SECTORS];
+    static uint8_t ref[SECTOR * SECTORS];
+    uint8_t key[SM4_XTS_KEY_SIZE], tweak[SM4_BLOCK_SIZE];
+    sm4_backend_t saved = sm4_get_backend();
+    sm4_xts_ctx_t xts;
+    int ok = 1;
+
+    memcpy(key, test_vectors[0].key, 16);
+    memcpy(key + 16, test_vectors[1].key, 16);
+    for (int i = 0; i < 16; i++) tweak[i] = (uint8_t)(i + 1);
+    ok &= sm4_xts_setkey(&xts, key) == 0;
+
+    for (int i = 0; i < 37; i++) pt[i] = (uint8_t)i;
+    sm4_xts_encrypt(&xts, tweak, pt, 37, out);
+    ok &= memcmp(out, ct37, 37) == 0;
+    for (int i = 0; i < 64; i++) pt[i] = (uint8_t)(i * 7);
+    sm4_xts_encrypt(&xts, tweak, pt, 64, out);
+    ok &= memcmp(out, ct64, 64) == 0;
+    printf("Known answers (37 and 64 bytes): %s\n", ok ? "PASS ✓" : "FAIL ✗");
+
+    /* Every length across a few batches, on every backend, in place too */
+    for (int i = 0; i < SECTOR * SECTORS; i++) pt[i] = (uint8_t)(i * 29 + 3);
+    for (int b = 0; b < SM4_BACKEND_COUNT; b++) {
+        int backend_ok = 1;
+
+        if (sm4_set_backend((sm4_backend_t)b) != 0) continue;
+        for (size_t len = 16; len <= LEN; len += (len < 300) ? 1 : 97) {
+            ref_xts(key, tweak, pt, len, ref, 1);
+            backend_ok &= sm4_xts_encrypt(&xts, tweak, pt, len, out) == 0;
+            backend_ok &= memcmp(out, ref, len) == 0;
+            backend_ok &= sm4_xts_decrypt(&xts, tweak, out, len, back) == 0;
+            backend_ok &= memcmp(back, pt, len) == 0;
+            ref_xts(key, tweak, out, len, ref, 0);
+            backend_ok &= memcmp(ref, pt, len) == 0;
+            memcpy(back, pt, len);
+            sm4_xts_encrypt(&xts, tweak, back, len, back);
+            backend_ok &= memcmp(back, out, len) == 0;
+            sm4_xts_decrypt(&xts, tweak, back, len, back);
+            backend_ok &= memcmp(back, pt, len) == 0;
+        }
+        printf("%-16s lengths 16..%d: %s\n", sm4_backend_name((sm4_backend_t)b), LEN,
+               backend_ok ? "PASS ✓" : "FAIL ✗");
+        ok &= backend_ok;
+    }
+    sm4_set_backend(saved);
+
+    /* Sectors: tweak = little-endian sector number, carried into the high
+     * half when the 64-bit number wraps */
+    {
+        uint64_t first = UINT64_MAX - 2;
+        int sectors_ok = sm4_xts_encrypt_sectors(&xts, first, SECTOR, pt, sizeof(pt), out) == 0;
+
+        for (int s = 0; s < SECTORS; s++) {
+            uint64_t n = first + (uint64_t)s;
+            memset(tweak, 0, sizeof(tweak));
+            for (int i = 0; i < 8; i++) tweak[i] = (uint8_t)(n >> (8 * i));
+            tweak[8] = n < first;
+            sm4_xts_encrypt(&xts, tweak, pt + s * SECTOR, SECTOR, ref + s * SECTOR);
+        }
+        sectors_ok &= memcmp(out, ref, sizeof(pt)) == 0;
+        sectors_ok &= sm4_xts_decrypt_sectors(&xts, first, SECTOR, out, sizeof(pt), back) == 0;
+        sectors_ok &= memcmp(back, pt, sizeof(pt)) == 0;
+        printf("%d sectors across the 64-bit wrap: %s\n", SECTORS, sectors_ok ? "PASS ✓" : "FAIL ✗");
+        ok &= sectors_ok;
+    }
+
+    /* Rejected: short input, sector size mismatch, equal key halves */
+    ok &= sm4_xts_encrypt(&xts, tweak, pt, 15, out) == -1;
+    ok &= sm4_xts_encrypt_sectors(&xts, 0, SECTOR, pt, SECTOR + 16, out) == -1;
+    ok &= sm4_xts_encrypt_sectors(&xts, 0, 8, pt, 64, out) == -1;
+    memcpy(key + 16, key, 16);
+    ok &= sm4_xts_setkey(&xts, key) == -1;
+
+    return ok;
+}
+
+/* HMAC-SM3 straight from the definition, for checking the fused path */
+static void ref_hmac_sm3(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t len,
+                         uint8_t mac[SM3_DIGEST_SIZE]) {
+    uint8_t k[SM3_BLOCK_SIZE] = {0}, pad[SM3_BLOCK_SIZE], inner[SM3_DIGEST_SIZE];
+    sm3_ctx_t c;
+
+    if (key_len > SM3_BLOCK_SIZE) sm3_hash(key, key_len, k);
+    else memcpy(k, key, key_len);
+    for (int i = 0; i < SM3_BLOCK_SIZE; i++) pad[i] = k[i] ^ 0x36;
+    sm3_init(&c);
+    sm3_update(&c, pad, SM3_BLOCK_SIZE);
+    sm3_update(&c, msg, len);
+    sm3_final(&c, inner);
+    for (int i = 0; i < SM3_BLOCK_SIZE; i++) pad[i] = k[i] ^ 0x5c;
+    sm3_init(&c);
+    sm3_update(&c, pad, SM3_BLOCK_SIZE);
+    sm3_update(&c, inner, SM3_DIGEST_SIZE);
+    sm3_final(&c, mac);
+}
+
+int test_encrypt_then_mac(void) {
+    printf("\nTesting Fused SM4 + SM3 (Encrypt-then-MAC)...\n");
+    printf("=============================================\n");
+
+    enum { LEN = 3 * SM4_SM3_TILE + 1000 };
+    static const size_t chunks[] = {SM4_SM3_TILE + 5, 1, 4093, 16, 2 * SM4_SM3_TILE, 77};
+    static const sm4_mode_t modes[] = {SM4_CBC, SM4_CTR};
+    static const char *const names[] = {"CBC", "CTR"};
+    /* HMAC-SM3("abc"), keys "key" and 100 x 'k' (OpenSSL) */
+    static const uint8_t kat_short[SM3_DIGEST_SIZE] = {
+        0x28, 0xe6, 0x32, 0x56, 0xe7, 0xc5, 0xa0, 0x87, 0xb1, 0xf0, 0x73, 0x26, 0x5d, 0xc5, 0x30, 0x92,
+        0x16, 0x3f, 0x7b, 0x82, 0x72, 0x97, 0x35, 0xd0, 0x6f, 0x28, 0xf1, 0x0a, 0xf9, 0xd5, 0x23, 0x93
+    };
+    static const uint8_t kat_long[SM3_DIGEST_SIZE] = {
+        0x2d, 0x87, 0xdd, 0x3f, 0xfa, 0x14, 0x52, 0xe8, 0xe4, 0x0d, 0x91, 0x23, 0xa0, 0x28, 0x24, 0xfb,
+        0x7d, 0xd9, 0x8a, 0xe4, 0xa5, 0x26, 0x83, 0x28, 0x72, 0x45, 0xf1, 0x73, 0x6d, 0xc6, 0x10, 0xef
+    };
+    static uint8_t pt[LEN + 16], ref[LEN + 16], out[LEN + 32], back[LEN + 32];
+    uint8_t iv[SM4_BLOCK_SIZE], iv2[SM4_BLOCK_SIZE], mac_key[100];
+    uint8_t digest[SM3_DIGEST_SIZE], expect[SM3_DIGEST_SIZE];
+    const uint8_t *key = test_vectors[0].key;
+    sm4_sm3_ctx_t c;
+    size_t n;
+    int ok = 1;
+
+    for (int i = 0; i < LEN; i++) pt[i] = (uint8_t)(i * 13 + 7);
+    memset(iv, 0x24, sizeof(iv));
+    memset(mac_key, 'k', sizeof(mac_key));
+
+    for (int m = 0; m < 2; m++) {
+        for (int hmac = 0; hmac < 2; hmac++) {
+            const uint8_t *mk = hmac ? mac_key : NULL;
+            int padding = modes[m] == SM4_CBC;
+            size_t ref_len = LEN, total = 0, off = 0, k = 0;
+            int mode_ok = 1;
+
+            /* Separate passes: encrypt, then hash the ciphertext */
+            memcpy(ref, pt, LEN);
+            if (padding) ref_len = sm4_pkcs7_padding_add(ref, LEN, sizeof(ref));
+            memcpy(iv2, iv, sizeof(iv));
+            sm4_encrypt_data(key, ref, ref_len, ref, modes[m], iv2);
+            if (hmac) ref_hmac_sm3(mac_key, 20, ref, ref_len, expect);
+            else sm3_hash(ref, ref_len, expect);
+
+            mode_ok &= sm4_sm3_init(&c, key, modes[m], 1, iv, padding, mk, 20) == 0;
+            while (off < LEN) {
+                size_t chunk = chunks[k++ % (sizeof(chunks) / sizeof(chunks[0]))];
+                chunk = chunk < LEN - off ? chunk : LEN - off;
+                mode_ok &= sm4_sm3_update(&c, pt + off, chunk, out + total, &n) == 0;
+                total += n;
+                off += chunk;
+            }
+            mode_ok &= sm4_sm3_final(&c, out + total, &n, digest) == 0;
+            total += n;
+            mode_ok &= total == ref_len && memcmp(out, ref, ref_len) == 0 &&
+                       memcmp(digest, expect, SM3_DIGEST_SIZE) == 0;
+
+            /* Decrypt in place in one call: the same digest over the ciphertext */
+            memcpy(back, out, ref_len);
+            mode_ok &= sm4_sm3_init(&c, key, modes[m], 0, iv, padding, mk, 20) == 0;
+            mode_ok &= sm4_sm3_update(&c, back, ref_len, back, &total) == 0;
+            mode_ok &= sm4_sm3_final(&c, back + total, &n, digest) == 0;
+            total += n;
+            mode_ok &= total == LEN && memcmp(back, pt, LEN) == 0 &&
+                       memcmp(digest, expect, SM3_DIGEST_SIZE) == 0;
+
+            printf("%s %-9s %d bytes: %s\n", names[m], hmac ? "HMAC-SM3" : "SM3", LEN,
+                   mode_ok ? "PASS ✓" : "FAIL ✗");
+            ok &= mode_ok;
+        }
+    }
+
+    /* Known answers: CTR decryption hashes its input, the message "abc" */
+    sm4_sm3_init(&c, key, SM4_CTR, 0, iv, 0, (const uint8_t *)"key", 3);
+    sm4_sm3_update(&c, (const uint8_t *)"abc", 3, out, &n);
+    sm4_sm3_final(&c, out, &n, digest);
+    ok &= memcmp(digest, kat_short, SM3_DIGEST_SIZE) == 0;
+    sm4_sm3_init(&c, key, SM4_CTR, 0, iv, 0, mac_key, sizeof(mac_key));
+    sm4_sm3_update(&c, (const uint8_t *)"abc", 3, out, &n);
+    sm4_sm3_final(&c, out, &n, digest);
+    ok &= memcmp(digest, kat_long, SM3_DIGEST_SIZE) == 0;
+    ok &= sm4_sm3_init(&c, key, SM4_ECB, 1, NULL, 0, NULL, 0) == -1;
+
+    printf("HMAC-SM3 known answers, ECB rejected: %s\n", ok ? "PASS ✓" : "FAIL ✗");
+    return ok;
+}
+
 int main(void) {
     printf("SM4 Algorithm Test Suite\n");
     printf("========================\n\n");
@@ -352,12 +1854,54 @@ int main(void) {
     if (test_cbc_mode()) passed_tests++;
     total_tests++;
     
+    if (test_cbc_batched()) passed_tests++;
+    total_tests++;
+    
+    if (test_ctr_mode()) passed_tests++;
+    total_tests++;
+    
+    if (test_gcm_mode()) passed_tests++;
+    total_tests++;
+    
+    if (test_gcm_iov()) passed_tests++;
+    total_tests++;
+    
+    if (test_gcm_batch()) passed_tests++;
+    total_tests++;
+    
     if (test_padding()) passed_tests++;
     total_tests++;
     
     if (test_large_data()) passed_tests++;
     total_tests++;
     
+    if (test_backend_dispatch()) passed_tests++;
+    total_tests++;
+    
+    if (test_stats()) passed_tests++;
+    total_tests++;
+    
+    if (test_streaming()) passed_tests++;
+    total_tests++;
+    
+    if (test_multithreaded()) passed_tests++;
+    total_tests++;
+    
+    if (test_in_place()) passed_tests++;
+    total_tests++;
+    
+    if (test_key_batch()) passed_tests++;
+    total_tests++;
+    
+    if (test_key_objects()) passed_tests++;
+    total_tests++;
+    
+    if (test_xts_mode()) passed_tests++;
+    total_tests++;
+    
+    if (test_encrypt_then_mac()) passed_tests++;
+    total_tests++;
+    
     printf("\n==================================================\n");
     printf("Test Results: %d/%d tests passed\n", passed_tests, total_tests);
     
@@ -1,177 +1,404 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <sys/time.h>
+#include <unistd.h>
 #include "../src/sm3.h"
+#include "bench_harness.h"
 
 #define TEST_DATA_SIZE (1024 * 1024)  // 1MB
-#define NUM_ITERATIONS 1000
 
-// Get current time in microseconds
+// Current time in microseconds
 static double get_time_us(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+    return bench_seconds() * 1000000.0;
 }
 
-// Performance measurement structure
+// Compression functions compared block by block; NULL means the full hash
 typedef struct {
     const char *name;
     void (*compress_func)(uint32_t state[8], const uint8_t block[64]);
-    double time_us;
-    double throughput_mbps;
-    double cycles_per_byte;
-} perf_result_t;
-
-// CPU frequency estimation (simplified)
-static double estimate_cpu_freq_ghz(void) {
-    double start_time = get_time_us();
-    volatile uint64_t cycles = 0;
-    
-    while (get_time_us() - start_time < 100000) { // 100ms
-        cycles++;
+} perf_impl_t;
+
+static void bench_compress(void *ctx, const uint8_t *data, uint8_t *out, size_t len) {
+    const perf_impl_t *impl = (const perf_impl_t *)ctx;
+    uint32_t state[8];
+    size_t off;
+
+    memcpy(state, sm3_iv, sizeof(state));
+    for (off = 0; off + SM3_BLOCK_SIZE <= len; off += SM3_BLOCK_SIZE) {
+        impl->compress_func(state, data + off);
     }
-    
-    double elapsed = get_time_us() - start_time;
-    return (cycles / elapsed) * 1e-3; // Rough estimate
+    memcpy(out, state, len < sizeof(state) ? len : sizeof(state));
 }
 
-// Benchmark a specific SM3 implementation
-static void benchmark_implementation(perf_result_t *result, const uint8_t *data, size_t len) {
-    sm3_ctx_t ctx;
+static void bench_hash(void *ctx, const uint8_t *data, uint8_t *out, size_t len) {
     uint8_t digest[SM3_DIGEST_SIZE];
-    double start_time, end_time;
-    int i;
-    
-    // Warm up
-    for (i = 0; i < 10; i++) {
-        sm3_init(&ctx);
-        sm3_update(&ctx, data, len);
-        sm3_final(&ctx, digest);
+
+    (void)ctx;
+    sm3_hash(data, len, digest);
+    memcpy(out, digest, len < sizeof(digest) ? len : sizeof(digest));
+}
+
+// Many short records: one sm3_hash() per record vs. the multi-buffer manager
+static void benchmark_multi_buffer(const uint8_t *data, size_t data_len) {
+    static const size_t record_sizes[] = {100, 256, 1024, 4096};
+    size_t num_records = data_len / 4096;
+    const uint8_t **messages = malloc(num_records * sizeof(*messages));
+    size_t *lengths = malloc(num_records * sizeof(*lengths));
+    uint8_t (*digests)[SM3_DIGEST_SIZE] = malloc(num_records * SM3_DIGEST_SIZE);
+    sm3_mb_mgr_t mgr;
+    size_t i, k;
+
+    if (!messages || !lengths || !digests) {
+        free(messages);
+        free(lengths);
+        free(digests);
+        return;
     }
-    
-    // Measure performance
-    start_time = get_time_us();
-    
-    for (i = 0; i < NUM_ITERATIONS; i++) {
-        sm3_init(&ctx);
-        
-        // Use specific compression function if provided
-        if (result->compress_func) {
-            const uint8_t *ptr = data;
-            size_t remaining = len;
-            uint32_t state[8];
-            memcpy(state, ctx.state, sizeof(state));
-            
-            while (remaining >= SM3_BLOCK_SIZE) {
-                result->compress_func(state, ptr);
-                ptr += SM3_BLOCK_SIZE;
-                remaining -= SM3_BLOCK_SIZE;
-            }
-        } else {
-            sm3_update(&ctx, data, len);
+
+    sm3_mb_mgr_init(&mgr);
+    printf("\nMulti-buffer Records (%zu lanes):\n", mgr.num_lanes);
+    printf("=================================\n");
+    printf("%-12s %20s %20s %10s\n", "Record size", "sm3_hash (MiB/s)", "sm3_hash_mb (MiB/s)", "Speedup");
+
+    for (k = 0; k < sizeof(record_sizes) / sizeof(record_sizes[0]); k++) {
+        double start_time, serial_us, mb_us, mbytes;
+
+        for (i = 0; i < num_records; i++) {
+            messages[i] = data + i * 4096;
+            lengths[i] = record_sizes[k];
+        }
+        mbytes = (double)num_records * record_sizes[k] / (1024.0 * 1024.0);
+
+        start_time = get_time_us();
+        for (i = 0; i < num_records; i++) {
+            sm3_hash(messages[i], lengths[i], digests[i]);
+        }
+        serial_us = get_time_us() - start_time;
+
+        start_time = get_time_us();
+        sm3_hash_mb(messages, lengths, num_records, digests);
+        mb_us = get_time_us() - start_time;
+
+        printf("%-12zu %20.2f %20.2f %9.2fx\n", record_sizes[k],
+               mbytes / (serial_us / 1000000.0), mbytes / (mb_us / 1000000.0), serial_us / mb_us);
+    }
+
+    free(messages);
+    free(lengths);
+    free(digests);
+}
+
+// HMAC-SM3 records under one key: key blocks re-hashed per message (key
+// init each time), cached key states, and the multi-buffer batch
+static void benchmark_hmac(const uint8_t *data, size_t data_len) {
+    static const size_t record_sizes[] = {64, 256, 1024};
+    static const uint8_t mac_key[32] = {0x4b};
+    size_t num_records = data_len / 4096;
+    const uint8_t **messages = malloc(num_records * sizeof(*messages));
+    size_t *lengths = malloc(num_records * sizeof(*lengths));
+    uint8_t (*macs)[SM3_DIGEST_SIZE] = malloc(num_records * SM3_DIGEST_SIZE);
+    sm3_hmac_key_t key;
+    size_t i, k;
+
+    if (!messages || !lengths || !macs) {
+        free(messages);
+        free(lengths);
+        free(macs);
+        return;
+    }
+
+    printf("\nHMAC-SM3 Records (thousand MACs/s):\n");
+    printf("===================================\n");
+    printf("%-12s %14s %14s %14s\n", "Record size", "re-keyed", "cached key", "batch");
+
+    for (k = 0; k < sizeof(record_sizes) / sizeof(record_sizes[0]); k++) {
+        double start_time, rekey_us, cached_us, batch_us;
+
+        for (i = 0; i < num_records; i++) {
+            messages[i] = data + i * 4096;
+            lengths[i] = record_sizes[k];
+        }
+
+        start_time = get_time_us();
+        for (i = 0; i < num_records; i++) {
+            sm3_hmac_key_init(&key, mac_key, sizeof(mac_key));
+            sm3_hmac(&key, messages[i], lengths[i], macs[i]);
+        }
+        rekey_us = get_time_us() - start_time;
+
+        start_time = get_time_us();
+        for (i = 0; i < num_records; i++) {
+            sm3_hmac(&key, messages[i], lengths[i], macs[i]);
+        }
+        cached_us = get_time_us() - start_time;
+
+        start_time = get_time_us();
+        sm3_hmac_batch(&key, messages, lengths, num_records, macs);
+        batch_us = get_time_us() - start_time;
+
+        printf("%-12zu %14.1f %14.1f %14.1f\n", record_sizes[k], num_records / (rekey_us / 1000.0),
+               num_records / (cached_us / 1000.0), num_records / (batch_us / 1000.0));
+    }
+
+    free(messages);
+    free(lengths);
+    free(macs);
+}
+
+// Messages behind a shared 128-byte header: every message rehashes it,
+// resumes from a saved midstate, or looks the midstate up in a cache
+static void benchmark_prefix(const uint8_t *data, size_t data_len) {
+    static const size_t message_sizes[] = {32, 256, 1024};
+    const size_t header_len = 2 * SM3_BLOCK_SIZE;
+    size_t num_messages = data_len / 4096;
+    sm3_prefix_cache_t *cache = sm3_prefix_cache_create(64);
+    uint8_t *buf = malloc(header_len + 1024);
+    uint8_t digest[SM3_DIGEST_SIZE];
+    sm3_ctx_t mid, ctx;
+    size_t i, k;
+
+    if (!cache || !buf) {
+        sm3_prefix_cache_destroy(cache);
+        free(buf);
+        return;
+    }
+    memcpy(buf, data, header_len);
+    sm3_init(&mid);
+    sm3_update(&mid, data, header_len);
+
+    printf("\nShared 128-byte Prefix (thousand hashes/s):\n");
+    printf("===========================================\n");
+    printf("%-12s %14s %14s %14s\n", "Message size", "full", "midstate", "cache");
+
+    for (k = 0; k < sizeof(message_sizes) / sizeof(message_sizes[0]); k++) {
+        size_t len = message_sizes[k];
+        double start_time, full_us, mid_us, cache_us;
+
+        start_time = get_time_us();
+        for (i = 0; i < num_messages; i++) {
+            memcpy(buf + header_len, data + i * 4096, len);
+            sm3_hash(buf, header_len + len, digest);
+        }
+        full_us = get_time_us() - start_time;
+
+        start_time = get_time_us();
+        for (i = 0; i < num_messages; i++) {
+            sm3_hash_from(&mid, data + i * 4096, len, digest);
+        }
+        mid_us = get_time_us() - start_time;
+
+        start_time = get_time_us();
+        for (i = 0; i < num_messages; i++) {
+            sm3_prefix_cache_init(cache, &ctx, data, header_len);
+            sm3_update(&ctx, data + i * 4096, len);
             sm3_final(&ctx, digest);
         }
+        cache_us = get_time_us() - start_time;
+
+        printf("%-12zu %14.1f %14.1f %14.1f\n", len, num_messages / (full_us / 1000.0),
+               num_messages / (mid_us / 1000.0), num_messages / (cache_us / 1000.0));
     }
-    
-    end_time = get_time_us();
-    
-    result->time_us = (end_time - start_time) / NUM_ITERATIONS;
-    result->throughput_mbps = (len / (1024.0 * 1024.0)) / (result->time_us / 1000000.0);
-    result->cycles_per_byte = (result->time_us * estimate_cpu_freq_ghz() * 1000) / len;
+
+    sm3_prefix_cache_destroy(cache);
+    free(buf);
+}
+
+// KDF keystreams from a 64-byte Z (an SM2 shared point): one full hash per
+// counter against sm3_kdf() running the counters across lanes
+static void benchmark_kdf(void) {
+    static const size_t key_sizes[] = {32, 256, 4096, 65536};
+    uint8_t z[64], ct_be[4], *key = malloc(65536);
+    size_t i, k, reps;
+
+    if (!key) {
+        return;
+    }
+    for (i = 0; i < sizeof(z); i++) {
+        z[i] = (uint8_t)(i * 37 + 11);
+    }
+
+    printf("\nSM3 KDF, 64-byte Z (MB/s of key):\n");
+    printf("=================================\n");
+    printf("%-12s %14s %14s\n", "Key size", "serial", "sm3_kdf");
+
+    for (k = 0; k < sizeof(key_sizes) / sizeof(key_sizes[0]); k++) {
+        size_t klen = key_sizes[k];
+        double start_time, serial_us, kdf_us;
+
+        reps = (4u << 20) / klen;
+        start_time = get_time_us();
+        for (size_t r = 0; r < reps; r++) {
+            for (uint32_t ct = 1; (ct - 1) * SM3_DIGEST_SIZE < klen; ct++) {
+                sm3_ctx_t ctx;
+
+                ct_be[0] = (uint8_t)(ct >> 24);
+                ct_be[1] = (uint8_t)(ct >> 16);
+                ct_be[2] = (uint8_t)(ct >> 8);
+                ct_be[3] = (uint8_t)ct;
+                sm3_init(&ctx);
+                sm3_update(&ctx, z, sizeof(z));
+                sm3_update(&ctx, ct_be, sizeof(ct_be));
+                sm3_final(&ctx, key + (ct - 1) * SM3_DIGEST_SIZE);
+            }
+        }
+        serial_us = get_time_us() - start_time;
+
+        start_time = get_time_us();
+        for (size_t r = 0; r < reps; r++) {
+            sm3_kdf(z, sizeof(z), key, klen);
+        }
+        kdf_us = get_time_us() - start_time;
+
+        printf("%-12zu %14.2f %14.2f\n", klen, (double)(reps * klen) / serial_us,
+               (double)(reps * klen) / kdf_us);
+    }
+    free(key);
+}
+
+// Small batches on the shared pool: per-call latency is what thread start-up
+// or a contended queue would show up in
+static void benchmark_pool_batches(const uint8_t *data) {
+    static const size_t batch_sizes[] = {64, 512, 4096};
+    const uint8_t *messages[4096];
+    size_t lengths[4096];
+    uint8_t (*digests)[SM3_DIGEST_SIZE] = malloc(4096 * SM3_DIGEST_SIZE);
+    uint8_t *hashes[4096];
+    size_t i, k;
+
+    if (!digests) {
+        return;
+    }
+    for (i = 0; i < 4096; i++) {
+        messages[i] = data + (i % 1024) * 1024;
+        lengths[i] = 256;
+        hashes[i] = digests[i];
+    }
+
+    printf("\nsm3_hash_parallel, 256-byte messages (%d pool workers):\n", sm3_pool_size(sm3_pool_default()));
+    printf("=====================================================\n");
+    for (k = 0; k < sizeof(batch_sizes) / sizeof(batch_sizes[0]); k++) {
+        const int rounds = 200;
+        double start_time, us;
+        int r;
+
+        sm3_hash_parallel(messages, lengths, batch_sizes[k], hashes);
+        start_time = get_time_us();
+        for (r = 0; r < rounds; r++) {
+            sm3_hash_parallel(messages, lengths, batch_sizes[k], hashes);
+        }
+        us = (get_time_us() - start_time) / rounds;
+        printf("%5zu messages: %10.2f us/batch %10.2f MiB/s\n", batch_sizes[k], us,
+               batch_sizes[k] * 256 / (1024.0 * 1024.0) / (us / 1000000.0));
+    }
+    free(digests);
+}
+
+// One large object: sequential SM3 vs. SM3-TREE on 1, 2, 4, ... threads
+static void benchmark_tree_mode(void) {
+    const size_t len = 256u << 20;
+    uint8_t *data = malloc(len);
+    uint8_t digest[SM3_DIGEST_SIZE];
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    double start_time, serial_us, mbytes = len / (1024.0 * 1024.0);
+    size_t i;
+    int t;
+
+    if (!data) {
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        data[i] = (uint8_t)(i * 31 + (i >> 13));
+    }
+
+    printf("\nSM3-TREE, %zu MB object, %zu KB chunks (%ld CPUs):\n", len >> 20,
+           (size_t)SM3_TREE_DEFAULT_CHUNK >> 10, ncpu);
+    printf("==============================================\n");
+    start_time = get_time_us();
+    sm3_hash(data, len, digest);
+    serial_us = get_time_us() - start_time;
+    printf("%-12s %12.2f MiB/s\n", "sm3_hash", mbytes / (serial_us / 1000000.0));
+
+    for (t = 1; t <= ncpu; t *= 2) {
+        double tree_us;
+
+        start_time = get_time_us();
+        sm3_tree_hash(data, len, 0, t, digest);
+        tree_us = get_time_us() - start_time;
+        printf("tree x%-6d %12.2f MiB/s %9.2fx\n", t, mbytes / (tree_us / 1000000.0), serial_us / tree_us);
+    }
+
+    free(data);
 }
 
-int main(void) {
+int main(int argc, char **argv) {
     uint8_t *test_data;
-    perf_result_t results[4];
+    bench_t b;
+    bench_stats_t stats;
+    perf_impl_t impls[] = {
+        {"Basic Implementation", sm3_compress_basic},
+        {"Optimized Implementation", sm3_compress_optimized},
+#ifdef __x86_64__
+        {"SIMD (AVX2) Implementation", sm3_compress_simd},
+#elif __aarch64__
+        {"NEON Implementation", sm3_compress_neon},
+#endif
+    };
+    double baseline_mbps = 0;
+    size_t n;
     int i;
-    
+
+    if (bench_init(&b, "sm3", argc, argv) != 0) {
+        return 1;
+    }
+
     printf("SM3 Performance Benchmark\n");
     printf("=========================\n\n");
-    
+
     // Allocate test data
     test_data = malloc(TEST_DATA_SIZE);
     if (!test_data) {
         fprintf(stderr, "Failed to allocate test data\n");
         return 1;
     }
-    
+
     // Initialize test data with pseudo-random pattern
     for (i = 0; i < TEST_DATA_SIZE; i++) {
         test_data[i] = (uint8_t)(i ^ (i >> 8) ^ (i >> 16));
     }
-    
-    // Setup benchmark configurations
-    results[0].name = "Basic Implementation";
-    results[0].compress_func = sm3_compress_basic;
-    
-    results[1].name = "Optimized Implementation";
-    results[1].compress_func = sm3_compress_optimized;
-    
-#ifdef __x86_64__
-    results[2].name = "SIMD (AVX2) Implementation";
-    results[2].compress_func = sm3_compress_simd;
-#elif __aarch64__
-    results[2].name = "NEON Implementation";
-    results[2].compress_func = sm3_compress_neon;
-#else
-    results[2].name = "Architecture-specific (Not Available)";
-    results[2].compress_func = NULL;
-#endif
-    
-    results[3].name = "Complete Hash Function";
-    results[3].compress_func = NULL; // Use full hash function
-    
-    printf("Testing with %d MB of data, %d iterations\n\n", 
-           TEST_DATA_SIZE / (1024 * 1024), NUM_ITERATIONS);
-    
-    // Run benchmarks
-    for (i = 0; i < 4; i++) {
-        if (results[i].compress_func || i == 3) {
-            printf("Benchmarking: %s...", results[i].name);
-            fflush(stdout);
-            
-            benchmark_implementation(&results[i], test_data, TEST_DATA_SIZE);
-            
-            printf(" Done\n");
-        } else {
-            printf("Skipping: %s (Not available on this platform)\n", results[i].name);
-            results[i].time_us = 0;
-            results[i].throughput_mbps = 0;
-            results[i].cycles_per_byte = 0;
-        }
-    }
-    
-    // Print results
-    printf("\nPerformance Results:\n");
+
+    printf("Compression backend: %s\n", sm3_backend_name(sm3_get_backend()));
+    printf("Counter: %s at %.3f GHz (cycles/byte are counter ticks, not core cycles)\n\n",
+           bench_counter_name(), b.tick_hz / 1e9);
+
+    // Compression functions alone, 1 MB per call
+    printf("Compression Functions (%d KB):\n", TEST_DATA_SIZE / 1024);
     printf("====================\n");
-    printf("%-30s %12s %15s %12s\n", 
-           "Implementation", "Time (μs)", "Throughput (MB/s)", "Cycles/Byte");
-    printf("%-30s %12s %15s %12s\n", 
-           "---------------", "--------", "----------------", "-----------");
-    
-    for (i = 0; i < 4; i++) {
-        if (results[i].time_us > 0) {
-            printf("%-30s %12.2f %15.2f %12.2f\n",
-                   results[i].name,
-                   results[i].time_us,
-                   results[i].throughput_mbps,
-                   results[i].cycles_per_byte);
+    bench_print_header();
+    for (n = 0; n < sizeof(impls) / sizeof(impls[0]); n++) {
+        if (bench_run(&b, impls[n].name, bench_compress, &impls[n], TEST_DATA_SIZE, 1, &stats) != 0) {
+            continue;
         }
-    }
-    
-    // Calculate speedup ratios
-    printf("\nSpeedup Analysis:\n");
-    printf("=================\n");
-    if (results[0].throughput_mbps > 0) {
-        for (i = 1; i < 4; i++) {
-            if (results[i].throughput_mbps > 0) {
-                double speedup = results[i].throughput_mbps / results[0].throughput_mbps;
-                printf("%-30s: %.2fx speedup\n", results[i].name, speedup);
-            }
+        bench_print_row(impls[n].name, TEST_DATA_SIZE, 1, &stats);
+        if (n == 0) {
+            baseline_mbps = stats.mbps;
+        } else {
+            printf("%-32s %.2fx speedup\n", "", stats.mbps / baseline_mbps);
         }
     }
+
+    // The public hash over every size: padding and per-call overhead
+    // dominate at the small end, memory bandwidth at the large end
+    printf("\nComplete Hash Function (sm3_hash):\n");
+    printf("==================================\n");
+    bench_print_header();
+    bench_sweep(&b, "sm3_hash", bench_hash, NULL, 1);
+
+    benchmark_multi_buffer(test_data, TEST_DATA_SIZE);
+    benchmark_hmac(test_data, TEST_DATA_SIZE);
+    benchmark_prefix(test_data, TEST_DATA_SIZE);
+    benchmark_kdf();
+    benchmark_pool_batches(test_data);
+    benchmark_tree_mode();
     
     // Test correctness
     printf("\nCorrectness Verification:\n");
@@ -204,5 +431,6 @@ int main(void) {
            memcmp(digest_basic, expected, SM3_DIGEST_SIZE) == 0 ? "PASS" : "FAIL");
     
     free(test_data);
+    bench_finish(&b);
     return 0;
 }
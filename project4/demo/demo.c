@@ -1,26 +1,53 @@
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <dirent.h>
 #include <getopt.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "../src/sm3.h"
 
+// sm3sum mode hashes this many files per parallel batch and prints each
+// batch in input order before starting the next
+#define SUM_WINDOW 4096
+
+typedef struct {
+    char **paths;
+    uint8_t (*expected)[SM3_DIGEST_SIZE];   // check mode only
+    size_t count;
+    size_t capacity;
+} path_list_t;
+
 void print_usage(const char *program_name) {
     printf("SM3 Hash Calculator\n");
     printf("==================\n\n");
     printf("Usage: %s [OPTIONS] [INPUT]\n\n", program_name);
     printf("Options:\n");
     printf("  -h, --help     Show this help message\n");
-    printf("  -f, --file     Hash contents of file\n");
+    printf("  -f, --file     Hash contents of file(s); several files are hashed concurrently\n");
     printf("  -t, --test     Run built-in test vectors\n");
     printf("  -b, --bench    Run performance benchmark\n");
+    printf("  -T, --tree     With -f: SM3-TREE digest (1 MiB chunks on all cores, not plain SM3)\n");
     printf("  -v, --verbose  Show detailed output\n");
     printf("  -x, --hex      Output in hexadecimal (default)\n");
     printf("  -B, --binary   Output in binary format\n");
     printf("\n");
+    printf("sm3sum mode (also when run as 'sm3sum'; files hashed on all cores):\n");
+    printf("  -s, --sum        Print \"<digest>  <file>\" lines like sha256sum\n");
+    printf("  -c, --check      Read digests from the given files and check them\n");
+    printf("  -r, --recursive  Hash every file below the given directories\n");
+    printf("  -q, --quiet      With -c: do not print OK for each verified file\n");
+    printf("\n");
     printf("Examples:\n");
     printf("  %s \"hello world\"           # Hash string\n", program_name);
     printf("  %s -f /path/to/file        # Hash file\n", program_name);
+    printf("  %s -f a.bin b.bin c.bin    # Hash several files\n", program_name);
+    printf("  %s -s -r dist > SM3SUMS    # Checksum a release tree\n", program_name);
+    printf("  %s -c SM3SUMS              # Verify it\n", program_name);
     printf("  %s -t                      # Run tests\n", program_name);
     printf("  echo \"test\" | %s           # Hash from stdin\n", program_name);
 }
@@ -36,39 +63,401 @@ void print_hash_binary(const uint8_t *hash) {
     fwrite(hash, 1, SM3_DIGEST_SIZE, stdout);
 }
 
+void print_io_stats(const sm3_file_stats_t *stats) {
+    double mbps = stats->seconds > 0 ? stats->bytes / (1024.0 * 1024.0) / stats->seconds : 0.0;
+
+    printf("I/O: %s, %.2f ms, %.2f MB/s\n", sm3_io_method_name(stats->method),
+           stats->seconds * 1000.0, mbps);
+}
+
 int hash_file(const char *filename, int verbose) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open file '%s'\n", filename);
+    uint8_t digest[SM3_DIGEST_SIZE];
+    sm3_file_stats_t stats;
+    
+    if (sm3_hash_file(filename, digest, &stats) != 0) {
+        fprintf(stderr, "Error: Cannot read file '%s'\n", filename);
         return 1;
     }
     
-    sm3_ctx_t ctx;
-    uint8_t buffer[8192];
-    uint8_t digest[SM3_DIGEST_SIZE];
-    size_t bytes_read;
-    size_t total_bytes = 0;
+    if (verbose) {
+        printf("File: %s\n", filename);
+        printf("Size: %llu bytes\n", (unsigned long long)stats.bytes);
+        print_io_stats(&stats);
+        printf("SM3: ");
+    }
     
-    sm3_init(&ctx);
+    print_hash_hex(digest);
+    return 0;
+}
+
+int hash_file_tree(const char *filename, int verbose) {
+    uint8_t digest[SM3_DIGEST_SIZE];
+    struct timespec start, end;
     
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        sm3_update(&ctx, buffer, bytes_read);
-        total_bytes += bytes_read;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (sm3_tree_hash_file(filename, 0, 0, digest) != 0) {
+        fprintf(stderr, "Error: Cannot read file '%s'\n", filename);
+        return 1;
     }
-    
-    sm3_final(&ctx, digest);
-    fclose(file);
+    clock_gettime(CLOCK_MONOTONIC, &end);
     
     if (verbose) {
+        double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
         printf("File: %s\n", filename);
-        printf("Size: %zu bytes\n", total_bytes);
-        printf("SM3: ");
+        printf("Mode: SM3-TREE, %u KB chunks, %.2f ms\n", SM3_TREE_DEFAULT_CHUNK >> 10, ms);
+        printf("SM3-TREE: ");
     }
     
     print_hash_hex(digest);
     return 0;
 }
 
+int hash_files(const char *const filenames[], size_t count, int verbose) {
+    uint8_t (*digests)[SM3_DIGEST_SIZE] = malloc(count * sizeof(*digests));
+    int *status = malloc(count * sizeof(*status));
+    sm3_file_stats_t stats;
+    int ret = 0;
+    
+    if (!digests || !status) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(digests);
+        free(status);
+        return 1;
+    }
+    
+    sm3_hash_files_parallel(filenames, count, digests, status, &stats);
+    
+    for (size_t i = 0; i < count; i++) {
+        if (status[i] != 0) {
+            fprintf(stderr, "Error: Cannot read file '%s'\n", filenames[i]);
+            ret = 1;
+            continue;
+        }
+        for (int j = 0; j < SM3_DIGEST_SIZE; j++) {
+            printf("%02x", digests[i][j]);
+        }
+        printf("  %s\n", filenames[i]);
+    }
+    
+    if (verbose) {
+        printf("Files: %zu, %llu bytes\n", count, (unsigned long long)stats.bytes);
+        print_io_stats(&stats);
+    }
+    
+    free(digests);
+    free(status);
+    return ret;
+}
+
+int path_list_add(path_list_t *list, char *path, const uint8_t *expected) {
+    if (!path) {
+        return -1;
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        char **paths = realloc(list->paths, capacity * sizeof(*paths));
+        uint8_t (*digests)[SM3_DIGEST_SIZE];
+
+        if (!paths) {
+            free(path);
+            return -1;
+        }
+        list->paths = paths;
+        digests = realloc(list->expected, capacity * sizeof(*digests));
+        if (!digests) {
+            free(path);
+            return -1;
+        }
+        list->expected = digests;
+        list->capacity = capacity;
+    }
+    if (expected) {
+        memcpy(list->expected[list->count], expected, SM3_DIGEST_SIZE);
+    }
+    list->paths[list->count++] = path;
+    return 0;
+}
+
+void path_list_free(path_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    free(list->expected);
+}
+
+int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Add every regular file below dir, entries sorted by name so the listing
+ * is reproducible; symlinks to directories are not followed
+ */
+int collect_dir(path_list_t *list, const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    char **names = NULL;
+    size_t count = 0, capacity = 0;
+    size_t dir_len = strlen(dir);
+    int ret = 0;
+
+    if (!d) {
+        fprintf(stderr, "sm3sum: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        if (count == capacity) {
+            char **grown = realloc(names, (capacity ? capacity * 2 : 64) * sizeof(*names));
+            if (!grown) {
+                ret = 1;
+                break;
+            }
+            names = grown;
+            capacity = capacity ? capacity * 2 : 64;
+        }
+        if ((names[count] = strdup(e->d_name)) == NULL) {
+            ret = 1;
+            break;
+        }
+        count++;
+    }
+    closedir(d);
+    qsort(names, count, sizeof(*names), compare_names);
+
+    for (size_t i = 0; i < count; i++) {
+        char *path = malloc(dir_len + strlen(names[i]) + 2);
+        struct stat st;
+
+        if (!path) {
+            ret = 1;
+            continue;
+        }
+        sprintf(path, "%s%s%s", dir, dir_len && dir[dir_len - 1] == '/' ? "" : "/", names[i]);
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            ret |= collect_dir(list, path);
+            free(path);
+        } else if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            ret |= path_list_add(list, path, NULL) != 0;
+        } else {
+            // Devices, sockets, dangling links and links to directories
+            free(path);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ret;
+}
+
+/**
+ * Hash list entries [begin, end) in parallel; "-" is standard input and
+ * splits the window into runs handed to the library
+ */
+void sum_hash_window(path_list_t *list, size_t begin, size_t end,
+                     uint8_t (*digests)[SM3_DIGEST_SIZE], int *status, uint64_t *bytes) {
+    sm3_file_stats_t stats;
+    size_t run = begin;
+
+    for (size_t i = begin; i <= end; i++) {
+        if (i < end && strcmp(list->paths[i], "-") != 0) {
+            continue;
+        }
+        if (i > run) {
+            sm3_hash_files_parallel((const char *const *)list->paths + run, i - run,
+                                    digests + (run - begin), status + (run - begin), &stats);
+            *bytes += stats.bytes;
+        }
+        if (i < end) {
+            status[i - begin] = sm3_hash_fd(STDIN_FILENO, digests[i - begin], &stats);
+            *bytes += stats.bytes;
+        }
+        run = i + 1;
+    }
+}
+
+void report_read_error(const char *path) {
+    if (strcmp(path, "-") != 0 && access(path, R_OK) != 0) {
+        fprintf(stderr, "sm3sum: %s: %s\n", path, strerror(errno));
+    } else {
+        fprintf(stderr, "sm3sum: %s: read error\n", path);
+    }
+}
+
+/**
+ * Hash the collected files a window at a time and print their sums
+ */
+int sum_files(path_list_t *list, int verbose) {
+    uint8_t (*digests)[SM3_DIGEST_SIZE] = malloc(SUM_WINDOW * sizeof(*digests));
+    int *status = malloc(SUM_WINDOW * sizeof(*status));
+    struct timespec start, end;
+    uint64_t bytes = 0;
+    int ret = 0;
+
+    if (!digests || !status) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(digests);
+        free(status);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t base = 0; base < list->count; base += SUM_WINDOW) {
+        size_t n = list->count - base < SUM_WINDOW ? list->count - base : SUM_WINDOW;
+
+        sum_hash_window(list, base, base + n, digests, status, &bytes);
+        for (size_t i = 0; i < n; i++) {
+            if (status[i] != 0) {
+                report_read_error(list->paths[base + i]);
+                ret = 1;
+            } else {
+                sm3_sum_format_line(stdout, digests[i], list->paths[base + i]);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (verbose) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "Files: %zu, %llu bytes, %.2f ms, %.2f MB/s\n", list->count,
+                (unsigned long long)bytes, seconds * 1000.0,
+                seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0);
+    }
+    free(digests);
+    free(status);
+    return ret;
+}
+
+/**
+ * Add one checksum line to the list; -1 if it is not in sm3sum format
+ */
+int parse_sum_line(path_list_t *list, const char *line) {
+    uint8_t digest[SM3_DIGEST_SIZE];
+    char *path = sm3_sum_parse_line(line, digest);
+
+    return path ? path_list_add(list, path, digest) : -1;
+}
+
+/**
+ * sm3sum -c: verify the digests listed in each checksum file
+ */
+int check_sums(const char *const files[], size_t num_files, int quiet, int verbose) {
+    uint8_t (*digests)[SM3_DIGEST_SIZE] = malloc(SUM_WINDOW * sizeof(*digests));
+    int *status = malloc(SUM_WINDOW * sizeof(*status));
+    size_t bad_lines = 0, unreadable = 0, mismatched = 0;
+    uint64_t bytes = 0;
+    int ret = 0;
+
+    if (!digests || !status) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(digests);
+        free(status);
+        return 1;
+    }
+    for (size_t f = 0; f < num_files; f++) {
+        int from_stdin = strcmp(files[f], "-") == 0;
+        FILE *in = from_stdin ? stdin : fopen(files[f], "r");
+        path_list_t list = {0};
+        char *line = NULL;
+        size_t cap = 0;
+
+        if (!in) {
+            fprintf(stderr, "sm3sum: %s: %s\n", files[f], strerror(errno));
+            ret = 1;
+            continue;
+        }
+        while (getline(&line, &cap, in) != -1) {
+            bad_lines += parse_sum_line(&list, line) != 0;
+        }
+        free(line);
+        if (!from_stdin) {
+            fclose(in);
+        }
+        if (list.count == 0) {
+            fprintf(stderr, "sm3sum: %s: no properly formatted SM3 checksum lines found\n",
+                    files[f]);
+            ret = 1;
+        }
+
+        for (size_t base = 0; base < list.count; base += SUM_WINDOW) {
+            size_t n = list.count - base < SUM_WINDOW ? list.count - base : SUM_WINDOW;
+
+            sum_hash_window(&list, base, base + n, digests, status, &bytes);
+            for (size_t i = 0; i < n; i++) {
+                const char *path = list.paths[base + i];
+
+                if (status[i] != 0) {
+                    report_read_error(path);
+                    printf("%s: FAILED open or read\n", path);
+                    unreadable++;
+                } else if (memcmp(digests[i], list.expected[base + i], SM3_DIGEST_SIZE) != 0) {
+                    printf("%s: FAILED\n", path);
+                    mismatched++;
+                } else if (!quiet) {
+                    printf("%s: OK\n", path);
+                }
+            }
+        }
+        path_list_free(&list);
+    }
+
+    fflush(stdout);
+    if (bad_lines) {
+        fprintf(stderr, "sm3sum: WARNING: %zu line%s improperly formatted\n", bad_lines,
+                bad_lines == 1 ? " is" : "s are");
+    }
+    if (unreadable) {
+        fprintf(stderr, "sm3sum: WARNING: %zu listed file%s could not be read\n", unreadable,
+                unreadable == 1 ? "" : "s");
+    }
+    if (mismatched) {
+        fprintf(stderr, "sm3sum: WARNING: %zu computed checksum%s did NOT match\n", mismatched,
+                mismatched == 1 ? "" : "s");
+    }
+    if (verbose) {
+        fprintf(stderr, "Checked %llu bytes\n", (unsigned long long)bytes);
+    }
+    free(digests);
+    free(status);
+    return ret || unreadable || mismatched;
+}
+
+/**
+ * sm3sum: hash the named files (standard input without any), descending
+ * into directories with -r
+ */
+int run_sum(char *const args[], size_t count, int recursive, int verbose) {
+    static char *const stdin_only[] = {"-"};
+    path_list_t list = {0};
+    int ret = 0;
+
+    if (count == 0) {
+        args = stdin_only;
+        count = 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        struct stat st;
+
+        if (strcmp(args[i], "-") != 0 && stat(args[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (recursive) {
+                ret |= collect_dir(&list, args[i]);
+            } else {
+                fprintf(stderr, "sm3sum: %s: Is a directory\n", args[i]);
+                ret = 1;
+            }
+            continue;
+        }
+        if (path_list_add(&list, strdup(args[i]), NULL) != 0) {
+            fprintf(stderr, "Memory allocation failed\n");
+            ret = 1;
+        }
+    }
+    ret |= sum_files(&list, verbose);
+    path_list_free(&list);
+    return ret;
+}
+
 int hash_string(const char *input, int verbose) {
     uint8_t digest[SM3_DIGEST_SIZE];
     
@@ -85,24 +474,18 @@ int hash_string(const char *input, int verbose) {
 }
 
 int hash_stdin(int verbose) {
-    sm3_ctx_t ctx;
-    uint8_t buffer[8192];
     uint8_t digest[SM3_DIGEST_SIZE];
-    size_t bytes_read;
-    size_t total_bytes = 0;
+    sm3_file_stats_t stats;
     
-    sm3_init(&ctx);
-    
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
-        sm3_update(&ctx, buffer, bytes_read);
-        total_bytes += bytes_read;
+    if (sm3_hash_fd(STDIN_FILENO, digest, &stats) != 0) {
+        fprintf(stderr, "Error: Cannot read stdin\n");
+        return 1;
     }
     
-    sm3_final(&ctx, digest);
-    
     if (verbose) {
         printf("Input: <stdin>\n");
-        printf("Size: %zu bytes\n", total_bytes);
+        printf("Size: %llu bytes\n", (unsigned long long)stats.bytes);
+        print_io_stats(&stats);
         printf("SM3: ");
     }
     
@@ -214,19 +597,35 @@ int main(int argc, char *argv[]) {
     int file_mode = 0;
     int test_mode = 0;
     int bench_mode = 0;
+    int tree_mode = 0;
+    int sum_mode = 0;
+    int check_mode = 0;
+    int recursive = 0;
+    int quiet = 0;
+    const char *base = strrchr(argv[0], '/');
+    
+    // Installed or linked as sm3sum, behave like the coreutils *sum tools
+    if (strcmp(base ? base + 1 : argv[0], "sm3sum") == 0) {
+        sum_mode = 1;
+    }
     
     static struct option long_options[] = {
         {"help",    no_argument,       0, 'h'},
         {"file",    no_argument,       0, 'f'},
         {"test",    no_argument,       0, 't'},
         {"bench",   no_argument,       0, 'b'},
+        {"tree",    no_argument,       0, 'T'},
         {"verbose", no_argument,       0, 'v'},
         {"hex",     no_argument,       0, 'x'},
         {"binary",  no_argument,       0, 'B'},
+        {"sum",       no_argument,     0, 's'},
+        {"check",     no_argument,     0, 'c'},
+        {"recursive", no_argument,     0, 'r'},
+        {"quiet",     no_argument,     0, 'q'},
         {0, 0, 0, 0}
     };
     
-    while ((opt = getopt_long(argc, argv, "hftbvxB", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hftTbvxBscrq", long_options, NULL)) != -1) {
         switch (opt) {
             case 'h':
                 print_usage(argv[0]);
@@ -240,6 +639,9 @@ int main(int argc, char *argv[]) {
             case 'b':
                 bench_mode = 1;
                 break;
+            case 'T':
+                tree_mode = 1;
+                break;
             case 'v':
                 verbose = 1;
                 break;
@@ -249,6 +651,18 @@ int main(int argc, char *argv[]) {
             case 'B':
                 binary_output = 1;
                 break;
+            case 's':
+                sum_mode = 1;
+                break;
+            case 'c':
+                check_mode = 1;
+                break;
+            case 'r':
+                recursive = 1;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
             default:
                 print_usage(argv[0]);
                 return 1;
@@ -263,11 +677,33 @@ int main(int argc, char *argv[]) {
         return run_benchmark();
     }
     
+    if (check_mode) {
+        static const char *const stdin_only[] = {"-"};
+        if (optind >= argc) {
+            return check_sums(stdin_only, 1, quiet, verbose);
+        }
+        return check_sums((const char *const *)&argv[optind], (size_t)(argc - optind), quiet, verbose);
+    }
+    
+    if (sum_mode || recursive) {
+        return run_sum(&argv[optind], (size_t)(argc - optind), recursive, verbose);
+    }
+    
     if (file_mode) {
         if (optind >= argc) {
             fprintf(stderr, "Error: Filename required with -f option\n");
             return 1;
         }
+        if (tree_mode) {
+            int ret = 0;
+            for (int i = optind; i < argc; i++) {
+                ret |= hash_file_tree(argv[i], verbose);
+            }
+            return ret;
+        }
+        if (argc - optind > 1) {
+            return hash_files((const char *const *)&argv[optind], (size_t)(argc - optind), verbose);
+        }
         return hash_file(argv[optind], verbose);
     }
     
@@ -0,0 +1,24 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/merkle_tree.h"
+
+/**
+ * Merkle tree demonstration: ./merkle_tree_demo [num_leaves]
+ * (the sparse tree is benchmarked with the same number of keys)
+ */
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        size_t num_leaves = atoi(argv[1]);
+        if (num_leaves > 0) {
+            benchmark_merkle_tree(num_leaves);
+            printf("\n");
+            benchmark_sparse_merkle(num_leaves);
+            return 0;
+        }
+    }
+    
+    demonstrate_large_merkle_tree();
+    printf("\n");
+    benchmark_sparse_merkle(100000);
+    return 0;
+}
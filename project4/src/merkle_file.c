@@ -0,0 +1,563 @@
+/**
+ * SM3 Merkle Tree File (persistent RFC 6962 log)
+ *
+ * One file holds a tree as the same level-ordered 32-byte hash arrays that
+ * merkle_tree_t uses in memory, so an open file is served by mapping it and
+ * pointing a merkle_tree_t at the mapping: no leaf is rehashed on restart.
+ *
+ *   page 0       header: magic, version, capacity and two commit records
+ *   level k      capacity >> k slots of 32 bytes, k = 0 .. log2(capacity)
+ *
+ * Slot j of level k is written once, when the 2^k leaves below it are all
+ * present (the append frontier), and never changes afterwards. The right
+ * edge of a tree whose size is not a power of two has up to log2(n)
+ * imperfect nodes; they are rewritten in place from their children whenever
+ * the size changes, so they are never trusted from disk.
+ *
+ * Crash safety: a commit msync()s the slots written since the previous one,
+ * then writes the new size and root into the older of the two commit
+ * records, each protected by an SM3 checksum, and syncs the header. Opening
+ * takes the newest valid record, rebuilds the right edge and checks the
+ * recorded root, so a torn commit falls back to the previous size.
+ *
+ * The capacity is a power of two reserved sparsely with ftruncate(), so an
+ * unused tail costs address space, not disk. Outgrowing it copies the levels
+ * into a file of twice the capacity that is renamed over the old one.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "merkle_tree.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MERKLE_FILE_MAGIC        "SM3MERKL"
+#define MERKLE_FILE_VERSION      1
+#define MERKLE_FILE_HEADER_SIZE  4096
+#define MERKLE_FILE_MIN_CAPACITY 1024
+// Largest capacity whose file length (under 64 bytes per leaf) fits size_t
+#define MERKLE_FILE_MAX_CAPACITY ((SIZE_MAX - MERKLE_FILE_HEADER_SIZE) / 64)
+
+// Header fields (integers little-endian)
+#define MF_OFF_MAGIC     0          // 8 bytes
+#define MF_OFF_VERSION   8          // u32
+#define MF_OFF_HEADER    12         // u32 header size
+#define MF_OFF_CAPACITY  16         // u64 leaf slots, a power of two
+#define MF_OFF_COMMIT    64         // two records of MF_COMMIT_SIZE
+#define MF_COMMIT_SIZE   128
+
+// Commit record: seq, size, root, then SM3 over those 48 bytes
+#define MF_REC_SEQ       0
+#define MF_REC_SIZE      8
+#define MF_REC_ROOT      16
+#define MF_REC_CHECK     48
+#define MF_REC_BODY      48
+
+struct merkle_file {
+    char* path;
+    int fd;
+    int writable;
+    uint8_t* map;
+    size_t map_len;
+    size_t capacity;            // leaf slots
+    int capacity_levels;        // log2(capacity) + 1
+    uint8_t (*levels[MERKLE_MAX_LEVELS])[32];   // slot arrays inside the map
+    size_t leaf_count;          // leaves appended, committed or not
+    size_t synced;              // size of the last commit
+    uint64_t seq;               // sequence number of the last commit
+    int edge_valid;             // right edge and view match leaf_count
+    merkle_tree_t view;         // points into the map, never freed
+};
+
+static void put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint64_t get64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static size_t merkle_file_length(size_t capacity) {
+    return MERKLE_FILE_HEADER_SIZE + (2 * capacity - 1) * 32;
+}
+
+/**
+ * Point the level arrays at the mapping; level k starts after the
+ * capacity + capacity/2 + ... + (capacity >> (k-1)) slots below it
+ */
+static void merkle_file_layout(merkle_file_t* mf) {
+    uint8_t* p = mf->map + MERKLE_FILE_HEADER_SIZE;
+    int k = 0;
+
+    for (size_t slots = mf->capacity; slots; slots >>= 1, k++) {
+        mf->levels[k] = (uint8_t (*)[32])p;
+        p += slots * 32;
+    }
+    mf->capacity_levels = k;
+}
+
+static int merkle_file_map(merkle_file_t* mf) {
+    // A read-only open still patches the right edge, in private copies
+    int flags = mf->writable ? MAP_SHARED : MAP_PRIVATE;
+    void* map = mmap(NULL, mf->map_len, PROT_READ | PROT_WRITE, flags, mf->fd, 0);
+
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    // Proofs touch one slot per level, scattered over the file
+    madvise(map, mf->map_len, MADV_RANDOM);
+    mf->map = map;
+    merkle_file_layout(mf);
+    return 0;
+}
+
+/**
+ * Rebuild the imperfect right-edge nodes bottom up and refresh the view
+ * Costs at most one node hash per level
+ */
+static void merkle_file_refresh(merkle_file_t* mf) {
+    merkle_tree_t* view = &mf->view;
+    size_t n = mf->leaf_count;
+    int level = 0;
+
+    if (mf->edge_valid) {
+        return;
+    }
+    view->levels[0] = mf->levels[0];
+    view->level_size[0] = n;
+    while (view->level_size[level] > 1) {
+        size_t count = view->level_size[level];
+        size_t last = (count + 1) / 2 - 1;
+        uint8_t (*below)[32] = mf->levels[level];
+
+        if (((last + 1) << (level + 1)) > n) {
+            if (2 * last + 1 < count) {
+                hash_nodes(below[2 * last], below[2 * last + 1], mf->levels[level + 1][last]);
+            } else {
+                memcpy(mf->levels[level + 1][last], below[2 * last], 32);
+            }
+        }
+        view->levels[level + 1] = mf->levels[level + 1];
+        view->level_size[level + 1] = last + 1;
+        level++;
+    }
+
+    view->num_levels = n ? level + 1 : 0;
+    view->leaf_count = n;
+    view->capacity = mf->capacity;
+    view->nodes = NULL;
+    view->node_capacity = 0;
+    // Bit k of n set: the perfect subtree ending at leaf n-1 is slot (n >> k) - 1
+    for (int k = 0; k < mf->capacity_levels; k++) {
+        if ((n >> k) & 1) {
+            memcpy(view->frontier[k], mf->levels[k][(n >> k) - 1], 32);
+        }
+    }
+    view->frontier_size = n;
+    mf->edge_valid = 1;
+}
+
+/**
+ * Write the newest size and root into the older commit record
+ */
+static void merkle_file_put_commit(uint8_t* header, uint64_t seq, size_t size,
+                                   const uint8_t root[32]) {
+    uint8_t* rec = header + MF_OFF_COMMIT + (seq & 1) * MF_COMMIT_SIZE;
+
+    put64(rec + MF_REC_SEQ, seq);
+    put64(rec + MF_REC_SIZE, size);
+    memcpy(rec + MF_REC_ROOT, root, 32);
+    sm3_hash(rec, MF_REC_BODY, rec + MF_REC_CHECK);
+}
+
+static const uint8_t* merkle_file_root_or_zero(merkle_file_t* mf) {
+    static const uint8_t zero[32];
+
+    merkle_file_refresh(mf);
+    return mf->leaf_count ? merkle_tree_root(&mf->view) : zero;
+}
+
+/**
+ * Fixed header fields of a fresh file; the commit records follow on commit
+ */
+static void merkle_file_init_header(merkle_file_t* mf) {
+    uint8_t* h = mf->map;
+
+    memset(h, 0, MERKLE_FILE_HEADER_SIZE);
+    memcpy(h + MF_OFF_MAGIC, MERKLE_FILE_MAGIC, 8);
+    put32(h + MF_OFF_VERSION, MERKLE_FILE_VERSION);
+    put32(h + MF_OFF_HEADER, MERKLE_FILE_HEADER_SIZE);
+    put64(h + MF_OFF_CAPACITY, mf->capacity);
+}
+
+/**
+ * Create (or truncate) a file and size it sparsely for capacity leaves
+ */
+static merkle_file_t* merkle_file_create_at(const char* path, size_t capacity) {
+    merkle_file_t* mf = calloc(1, sizeof(merkle_file_t));
+    size_t slots = MERKLE_FILE_MIN_CAPACITY;
+
+    if (!mf) {
+        return NULL;
+    }
+    while (slots < capacity && slots <= MERKLE_FILE_MAX_CAPACITY / 2) {
+        slots <<= 1;
+    }
+    if (slots < capacity) {
+        free(mf);
+        return NULL;
+    }
+    mf->capacity = slots;
+    mf->map_len = merkle_file_length(slots);
+    mf->writable = 1;
+    mf->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mf->fd < 0 || flock(mf->fd, LOCK_EX | LOCK_NB) != 0 ||
+        ftruncate(mf->fd, (off_t)mf->map_len) != 0 || merkle_file_map(mf) != 0) {
+        if (mf->fd >= 0) {
+            close(mf->fd);
+        }
+        free(mf);
+        return NULL;
+    }
+    merkle_file_init_header(mf);
+    return mf;
+}
+
+/**
+ * Make everything appended so far durable
+ * Slots first, then the commit record, so a record never names a size
+ * whose perfect nodes might still be in flight
+ */
+int merkle_file_commit(merkle_file_t* mf) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t n = mf->leaf_count;
+
+    if (!mf->writable) {
+        return -1;
+    }
+    const uint8_t* root = merkle_file_root_or_zero(mf);
+
+    for (int k = 0; k < mf->capacity_levels && n; k++) {
+        // Slots from the last committed frontier up to the new right edge
+        size_t lo = mf->synced >> k;
+        size_t hi = ((n - 1) >> k) + 1;
+        size_t begin = (size_t)((uint8_t*)mf->levels[k][lo] - mf->map) & ~(page - 1);
+        size_t end = (size_t)((uint8_t*)mf->levels[k][hi] - mf->map);
+
+        if (msync(mf->map + begin, end - begin, MS_SYNC) != 0) {
+            return -1;
+        }
+    }
+    merkle_file_put_commit(mf->map, mf->seq + 1, n, root);
+    if (msync(mf->map, MERKLE_FILE_HEADER_SIZE, MS_SYNC) != 0) {
+        return -1;
+    }
+    mf->seq++;
+    mf->synced = n;
+    return 0;
+}
+
+merkle_file_t* merkle_file_create(const char* path, size_t capacity) {
+    merkle_file_t* mf = merkle_file_create_at(path, capacity);
+
+    if (!mf) {
+        return NULL;
+    }
+    mf->path = strdup(path);
+    if (!mf->path || merkle_file_commit(mf) != 0) {
+        merkle_file_close(mf);
+        return NULL;
+    }
+    return mf;
+}
+
+/**
+ * Parse a commit record; returns 0 if its checksum holds
+ */
+static int merkle_file_get_commit(const uint8_t* header, int which, uint64_t* seq,
+                                  size_t* size, uint8_t root[32]) {
+    const uint8_t* rec = header + MF_OFF_COMMIT + which * MF_COMMIT_SIZE;
+    uint8_t check[32];
+
+    sm3_hash(rec, MF_REC_BODY, check);
+    if (memcmp(check, rec + MF_REC_CHECK, 32) != 0) {
+        return -1;
+    }
+    *seq = get64(rec + MF_REC_SEQ);
+    *size = (size_t)get64(rec + MF_REC_SIZE);
+    memcpy(root, rec + MF_REC_ROOT, 32);
+    return 0;
+}
+
+/**
+ * Open a file at its newest valid commit
+ * Cost is independent of the size: map, rebuild the right edge, compare
+ * its root with the recorded one. Uncommitted slots past the size are
+ * overwritten by the next append.
+ */
+merkle_file_t* merkle_file_open(const char* path, int writable) {
+    merkle_file_t* mf = calloc(1, sizeof(merkle_file_t));
+    uint8_t header[MERKLE_FILE_HEADER_SIZE];
+    uint8_t root[2][32];
+    uint64_t seq[2];
+    size_t size[2];
+    int valid[2];
+    struct stat st;
+
+    if (!mf) {
+        return NULL;
+    }
+    mf->writable = writable;
+    mf->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (mf->fd < 0) {
+        free(mf);
+        return NULL;
+    }
+    if ((writable && flock(mf->fd, LOCK_EX | LOCK_NB) != 0) || fstat(mf->fd, &st) != 0 ||
+        pread(mf->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header + MF_OFF_MAGIC, MERKLE_FILE_MAGIC, 8) != 0 ||
+        get32(header + MF_OFF_VERSION) != MERKLE_FILE_VERSION ||
+        get32(header + MF_OFF_HEADER) != MERKLE_FILE_HEADER_SIZE) {
+        goto fail;
+    }
+
+    // Bounded before the layout is computed: a crafted capacity must not
+    // wrap the file length below the real size and pass the check after it
+    uint64_t capacity = get64(header + MF_OFF_CAPACITY);
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        capacity > MERKLE_FILE_MAX_CAPACITY) {
+        goto fail;
+    }
+    mf->capacity = (size_t)capacity;
+    mf->map_len = merkle_file_length(mf->capacity);
+    if ((size_t)st.st_size < mf->map_len) {
+        goto fail;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        valid[i] = merkle_file_get_commit(header, i, &seq[i], &size[i], root[i]) == 0 &&
+                   size[i] <= mf->capacity;
+    }
+    if (!valid[0] && !valid[1]) {
+        goto fail;
+    }
+    int use = valid[1] && (!valid[0] || seq[1] > seq[0]);
+    if (merkle_file_map(mf) != 0) {
+        goto fail;
+    }
+    mf->seq = seq[use];
+    mf->leaf_count = size[use];
+    mf->synced = size[use];
+    if (memcmp(merkle_file_root_or_zero(mf), root[use], 32) != 0) {
+        errno = EIO;
+        goto fail;
+    }
+    mf->path = strdup(path);
+    if (!mf->path) {
+        goto fail;
+    }
+    return mf;
+
+fail:
+    if (mf->map) {
+        munmap(mf->map, mf->map_len);
+    }
+    close(mf->fd);
+    free(mf);
+    return NULL;
+}
+
+/**
+ * Move to a file of a larger capacity: the levels are copied up to the
+ * current right edge and committed, then the new file replaces the old one
+ * by rename(), so a crash leaves one or the other
+ */
+static int merkle_file_grow(merkle_file_t* mf, size_t capacity) {
+    size_t len = strlen(mf->path);
+    char* tmp = malloc(len + sizeof(".grow"));
+    size_t n = mf->leaf_count;
+
+    if (!tmp) {
+        return -1;
+    }
+    memcpy(tmp, mf->path, len);
+    memcpy(tmp + len, ".grow", sizeof(".grow"));
+
+    merkle_file_refresh(mf);
+    merkle_file_t* next = merkle_file_create_at(tmp, capacity);
+    if (!next) {
+        free(tmp);
+        return -1;
+    }
+    for (int k = 0; k < mf->view.num_levels; k++) {
+        memcpy(next->levels[k], mf->levels[k], mf->view.level_size[k] * 32);
+    }
+    next->leaf_count = n;
+    next->seq = mf->seq;
+    if (merkle_file_commit(next) != 0 || rename(tmp, mf->path) != 0) {
+        munmap(next->map, next->map_len);
+        close(next->fd);
+        free(next);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+
+    // Make the rename itself durable
+    char* slash = strrchr(mf->path, '/');
+    int dir;
+    if (slash) {
+        *slash = '\0';
+        dir = open(slash == mf->path ? "/" : mf->path, O_RDONLY);
+        *slash = '/';
+    } else {
+        dir = open(".", O_RDONLY);
+    }
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+
+    munmap(mf->map, mf->map_len);
+    close(mf->fd);
+    mf->fd = next->fd;
+    mf->map = next->map;
+    mf->map_len = next->map_len;
+    mf->capacity = next->capacity;
+    mf->capacity_levels = next->capacity_levels;
+    memcpy(mf->levels, next->levels, sizeof(mf->levels));
+    mf->seq = next->seq;
+    mf->synced = n;
+    mf->edge_valid = 0;
+    free(next);
+    return 0;
+}
+
+/**
+ * Append leaf hashes; each level's newly completed slots are hashed in one
+ * multi-buffer batch, so a bulk append costs about one node hash per leaf.
+ * Not durable until merkle_file_commit() (growing the file commits).
+ */
+int merkle_file_append_hashes(merkle_file_t* mf, uint8_t (*leaf_hashes)[32], size_t count) {
+    size_t old = mf->leaf_count;
+    size_t n = old + count;
+
+    if (!mf->writable || n < old) {
+        return -1;
+    }
+    if (n > mf->capacity) {
+        size_t capacity = mf->capacity;
+        while (capacity < n) {
+            if (capacity > MERKLE_FILE_MAX_CAPACITY / 2) {
+                return -1;
+            }
+            capacity <<= 1;
+        }
+        if (merkle_file_grow(mf, capacity) != 0) {
+            return -1;
+        }
+    }
+
+    memcpy(mf->levels[0][old], leaf_hashes, count * 32);
+    for (int k = 1; k < mf->capacity_levels; k++) {
+        size_t lo = old >> k;
+        size_t hi = n >> k;
+        uint8_t (*below)[32] = mf->levels[k - 1];
+
+        if (lo == hi) {
+            continue;
+        }
+        if (hi - lo == 1) {
+            hash_nodes(below[2 * lo], below[2 * lo + 1], mf->levels[k][lo]);
+        } else {
+            hash_nodes_batch(below + 2 * lo, hi - lo, mf->levels[k] + lo);
+        }
+    }
+    mf->leaf_count = n;
+    mf->edge_valid = 0;
+    return 0;
+}
+
+int merkle_file_append(merkle_file_t* mf, const uint8_t* data, size_t data_len) {
+    uint8_t hash[1][32];
+
+    hash_leaf(data, data_len, hash[0]);
+    return merkle_file_append_hashes(mf, hash, 1);
+}
+
+size_t merkle_file_size(const merkle_file_t* mf) {
+    return mf->leaf_count;
+}
+
+/**
+ * Tree view over the mapping, at the current (not necessarily committed)
+ * size; valid until the next append, commit or close
+ */
+const merkle_tree_t* merkle_file_tree(merkle_file_t* mf) {
+    merkle_file_refresh(mf);
+    return &mf->view;
+}
+
+/**
+ * Copy a built in-memory tree into a new file, committed
+ */
+int merkle_file_save(const merkle_tree_t* tree, const char* path) {
+    if (tree->num_levels == 0) {
+        return -1;
+    }
+    merkle_file_t* mf = merkle_file_create(path, tree->leaf_count);
+    if (!mf) {
+        return -1;
+    }
+    for (int k = 0; k < tree->num_levels; k++) {
+        memcpy(mf->levels[k], tree->levels[k], tree->level_size[k] * 32);
+    }
+    mf->leaf_count = tree->leaf_count;
+    mf->edge_valid = 0;
+    int ret = merkle_file_commit(mf);
+    return merkle_file_close(mf) != 0 ? -1 : ret;
+}
+
+/**
+ * Close a file, committing pending appends of a writable one
+ * Returns 0, or -1 if that final commit failed and the appends since the
+ * last successful commit may not be durable
+ */
+int merkle_file_close(merkle_file_t* mf) {
+    int ret = 0;
+
+    if (!mf) return 0;
+
+    if (mf->writable && mf->path && mf->leaf_count != mf->synced) {
+        ret = merkle_file_commit(mf);
+    }
+    munmap(mf->map, mf->map_len);
+    close(mf->fd);
+    free(mf->path);
+    free(mf);
+    return ret;
+}
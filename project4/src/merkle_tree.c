@@ -4,119 +4,109 @@
  * This file implements a large-scale Merkle tree construction based on RFC 6962
  * specifications for Certificate Transparency. Supports:
  * - Efficient construction of trees with 100,000+ leaf nodes
+ * - Append-only logging with O(log n) root updates
  * - Inclusion proofs (proving a leaf exists in the tree)
  * - Consistency proofs (proving tree consistency across versions)
- * - Non-inclusion proofs (proving a leaf does not exist)
+ * - Non-inclusion proofs through the sparse tree in sparse_merkle.c
+ * - Persistence through the memory-mapped file format in merkle_file.c
  * 
  * Performance optimizations:
- * - Memory-efficient tree representation
- * - Parallel hash computation
+ * - Flat level-ordered hash arrays: 32 bytes per node, no per-node allocation
+ * - Parallel hash computation on the shared work-stealing pool, each level
+ *   hashed a SIMD lane per node
  * - Optimized proof generation
  */
 
-#include "sm3.h"
+#define _DEFAULT_SOURCE
+
+#include "merkle_tree.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <pthread.h>
-#include <math.h>
 #include <time.h>
 
-#define MAX_TREE_HEIGHT 64
 #define LEAF_PREFIX 0x00
 #define NODE_PREFIX 0x01
 
-/**
- * Merkle tree node structure
- */
-typedef struct merkle_node {
-    uint8_t hash[32];           // SM3 hash of the node
-    struct merkle_node* left;   // Left child
-    struct merkle_node* right;  // Right child
-    size_t leaf_count;          // Number of leaves in this subtree
-    int height;                 // Height of this node
-} merkle_node_t;
+// Node pairs per pool task when hashing one tree level
+#define MERKLE_LEVEL_GRAIN 1024
+
+// Bulk leaf hashing: leaves per pool task, leaves per multi-buffer call,
+// and the size above which a leaf is streamed instead of copied behind
+// its 0x00 prefix
+#define MERKLE_LEAF_GRAIN   512
+#define MERKLE_LEAF_BATCH   (4 * SM3_MB_MAX_LANES)
+#define MERKLE_LEAF_COPY_MAX 4096
+
+// Most leaves a tree can hold: leaf and interior arrays are 32-byte hashes,
+// so any count up to this has a byte size that fits in size_t
+#define MERKLE_MAX_LEAVES (SIZE_MAX / 32)
 
 /**
- * Merkle tree structure
+ * One tree level being reduced into the next
  */
 typedef struct {
-    merkle_node_t* root;        // Root node
-    size_t leaf_count;          // Total number of leaves
-    size_t tree_size;           // Total number of nodes
-    uint8_t** leaf_hashes;      // Array of leaf hashes for quick access
-    size_t capacity;            // Allocated capacity for leaves
-} merkle_tree_t;
+    uint8_t (*current)[32];
+    uint8_t (*next)[32];
+    size_t current_count;
+} level_job_t;
 
 /**
- * Merkle proof structure
+ * One proof's step at a tree level in batch verification: the children of
+ * parent as that proof claims them
  */
 typedef struct {
-    uint8_t** path;             // Array of hashes in the proof path
-    int* directions;            // Array indicating left (0) or right (1)
-    size_t path_length;         // Length of the proof path
-    size_t leaf_index;          // Index of the leaf being proven
-    size_t tree_size;           // Size of the tree when proof was generated
-} merkle_proof_t;
+    size_t parent;              // node index one level up
+    uint8_t pair[64];           // left || right
+    size_t proof;
+} verify_step_t;
 
 /**
- * Thread data for parallel tree construction
+ * Leaves being hashed into a slice of level 0
  */
 typedef struct {
-    merkle_node_t** nodes;      // Array of nodes to process
-    size_t start_index;         // Starting index for this thread
-    size_t end_index;           // Ending index for this thread
-    int level;                  // Current level being processed
-} thread_data_t;
+    const uint8_t* const* datas;
+    const size_t* lens;
+    uint8_t (*hashes)[32];
+} leaf_job_t;
+
+// Wall-clock seconds; parallel phases would be overstated by clock()
+static double merkle_now(void) {
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
 /**
  * Initialize empty Merkle tree
+ * Leaf hashes live in one array that grows on demand
  */
 merkle_tree_t* merkle_tree_init(size_t initial_capacity) {
-    merkle_tree_t* tree = malloc(sizeof(merkle_tree_t));
-    if (!tree) return NULL;
+    if (initial_capacity > MERKLE_MAX_LEAVES) return NULL;
     
-    tree->root = NULL;
-    tree->leaf_count = 0;
-    tree->tree_size = 0;
-    tree->capacity = initial_capacity;
+    merkle_tree_t* tree = calloc(1, sizeof(merkle_tree_t));
+    if (!tree) return NULL;
     
-    tree->leaf_hashes = malloc(initial_capacity * sizeof(uint8_t*));
-    if (!tree->leaf_hashes) {
+    tree->capacity = initial_capacity ? initial_capacity : 1;
+    tree->levels[0] = malloc(tree->capacity * sizeof(*tree->levels[0]));
+    if (!tree->levels[0]) {
         free(tree);
         return NULL;
     }
     
-    for (size_t i = 0; i < initial_capacity; i++) {
-        tree->leaf_hashes[i] = malloc(32);
-        if (!tree->leaf_hashes[i]) {
-            // Cleanup on failure
-            for (size_t j = 0; j < i; j++) {
-                free(tree->leaf_hashes[j]);
-            }
-            free(tree->leaf_hashes);
-            free(tree);
-            return NULL;
-        }
-    }
-    
     return tree;
 }
 
 /**
- * Create a new Merkle tree node
+ * Free a tree: one leaf array and one interior arena, whatever its size
  */
-merkle_node_t* merkle_node_create(const uint8_t hash[32]) {
-    merkle_node_t* node = malloc(sizeof(merkle_node_t));
-    if (!node) return NULL;
-    
-    memcpy(node->hash, hash, 32);
-    node->left = NULL;
-    node->right = NULL;
-    node->leaf_count = 1;
-    node->height = 0;
+void merkle_tree_free(merkle_tree_t* tree) {
+    if (!tree) return;
     
-    return node;
+    free(tree->levels[0]);
+    free(tree->nodes);
+    free(tree);
 }
 
 /**
@@ -124,7 +114,7 @@ merkle_node_t* merkle_node_create(const uint8_t hash[32]) {
  * MTH({d(0)}) = Hash(0x00 || d(0))
  */
 void hash_leaf(const uint8_t* data, size_t data_len, uint8_t hash[32]) {
-    sm3_context_t ctx;
+    sm3_ctx_t ctx;
     sm3_init(&ctx);
     
     uint8_t prefix = LEAF_PREFIX;
@@ -139,7 +129,7 @@ void hash_leaf(const uint8_t* data, size_t data_len, uint8_t hash[32]) {
  * MTH(D[n]) = Hash(0x01 || MTH(D[0:k]) || MTH(D[k:n]))
  */
 void hash_nodes(const uint8_t left_hash[32], const uint8_t right_hash[32], uint8_t hash[32]) {
-    sm3_context_t ctx;
+    sm3_ctx_t ctx;
     sm3_init(&ctx);
     
     uint8_t prefix = NODE_PREFIX;
@@ -150,51 +140,270 @@ void hash_nodes(const uint8_t left_hash[32], const uint8_t right_hash[32], uint8
     sm3_final(&ctx, hash);
 }
 
+/**
+ * parents[i] = SM3(0x01 || children[2i] || children[2i+1]) for i < count
+ * A node message is always 65 bytes, i.e. exactly two blocks whose padding
+ * never changes: each lane's blocks are laid out once from a template and
+ * only the 64 child bytes are copied in per node, then the widest
+ * multi-buffer kernel compresses a node per lane.
+ */
+void hash_nodes_batch(uint8_t (*children)[32], size_t count, uint8_t (*parents)[32]) {
+    static const uint64_t node_bits = (1 + 64) * 8;
+    uint8_t blocks[SM3_MB_MAX_LANES][2 * SM3_BLOCK_SIZE];
+    uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES];
+    const uint8_t* data[SM3_MB_MAX_LANES];
+    size_t lanes;
+    sm3_mb_kernel_t kernel = sm3_mb_best_kernel(&lanes);
+    
+    memset(blocks, 0, sizeof(blocks));
+    for (size_t l = 0; l < SM3_MB_MAX_LANES; l++) {
+        blocks[l][0] = NODE_PREFIX;
+        blocks[l][65] = 0x80;
+        for (int i = 0; i < 8; i++) {
+            blocks[l][2 * SM3_BLOCK_SIZE - 1 - i] = (uint8_t)(node_bits >> (8 * i));
+        }
+        data[l] = blocks[l];
+    }
+    
+    for (size_t base = 0; base < count; base += lanes) {
+        size_t n = count - base < lanes ? count - base : lanes;
+        
+        // Idle lanes of a short last batch hash stale blocks, ignored below
+        for (size_t l = 0; l < n; l++) {
+            memcpy(blocks[l] + 1, children[2 * (base + l)], 64);
+        }
+        for (int i = 0; i < SM3_STATE_SIZE; i++) {
+            for (size_t l = 0; l < lanes; l++) {
+                state[i][l] = sm3_iv[i];
+            }
+        }
+        kernel(state, data, 2);
+        for (size_t l = 0; l < n; l++) {
+            for (int i = 0; i < SM3_STATE_SIZE; i++) {
+                parents[base + l][4 * i] = (uint8_t)(state[i][l] >> 24);
+                parents[base + l][4 * i + 1] = (uint8_t)(state[i][l] >> 16);
+                parents[base + l][4 * i + 2] = (uint8_t)(state[i][l] >> 8);
+                parents[base + l][4 * i + 3] = (uint8_t)state[i][l];
+            }
+        }
+    }
+}
+
+/**
+ * Leaf capacity for needed leaves: capacity doubled until it fits, never
+ * past MERKLE_MAX_LEAVES; 0 if needed itself is past it
+ */
+static size_t merkle_grow_capacity(size_t capacity, size_t needed) {
+    if (needed > MERKLE_MAX_LEAVES) {
+        return 0;
+    }
+    while (capacity < needed) {
+        capacity = capacity > MERKLE_MAX_LEAVES / 2 ? MERKLE_MAX_LEAVES : capacity * 2;
+    }
+    return capacity;
+}
+
 /**
  * Add a leaf to the Merkle tree
+ * The tree must be rebuilt before its root or proofs are used again
  */
 int merkle_tree_add_leaf(merkle_tree_t* tree, const uint8_t* data, size_t data_len) {
     if (tree->leaf_count >= tree->capacity) {
-        return -1; // Tree is full
+        size_t capacity = merkle_grow_capacity(tree->capacity, tree->leaf_count + 1);
+        if (capacity == 0) {
+            return -1;
+        }
+        uint8_t (*leaves)[32] = realloc(tree->levels[0], capacity * sizeof(*leaves));
+        if (!leaves) {
+            return -1;
+        }
+        tree->levels[0] = leaves;
+        tree->capacity = capacity;
     }
     
     // Hash the leaf data
-    hash_leaf(data, data_len, tree->leaf_hashes[tree->leaf_count]);
+    hash_leaf(data, data_len, tree->levels[0][tree->leaf_count]);
     tree->leaf_count++;
+    tree->num_levels = 0;
     
     return 0;
 }
 
 /**
- * Thread worker for parallel hash computation
+ * Pool task: leaf hashes [begin, end)
+ * Leaves are copied behind their prefix into one scratch buffer per batch
+ * so the multi-buffer manager hashes a leaf per lane; the buffer is reused
+ * across batches, never allocated per leaf
  */
-void* hash_level_worker(void* arg) {
-    thread_data_t* data = (thread_data_t*)arg;
+static void hash_leaf_range(void* ctx, size_t begin, size_t end) {
+    leaf_job_t* job = (leaf_job_t*)ctx;
+    const uint8_t* msgs[MERKLE_LEAF_BATCH];
+    size_t lens[MERKLE_LEAF_BATCH];
+    size_t index[MERKLE_LEAF_BATCH];
+    uint8_t digests[MERKLE_LEAF_BATCH][SM3_DIGEST_SIZE];
+    uint8_t* scratch = NULL;
+    size_t scratch_size = 0;
+    size_t i = begin;
     
-    for (size_t i = data->start_index; i < data->end_index; i += 2) {
-        if (data->nodes[i] && data->nodes[i + 1]) {
-            // Hash two nodes together
-            uint8_t combined_hash[32];
-            hash_nodes(data->nodes[i]->hash, data->nodes[i + 1]->hash, combined_hash);
-            
-            // Create parent node
-            merkle_node_t* parent = merkle_node_create(combined_hash);
-            if (parent) {
-                parent->left = data->nodes[i];
-                parent->right = data->nodes[i + 1];
-                parent->leaf_count = data->nodes[i]->leaf_count + data->nodes[i + 1]->leaf_count;
-                parent->height = 1 + (data->nodes[i]->height > data->nodes[i + 1]->height ? 
-                                     data->nodes[i]->height : data->nodes[i + 1]->height);
-                
-                data->nodes[i / 2] = parent;
+    while (i < end) {
+        size_t count = 0;
+        size_t bytes = 0;
+        size_t stop = i;
+        
+        // Gather a batch of short leaves; long ones are streamed on the spot
+        for (; stop < end && count < MERKLE_LEAF_BATCH; stop++) {
+            if (job->lens[stop] > MERKLE_LEAF_COPY_MAX) {
+                hash_leaf(job->datas[stop], job->lens[stop], job->hashes[stop]);
+                continue;
+            }
+            index[count] = stop;
+            lens[count++] = job->lens[stop] + 1;
+            bytes += job->lens[stop] + 1;
+        }
+        if (bytes > scratch_size) {
+            uint8_t* grown = realloc(scratch, bytes);
+            if (!grown) {
+                // Out of memory: hash this batch one leaf at a time
+                for (size_t j = 0; j < count; j++) {
+                    hash_leaf(job->datas[index[j]], lens[j] - 1, job->hashes[index[j]]);
+                }
+                i = stop;
+                continue;
             }
-        } else if (data->nodes[i]) {
-            // Odd node, promote to next level
-            data->nodes[i / 2] = data->nodes[i];
+            scratch = grown;
+            scratch_size = bytes;
+        }
+        
+        uint8_t* p = scratch;
+        for (size_t j = 0; j < count; j++) {
+            p[0] = LEAF_PREFIX;
+            if (lens[j] > 1) {
+                memcpy(p + 1, job->datas[index[j]], lens[j] - 1);
+            }
+            msgs[j] = p;
+            p += lens[j];
+        }
+        sm3_hash_mb(msgs, lens, count, digests);
+        for (size_t j = 0; j < count; j++) {
+            memcpy(job->hashes[index[j]], digests[j], 32);
+        }
+        i = stop;
+    }
+    free(scratch);
+}
+
+/**
+ * Add n leaves at once, hashed in parallel on the shared pool
+ * Storage grows geometrically in one step for the whole batch. On failure
+ * no leaf is added. The tree must be rebuilt as after merkle_tree_add_leaf().
+ */
+int merkle_tree_add_leaves(merkle_tree_t* tree, const uint8_t* const datas[],
+                           const size_t lens[], size_t n) {
+    size_t needed = tree->leaf_count + n;
+    
+    if (needed < tree->leaf_count) {
+        return -1;
+    }
+    if (needed > tree->capacity) {
+        size_t capacity = merkle_grow_capacity(tree->capacity, needed);
+        if (capacity == 0) {
+            return -1;
+        }
+        uint8_t (*leaves)[32] = realloc(tree->levels[0], capacity * sizeof(*leaves));
+        if (!leaves) {
+            return -1;
+        }
+        tree->levels[0] = leaves;
+        tree->capacity = capacity;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    
+    leaf_job_t job;
+    job.datas = datas;
+    job.lens = lens;
+    job.hashes = tree->levels[0] + tree->leaf_count;
+    sm3_parallel_for(NULL, 0, n, MERKLE_LEAF_GRAIN, hash_leaf_range, &job);
+    
+    tree->leaf_count = needed;
+    tree->num_levels = 0;
+    return 0;
+}
+
+/**
+ * Fold leaves [frontier_size, leaf_count) into the frontier
+ * Appending leaf n merges one frontier slot per trailing one bit of n, so
+ * each leaf costs one node hash amortised and at most log2(n) in the worst case
+ */
+static void merkle_frontier_advance(merkle_tree_t* tree) {
+    while (tree->frontier_size < tree->leaf_count) {
+        size_t n = tree->frontier_size;
+        uint8_t hash[32];
+        int k = 0;
+        
+        memcpy(hash, tree->levels[0][n], 32);
+        for (; n & 1; n >>= 1, k++) {
+            hash_nodes(tree->frontier[k], hash, hash);
+        }
+        memcpy(tree->frontier[k], hash, 32);
+        tree->frontier_size++;
+    }
+}
+
+/**
+ * Append a leaf and fold it into the frontier straight away
+ */
+int merkle_tree_append(merkle_tree_t* tree, const uint8_t* data, size_t data_len) {
+    if (merkle_tree_add_leaf(tree, data, data_len) != 0) {
+        return -1;
+    }
+    merkle_frontier_advance(tree);
+    return 0;
+}
+
+/**
+ * RFC 6962 root of all leaves added so far, built or not
+ * The perfect subtrees are joined right to left: the smallest one is the
+ * innermost right child, exactly where the split at 2^k puts it
+ */
+int merkle_tree_current_root(merkle_tree_t* tree, uint8_t root[32]) {
+    if (tree->leaf_count == 0) {
+        return -1;
+    }
+    merkle_frontier_advance(tree);
+    
+    size_t n = tree->frontier_size;
+    int k = 0;
+    while (!(n & 1)) {
+        n >>= 1;
+        k++;
+    }
+    memcpy(root, tree->frontier[k], 32);
+    for (n >>= 1, k++; n; n >>= 1, k++) {
+        if (n & 1) {
+            hash_nodes(tree->frontier[k], root, root);
         }
     }
+    return 0;
+}
+
+/**
+ * Pool task: parents [begin, end) of one level
+ */
+static void hash_level_range(void* ctx, size_t begin, size_t end) {
+    level_job_t* job = (level_job_t*)ctx;
+    size_t pairs = job->current_count / 2;
+    size_t full_end = end < pairs ? end : pairs;
     
-    return NULL;
+    // Children 2p and 2p+1 sit next to each other, so pairs hash in place
+    if (begin < full_end) {
+        hash_nodes_batch(job->current + 2 * begin, full_end - begin, job->next + begin);
+    }
+    if (end > pairs) {
+        // Odd node, promote to next level
+        memcpy(job->next[pairs], job->current[2 * pairs], 32);
+    }
 }
 
 /**
@@ -205,78 +414,90 @@ int merkle_tree_build(merkle_tree_t* tree) {
         return -1;
     }
     
-    // Create leaf nodes
-    merkle_node_t** current_level = malloc(tree->leaf_count * sizeof(merkle_node_t*));
-    if (!current_level) return -1;
-    
-    for (size_t i = 0; i < tree->leaf_count; i++) {
-        current_level[i] = merkle_node_create(tree->leaf_hashes[i]);
-        if (!current_level[i]) {
-            // Cleanup on failure
-            for (size_t j = 0; j < i; j++) {
-                free(current_level[j]);
-            }
-            free(current_level);
+    // All interior levels share one arena: n/2 + n/4 + ... < n hashes, so
+    // its byte size fits whenever the leaf array's does
+    size_t interior = 0;
+    for (size_t count = tree->leaf_count; count > 1; count = (count + 1) / 2) {
+        interior += (count + 1) / 2;
+    }
+    if (interior > tree->node_capacity) {
+        uint8_t (*nodes)[32] = realloc(tree->nodes, interior * sizeof(*nodes));
+        if (!nodes) {
             return -1;
         }
+        tree->nodes = nodes;
+        tree->node_capacity = interior;
     }
     
-    size_t current_count = tree->leaf_count;
-    int num_threads = 4; // Use 4 threads for parallel processing
+    tree->level_size[0] = tree->leaf_count;
+    int level = 0;
+    size_t offset = 0;
     
-    // Build tree level by level
-    while (current_count > 1) {
-        size_t next_count = (current_count + 1) / 2;
-        merkle_node_t** next_level = malloc(next_count * sizeof(merkle_node_t*));
-        if (!next_level) {
-            free(current_level);
-            return -1;
-        }
+    // Build tree level by level on the shared pool; parents go to the next
+    // level's slice, so pieces never read what another piece writes
+    while (tree->level_size[level] > 1) {
+        size_t next_count = (tree->level_size[level] + 1) / 2;
+        level_job_t job;
         
-        memset(next_level, 0, next_count * sizeof(merkle_node_t*));
+        tree->levels[level + 1] = tree->nodes + offset;
+        tree->level_size[level + 1] = next_count;
+        offset += next_count;
         
-        // Determine work distribution for threads
-        size_t work_per_thread = (current_count + num_threads - 1) / num_threads;
-        work_per_thread = (work_per_thread + 1) & ~1; // Make even for pairing
-        
-        pthread_t threads[num_threads];
-        thread_data_t thread_data[num_threads];
-        
-        // Launch threads
-        for (int t = 0; t < num_threads; t++) {
-            thread_data[t].nodes = current_level;
-            thread_data[t].start_index = t * work_per_thread;
-            thread_data[t].end_index = (t + 1) * work_per_thread;
-            if (thread_data[t].end_index > current_count) {
-                thread_data[t].end_index = current_count;
-            }
-            
-            if (thread_data[t].start_index < current_count) {
-                pthread_create(&threads[t], NULL, hash_level_worker, &thread_data[t]);
-            }
-        }
+        job.current = tree->levels[level];
+        job.next = tree->levels[level + 1];
+        job.current_count = tree->level_size[level];
+        sm3_parallel_for(NULL, 0, next_count, MERKLE_LEVEL_GRAIN, hash_level_range, &job);
+        level++;
+    }
+    
+    tree->num_levels = level + 1;
+    return 0;
+}
+
+const uint8_t* merkle_tree_root(const merkle_tree_t* tree) {
+    if (tree->num_levels == 0) {
+        return NULL;
+    }
+    return tree->levels[tree->num_levels - 1][0];
+}
+
+const uint8_t* merkle_tree_leaf_hash(const merkle_tree_t* tree, size_t leaf_index) {
+    if (leaf_index >= tree->leaf_count) {
+        return NULL;
+    }
+    return tree->levels[0][leaf_index];
+}
+
+/**
+ * Write the audit path of a leaf into caller buffers (leaf to root)
+ * Walks up the levels by index: the sibling of node i is i ^ 1, and a node
+ * without one was promoted unchanged, so that level adds nothing to the path
+ */
+int merkle_tree_inclusion_path(const merkle_tree_t* tree, size_t leaf_index,
+                               uint8_t (*path)[32], int* directions, size_t max_path,
+                               size_t* path_length) {
+    if (leaf_index >= tree->leaf_count || tree->num_levels == 0) {
+        return -1;
+    }
+    
+    size_t length = 0;
+    size_t index = leaf_index;
+    for (int level = 0; level + 1 < tree->num_levels; level++, index >>= 1) {
+        size_t sibling = index ^ 1;
         
-        // Wait for threads to complete
-        for (int t = 0; t < num_threads; t++) {
-            if (thread_data[t].start_index < current_count) {
-                pthread_join(threads[t], NULL);
-            }
+        if (sibling >= tree->level_size[level]) {
+            continue;
         }
-        
-        // Copy results to next level
-        for (size_t i = 0; i < next_count; i++) {
-            next_level[i] = current_level[i];
+        if (length >= max_path) {
+            return -1;
         }
-        
-        free(current_level);
-        current_level = next_level;
-        current_count = next_count;
+        memcpy(path[length], tree->levels[level][sibling], 32);
+        // Odd index: the sibling sits on the left
+        directions[length] = (index & 1) ? 0 : 1;
+        length++;
     }
     
-    tree->root = current_level[0];
-    tree->tree_size = tree->leaf_count;
-    
-    free(current_level);
+    *path_length = length;
     return 0;
 }
 
@@ -284,81 +505,50 @@ int merkle_tree_build(merkle_tree_t* tree) {
  * Generate inclusion proof for a leaf at given index
  */
 merkle_proof_t* merkle_tree_generate_inclusion_proof(merkle_tree_t* tree, size_t leaf_index) {
-    if (leaf_index >= tree->leaf_count || !tree->root) {
+    if (leaf_index >= tree->leaf_count || tree->num_levels == 0) {
         return NULL;
     }
     
     merkle_proof_t* proof = malloc(sizeof(merkle_proof_t));
     if (!proof) return NULL;
     
-    // Calculate maximum possible path length
-    size_t max_path_length = (size_t)ceil(log2(tree->leaf_count));
+    // One extra slot keeps the allocations non-empty for a one-leaf tree
+    size_t max_path_length = (size_t)tree->num_levels;
     
-    proof->path = malloc(max_path_length * sizeof(uint8_t*));
+    proof->path = malloc(max_path_length * sizeof(*proof->path));
     proof->directions = malloc(max_path_length * sizeof(int));
     proof->path_length = 0;
     proof->leaf_index = leaf_index;
     proof->tree_size = tree->leaf_count;
     
-    if (!proof->path || !proof->directions) {
-        free(proof->path);
-        free(proof->directions);
-        free(proof);
+    if (!proof->path || !proof->directions ||
+        merkle_tree_inclusion_path(tree, leaf_index, proof->path, proof->directions,
+                                   max_path_length, &proof->path_length) != 0) {
+        merkle_proof_free(proof);
         return NULL;
     }
     
-    // Allocate memory for hash values
-    for (size_t i = 0; i < max_path_length; i++) {
-        proof->path[i] = malloc(32);
-        if (!proof->path[i]) {
-            // Cleanup on failure
-            for (size_t j = 0; j < i; j++) {
-                free(proof->path[j]);
-            }
-            free(proof->path);
-            free(proof->directions);
-            free(proof);
-            return NULL;
-        }
-    }
-    
-    // Traverse tree to collect proof path
-    merkle_node_t* current = tree->root;
-    size_t current_index = leaf_index;
-    size_t current_range = tree->leaf_count;
-    
-    while (current && current->left && current->right) {
-        size_t left_range = current->left->leaf_count;
-        
-        if (current_index < left_range) {
-            // Target is in left subtree, so we need right sibling hash
-            memcpy(proof->path[proof->path_length], current->right->hash, 32);
-            proof->directions[proof->path_length] = 1; // Right sibling
-            current = current->left;
-        } else {
-            // Target is in right subtree, so we need left sibling hash
-            memcpy(proof->path[proof->path_length], current->left->hash, 32);
-            proof->directions[proof->path_length] = 0; // Left sibling
-            current = current->right;
-            current_index -= left_range;
-        }
-        
-        proof->path_length++;
-        current_range = current->leaf_count;
-    }
-    
     return proof;
 }
 
+void merkle_proof_free(merkle_proof_t* proof) {
+    if (!proof) return;
+    
+    free(proof->path);
+    free(proof->directions);
+    free(proof);
+}
+
 /**
  * Verify inclusion proof
  */
 int merkle_tree_verify_inclusion_proof(merkle_proof_t* proof, const uint8_t leaf_hash[32], 
                                       const uint8_t root_hash[32]) {
-    if (!proof || proof->path_length == 0) {
+    if (!proof) {
         return 0;
     }
     
+    // An empty path proves the only leaf of a one-leaf tree
     uint8_t computed_hash[32];
     memcpy(computed_hash, leaf_hash, 32);
     
@@ -381,69 +571,419 @@ int merkle_tree_verify_inclusion_proof(merkle_proof_t* proof, const uint8_t leaf
     return memcmp(computed_hash, root_hash, 32) == 0;
 }
 
+static int verify_step_compare(const void* a, const void* b) {
+    const verify_step_t* x = (const verify_step_t*)a;
+    const verify_step_t* y = (const verify_step_t*)b;
+    
+    if (x->parent != y->parent) {
+        return x->parent < y->parent ? -1 : 1;
+    }
+    return memcmp(x->pair, y->pair, 64);
+}
+
+/**
+ * Verify many inclusion proofs against one root of a tree_size-leaf tree
+ * All proofs climb the tree together a level at a time. Steps are sorted
+ * by (parent, children) so each distinct node is hashed once however many
+ * proofs pass through it, and each level's distinct nodes go through
+ * hash_nodes_batch. Hashing work is the size of the union of the paths.
+ *
+ * Stricter than merkle_tree_verify_inclusion_proof(): a proof must match
+ * the shape its leaf_index and tree_size dictate (length and directions),
+ * since its steps are keyed by position. Proofs that disagree on a shared
+ * node are hashed separately, so one bad proof cannot affect another.
+ * results[i] is 1 if proof i verifies; returns the number that do.
+ */
+size_t merkle_tree_verify_inclusion_batch(size_t tree_size, merkle_proof_t* const proofs[],
+                                          uint8_t (*leaf_hashes)[32], size_t count,
+                                          const uint8_t root[32], int* results) {
+    verify_step_t* steps = malloc(count * sizeof(*steps));
+    uint8_t (*values)[32] = malloc(count * 4 * sizeof(*values));
+    size_t* pos = malloc(count * 2 * sizeof(size_t));
+    size_t verified = 0;
+    
+    if (!steps || !values || !pos) {
+        // Out of memory: fall back to one proof at a time
+        for (size_t i = 0; i < count; i++) {
+            results[i] = proofs[i] && proofs[i]->tree_size == tree_size &&
+                merkle_tree_verify_inclusion_proof(proofs[i], leaf_hashes[i], root);
+            verified += results[i];
+        }
+        free(steps);
+        free(values);
+        free(pos);
+        return verified;
+    }
+    // Per proof current node, then up to count distinct child pairs and parents
+    uint8_t (*pairs)[32] = values + count;
+    size_t* used = pos + count;
+    
+    for (size_t i = 0; i < count; i++) {
+        results[i] = proofs[i] && proofs[i]->tree_size == tree_size &&
+                     proofs[i]->leaf_index < tree_size;
+        if (results[i]) {
+            memcpy(values[i], leaf_hashes[i], 32);
+            pos[i] = proofs[i]->leaf_index;
+            used[i] = 0;
+        }
+    }
+    
+    for (size_t size = tree_size; size > 1; size = (size + 1) / 2) {
+        size_t m = 0;
+        
+        for (size_t i = 0; i < count; i++) {
+            if (!results[i]) {
+                continue;
+            }
+            size_t x = pos[i];
+            const merkle_proof_t* proof = proofs[i];
+            
+            pos[i] = x >> 1;
+            if ((x ^ 1) >= size) {
+                // Promoted: no sibling at this level
+                continue;
+            }
+            if (used[i] >= proof->path_length ||
+                proof->directions[used[i]] != ((x & 1) ? 0 : 1)) {
+                results[i] = 0;
+                continue;
+            }
+            verify_step_t* step = &steps[m++];
+            step->parent = x >> 1;
+            step->proof = i;
+            memcpy(step->pair + 32 * !(x & 1), proof->path[used[i]], 32);
+            memcpy(step->pair + 32 * (x & 1), values[i], 32);
+            used[i]++;
+        }
+        if (m == 0) {
+            continue;
+        }
+        
+        // Distinct (parent, children) in sorted order, one batch per level
+        qsort(steps, m, sizeof(*steps), verify_step_compare);
+        size_t distinct = 0;
+        for (size_t j = 0; j < m; j++) {
+            if (j == 0 || verify_step_compare(&steps[j - 1], &steps[j]) != 0) {
+                memcpy(pairs[2 * distinct], steps[j].pair, 64);
+                distinct++;
+            }
+            // The parent index is spent; keep the step's distinct node instead
+            steps[j].parent = distinct - 1;
+        }
+        uint8_t (*parents)[32] = pairs + 2 * distinct;
+        if (distinct == 1) {
+            hash_nodes(pairs[0], pairs[1], parents[0]);
+        } else {
+            hash_nodes_batch(pairs, distinct, parents);
+        }
+        for (size_t j = 0; j < m; j++) {
+            memcpy(values[steps[j].proof], parents[steps[j].parent], 32);
+        }
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        results[i] = results[i] && used[i] == proofs[i]->path_length &&
+                     memcmp(values[i], root, 32) == 0;
+        verified += results[i];
+    }
+    free(steps);
+    free(values);
+    free(pos);
+    return verified;
+}
+
+/**
+ * Largest power of two strictly below n (n >= 2)
+ */
+static size_t split_point(size_t n) {
+    size_t k = 1;
+    while ((k << 1) < n) {
+        k <<= 1;
+    }
+    return k;
+}
+
+/**
+ * MTH(D[begin:end]) of the built tree
+ * A stored node at level j covers [i * 2^j, min((i + 1) * 2^j, leaf_count)),
+ * so ranges of that shape are a lookup; anything else (a right edge inside
+ * an older, smaller tree) is split as RFC 6962 does, one side of each split
+ * being a perfect stored subtree
+ */
+static void merkle_subtree_hash(const merkle_tree_t* tree, size_t begin, size_t end,
+                                uint8_t hash[32]) {
+    size_t size = end - begin;
+    int level = 0;
+    
+    while (((size_t)1 << level) < size) {
+        level++;
+    }
+    if ((begin & (((size_t)1 << level) - 1)) == 0 &&
+        (size == (size_t)1 << level || end == tree->leaf_count)) {
+        memcpy(hash, tree->levels[level][begin >> level], 32);
+        return;
+    }
+    
+    uint8_t left[32], right[32];
+    size_t k = split_point(size);
+    merkle_subtree_hash(tree, begin, begin + k, left);
+    merkle_subtree_hash(tree, begin + k, end, right);
+    hash_nodes(left, right, hash);
+}
+
+/**
+ * RFC 6962 SUBPROOF(m, D[begin:end], complete)
+ */
+static int merkle_subproof(const merkle_tree_t* tree, size_t m, size_t begin, size_t end,
+                           int complete, uint8_t (*path)[32], size_t max_path, size_t* length) {
+    size_t n = end - begin;
+    
+    if (m == n) {
+        if (complete) {
+            return 0;
+        }
+        if (*length >= max_path) {
+            return -1;
+        }
+        merkle_subtree_hash(tree, begin, end, path[(*length)++]);
+        return 0;
+    }
+    
+    size_t k = split_point(n);
+    int ret;
+    if (m <= k) {
+        // Old tree lies in the left subtree; the right one is all new
+        ret = merkle_subproof(tree, m, begin, begin + k, complete, path, max_path, length);
+        begin += k;
+    } else {
+        // Left subtree is shared in full; recurse into the right one
+        ret = merkle_subproof(tree, m - k, begin + k, end, 0, path, max_path, length);
+        end = begin + k;
+    }
+    if (ret != 0 || *length >= max_path) {
+        return -1;
+    }
+    merkle_subtree_hash(tree, begin, end, path[(*length)++]);
+    return 0;
+}
+
+/**
+ * Write the consistency proof between two sizes of the built tree
+ * 0 < old_size <= new_size <= leaf_count; equal sizes give an empty proof
+ */
+int merkle_tree_consistency_path(const merkle_tree_t* tree, size_t old_size, size_t new_size,
+                                 uint8_t (*path)[32], size_t max_path, size_t* path_length) {
+    if (old_size == 0 || old_size > new_size || new_size > tree->leaf_count ||
+        tree->num_levels == 0) {
+        return -1;
+    }
+    
+    *path_length = 0;
+    return merkle_subproof(tree, old_size, 0, new_size, 1, path, max_path, path_length);
+}
+
+/**
+ * Verify a consistency proof (RFC 9162, section 2.1.4.2)
+ */
+int merkle_tree_verify_consistency(size_t old_size, size_t new_size,
+                                   const uint8_t old_root[32], const uint8_t new_root[32],
+                                   uint8_t (*path)[32], size_t path_length) {
+    if (old_size == 0 || old_size > new_size) {
+        return 0;
+    }
+    if (old_size == new_size) {
+        return path_length == 0 && memcmp(old_root, new_root, 32) == 0;
+    }
+    if (path_length == 0) {
+        return 0;
+    }
+    
+    // A power-of-two old tree is itself a node of the new one, so the
+    // proof leaves out its root and the walk starts from it
+    size_t i = 0;
+    const uint8_t* seed = (old_size & (old_size - 1)) == 0 ? old_root : path[i++];
+    size_t fn = old_size - 1;
+    size_t sn = new_size - 1;
+    uint8_t fr[32], sr[32];
+    
+    while (fn & 1) {
+        fn >>= 1;
+        sn >>= 1;
+    }
+    memcpy(fr, seed, 32);
+    memcpy(sr, seed, 32);
+    
+    for (; i < path_length; i++) {
+        if (sn == 0) {
+            return 0;
+        }
+        if ((fn & 1) || fn == sn) {
+            hash_nodes(path[i], fr, fr);
+            hash_nodes(path[i], sr, sr);
+            while (!(fn & 1) && fn != 0) {
+                fn >>= 1;
+                sn >>= 1;
+            }
+        } else {
+            hash_nodes(sr, path[i], sr);
+        }
+        fn >>= 1;
+        sn >>= 1;
+    }
+    
+    return sn == 0 && memcmp(fr, old_root, 32) == 0 && memcmp(sr, new_root, 32) == 0;
+}
+
 /**
  * Generate consistency proof between two tree sizes
+ * Wraps merkle_tree_consistency_path(); directions are not used
  */
 merkle_proof_t* merkle_tree_generate_consistency_proof(merkle_tree_t* tree, 
                                                        size_t old_size, size_t new_size) {
-    if (old_size > new_size || new_size > tree->leaf_count) {
-        return NULL;
-    }
-    
-    // For simplicity, this is a basic implementation
-    // Full RFC 6962 consistency proofs are more complex
-    merkle_proof_t* proof = malloc(sizeof(merkle_proof_t));
+    merkle_proof_t* proof = calloc(1, sizeof(merkle_proof_t));
     if (!proof) return NULL;
     
-    // Initialize proof structure
-    proof->path_length = 0;
     proof->leaf_index = old_size;
     proof->tree_size = new_size;
-    proof->path = NULL;
-    proof->directions = NULL;
-    
-    // TODO: Implement full consistency proof generation
-    // This would require more complex tree traversal logic
+    proof->path = malloc(MERKLE_MAX_PATH * sizeof(*proof->path));
+    if (!proof->path ||
+        merkle_tree_consistency_path(tree, old_size, new_size, proof->path, MERKLE_MAX_PATH,
+                                     &proof->path_length) != 0) {
+        merkle_proof_free(proof);
+        return NULL;
+    }
     
     return proof;
 }
 
 /**
- * Generate sparse Merkle tree non-inclusion proof
+ * Multiproof for a strictly increasing set of leaf indices
+ * Walks the levels once for the whole set: at level L the known nodes are
+ * the distinct indices >> L, and a sibling is emitted only when it is not
+ * itself known (nor missing because the node was promoted). Hashes come out
+ * level by level, left to right, which is the order the verifier eats them.
  */
-typedef struct {
-    uint8_t* default_hash;      // Default hash for empty nodes
-    size_t tree_height;         // Height of the sparse tree
-    merkle_proof_t* proof;      // Proof path
-} sparse_merkle_proof_t;
+int merkle_tree_multiproof(const merkle_tree_t* tree, const size_t* indices, size_t count,
+                           uint8_t (*path)[32], size_t max_path, size_t* path_length) {
+    if (count == 0 || tree->num_levels == 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (indices[i] >= tree->leaf_count || (i > 0 && indices[i] <= indices[i - 1])) {
+            return -1;
+        }
+    }
+    
+    size_t length = 0;
+    for (int level = 0; level + 1 < tree->num_levels; level++) {
+        size_t i = 0;
+        
+        while (i < count) {
+            size_t x = indices[i] >> level;
+            size_t sibling = x ^ 1;
+            
+            while (i < count && (indices[i] >> level) == x) {
+                i++;
+            }
+            if (!(x & 1) && i < count && (indices[i] >> level) == sibling) {
+                // Both children known: the parent costs nothing
+                while (i < count && (indices[i] >> level) == sibling) {
+                    i++;
+                }
+                continue;
+            }
+            if (sibling >= tree->level_size[level]) {
+                continue;
+            }
+            if (length >= max_path) {
+                return -1;
+            }
+            memcpy(path[length++], tree->levels[level][sibling], 32);
+        }
+    }
+    
+    *path_length = length;
+    return 0;
+}
 
 /**
- * Build sparse Merkle tree for non-inclusion proofs
+ * Verify a multiproof: leaf_hashes[i] is the hash of leaf indices[i]
  */
-sparse_merkle_proof_t* generate_non_inclusion_proof(merkle_tree_t* tree, 
-                                                    const uint8_t* query_data, size_t data_len) {
-    // Hash the query data to get its position in sparse tree
-    uint8_t query_hash[32];
-    hash_leaf(query_data, data_len, query_hash);
-    
-    sparse_merkle_proof_t* sparse_proof = malloc(sizeof(sparse_merkle_proof_t));
-    if (!sparse_proof) return NULL;
+int merkle_tree_verify_multiproof(size_t tree_size, const size_t* indices,
+                                  uint8_t (*leaf_hashes)[32], size_t count,
+                                  uint8_t (*path)[32], size_t path_length,
+                                  const uint8_t root[32]) {
+    if (count == 0 || count > tree_size) {
+        return 0;
+    }
     
-    sparse_proof->tree_height = 256; // Height for 256-bit hash space
-    sparse_proof->default_hash = malloc(32);
-    if (!sparse_proof->default_hash) {
-        free(sparse_proof);
-        return NULL;
+    // Known nodes of the current level, compacted in place as levels go up;
+    // each level's parents are gathered as child pairs and hashed in one batch
+    size_t* known = malloc(count * 2 * sizeof(size_t));
+    uint8_t (*hashes)[32] = malloc(count * 4 * sizeof(*hashes));
+    int ok = known && hashes;
+    if (!ok) {
+        free(known);
+        free(hashes);
+        return 0;
     }
+    size_t* slot = known + count;
+    uint8_t (*pairs)[32] = hashes + count;
+    uint8_t (*parents)[32] = hashes + 3 * count;
     
-    // Set default hash for empty nodes (all zeros)
-    memset(sparse_proof->default_hash, 0, 32);
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = indices[i] < tree_size && (i == 0 || indices[i] > indices[i - 1]);
+        known[i] = indices[i];
+        memcpy(hashes[i], leaf_hashes[i], 32);
+    }
     
-    // Generate proof that query_hash is not in the tree
-    // This is a simplified version - full implementation would be more complex
-    sparse_proof->proof = merkle_tree_generate_inclusion_proof(tree, 0);
+    size_t used = 0;
+    size_t size = tree_size;
+    size_t m = count;
+    while (ok && size > 1) {
+        size_t out = 0;
+        size_t np = 0;
+        
+        for (size_t i = 0; i < m; out++) {
+            size_t x = known[i];
+            
+            slot[out] = np;
+            if (!(x & 1) && i + 1 < m && known[i + 1] == x + 1) {
+                memcpy(pairs[2 * np], hashes[i], 32);
+                memcpy(pairs[2 * np + 1], hashes[i + 1], 32);
+                i += 2;
+            } else if (!(x & 1) && x + 1 >= size) {
+                // Promoted: entries before i are all consumed already
+                slot[out] = SIZE_MAX;
+                memcpy(hashes[out], hashes[i], 32);
+                i++;
+            } else if (used < path_length) {
+                memcpy(pairs[2 * np + !(x & 1)], path[used], 32);
+                memcpy(pairs[2 * np + (x & 1)], hashes[i], 32);
+                used++;
+                i++;
+            } else {
+                ok = 0;
+                break;
+            }
+            np += slot[out] != SIZE_MAX;
+            known[out] = x >> 1;
+        }
+        
+        hash_nodes_batch(pairs, np, parents);
+        for (size_t j = 0; j < out; j++) {
+            if (slot[j] != SIZE_MAX) {
+                memcpy(hashes[j], parents[slot[j]], 32);
+            }
+        }
+        m = out;
+        size = (size + 1) / 2;
+    }
     
-    return sparse_proof;
+    ok = ok && m == 1 && used == path_length && memcmp(hashes[0], root, 32) == 0;
+    free(known);
+    free(hashes);
+    return ok;
 }
 
 /**
@@ -453,26 +993,67 @@ void benchmark_merkle_tree(size_t num_leaves) {
     printf("=== Benchmarking Merkle Tree with %zu leaves ===\n", num_leaves);
     
     // Initialize tree
-    clock_t start = clock();
     merkle_tree_t* tree = merkle_tree_init(num_leaves);
     if (!tree) {
         printf("Failed to initialize tree\n");
         return;
     }
     
-    // Add leaves
-    printf("Adding %zu leaves...\n", num_leaves);
+    // Leaf data laid out up front so both ingestion paths hash the same bytes
+    char* leaf_text = malloc(num_leaves * 32);
+    const uint8_t** leaf_data = malloc(num_leaves * sizeof(*leaf_data));
+    size_t* leaf_lens = malloc(num_leaves * sizeof(*leaf_lens));
+    if (!leaf_text || !leaf_data || !leaf_lens) {
+        printf("Failed to allocate leaf data\n");
+        free(leaf_text);
+        free(leaf_data);
+        free(leaf_lens);
+        merkle_tree_free(tree);
+        return;
+    }
     for (size_t i = 0; i < num_leaves; i++) {
-        char data[64];
-        snprintf(data, sizeof(data), "leaf_data_%zu", i);
-        merkle_tree_add_leaf(tree, (uint8_t*)data, strlen(data));
+        leaf_lens[i] = (size_t)snprintf(leaf_text + 32 * i, 32, "leaf_data_%zu", i);
+        leaf_data[i] = (const uint8_t*)(leaf_text + 32 * i);
+    }
+    
+    // Add leaves one at a time, then again in bulk
+    printf("Adding %zu leaves...\n", num_leaves);
+    merkle_tree_t* serial = merkle_tree_init(1024);
+    double serial_start = merkle_now();
+    for (size_t i = 0; serial && i < num_leaves; i++) {
+        merkle_tree_add_leaf(serial, leaf_data[i], leaf_lens[i]);
     }
-    clock_t leaves_added = clock();
+    double serial_time = merkle_now() - serial_start;
+    double bulk_start = merkle_now();
+    merkle_tree_add_leaves(tree, leaf_data, leaf_lens, num_leaves);
+    double bulk_time = merkle_now() - bulk_start;
+    int bulk_matches = serial && memcmp(serial->levels[0], tree->levels[0],
+                                        num_leaves * sizeof(*tree->levels[0])) == 0;
+    merkle_tree_free(serial);
+    free(leaf_text);
+    free(leaf_data);
+    free(leaf_lens);
     
     // Build tree
     printf("Building tree...\n");
+    double build_start = merkle_now();
     merkle_tree_build(tree);
-    clock_t tree_built = clock();
+    double build_time = merkle_now() - build_start;
+    
+    // Same leaves through the append-only path, reading the root every time
+    printf("Appending leaves with live root...\n");
+    merkle_tree_t* log = merkle_tree_init(1024);
+    uint8_t live_root[32];
+    clock_t append_start = clock();
+    for (size_t i = 0; log && i < num_leaves; i++) {
+        char data[64];
+        snprintf(data, sizeof(data), "leaf_data_%zu", i);
+        merkle_tree_append(log, (uint8_t*)data, strlen(data));
+        merkle_tree_current_root(log, live_root);
+    }
+    clock_t append_done = clock();
+    int append_matches = log && memcmp(live_root, merkle_tree_root(tree), 32) == 0;
+    merkle_tree_free(log);
     
     // Generate some inclusion proofs
     printf("Generating inclusion proofs...\n");
@@ -492,48 +1073,146 @@ void benchmark_merkle_tree(size_t num_leaves) {
         if (proofs[i]) {
             size_t leaf_index = i * (num_leaves / num_proofs);
             int verified = merkle_tree_verify_inclusion_proof(
-                proofs[i], tree->leaf_hashes[leaf_index], tree->root->hash);
+                proofs[i], merkle_tree_leaf_hash(tree, leaf_index), merkle_tree_root(tree));
             if (verified) successful_verifications++;
         }
     }
     clock_t proofs_verified = clock();
     
+    // A monitor checking many proofs against one root: one at a time, then
+    // as a batch that hashes each shared node once
+    size_t monitor = 10000;
+    merkle_proof_t** monitor_proofs = malloc(monitor * sizeof(*monitor_proofs));
+    uint8_t (*monitor_leaves)[32] = malloc(monitor * sizeof(*monitor_leaves));
+    int* monitor_results = malloc(monitor * sizeof(int));
+    size_t monitor_single = 0, monitor_batch = 0;
+    double single_time = 0, batch_verify_time = 0;
+    if (monitor_proofs && monitor_leaves && monitor_results) {
+        for (size_t i = 0; i < monitor; i++) {
+            size_t leaf = (i * 2654435761u) % num_leaves;
+            monitor_proofs[i] = merkle_tree_generate_inclusion_proof(tree, leaf);
+            memcpy(monitor_leaves[i], merkle_tree_leaf_hash(tree, leaf), 32);
+        }
+        double t = merkle_now();
+        for (size_t i = 0; i < monitor; i++) {
+            monitor_single += merkle_tree_verify_inclusion_proof(
+                monitor_proofs[i], monitor_leaves[i], merkle_tree_root(tree));
+        }
+        single_time = merkle_now() - t;
+        t = merkle_now();
+        monitor_batch = merkle_tree_verify_inclusion_batch(num_leaves, monitor_proofs,
+                                                           monitor_leaves, monitor,
+                                                           merkle_tree_root(tree),
+                                                           monitor_results);
+        batch_verify_time = merkle_now() - t;
+        for (size_t i = 0; i < monitor; i++) {
+            merkle_proof_free(monitor_proofs[i]);
+        }
+    }
+    free(monitor_proofs);
+    free(monitor_leaves);
+    free(monitor_results);
+    
+    // One multiproof for a contiguous run of entries, as an auditor polls them
+    size_t batch = num_leaves < 1000 ? num_leaves : 1000;
+    size_t* batch_indices = malloc(batch * sizeof(size_t));
+    uint8_t (*batch_path)[32] = malloc(batch * MERKLE_MAX_PATH * sizeof(*batch_path));
+    size_t batch_length = 0;
+    int batch_verified = 0;
+    clock_t batch_start = clock();
+    if (batch > 0 && batch_indices && batch_path) {
+        for (size_t i = 0; i < batch; i++) {
+            batch_indices[i] = num_leaves - batch + i;
+        }
+        if (merkle_tree_multiproof(tree, batch_indices, batch, batch_path,
+                                   batch * MERKLE_MAX_PATH, &batch_length) == 0) {
+            batch_verified = merkle_tree_verify_multiproof(
+                num_leaves, batch_indices, tree->levels[0] + (num_leaves - batch), batch,
+                batch_path, batch_length, merkle_tree_root(tree));
+        }
+    }
+    clock_t batch_done = clock();
+    free(batch_indices);
+    free(batch_path);
+    
+    // Consistency of the first half with the whole tree
+    uint8_t cons_path[MERKLE_MAX_PATH][32];
+    uint8_t half_root[32];
+    size_t cons_length = 0;
+    int cons_verified = 0;
+    if (num_leaves >= 2 &&
+        merkle_tree_consistency_path(tree, num_leaves / 2, num_leaves, cons_path,
+                                     MERKLE_MAX_PATH, &cons_length) == 0) {
+        merkle_tree_t* half = merkle_tree_init(num_leaves / 2);
+        for (size_t i = 0; half && i < num_leaves / 2; i++) {
+            char data[64];
+            snprintf(data, sizeof(data), "leaf_data_%zu", i);
+            merkle_tree_add_leaf(half, (uint8_t*)data, strlen(data));
+        }
+        cons_verified = half && merkle_tree_current_root(half, half_root) == 0 &&
+            merkle_tree_verify_consistency(num_leaves / 2, num_leaves, half_root,
+                                           merkle_tree_root(tree), cons_path, cons_length);
+        merkle_tree_free(half);
+    }
+    
+    // Restart from disk: save the built tree, then reopen it instead of rebuilding
+    static const char* file_path = "merkle_bench.tmp";
+    clock_t save_start = clock();
+    int saved = merkle_file_save(tree, file_path) == 0;
+    clock_t save_done = clock();
+    merkle_file_t* mf = saved ? merkle_file_open(file_path, 0) : NULL;
+    clock_t reopened = clock();
+    int reopen_matches = mf &&
+        memcmp(merkle_tree_root(merkle_file_tree(mf)), merkle_tree_root(tree), 32) == 0;
+    merkle_file_close(mf);
+    remove(file_path);
+    
     // Print results
-    double add_time = ((double)(leaves_added - start)) / CLOCKS_PER_SEC;
-    double build_time = ((double)(tree_built - leaves_added)) / CLOCKS_PER_SEC;
-    double proof_gen_time = ((double)(proofs_generated - tree_built)) / CLOCKS_PER_SEC;
+    double append_time = ((double)(append_done - append_start)) / CLOCKS_PER_SEC;
+    double proof_gen_time = ((double)(proofs_generated - append_done)) / CLOCKS_PER_SEC;
     double proof_verify_time = ((double)(proofs_verified - proofs_generated)) / CLOCKS_PER_SEC;
     
     printf("\nBenchmark Results:\n");
-    printf("  Add leaves: %.3f seconds (%.0f leaves/sec)\n", 
-           add_time, num_leaves / add_time);
+    printf("  Add leaves one by one: %.3f seconds (%.0f leaves/sec)\n",
+           serial_time, num_leaves / serial_time);
+    printf("  Add leaves in bulk: %.3f seconds (%.0f leaves/sec, %.1fx, hashes %s)\n",
+           bulk_time, num_leaves / bulk_time, serial_time / bulk_time,
+           bulk_matches ? "match" : "MISMATCH");
     printf("  Build tree: %.3f seconds\n", build_time);
+    printf("  Append + root: %.3f seconds (%.0f appends/sec, root %s)\n",
+           append_time, num_leaves / append_time, append_matches ? "matches build" : "MISMATCH");
     printf("  Generate proofs: %.3f seconds (%.0f proofs/sec)\n", 
            proof_gen_time, num_proofs / proof_gen_time);
     printf("  Verify proofs: %.3f seconds (%.0f verifications/sec)\n", 
            proof_verify_time, num_proofs / proof_verify_time);
     printf("  Successful verifications: %d/%zu\n", successful_verifications, num_proofs);
+    printf("  Verify %zu proofs: %.3f ms one by one (%zu ok), %.3f ms batched (%zu ok, %.1fx)\n",
+           monitor, single_time * 1000.0, monitor_single, batch_verify_time * 1000.0,
+           monitor_batch, single_time / batch_verify_time);
+    printf("  Multiproof for %zu entries: %zu hashes (vs up to %zu separately), %.3f ms, %s\n",
+           batch, batch_length, batch * (size_t)(tree->num_levels - 1),
+           ((double)(batch_done - batch_start)) * 1000.0 / CLOCKS_PER_SEC,
+           batch_verified ? "verified" : "FAILED");
+    if (num_leaves >= 2) {
+        printf("  Consistency %zu -> %zu: %zu hashes, %s\n", num_leaves / 2, num_leaves,
+               cons_length, cons_verified ? "verified" : "FAILED");
+    }
+    printf("  Save to file: %.3f seconds, reopen: %.3f ms (root %s)\n",
+           ((double)(save_done - save_start)) / CLOCKS_PER_SEC,
+           ((double)(reopened - save_done)) * 1000.0 / CLOCKS_PER_SEC,
+           reopen_matches ? "matches build" : "MISMATCH");
     printf("  Root hash: ");
     for (int i = 0; i < 32; i++) {
-        printf("%02x", tree->root->hash[i]);
+        printf("%02x", merkle_tree_root(tree)[i]);
     }
     printf("\n");
-    printf("  Tree height: %d\n", tree->root->height);
+    printf("  Tree height: %d\n", tree->num_levels - 1);
     
     // Cleanup
     for (size_t i = 0; i < num_proofs; i++) {
-        if (proofs[i]) {
-            for (size_t j = 0; j < proofs[i]->path_length; j++) {
-                free(proofs[i]->path[j]);
-            }
-            free(proofs[i]->path);
-            free(proofs[i]->directions);
-            free(proofs[i]);
-        }
+        merkle_proof_free(proofs[i]);
     }
-    
-    // Free tree (simplified cleanup)
-    free(tree);
+    merkle_tree_free(tree);
 }
 
 /**
@@ -555,19 +1234,3 @@ void demonstrate_large_merkle_tree(void) {
         benchmark_merkle_tree(sizes[i]);
     }
 }
-
-/**
- * Main function for testing
- */
-int main(int argc, char* argv[]) {
-    if (argc > 1) {
-        size_t num_leaves = atoi(argv[1]);
-        if (num_leaves > 0) {
-            benchmark_merkle_tree(num_leaves);
-            return 0;
-        }
-    }
-    
-    demonstrate_large_merkle_tree();
-    return 0;
-}
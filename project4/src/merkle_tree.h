@@ -0,0 +1,182 @@
+#ifndef MERKLE_TREE_H
+#define MERKLE_TREE_H
+
+#include "sm3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// SM3 Merkle tree (RFC 6962): leaves are SM3(0x00 || d), interior nodes
+// SM3(0x01 || left || right), split at the largest power of two below n
+
+#define MERKLE_MAX_LEVELS 65     // leaves plus one level per halving of a size_t count
+#define MERKLE_MAX_PATH MERKLE_MAX_LEVELS   // bound on any audit or consistency path
+
+/**
+ * Merkle tree stored level by level in flat arrays of 32-byte hashes
+ *
+ * Level 0 holds the leaf hashes; level k holds ceil(n / 2^k) nodes, node j
+ * being SM3(0x01 || L[2j] || L[2j+1]) of level k-1, or a copy of L[2j] when
+ * it has no right sibling. Pairing neighbours and promoting the lone last
+ * node gives exactly the RFC 6962 tree, so subtree extents follow from the
+ * indices and no node stores pointers or sizes.
+ *
+ * Alongside the levels the tree keeps the append frontier: frontier[k] is
+ * the root of the perfect 2^k-leaf subtree at the right edge whenever bit k
+ * of frontier_size is set. It is advanced by merkle_tree_append() (or lazily
+ * by merkle_tree_current_root()) and gives the current root without a build.
+ */
+typedef struct {
+    uint8_t (*levels[MERKLE_MAX_LEVELS])[32];  // levels[0] = leaves, then interior arena
+    size_t level_size[MERKLE_MAX_LEVELS];      // nodes per level
+    int num_levels;             // levels valid since the last build (0 = not built)
+    size_t leaf_count;          // Total number of leaves
+    size_t capacity;            // Allocated capacity for leaves
+    uint8_t (*nodes)[32];       // Arena holding levels 1 .. num_levels-1 back to back
+    size_t node_capacity;       // Hashes the arena can hold
+    uint8_t frontier[MERKLE_MAX_LEVELS][32];   // Right-edge perfect subtree roots
+    size_t frontier_size;       // Leaves folded into the frontier so far
+} merkle_tree_t;
+
+/**
+ * Merkle proof structure
+ */
+typedef struct {
+    uint8_t (*path)[32];        // Hashes in the proof path, leaf to root
+    int* directions;            // Array indicating left (0) or right (1)
+    size_t path_length;         // Length of the proof path
+    size_t leaf_index;          // Index of the leaf being proven
+    size_t tree_size;           // Size of the tree when proof was generated
+} merkle_proof_t;
+
+/**
+ * Persistent tree: the level arrays in one mmap()ed file (see merkle_file.c)
+ */
+typedef struct merkle_file merkle_file_t;
+
+#define SPARSE_MERKLE_DEPTH 256  // one level per key bit
+
+/**
+ * Sparse Merkle tree over 256-bit keys (see sparse_merkle.c for the hashing)
+ */
+typedef struct sparse_merkle_tree sparse_merkle_tree_t;
+
+typedef enum {
+    SPARSE_MERKLE_EMPTY,        // Key's path ends in an empty subtree: absent
+    SPARSE_MERKLE_OTHER_LEAF,   // Path ends at another key's short-cut leaf: absent
+    SPARSE_MERKLE_FOUND         // Path ends at the key's own leaf
+} sparse_merkle_terminal_t;
+
+/**
+ * Sparse Merkle (non-)inclusion proof, filled in place; siblings equal to
+ * the default hash of their level are left out and flagged in bitmap
+ */
+typedef struct {
+    uint8_t key[32];            // Key the proof is about
+    sparse_merkle_terminal_t terminal;
+    uint16_t depth;             // Depth of the terminal subtree on the key's path
+    uint8_t leaf_key[32];       // Terminal leaf key (OTHER_LEAF / FOUND)
+    uint8_t leaf_value_hash[32];    // SM3 of the terminal leaf's value (OTHER_LEAF / FOUND)
+    uint8_t bitmap[32];         // Bit d (MSB first): stored sibling at depth d
+    uint8_t siblings[SPARSE_MERKLE_DEPTH][32];   // Stored siblings, root first
+    size_t num_siblings;
+} sparse_merkle_proof_t;
+
+// RFC 6962 hashing
+void hash_leaf(const uint8_t* data, size_t data_len, uint8_t hash[32]);
+void hash_nodes(const uint8_t left_hash[32], const uint8_t right_hash[32], uint8_t hash[32]);
+// parents[i] = hash_nodes(children[2i], children[2i+1]) on the multi-buffer kernels
+void hash_nodes_batch(uint8_t (*children)[32], size_t count, uint8_t (*parents)[32]);
+
+// Tree construction; levels are hashed on the shared pool (sm3_pool_default)
+merkle_tree_t* merkle_tree_init(size_t initial_capacity);
+void merkle_tree_free(merkle_tree_t* tree);
+int merkle_tree_add_leaf(merkle_tree_t* tree, const uint8_t* data, size_t data_len);
+// Bulk add: leaves hashed on the pool, a multi-buffer lane per leaf
+int merkle_tree_add_leaves(merkle_tree_t* tree, const uint8_t* const datas[],
+                           const size_t lens[], size_t n);
+int merkle_tree_build(merkle_tree_t* tree);
+const uint8_t* merkle_tree_root(const merkle_tree_t* tree);      // NULL until built
+const uint8_t* merkle_tree_leaf_hash(const merkle_tree_t* tree, size_t leaf_index);
+
+// Append-only log: O(log n) node hashes per append, root at any size
+int merkle_tree_append(merkle_tree_t* tree, const uint8_t* data, size_t data_len);
+int merkle_tree_current_root(merkle_tree_t* tree, uint8_t root[32]);
+
+// Flat proofs into caller buffers of max_path hashes; return 0, or -1 on bad
+// arguments or a short buffer. The tree must be built.
+int merkle_tree_inclusion_path(const merkle_tree_t* tree, size_t leaf_index,
+                               uint8_t (*path)[32], int* directions, size_t max_path,
+                               size_t* path_length);
+int merkle_tree_consistency_path(const merkle_tree_t* tree, size_t old_size, size_t new_size,
+                                 uint8_t (*path)[32], size_t max_path, size_t* path_length);
+int merkle_tree_verify_consistency(size_t old_size, size_t new_size,
+                                   const uint8_t old_root[32], const uint8_t new_root[32],
+                                   uint8_t (*path)[32], size_t path_length);
+
+// One deduplicated proof for a strictly increasing set of leaf indices;
+// needs at most count * (levels - 1) hashes, far fewer for clustered sets
+int merkle_tree_multiproof(const merkle_tree_t* tree, const size_t* indices, size_t count,
+                           uint8_t (*path)[32], size_t max_path, size_t* path_length);
+int merkle_tree_verify_multiproof(size_t tree_size, const size_t* indices,
+                                  uint8_t (*leaf_hashes)[32], size_t count,
+                                  uint8_t (*path)[32], size_t path_length,
+                                  const uint8_t root[32]);
+
+// Allocating wrappers (merkle_proof_free)
+merkle_proof_t* merkle_tree_generate_inclusion_proof(merkle_tree_t* tree, size_t leaf_index);
+int merkle_tree_verify_inclusion_proof(merkle_proof_t* proof, const uint8_t leaf_hash[32],
+                                       const uint8_t root_hash[32]);
+// Many proofs against one root, each distinct node hashed once; results[i]
+// set per proof, returns how many verify
+size_t merkle_tree_verify_inclusion_batch(size_t tree_size, merkle_proof_t* const proofs[],
+                                          uint8_t (*leaf_hashes)[32], size_t count,
+                                          const uint8_t root[32], int* results);
+merkle_proof_t* merkle_tree_generate_consistency_proof(merkle_tree_t* tree,
+                                                       size_t old_size, size_t new_size);
+void merkle_proof_free(merkle_proof_t* proof);
+
+// Persistent tree: opening maps the file and rehashes O(log n) edge nodes;
+// appends extend the on-disk frontier and survive a crash once committed.
+// merkle_file_tree() is a read-only view valid until the next append,
+// commit or close; never pass it to merkle_tree_free or merkle_tree_add_leaf.
+merkle_file_t* merkle_file_create(const char* path, size_t capacity);
+merkle_file_t* merkle_file_open(const char* path, int writable);
+int merkle_file_save(const merkle_tree_t* tree, const char* path);
+int merkle_file_append(merkle_file_t* mf, const uint8_t* data, size_t data_len);
+int merkle_file_append_hashes(merkle_file_t* mf, uint8_t (*leaf_hashes)[32], size_t count);
+int merkle_file_commit(merkle_file_t* mf);
+size_t merkle_file_size(const merkle_file_t* mf);
+const merkle_tree_t* merkle_file_tree(merkle_file_t* mf);
+int merkle_file_close(merkle_file_t* mf);       // commits pending appends; -1 if that fails
+
+// Sparse tree: updates are lazy, the next root or proof rehashes each dirty
+// node once, so batches share the work on common ancestors
+sparse_merkle_tree_t* sparse_merkle_create(void);
+void sparse_merkle_destroy(sparse_merkle_tree_t* smt);
+size_t sparse_merkle_size(const sparse_merkle_tree_t* smt);
+const uint8_t* sparse_merkle_default_hash(int height);
+int sparse_merkle_update(sparse_merkle_tree_t* smt, const uint8_t key[32],
+                         const uint8_t* value, size_t value_len);
+int sparse_merkle_update_batch(sparse_merkle_tree_t* smt, uint8_t (*keys)[32],
+                               const uint8_t* const values[], const size_t value_lens[],
+                               size_t count);
+void sparse_merkle_root(sparse_merkle_tree_t* smt, uint8_t root[32]);
+int sparse_merkle_prove(sparse_merkle_tree_t* smt, const uint8_t key[32],
+                        sparse_merkle_proof_t* proof);
+int sparse_merkle_verify(const sparse_merkle_proof_t* proof, const uint8_t root[32],
+                         const uint8_t* value, size_t value_len);
+int generate_non_inclusion_proof(sparse_merkle_tree_t* smt, const uint8_t* query_data,
+                                 size_t data_len, sparse_merkle_proof_t* proof);
+
+// Benchmarks / demonstration
+void benchmark_merkle_tree(size_t num_leaves);
+void demonstrate_large_merkle_tree(void);
+void benchmark_sparse_merkle(size_t num_keys);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MERKLE_TREE_H
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,6 +30,8 @@ void sm3_hash(const uint8_t *data, size_t len, uint8_t *digest);
 // Optimized implementations
 void sm3_compress_basic(uint32_t state[8], const uint8_t block[64]);
 void sm3_compress_optimized(uint32_t state[8], const uint8_t block[64]);
+void sm3_hash_batch_optimized(const uint8_t **messages, const size_t *lengths,
+                              size_t count, uint8_t **hashes);
 
 #ifdef __x86_64__
 void sm3_compress_simd(uint32_t state[8], const uint8_t block[64]);
@@ -38,6 +41,340 @@ void sm3_compress_simd(uint32_t state[8], const uint8_t block[64]);
 void sm3_compress_neon(uint32_t state[8], const uint8_t block[64]);
 #endif
 
+// Multi-block compression with runtime dispatch (sm3_arch_specific.c)
+//
+// sm3_compress_blocks() compresses nblocks consecutive 64-byte blocks with
+// the fastest backend the running CPU supports, chosen once on first use
+// via detect_cpu_features(). sm3_update() calls it once per bulk span.
+typedef void (*sm3_blocks_func_t)(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks);
+
+typedef enum {
+    SM3_BACKEND_GENERIC,
+    SM3_BACKEND_AVX2,
+    SM3_BACKEND_AVX512,
+    SM3_BACKEND_NEON,
+    SM3_BACKEND_ARMV8_CE,
+    SM3_BACKEND_COUNT
+} sm3_backend_t;
+
+void sm3_compress_blocks(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks);
+
+void detect_cpu_features(void);
+sm3_backend_t sm3_get_backend(void);
+int sm3_set_backend(sm3_backend_t backend);        // -1 if not supported on this CPU
+int sm3_backend_supported(sm3_backend_t backend);
+const char *sm3_backend_name(sm3_backend_t backend);
+sm3_blocks_func_t sm3_get_blocks_func(sm3_backend_t backend);
+
+// Per-backend kernels (prefer sm3_compress_blocks); they differ in how the
+// message schedule is computed, the rounds are shared
+void sm3_compress_blocks_generic(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks);
+#ifdef __x86_64__
+void sm3_compress_blocks_avx2(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks);
+void sm3_compress_blocks_avx512(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks);
+#endif
+#ifdef __aarch64__
+void sm3_compress_blocks_neon(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks);
+// Armv8.2 SM3PARTW/SM3TT (sm3_ce.c); rounds in hardware
+void sm3_compress_blocks_ce(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks);
+int sm3_ce_compiled(void);
+#endif
+
+// Compression on a pre-expanded schedule W[0..67], W'[0..63] (sm3_optimized.c)
+void sm3_message_expansion_optimized(uint32_t w[68], uint32_t w1[64]);
+void sm3_compress_expanded(uint32_t state[8], const uint32_t w[68], const uint32_t w1[64]);
+
+// Round constants T(j) <<< (j mod 32)
+extern const uint32_t sm3_tj[64];
+
+// Initial hash value
+extern const uint32_t sm3_iv[SM3_STATE_SIZE];
+
+// Multi-buffer job manager (sm3_mb.c)
+//
+// Hashes many independent messages at once, one message per SIMD lane
+// (16 lanes with AVX-512, 8 with AVX2, 1 otherwise). A lane whose message
+// finishes takes the next submitted job straight away, so variable-length
+// messages keep every lane busy. Padding is done inside the lanes.
+//
+// sm3_mb_submit() queues a job and returns a completed job or NULL. Call
+// sm3_mb_flush() until it returns NULL to drain the remaining jobs. Jobs
+// may come back in any order and must stay valid until returned.
+#define SM3_MB_MAX_LANES    16
+
+typedef enum {
+    SM3_JOB_IN_PROGRESS,
+    SM3_JOB_COMPLETED
+} sm3_job_status_t;
+
+typedef struct {
+    const uint8_t *buffer;
+    size_t len;
+    uint8_t *digest;                // SM3_DIGEST_SIZE bytes, written on completion
+    void *user_data;
+    sm3_job_status_t status;
+} sm3_job_t;
+
+typedef void (*sm3_mb_kernel_t)(uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES],
+                                const uint8_t *data[SM3_MB_MAX_LANES], size_t nblocks);
+
+typedef struct {
+    uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES];   // word-sliced chaining values
+    const uint8_t *data[SM3_MB_MAX_LANES];              // next block of each lane
+    size_t blocks[SM3_MB_MAX_LANES];                    // blocks left in the current segment
+    uint8_t tail_blocks[SM3_MB_MAX_LANES];              // padded blocks after the body (1 or 2)
+    uint8_t in_tail[SM3_MB_MAX_LANES];
+    sm3_job_t *job[SM3_MB_MAX_LANES];                   // NULL if the lane is idle
+    uint8_t tail[SM3_MB_MAX_LANES][2 * SM3_BLOCK_SIZE]; // last partial block + padding
+    sm3_job_t *done[2 * SM3_MB_MAX_LANES];              // completed, not yet returned
+    size_t done_head;
+    size_t done_count;
+    size_t num_lanes;
+    size_t busy;
+    sm3_mb_kernel_t kernel;
+    uint32_t init_state[SM3_STATE_SIZE];                // every lane starts here (sm3_iv)
+    uint64_t prefix_len;                                // bytes already hashed into init_state
+} sm3_mb_mgr_t;
+
+void sm3_mb_mgr_init(sm3_mb_mgr_t *mgr);
+int sm3_mb_mgr_init_lanes(sm3_mb_mgr_t *mgr, size_t num_lanes);  // -1 if unsupported
+
+// Start jobs submitted from now on from a midstate instead of sm3_iv:
+// state after prefix_len bytes (a multiple of SM3_BLOCK_SIZE), which the
+// length padding then counts, as for HMAC's key block
+void sm3_mb_mgr_set_prefix(sm3_mb_mgr_t *mgr, const uint32_t state[SM3_STATE_SIZE], uint64_t prefix_len);
+sm3_job_t *sm3_mb_submit(sm3_mb_mgr_t *mgr, sm3_job_t *job);
+sm3_job_t *sm3_mb_flush(sm3_mb_mgr_t *mgr);
+
+// Widest kernel available; lanes start from sm3_iv and take whole blocks
+sm3_mb_kernel_t sm3_mb_best_kernel(size_t *num_lanes);
+
+// Hash count messages through a multi-buffer manager
+void sm3_hash_mb(const uint8_t *const messages[], const size_t lengths[], size_t count,
+                 uint8_t digests[][SM3_DIGEST_SIZE]);
+
+// Multi-lane compression kernels (data[0..lanes) each advance nblocks blocks)
+void sm3_mb_compress_x1(uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES],
+                        const uint8_t *data[SM3_MB_MAX_LANES], size_t nblocks);
+#ifdef __x86_64__
+void sm3_mb_compress_x8_avx2(uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES],
+                             const uint8_t *data[SM3_MB_MAX_LANES], size_t nblocks);
+void sm3_mb_compress_x16_avx512(uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES],
+                                const uint8_t *data[SM3_MB_MAX_LANES], size_t nblocks);
+#endif
+
+// HMAC-SM3 (sm3_hmac.c)
+//
+// sm3_hmac_key_init() compresses the K ^ ipad and K ^ opad blocks once;
+// every MAC under the key then resumes from those two states, so a short
+// message costs its own blocks plus one outer block instead of two more key
+// blocks. Keys longer than a block are hashed first (RFC 2104). A key
+// object is read-only after init and may be shared between threads.
+// sm3_hmac_batch() runs the inner and outer hashes of count messages
+// through two multi-buffer managers, one message per lane.
+// sm3_hmac_verify() compares in constant time and returns 0 on a match
+// (mac_len 1..SM3_DIGEST_SIZE, truncated tags compare the leading bytes).
+typedef struct {
+    uint32_t istate[SM3_STATE_SIZE];  // after the K ^ ipad block
+    uint32_t ostate[SM3_STATE_SIZE];  // after the K ^ opad block
+} sm3_hmac_key_t;
+
+typedef struct {
+    sm3_ctx_t inner;
+    uint32_t ostate[SM3_STATE_SIZE];
+} sm3_hmac_ctx_t;
+
+void sm3_hmac_key_init(sm3_hmac_key_t *key, const uint8_t *k, size_t k_len);
+void sm3_hmac_key_clear(sm3_hmac_key_t *key);
+void sm3_hmac_init(sm3_hmac_ctx_t *ctx, const sm3_hmac_key_t *key);
+void sm3_hmac_update(sm3_hmac_ctx_t *ctx, const uint8_t *data, size_t len);
+void sm3_hmac_final(sm3_hmac_ctx_t *ctx, uint8_t mac[SM3_DIGEST_SIZE]);
+void sm3_hmac(const sm3_hmac_key_t *key, const uint8_t *data, size_t len, uint8_t mac[SM3_DIGEST_SIZE]);
+int sm3_hmac_verify(const sm3_hmac_key_t *key, const uint8_t *data, size_t len,
+                    const uint8_t *mac, size_t mac_len);
+void sm3_hmac_batch(const sm3_hmac_key_t *key, const uint8_t *const messages[], const size_t lengths[],
+                    size_t count, uint8_t macs[][SM3_DIGEST_SIZE]);
+
+// Midstates and a prefix cache (sm3_prefix.c)
+//
+// An sm3_ctx_t is plain data: the context after absorbing a prefix can be
+// kept and resumed any number of times. sm3_ctx_clone() copies only what
+// is live (chaining value, count and the buffered partial block) and
+// sm3_hash_from() hashes midstate || data without touching the midstate.
+// A prefix that is a whole number of blocks leaves nothing buffered, so
+// each message then costs only its own blocks.
+//
+// sm3_prefix_cache_t maps prefix bytes to their midstate, keeping up to
+// capacity of them (rounded up to a power of two of 4-way sets, LRU within
+// a set). sm3_prefix_cache_init()
+// starts ctx after prefix, from the cache on a hit (the prefix is compared
+// byte for byte) or by hashing and inserting it on a miss; it returns 1 on
+// a hit, 0 on a miss. The cache is thread-safe; hashing runs outside its
+// lock. Prefixes longer than SM3_PREFIX_CACHE_MAX_LEN are not cached.
+#define SM3_PREFIX_CACHE_MAX_LEN    4096
+
+typedef struct sm3_prefix_cache sm3_prefix_cache_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+} sm3_prefix_cache_stats_t;
+
+void sm3_ctx_clone(sm3_ctx_t *dst, const sm3_ctx_t *src);
+void sm3_hash_from(const sm3_ctx_t *midstate, const uint8_t *data, size_t len,
+                   uint8_t digest[SM3_DIGEST_SIZE]);
+
+sm3_prefix_cache_t *sm3_prefix_cache_create(size_t capacity);   // NULL on allocation failure
+void sm3_prefix_cache_destroy(sm3_prefix_cache_t *cache);
+int sm3_prefix_cache_init(sm3_prefix_cache_t *cache, sm3_ctx_t *ctx,
+                          const uint8_t *prefix, size_t prefix_len);
+void sm3_prefix_cache_get_stats(sm3_prefix_cache_t *cache, sm3_prefix_cache_stats_t *stats);
+
+// SM3 key derivation function, GB/T 32918.4 (sm3_kdf.c)
+//
+// key = SM3(Z || ct) for ct = 1, 2, ... as 32-bit big-endian, truncated to
+// klen bytes (SM2 key exchange and encryption). The whole blocks of Z are
+// compressed once and every counter block runs from that midstate in its
+// own multi-buffer lane, so a long key costs one or two compressions per
+// 32 bytes spread over 8 or 16 lanes. Returns 0, or -1 if klen would need
+// more than 2^32 - 1 counters.
+int sm3_kdf(const uint8_t *z, size_t z_len, uint8_t *key, size_t klen);
+
+// File hashing (sm3_file.c)
+//
+// Regular files are mmap()ed (MADV_SEQUENTIAL, next window prefetched while
+// the current one is compressed); pipes and other unmappable inputs are read
+// by a helper thread into one buffer while the caller hashes the other.
+// sm3_hash_files() hashes all mappable files concurrently, one per
+// multi-buffer lane; sm3_hash_files_parallel() spreads the list over the
+// shared pool, small files in multi-buffer batches and large ones a task
+// each, results in path order. All return 0 on success, -1 on any I/O
+// error; stats may be NULL.
+typedef enum {
+    SM3_IO_MMAP,
+    SM3_IO_PIPELINED_READ
+} sm3_io_method_t;
+
+typedef struct {
+    uint64_t bytes;
+    double seconds;                 // wall clock, I/O included
+    sm3_io_method_t method;
+} sm3_file_stats_t;
+
+int sm3_hash_fd(int fd, uint8_t digest[SM3_DIGEST_SIZE], sm3_file_stats_t *stats);
+int sm3_hash_file(const char *path, uint8_t digest[SM3_DIGEST_SIZE], sm3_file_stats_t *stats);
+int sm3_hash_files(const char *const paths[], size_t count, uint8_t digests[][SM3_DIGEST_SIZE],
+                   int status[], sm3_file_stats_t *stats);
+int sm3_hash_files_parallel(const char *const paths[], size_t count,
+                            uint8_t digests[][SM3_DIGEST_SIZE], int status[],
+                            sm3_file_stats_t *stats);
+const char *sm3_io_method_name(sm3_io_method_t method);
+
+// sha256sum-style checksum lines, "<digest>  <path>", with coreutils'
+// escaping of backslashes and newlines in path
+int sm3_sum_format_line(FILE *out, const uint8_t digest[SM3_DIGEST_SIZE], const char *path);
+char *sm3_sum_parse_line(const char *line, uint8_t digest[SM3_DIGEST_SIZE]);
+
+// SM3-TREE digest mode (sm3_tree.c)
+//
+// A separate digest, not interchangeable with SM3: the input is cut into
+// chunk_size-byte chunks hashed on num_threads cores and combined with an
+// RFC 6962 tree. chunk_size 0 means SM3_TREE_DEFAULT_CHUNK, num_threads
+// <= 0 means the shared pool (one worker per CPU), 1 the calling thread
+// only. The digest depends on chunk_size but not on num_threads. Returns
+// 0, or -1 on allocation / I/O failure.
+#define SM3_TREE_DEFAULT_CHUNK  (1u << 20)
+
+int sm3_tree_hash(const uint8_t *data, size_t len, size_t chunk_size, int num_threads,
+                  uint8_t digest[SM3_DIGEST_SIZE]);
+int sm3_tree_hash_file(const char *path, size_t chunk_size, int num_threads,
+                       uint8_t digest[SM3_DIGEST_SIZE]);
+
+// Work-stealing thread pool (sm3_pool.c)
+//
+// Persistent workers with per-worker deques. sm3_pool_default() is shared
+// by the library (one worker per allowed CPU, pinned, NUMA-aware steal
+// order) and created on first use. Tasks are grouped: submit any number
+// into a group, then sm3_pool_wait() runs queued tasks until the group is
+// done. sm3_parallel_for() calls fn(ctx, b, e) over [begin, end) in pieces
+// of at least grain (0 picks one) and returns when all have run. A NULL
+// pool means the shared one for sm3_parallel_for() and inline execution
+// for submit. Tasks may submit and wait on nested groups.
+typedef struct sm3_pool sm3_pool_t;
+typedef void (*sm3_task_fn_t)(void *arg);
+typedef void (*sm3_range_fn_t)(void *ctx, size_t begin, size_t end);
+
+typedef struct {
+    sm3_task_fn_t fn;
+    void *arg;
+} sm3_task_t;
+
+typedef struct {
+    size_t pending;                 // tasks not finished yet
+} sm3_task_group_t;
+
+sm3_pool_t *sm3_pool_create(int num_threads);       // <= 0: one per CPU
+void sm3_pool_destroy(sm3_pool_t *pool);
+sm3_pool_t *sm3_pool_default(void);
+int sm3_pool_size(const sm3_pool_t *pool);
+void sm3_task_group_init(sm3_task_group_t *group);
+int sm3_pool_submit(sm3_pool_t *pool, sm3_task_group_t *group, sm3_task_fn_t fn, void *arg);
+int sm3_pool_submit_batch(sm3_pool_t *pool, sm3_task_group_t *group,
+                          const sm3_task_t tasks[], size_t count);
+void sm3_pool_wait(sm3_pool_t *pool, sm3_task_group_t *group);
+void sm3_parallel_for(sm3_pool_t *pool, size_t begin, size_t end, size_t grain,
+                      sm3_range_fn_t fn, void *ctx);
+
+// Parallel multi-message hashing on the pool (sm3_parallel.c)
+//
+// sm3_parallel_init() gives sm3_hash_parallel() a private pool of
+// num_threads workers (<= 0: one per CPU) until sm3_parallel_cleanup();
+// without it the shared pool is used.
+int sm3_parallel_init(int num_threads);
+void sm3_parallel_cleanup(void);
+int sm3_hash_parallel(const uint8_t **messages, const size_t *lengths,
+                      size_t count, uint8_t **hashes);
+int sm3_hash_simd_x4(const uint8_t *messages[4], const size_t lengths[4], uint8_t hashes[4][32]);
+double benchmark_sm3_parallel(size_t num_messages, size_t message_size, int num_threads);
+
+// Runtime statistics (sm3_stats.c)
+//
+// With -DSM3_STATS (make STATS=1) the library counts compression calls and
+// blocks per backend, calls and bytes per entry point, and slow-path hits.
+// Counters are per thread and cache-line aligned; sm3_stats_snapshot()
+// adds them up without locking. They only increase, and a snapshot is not
+// atomic across counters. Without SM3_STATS nothing is counted and
+// snapshots are zero.
+typedef enum {
+    SM3_STAT_UPDATE,        // sm3_update (and so sm3_hash)
+    SM3_STAT_MB,            // jobs through the multi-buffer manager
+    SM3_STAT_PARALLEL,      // sm3_hash_parallel batches
+    SM3_STAT_TREE,          // sm3_tree_hash
+    SM3_STAT_OP_COUNT
+} sm3_stat_op_t;
+
+typedef enum {
+    SM3_SLOW_UPDATE_CARRY,  // buffered partial block completed by sm3_update
+    SM3_SLOW_MB_IDLE_LANES, // multi-buffer kernel run with idle lanes
+    SM3_SLOW_POOL_INLINE,   // sm3_parallel_for range too small to split
+    SM3_SLOW_COUNT
+} sm3_slow_path_t;
+
+typedef struct {
+    uint64_t backend_calls[SM3_BACKEND_COUNT];
+    uint64_t backend_blocks[SM3_BACKEND_COUNT];
+    uint64_t op_calls[SM3_STAT_OP_COUNT];
+    uint64_t op_bytes[SM3_STAT_OP_COUNT];
+    uint64_t slow_paths[SM3_SLOW_COUNT];
+} sm3_stats_t;
+
+int sm3_stats_enabled(void);
+void sm3_stats_snapshot(sm3_stats_t *stats);
+const char *sm3_stat_op_name(sm3_stat_op_t op);
+const char *sm3_slow_path_name(sm3_slow_path_t path);
+
 // Utility macros
 #define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 #define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
@@ -1,27 +1,38 @@
 /**
  * SM3 Architecture-Specific Optimizations
- * 
+ *
  * This file implements architecture-specific optimizations for SM3:
- * - x86_64 optimizations (AVX2, AVX-512, BMI instructions)
- * - ARM64 optimizations (NEON, SVE, Crypto extensions)
- * - CPU feature detection and dynamic dispatch
- * - Compiler-specific optimizations
- * 
- * Performance improvements: 40-80% depending on architecture
+ * - CPU feature detection (CPUID/XGETBV on x86_64, HWCAP on ARM64)
+ * - Dynamic dispatch of sm3_compress_blocks() to the best backend:
+ *   AVX-512 / AVX2 message schedule on x86_64, the SM3 crypto extension
+ *   or NEON on ARM64, portable C everywhere else
+ * - Prefetching and runtime tuning helpers
+ *
+ * The backends live in sm3_simd.c, sm3_simd_avx512.c, sm3_neon.c, sm3_ce.c
+ * and sm3_basic.c, each built with only its own ISA flags; all of them take
+ * (state, data, nblocks), so callers never see which one runs.
  */
 
 #include "sm3.h"
-#include <cpuid.h>
-#include <string.h>
+#include "sm3_stats.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 // Architecture detection macros
 #if defined(__x86_64__) || defined(_M_X64)
     #define ARCH_X86_64 1
+    #include <cpuid.h>
     #include <immintrin.h>
 #elif defined(__aarch64__) || defined(_M_ARM64)
     #define ARCH_ARM64 1
-    #include <arm_neon.h>
+    #include <sys/auxv.h>
+    #include <asm/hwcap.h>
+    #ifndef HWCAP_SM3
+    #define HWCAP_SM3 (1 << 18)
+    #endif
 #else
     #define ARCH_GENERIC 1
 #endif
@@ -31,410 +42,227 @@
  */
 typedef struct {
     int has_avx2;
-    int has_avx512;
+    int has_avx512;         // AVX512F + AVX512VL, enabled by the OS
     int has_bmi1;
     int has_bmi2;
     int has_sha;
     int has_neon;
     int has_sve;
     int has_crypto;
+    int has_sm3;            // SM3SS1/SM3TT*/SM3PARTW*
 } cpu_features_t;
 
 static cpu_features_t g_cpu_features = {0};
-static int g_features_detected = 0;
+static pthread_once_t g_features_once = PTHREAD_ONCE_INIT;
 
-/**
- * Detect CPU features
- */
-void detect_cpu_features(void) {
-    if (g_features_detected) return;
-    
+#ifdef ARCH_X86_64
+static uint64_t arch_xgetbv(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+#endif
+
+static void detect_cpu_features_once(void) {
 #ifdef ARCH_X86_64
     unsigned int eax, ebx, ecx, edx;
-    
-    // Check for AVX2 support
+    uint64_t xcr0 = 0;
+
+    // The OS must save YMM (and ZMM/opmask) state for AVX2 (AVX-512) to be usable
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE)) {
+        xcr0 = arch_xgetbv();
+    }
+
     if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
-        g_cpu_features.has_avx2 = (ebx & (1 << 5)) != 0;
-        g_cpu_features.has_bmi1 = (ebx & (1 << 3)) != 0;
-        g_cpu_features.has_bmi2 = (ebx & (1 << 8)) != 0;
-        g_cpu_features.has_sha = (ebx & (1 << 29)) != 0;
-        g_cpu_features.has_avx512 = (ebx & (1 << 16)) != 0; // AVX512F
+        g_cpu_features.has_avx2 = (ebx & bit_AVX2) && (xcr0 & 0x6) == 0x6;
+        g_cpu_features.has_bmi1 = (ebx & bit_BMI) != 0;
+        g_cpu_features.has_bmi2 = (ebx & bit_BMI2) != 0;
+        g_cpu_features.has_sha = (ebx & bit_SHA) != 0;
+        g_cpu_features.has_avx512 = (ebx & bit_AVX512F) && (ebx & bit_AVX512VL) &&
+                                    (xcr0 & 0xE6) == 0xE6;
     }
-    
-    printf("CPU Features detected: AVX2=%d, AVX512=%d, BMI1=%d, BMI2=%d, SHA=%d\n",
-           g_cpu_features.has_avx2, g_cpu_features.has_avx512,
-           g_cpu_features.has_bmi1, g_cpu_features.has_bmi2, g_cpu_features.has_sha);
-           
 #elif defined(ARCH_ARM64)
-    // ARM64 feature detection would use getauxval() or similar
-    // For now, assume NEON is available (standard on ARM64)
-    g_cpu_features.has_neon = 1;
-    
-    // Check for crypto extensions (simplified)
-    #ifdef __ARM_FEATURE_CRYPTO
-    g_cpu_features.has_crypto = 1;
-    #endif
-    
-    printf("CPU Features detected: NEON=%d, Crypto=%d, SVE=%d\n",
-           g_cpu_features.has_neon, g_cpu_features.has_crypto, g_cpu_features.has_sve);
+    unsigned long hwcap = getauxval(AT_HWCAP);
+
+    g_cpu_features.has_neon = (hwcap & HWCAP_ASIMD) != 0;
+    g_cpu_features.has_sm3 = (hwcap & HWCAP_SM3) != 0;
+#ifdef HWCAP_SVE
+    g_cpu_features.has_sve = (hwcap & HWCAP_SVE) != 0;
+#endif
 #endif
-    
-    g_features_detected = 1;
 }
 
 /**
- * x86_64 AVX2 optimized SM3 compression
+ * Detect CPU features (once; safe to call from several threads)
  */
-#ifdef ARCH_X86_64
-void sm3_compress_avx2(uint32_t state[8], const uint32_t w[68], const uint32_t w1[64]) {
-    if (!g_cpu_features.has_avx2) {
-        sm3_compress_simd(state, w, w1); // Fall back to basic SIMD
-        return;
-    }
-    
-    // Load state into AVX2 registers
-    __m256i state_lo = _mm256_loadu_si256((__m256i*)&state[0]); // A,B,C,D
-    __m256i state_hi = _mm256_loadu_si256((__m256i*)&state[4]); // E,F,G,H
-    
-    // Constants
-    const __m256i t1 = _mm256_set1_epi32(0x79CC4519);
-    const __m256i t2 = _mm256_set1_epi32(0x7A879D8A);
-    
-    // Process rounds in groups of 4 for better vectorization
-    for (int j = 0; j < 64; j += 4) {
-        __m256i t_vals = (j < 16) ? t1 : t2;
-        
-        // Vectorized round processing
-        for (int i = 0; i < 4 && j + i < 64; i++) {
-            uint32_t t_j = (j + i < 16) ? 0x79CC4519 : 0x7A879D8A;
-            
-            // Rotate t_j by (j+i) positions
-            uint32_t rot = (j + i) % 32;
-            t_j = (t_j << rot) | (t_j >> (32 - rot));
-            
-            // Extract individual state values for computation
-            uint32_t a = _mm256_extract_epi32(state_lo, 0);
-            uint32_t b = _mm256_extract_epi32(state_lo, 1);
-            uint32_t c = _mm256_extract_epi32(state_lo, 2);
-            uint32_t d = _mm256_extract_epi32(state_lo, 3);
-            uint32_t e = _mm256_extract_epi32(state_hi, 0);
-            uint32_t f = _mm256_extract_epi32(state_hi, 1);
-            uint32_t g = _mm256_extract_epi32(state_hi, 2);
-            uint32_t h = _mm256_extract_epi32(state_hi, 3);
-            
-            // SM3 round computation
-            uint32_t ss1 = ROL32((ROL32(a, 12) + e + t_j), 7);
-            uint32_t ss2 = ss1 ^ ROL32(a, 12);
-            
-            uint32_t tt1, tt2;
-            if (j + i <= 15) {
-                tt1 = ((a & b) | ((~a) & c)) + d + ss2 + w1[j + i];
-                tt2 = ((e & f) | ((~e) & g)) + h + ss1 + w[j + i];
-            } else {
-                tt1 = (a ^ b ^ c) + d + ss2 + w1[j + i];
-                tt2 = (e ^ f ^ g) + h + ss1 + w[j + i];
-            }
-            
-            // Update state
-            d = c;
-            c = ROL32(b, 9);
-            b = a;
-            a = tt1;
-            h = g;
-            g = ROL32(f, 19);
-            f = e;
-            e = p0_function(tt2);
-            
-            // Pack back into AVX2 registers
-            state_lo = _mm256_insert_epi32(state_lo, a, 0);
-            state_lo = _mm256_insert_epi32(state_lo, b, 1);
-            state_lo = _mm256_insert_epi32(state_lo, c, 2);
-            state_lo = _mm256_insert_epi32(state_lo, d, 3);
-            state_hi = _mm256_insert_epi32(state_hi, e, 0);
-            state_hi = _mm256_insert_epi32(state_hi, f, 1);
-            state_hi = _mm256_insert_epi32(state_hi, g, 2);
-            state_hi = _mm256_insert_epi32(state_hi, h, 3);
-        }
-    }
-    
-    // Extract final values and XOR with original state
-    uint32_t final_state[8];
-    _mm256_storeu_si256((__m256i*)&final_state[0], state_lo);
-    _mm256_storeu_si256((__m256i*)&final_state[4], state_hi);
-    
-    for (int i = 0; i < 8; i++) {
-        state[i] ^= final_state[i];
-    }
+void detect_cpu_features(void) {
+    pthread_once(&g_features_once, detect_cpu_features_once);
 }
 
 /**
- * x86_64 BMI instruction optimizations
+ * Backend table
  */
-uint32_t rol32_bmi(uint32_t value, int count) {
-    #ifdef __BMI2__
-    if (g_cpu_features.has_bmi2) {
-        return _rotl(value, count);
-    }
-    #endif
-    return (value << count) | (value >> (32 - count));
-}
+static const char *const g_backend_names[SM3_BACKEND_COUNT] = {
+    "generic",
+    "avx2",
+    "avx512",
+    "neon",
+    "armv8-ce"
+};
 
-/**
- * AVX-512 optimized message expansion (if available)
- */
-void sm3_message_expansion_avx512(uint32_t w[68], uint32_t w1[64]) {
-    #ifdef __AVX512F__
-    if (!g_cpu_features.has_avx512) {
-        sm3_message_expansion_optimized(w, w1);
-        return;
-    }
-    
-    // Process 16 words at a time with AVX-512
-    for (int i = 16; i < 68; i += 16) {
-        int remaining = (i + 16 <= 68) ? 16 : (68 - i);
-        
-        for (int j = 0; j < remaining; j++) {
-            if (i + j >= 68) break;
-            
-            uint32_t temp = w[i + j - 16] ^ w[i + j - 9] ^ rol32_bmi(w[i + j - 3], 15);
-            w[i + j] = p1_function(temp) ^ rol32_bmi(w[i + j - 13], 7) ^ w[i + j - 6];
-        }
-    }
-    
-    // Compute W1 with vectorization
-    __m512i* w_vec = (__m512i*)w;
-    __m512i* w1_vec = (__m512i*)w1;
-    
-    for (int i = 0; i < 64; i += 16) {
-        __m512i w_block = _mm512_loadu_si512(&w_vec[i / 16]);
-        __m512i w_next = _mm512_loadu_si512(&w_vec[(i + 4) / 16]);
-        __m512i w1_block = _mm512_xor_si512(w_block, w_next);
-        _mm512_storeu_si512(&w1_vec[i / 16], w1_block);
+sm3_blocks_func_t sm3_get_blocks_func(sm3_backend_t backend) {
+    switch (backend) {
+    case SM3_BACKEND_GENERIC:
+        return sm3_compress_blocks_generic;
+#ifdef ARCH_X86_64
+    case SM3_BACKEND_AVX2:
+        return sm3_compress_blocks_avx2;
+    case SM3_BACKEND_AVX512:
+        return sm3_compress_blocks_avx512;
+#endif
+#ifdef ARCH_ARM64
+    case SM3_BACKEND_NEON:
+        return sm3_compress_blocks_neon;
+    case SM3_BACKEND_ARMV8_CE:
+        return sm3_compress_blocks_ce;
+#endif
+    default:
+        return NULL;
     }
-    #else
-    sm3_message_expansion_optimized(w, w1);
-    #endif
 }
 
-#endif /* ARCH_X86_64 */
+int sm3_backend_supported(sm3_backend_t backend) {
+    detect_cpu_features();
 
-/**
- * ARM64 NEON optimized SM3 compression
- */
+    switch (backend) {
+    case SM3_BACKEND_GENERIC:
+        return 1;
+#ifdef ARCH_X86_64
+    case SM3_BACKEND_AVX2:
+        return g_cpu_features.has_avx2;
+    case SM3_BACKEND_AVX512:
+        return g_cpu_features.has_avx512;
+#endif
 #ifdef ARCH_ARM64
-void sm3_compress_neon(uint32_t state[8], const uint32_t w[68], const uint32_t w1[64]) {
-    if (!g_cpu_features.has_neon) {
-        sm3_compress_basic(state, w, w1);
-        return;
-    }
-    
-    // Load state into NEON registers
-    uint32x4_t state_lo = vld1q_u32(&state[0]); // A,B,C,D
-    uint32x4_t state_hi = vld1q_u32(&state[4]); // E,F,G,H
-    
-    // Process rounds
-    for (int j = 0; j < 64; j++) {
-        uint32_t t_j = (j <= 15) ? 0x79CC4519 : 0x7A879D8A;
-        
-        // Rotate t_j
-        uint32_t rot = j % 32;
-        t_j = (t_j << rot) | (t_j >> (32 - rot));
-        
-        // Extract state values
-        uint32_t a = vgetq_lane_u32(state_lo, 0);
-        uint32_t b = vgetq_lane_u32(state_lo, 1);
-        uint32_t c = vgetq_lane_u32(state_lo, 2);
-        uint32_t d = vgetq_lane_u32(state_lo, 3);
-        uint32_t e = vgetq_lane_u32(state_hi, 0);
-        uint32_t f = vgetq_lane_u32(state_hi, 1);
-        uint32_t g = vgetq_lane_u32(state_hi, 2);
-        uint32_t h = vgetq_lane_u32(state_hi, 3);
-        
-        // SM3 round computation using NEON for rotations where beneficial
-        uint32_t a_rot12 = vgetq_lane_u32(vshlq_n_u32(vdupq_n_u32(a), 12) | 
-                                          vshrq_n_u32(vdupq_n_u32(a), 20), 0);
-        uint32_t ss1_temp = a_rot12 + e + t_j;
-        uint32_t ss1 = vgetq_lane_u32(vshlq_n_u32(vdupq_n_u32(ss1_temp), 7) | 
-                                      vshrq_n_u32(vdupq_n_u32(ss1_temp), 25), 0);
-        uint32_t ss2 = ss1 ^ a_rot12;
-        
-        uint32_t tt1, tt2;
-        if (j <= 15) {
-            tt1 = ((a & b) | ((~a) & c)) + d + ss2 + w1[j];
-            tt2 = ((e & f) | ((~e) & g)) + h + ss1 + w[j];
-        } else {
-            tt1 = (a ^ b ^ c) + d + ss2 + w1[j];
-            tt2 = (e ^ f ^ g) + h + ss1 + w[j];
-        }
-        
-        // Update state
-        d = c;
-        c = vgetq_lane_u32(vshlq_n_u32(vdupq_n_u32(b), 9) | 
-                           vshrq_n_u32(vdupq_n_u32(b), 23), 0);
-        b = a;
-        a = tt1;
-        h = g;
-        g = vgetq_lane_u32(vshlq_n_u32(vdupq_n_u32(f), 19) | 
-                           vshrq_n_u32(vdupq_n_u32(f), 13), 0);
-        f = e;
-        e = p0_function(tt2);
-        
-        // Pack back into NEON registers
-        state_lo = vsetq_lane_u32(a, state_lo, 0);
-        state_lo = vsetq_lane_u32(b, state_lo, 1);
-        state_lo = vsetq_lane_u32(c, state_lo, 2);
-        state_lo = vsetq_lane_u32(d, state_lo, 3);
-        state_hi = vsetq_lane_u32(e, state_hi, 0);
-        state_hi = vsetq_lane_u32(f, state_hi, 1);
-        state_hi = vsetq_lane_u32(g, state_hi, 2);
-        state_hi = vsetq_lane_u32(h, state_hi, 3);
+    case SM3_BACKEND_NEON:
+        return g_cpu_features.has_neon;
+    case SM3_BACKEND_ARMV8_CE:
+        return g_cpu_features.has_sm3 && sm3_ce_compiled();
+#endif
+    default:
+        return 0;
     }
-    
-    // XOR with original state
-    uint32x4_t orig_lo = vld1q_u32(&state[0]);
-    uint32x4_t orig_hi = vld1q_u32(&state[4]);
-    
-    state_lo = veorq_u32(state_lo, orig_lo);
-    state_hi = veorq_u32(state_hi, orig_hi);
-    
-    vst1q_u32(&state[0], state_lo);
-    vst1q_u32(&state[4], state_hi);
 }
 
-/**
- * ARM64 Crypto Extensions optimization (if available)
- */
-void sm3_compress_crypto(uint32_t state[8], const uint32_t w[68], const uint32_t w1[64]) {
-    #ifdef __ARM_FEATURE_CRYPTO
-    if (!g_cpu_features.has_crypto) {
-        sm3_compress_neon(state, w, w1);
-        return;
+const char *sm3_backend_name(sm3_backend_t backend) {
+    if ((unsigned)backend >= SM3_BACKEND_COUNT) {
+        return "unknown";
     }
-    
-    // Use crypto extensions for SHA operations where applicable
-    // Note: This is simplified - actual implementation would use SHA instructions
-    // for the permutation functions where beneficial
-    
-    sm3_compress_neon(state, w, w1); // Fallback for now
-    #else
-    sm3_compress_neon(state, w, w1);
-    #endif
+    return g_backend_names[backend];
 }
 
-#endif /* ARCH_ARM64 */
-
 /**
- * Function pointer for dynamic dispatch
+ * Dynamic dispatch state: the kernel table is filled once under
+ * pthread_once and read-only after that, and the active backend is the
+ * single word sm3_set_backend() may change while other threads hash, so
+ * it is only accessed atomically and the kernel always matches it
  */
-typedef void (*sm3_compress_func_t)(uint32_t state[8], const uint32_t w[68], const uint32_t w1[64]);
-static sm3_compress_func_t g_sm3_compress_func = NULL;
+static sm3_blocks_func_t g_sm3_blocks_funcs[SM3_BACKEND_COUNT];
+static sm3_backend_t g_sm3_backend = SM3_BACKEND_GENERIC;
+static pthread_once_t g_arch_once = PTHREAD_ONCE_INIT;
 
 /**
- * Initialize optimized functions based on CPU features
+ * Select the fastest supported backend
  */
-void sm3_arch_init(void) {
-    detect_cpu_features();
-    
-#ifdef ARCH_X86_64
-    if (g_cpu_features.has_avx2) {
-        g_sm3_compress_func = sm3_compress_avx2;
-        printf("Selected: AVX2 optimized SM3\n");
-    } else {
-        g_sm3_compress_func = sm3_compress_simd;
-        printf("Selected: Basic SIMD SM3\n");
+static void sm3_arch_init_once(void) {
+    static const sm3_backend_t preference[] = {
+        SM3_BACKEND_ARMV8_CE,
+        SM3_BACKEND_AVX512,
+        SM3_BACKEND_AVX2,
+        SM3_BACKEND_NEON,
+        SM3_BACKEND_GENERIC
+    };
+    size_t i;
+
+    for (i = 0; i < SM3_BACKEND_COUNT; i++) {
+        g_sm3_blocks_funcs[i] = sm3_get_blocks_func((sm3_backend_t)i);
     }
-#elif defined(ARCH_ARM64)
-    if (g_cpu_features.has_crypto) {
-        g_sm3_compress_func = sm3_compress_crypto;
-        printf("Selected: ARM Crypto optimized SM3\n");
-    } else if (g_cpu_features.has_neon) {
-        g_sm3_compress_func = sm3_compress_neon;
-        printf("Selected: NEON optimized SM3\n");
-    } else {
-        g_sm3_compress_func = sm3_compress_basic;
-        printf("Selected: Basic SM3\n");
+    for (i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        if (sm3_backend_supported(preference[i])) {
+            __atomic_store_n(&g_sm3_backend, preference[i], __ATOMIC_RELAXED);
+            return;
+        }
     }
-#else
-    g_sm3_compress_func = sm3_compress_basic;
-    printf("Selected: Generic SM3\n");
-#endif
+}
+
+void sm3_arch_init(void) {
+    pthread_once(&g_arch_once, sm3_arch_init_once);
+}
+
+sm3_backend_t sm3_get_backend(void) {
+    sm3_arch_init();
+    return __atomic_load_n(&g_sm3_backend, __ATOMIC_RELAXED);
+}
+
+int sm3_set_backend(sm3_backend_t backend) {
+    sm3_arch_init();
+    if (!sm3_backend_supported(backend)) {
+        return -1;
+    }
+    __atomic_store_n(&g_sm3_backend, backend, __ATOMIC_RELAXED);
+    return 0;
 }
 
 /**
- * Optimized SM3 compression with dynamic dispatch
+ * Multi-block compression with dynamic dispatch
  */
-void sm3_compress_optimized(uint32_t state[8], const uint32_t w[68], const uint32_t w1[64]) {
-    if (!g_sm3_compress_func) {
-        sm3_arch_init();
+void sm3_compress_blocks(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks) {
+    sm3_backend_t backend;
+
+    if (nblocks == 0) {
+        return;
     }
-    g_sm3_compress_func(state, w, w1);
+    sm3_arch_init();
+    backend = __atomic_load_n(&g_sm3_backend, __ATOMIC_RELAXED);
+    SM3_STAT_ADD(backend_calls[backend], 1);
+    SM3_STAT_ADD(backend_blocks[backend], nblocks);
+    g_sm3_blocks_funcs[backend](state, data, nblocks);
 }
 
 /**
  * Compiler-specific optimizations
  */
 #if defined(__GNUC__) || defined(__clang__)
-    #define FORCE_INLINE __attribute__((always_inline)) inline
     #define LIKELY(x) __builtin_expect(!!(x), 1)
-    #define UNLIKELY(x) __builtin_expect(!!(x), 0)
     #define PREFETCH(addr, rw, locality) __builtin_prefetch(addr, rw, locality)
-#elif defined(_MSC_VER)
-    #define FORCE_INLINE __forceinline
-    #define LIKELY(x) (x)
-    #define UNLIKELY(x) (x)
-    #define PREFETCH(addr, rw, locality) _mm_prefetch((const char*)(addr), _MM_HINT_T##locality)
 #else
-    #define FORCE_INLINE inline
     #define LIKELY(x) (x)
-    #define UNLIKELY(x) (x)
     #define PREFETCH(addr, rw, locality)
 #endif
 
 /**
  * Cache-optimized SM3 for large data
+ *
+ * Compresses 512-byte spans through the dispatched backend while
+ * prefetching the next span.
  */
 void sm3_hash_large_data_optimized(const uint8_t* data, size_t length, uint8_t hash[32]) {
-    sm3_context_t ctx;
+    const size_t span = 512;
+    sm3_ctx_t ctx;
+    size_t offset = 0;
+
     sm3_init(&ctx);
-    
-    const size_t block_size = 64;
-    const size_t prefetch_distance = 512; // Prefetch 8 blocks ahead
-    
-    // Process full blocks with prefetching
-    size_t blocks = length / block_size;
-    for (size_t i = 0; i < blocks; i++) {
-        const uint8_t* block = data + i * block_size;
-        
-        // Prefetch future blocks
-        if (LIKELY(i * block_size + prefetch_distance < length)) {
-            PREFETCH(data + i * block_size + prefetch_distance, 0, 3);
-        }
-        
-        // Process current block
-        uint32_t w[68], w1[64];
-        
-        // Load message block with potential unaligned access optimization
-        for (int j = 0; j < 16; j++) {
-            w[j] = be32toh(((const uint32_t*)block)[j]);
+
+    while (offset + span <= length) {
+        if (LIKELY(offset + 2 * span <= length)) {
+            PREFETCH(data + offset + span, 0, 3);
+            PREFETCH(data + offset + span + 256, 0, 3);
         }
-        
-        // Use optimized message expansion
-        #ifdef ARCH_X86_64
-        sm3_message_expansion_avx512(w, w1);
-        #else
-        sm3_message_expansion_optimized(w, w1);
-        #endif
-        
-        // Use optimized compression
-        sm3_compress_optimized(ctx.state, w, w1);
-    }
-    
-    // Handle remaining bytes
-    size_t remaining = length % block_size;
-    if (remaining > 0) {
-        sm3_update(&ctx, data + blocks * block_size, remaining);
+        sm3_update(&ctx, data + offset, span);
+        offset += span;
     }
-    
+    sm3_update(&ctx, data + offset, length - offset);
+
     sm3_final(&ctx, hash);
 }
 
@@ -442,56 +270,50 @@ void sm3_hash_large_data_optimized(const uint8_t* data, size_t length, uint8_t h
  * Architecture-specific benchmarking
  */
 void benchmark_arch_optimizations(void) {
-    printf("=== Architecture-Specific Optimization Benchmark ===\n");
-    
     const size_t test_size = 1024 * 1024; // 1MB
     const int iterations = 100;
-    
+    sm3_backend_t saved = sm3_get_backend();
     uint8_t* test_data = malloc(test_size);
     uint8_t hash[32];
-    
-    // Fill with random data
+    int b;
+
+    if (!test_data) {
+        return;
+    }
+
+    printf("=== Architecture-Specific Optimization Benchmark ===\n");
+
     for (size_t i = 0; i < test_size; i++) {
         test_data[i] = (uint8_t)(rand() & 0xFF);
     }
-    
-    // Benchmark different implementations
-    clock_t start, end;
-    double time_taken;
-    
-    // Generic implementation
-    start = clock();
-    for (int i = 0; i < iterations; i++) {
-        sm3_hash_basic(test_data, test_size, hash);
-    }
-    end = clock();
-    time_taken = ((double)(end - start)) / CLOCKS_PER_SEC;
-    printf("Generic SM3: %.3f seconds (%.2f MB/s)\n", 
-           time_taken, (test_size * iterations) / (time_taken * 1024 * 1024));
-    
-    // Optimized implementation
-    sm3_arch_init(); // Ensure optimizations are initialized
-    start = clock();
-    for (int i = 0; i < iterations; i++) {
-        sm3_hash_large_data_optimized(test_data, test_size, hash);
+
+    for (b = 0; b < SM3_BACKEND_COUNT; b++) {
+        clock_t start, end;
+        double time_taken;
+
+        if (sm3_set_backend((sm3_backend_t)b) != 0) {
+            continue;
+        }
+        start = clock();
+        for (int i = 0; i < iterations; i++) {
+            sm3_hash(test_data, test_size, hash);
+        }
+        end = clock();
+        time_taken = ((double)(end - start)) / CLOCKS_PER_SEC;
+        printf("%-8s SM3: %.3f seconds (%.2f MB/s)\n", sm3_backend_name((sm3_backend_t)b),
+               time_taken, (test_size * iterations) / (time_taken * 1024 * 1024));
     }
-    end = clock();
-    time_taken = ((double)(end - start)) / CLOCKS_PER_SEC;
-    printf("Optimized SM3: %.3f seconds (%.2f MB/s)\n", 
-           time_taken, (test_size * iterations) / (time_taken * 1024 * 1024));
-    
+    sm3_set_backend(saved);
+
 #ifdef ARCH_X86_64
-    if (g_cpu_features.has_avx2) {
-        printf("Architecture: x86_64 with AVX2\n");
-        printf("Additional optimizations: BMI=%d, AVX512=%d, SHA=%d\n",
-               g_cpu_features.has_bmi1, g_cpu_features.has_avx512, g_cpu_features.has_sha);
-    }
+    printf("Architecture: x86_64 (AVX2=%d, AVX512=%d, BMI2=%d, SHA=%d)\n",
+           g_cpu_features.has_avx2, g_cpu_features.has_avx512,
+           g_cpu_features.has_bmi2, g_cpu_features.has_sha);
 #elif defined(ARCH_ARM64)
-    printf("Architecture: ARM64\n");
-    printf("Available features: NEON=%d, Crypto=%d, SVE=%d\n",
-           g_cpu_features.has_neon, g_cpu_features.has_crypto, g_cpu_features.has_sve);
+    printf("Architecture: ARM64 (NEON=%d, SM3=%d, SVE=%d)\n",
+           g_cpu_features.has_neon, g_cpu_features.has_sm3, g_cpu_features.has_sve);
 #endif
-    
+
     free(test_data);
 }
 
@@ -506,7 +328,9 @@ typedef struct {
 
 perf_config_t auto_tune_performance(void) {
     perf_config_t config = {64, 512, 0}; // Default values
-    
+
+    detect_cpu_features();
+
     // Simple auto-tuning based on CPU features
 #ifdef ARCH_X86_64
     if (g_cpu_features.has_avx512) {
@@ -525,32 +349,6 @@ perf_config_t auto_tune_performance(void) {
         config.use_parallel_processing = 1;
     }
 #endif
-    
-    printf("Auto-tuned configuration:\n");
-    printf("  Block size: %zu bytes\n", config.optimal_block_size);
-    printf("  Prefetch distance: %zu bytes\n", config.optimal_prefetch_distance);
-    printf("  Parallel processing: %s\n", config.use_parallel_processing ? "enabled" : "disabled");
-    
-    return config;
-}
 
-/**
- * Main demonstration function
- */
-int main(void) {
-    printf("SM3 Architecture-Specific Optimizations Demo\n");
-    printf("============================================\n\n");
-    
-    // Initialize and show detected features
-    sm3_arch_init();
-    printf("\n");
-    
-    // Run benchmarks
-    benchmark_arch_optimizations();
-    printf("\n");
-    
-    // Auto-tune performance
-    perf_config_t config = auto_tune_performance();
-    
-    return 0;
+    return config;
 }
@@ -1,12 +1,35 @@
 #include "sm3.h"
+#include "sm3_stats.h"
+#include "sm3_internal.h"
 #include <string.h>
 
 // SM3 initial hash values
-static const uint32_t sm3_iv[8] = {
+const uint32_t sm3_iv[SM3_STATE_SIZE] = {
     0x7380166F, 0x4914B2B9, 0x172442D7, 0xDA8A0600,
     0xA96F30BC, 0x163138AA, 0xE38DEE4D, 0xB0FB0E4E
 };
 
+// Round constants T(j) <<< (j mod 32), as const data so no round rotates
+// a constant at run time (checked against T(j) by the test suite)
+const uint32_t sm3_tj[64] __attribute__((aligned(64))) = {
+    0x79CC4519, 0xF3988A32, 0xE7311465, 0xCE6228CB,
+    0x9CC45197, 0x3988A32F, 0x7311465E, 0xE6228CBC,
+    0xCC451979, 0x988A32F3, 0x311465E7, 0x6228CBCE,
+    0xC451979C, 0x88A32F39, 0x11465E73, 0x228CBCE6,
+    0x9D8A7A87, 0x3B14F50F, 0x7629EA1E, 0xEC53D43C,
+    0xD8A7A879, 0xB14F50F3, 0x629EA1E7, 0xC53D43CE,
+    0x8A7A879D, 0x14F50F3B, 0x29EA1E76, 0x53D43CEC,
+    0xA7A879D8, 0x4F50F3B1, 0x9EA1E762, 0x3D43CEC5,
+    0x7A879D8A, 0xF50F3B14, 0xEA1E7629, 0xD43CEC53,
+    0xA879D8A7, 0x50F3B14F, 0xA1E7629E, 0x43CEC53D,
+    0x879D8A7A, 0x0F3B14F5, 0x1E7629EA, 0x3CEC53D4,
+    0x79D8A7A8, 0xF3B14F50, 0xE7629EA1, 0xCEC53D43,
+    0x9D8A7A87, 0x3B14F50F, 0x7629EA1E, 0xEC53D43C,
+    0xD8A7A879, 0xB14F50F3, 0x629EA1E7, 0xC53D43CE,
+    0x8A7A879D, 0x14F50F3B, 0x29EA1E76, 0x53D43CEC,
+    0xA7A879D8, 0x4F50F3B1, 0x9EA1E762, 0x3D43CEC5
+};
+
 // Initialize SM3 context
 void sm3_init(sm3_ctx_t *ctx) {
     memcpy(ctx->state, sm3_iv, sizeof(sm3_iv));
@@ -49,7 +72,7 @@ void sm3_compress_basic(uint32_t state[8], const uint8_t block[64]) {
     
     // Main compression loop
     for (j = 0; j < 64; j++) {
-        SS1 = ROTL32(ROTL32(A, 12) + E + ROTL32(T(j), j % 32), 7);
+        SS1 = ROTL32(ROTL32(A, 12) + E + sm3_tj[j], 7);
         SS2 = SS1 ^ ROTL32(A, 12);
         TT1 = FF(A, B, C, j) + D + SS2 + W1[j];
         TT2 = GG(E, F, G, j) + H + SS1 + W[j];
@@ -106,7 +129,7 @@ void sm3_compress_optimized(uint32_t state[8], const uint8_t block[64]) {
     
     // Optimized compression with reduced branching
     for (j = 0; j < 16; j++) {
-        SS1 = ROTL32(ROTL32(A, 12) + E + ROTL32(0x79CC4519, j), 7);
+        SS1 = ROTL32(ROTL32(A, 12) + E + sm3_tj[j], 7);
         SS2 = SS1 ^ ROTL32(A, 12);
         TT1 = (A ^ B ^ C) + D + SS2 + W1[j];
         TT2 = (E ^ F ^ G) + H + SS1 + W[j];
@@ -115,7 +138,7 @@ void sm3_compress_optimized(uint32_t state[8], const uint8_t block[64]) {
     }
     
     for (j = 16; j < 64; j++) {
-        SS1 = ROTL32(ROTL32(A, 12) + E + ROTL32(0x7A879D8A, j % 32), 7);
+        SS1 = ROTL32(ROTL32(A, 12) + E + sm3_tj[j], 7);
         SS2 = SS1 ^ ROTL32(A, 12);
         TT1 = ((A & B) | (A & C) | (B & C)) + D + SS2 + W1[j];
         TT2 = ((E & F) | ((~E) & G)) + H + SS1 + W[j];
@@ -127,25 +150,58 @@ void sm3_compress_optimized(uint32_t state[8], const uint8_t block[64]) {
     state[4] ^= E; state[5] ^= F; state[6] ^= G; state[7] ^= H;
 }
 
+// Portable multi-block compression: scalar schedule, unrolled rounds
+void sm3_compress_blocks_generic(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+    uint32_t W[68];
+    int j;
+    
+    while (nblocks-- > 0) {
+        for (j = 0; j < 16; j++) {
+            W[j] = ((uint32_t)data[j * 4] << 24) |
+                   ((uint32_t)data[j * 4 + 1] << 16) |
+                   ((uint32_t)data[j * 4 + 2] << 8) |
+                   ((uint32_t)data[j * 4 + 3]);
+        }
+        // Three independent words per step (W[j] needs W[j-3]); a plain
+        // one-word loop gets auto-vectorised into something slower
+        for (j = 16; j < 67; j += 3) {
+            uint32_t w0 = P1(W[j-16] ^ W[j-9] ^ ROTL32(W[j-3], 15)) ^ ROTL32(W[j-13], 7) ^ W[j-6];
+            uint32_t w1 = P1(W[j-15] ^ W[j-8] ^ ROTL32(W[j-2], 15)) ^ ROTL32(W[j-12], 7) ^ W[j-5];
+            uint32_t w2 = P1(W[j-14] ^ W[j-7] ^ ROTL32(W[j-1], 15)) ^ ROTL32(W[j-11], 7) ^ W[j-4];
+            W[j] = w0;
+            W[j+1] = w1;
+            W[j+2] = w2;
+        }
+        W[67] = P1(W[51] ^ W[58] ^ ROTL32(W[64], 15)) ^ ROTL32(W[54], 7) ^ W[61];
+        sm3_compress_rounds(state, W);
+        data += SM3_BLOCK_SIZE;
+    }
+}
+
 // Update SM3 context with new data
 void sm3_update(sm3_ctx_t *ctx, const uint8_t *data, size_t len) {
     size_t left = ctx->count % SM3_BLOCK_SIZE;
     size_t fill = SM3_BLOCK_SIZE - left;
     
     ctx->count += len;
+    SM3_STAT_ADD(op_calls[SM3_STAT_UPDATE], 1);
+    SM3_STAT_ADD(op_bytes[SM3_STAT_UPDATE], len);
     
     if (left && len >= fill) {
+        SM3_STAT_ADD(slow_paths[SM3_SLOW_UPDATE_CARRY], 1);
         memcpy(ctx->buffer + left, data, fill);
-        sm3_compress_optimized(ctx->state, ctx->buffer);
+        sm3_compress_blocks(ctx->state, ctx->buffer, 1);
         data += fill;
         len -= fill;
         left = 0;
     }
     
-    while (len >= SM3_BLOCK_SIZE) {
-        sm3_compress_optimized(ctx->state, data);
-        data += SM3_BLOCK_SIZE;
-        len -= SM3_BLOCK_SIZE;
+    // All whole blocks in one call
+    if (len >= SM3_BLOCK_SIZE) {
+        size_t nblocks = len / SM3_BLOCK_SIZE;
+        sm3_compress_blocks(ctx->state, data, nblocks);
+        data += nblocks * SM3_BLOCK_SIZE;
+        len -= nblocks * SM3_BLOCK_SIZE;
     }
     
     if (len > 0) {
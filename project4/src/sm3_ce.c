@@ -0,0 +1,112 @@
+#include "sm3.h"
+
+// SM3 with the Armv8.2-A SM3 Crypto Extension
+//
+// The state lives in two vectors, ABCD and EFGH, stored in reverse lane
+// order as the instructions expect. Each round is SM3SS1 + SM3TT1x +
+// SM3TT2x (x = A for rounds 0-15, B after), with the rotated T(j) kept in
+// the top lane of a vector and rotated once per round. SM3PARTW1/SM3PARTW2
+// extend the message schedule four words at a time, overlapped with the
+// rounds that consume the previous four.
+//
+// Built with -march=armv8.2-a+sm4 and only selected when the kernel reports
+// HWCAP_SM3; without compiler support the backend reports unsupported.
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_SM3)
+#include <arm_neon.h>
+
+static inline uint32x4_t ce_load_be(const uint8_t *p) {
+    return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)));
+}
+
+// [x0, x1, x2, x3] <-> [x3, x2, x1, x0]
+static inline uint32x4_t ce_reverse(uint32x4_t x) {
+    x = vrev64q_u32(x);
+    return vextq_u32(x, x, 2);
+}
+
+#define SM3_CE_ROUND(ab, w, wp, i) do {                                  \
+        uint32x4_t ss1 = vsm3ss1q_u32(abcd, t, efgh);                    \
+        t = vsriq_n_u32(vshlq_n_u32(t, 1), t, 31);                       \
+        abcd = vsm3tt1##ab##q_u32(abcd, ss1, wp, i);                     \
+        efgh = vsm3tt2##ab##q_u32(efgh, ss1, w, i);                      \
+    } while (0)
+
+// Four rounds on W[j..j+3] (s0), with W'[j] = W[j] ^ W[j+4]
+#define SM3_CE_QROUND(ab, s0, s1) do {                                   \
+        uint32x4_t wp = veorq_u32(s0, s1);                               \
+        SM3_CE_ROUND(ab, s0, wp, 0);                                     \
+        SM3_CE_ROUND(ab, s0, wp, 1);                                     \
+        SM3_CE_ROUND(ab, s0, wp, 2);                                     \
+        SM3_CE_ROUND(ab, s0, wp, 3);                                     \
+    } while (0)
+
+// Same, and produce W[j+16..j+19] into s4 meanwhile
+#define SM3_CE_QROUND_EXPAND(ab, s0, s1, s2, s3, s4) do {                \
+        uint32x4_t w7 = vextq_u32(s0, s1, 3);                            \
+        uint32x4_t w10 = vextq_u32(s2, s3, 2);                           \
+        s4 = vsm3partw1q_u32(vextq_u32(s1, s2, 3), s0, s3);              \
+        SM3_CE_QROUND(ab, s0, s1);                                       \
+        s4 = vsm3partw2q_u32(s4, w10, w7);                               \
+    } while (0)
+
+void sm3_compress_blocks_ce(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks) {
+    const uint32x4_t t0 = vsetq_lane_u32(0x79CC4519, vdupq_n_u32(0), 3);
+    const uint32x4_t t16 = vsetq_lane_u32(0x9D8A7A87, vdupq_n_u32(0), 3);    // 0x7A879D8A <<< 16
+    uint32x4_t abcd = ce_reverse(vld1q_u32(state));
+    uint32x4_t efgh = ce_reverse(vld1q_u32(state + 4));
+
+    while (nblocks-- > 0) {
+        const uint32x4_t abcd0 = abcd, efgh0 = efgh;
+        uint32x4_t v0 = ce_load_be(data);
+        uint32x4_t v1 = ce_load_be(data + 16);
+        uint32x4_t v2 = ce_load_be(data + 32);
+        uint32x4_t v3 = ce_load_be(data + 48);
+        uint32x4_t v4;
+        uint32x4_t t = t0;
+
+        // Five schedule registers rotate through W[j..j+19]
+        SM3_CE_QROUND_EXPAND(a, v0, v1, v2, v3, v4);
+        SM3_CE_QROUND_EXPAND(a, v1, v2, v3, v4, v0);
+        SM3_CE_QROUND_EXPAND(a, v2, v3, v4, v0, v1);
+        SM3_CE_QROUND_EXPAND(a, v3, v4, v0, v1, v2);
+
+        t = t16;
+        SM3_CE_QROUND_EXPAND(b, v4, v0, v1, v2, v3);
+        SM3_CE_QROUND_EXPAND(b, v0, v1, v2, v3, v4);
+        SM3_CE_QROUND_EXPAND(b, v1, v2, v3, v4, v0);
+        SM3_CE_QROUND_EXPAND(b, v2, v3, v4, v0, v1);
+        SM3_CE_QROUND_EXPAND(b, v3, v4, v0, v1, v2);
+        SM3_CE_QROUND_EXPAND(b, v4, v0, v1, v2, v3);
+        SM3_CE_QROUND_EXPAND(b, v0, v1, v2, v3, v4);
+        SM3_CE_QROUND_EXPAND(b, v1, v2, v3, v4, v0);
+        SM3_CE_QROUND_EXPAND(b, v2, v3, v4, v0, v1);
+        SM3_CE_QROUND(b, v3, v4);
+        SM3_CE_QROUND(b, v4, v0);
+        SM3_CE_QROUND(b, v0, v1);
+
+        abcd = veorq_u32(abcd, abcd0);
+        efgh = veorq_u32(efgh, efgh0);
+        data += SM3_BLOCK_SIZE;
+    }
+
+    vst1q_u32(state, ce_reverse(abcd));
+    vst1q_u32(state + 4, ce_reverse(efgh));
+}
+
+int sm3_ce_compiled(void) {
+    return 1;
+}
+
+#elif defined(__aarch64__)
+
+// Toolchain without +sm4: the backend is reported unsupported
+void sm3_compress_blocks_ce(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks) {
+    sm3_compress_blocks_neon(state, data, nblocks);
+}
+
+int sm3_ce_compiled(void) {
+    return 0;
+}
+
+#endif // __aarch64__
@@ -0,0 +1,500 @@
+/**
+ * SM3 File Hashing
+ *
+ * This file implements file hashing that stays off the read() syscall path:
+ * - Regular files are mmap()ed with MADV_SEQUENTIAL and hashed window by
+ *   window, the next window requested with MADV_WILLNEED while the current
+ *   one is compressed, consumed windows dropped with MADV_DONTNEED
+ * - Pipes and other unmappable inputs are read by a helper thread into one
+ *   of two buffers while the caller hashes the other
+ * - Many files are hashed at once through the multi-buffer engine, one
+ *   mapped file per SIMD lane
+ * - Whole file lists are spread over the work-stealing pool: small files
+ *   in multi-buffer batches, large ones one per task through the mapping
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sm3.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SM3_FILE_WINDOW     (8u << 20)  // mmap hashing / prefetch granularity
+#define SM3_FILE_READ_CHUNK (1u << 20)  // per buffer of the pipelined reader
+#define SM3_FILE_SMALL      (1u << 20)  // larger files get a pool task of their own
+#define SM3_FILE_GRAIN      (2 * SM3_MB_MAX_LANES)  // files per pool piece
+
+static double sm3_file_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+const char *sm3_io_method_name(sm3_io_method_t method) {
+    return method == SM3_IO_MMAP ? "mmap" : "pipelined-read";
+}
+
+/**
+ * Hash [offset, size) of a regular file through a read-only mapping
+ * Returns -1 if the file cannot be mapped (caller falls back to reading)
+ */
+static int sm3_hash_mapped(int fd, off_t offset, off_t size, uint8_t digest[SM3_DIGEST_SIZE]) {
+    const uint8_t *map;
+    size_t pos = (size_t)offset;
+    size_t end = (size_t)size;
+    size_t page_mask = (size_t)sysconf(_SC_PAGESIZE) - 1;
+    sm3_ctx_t ctx;
+
+    map = mmap(NULL, end, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void *)map, end, MADV_SEQUENTIAL);
+
+    sm3_init(&ctx);
+    while (pos < end) {
+        size_t len = end - pos < SM3_FILE_WINDOW ? end - pos : SM3_FILE_WINDOW;
+        // Windows start page-aligned except possibly the first one
+        size_t page = pos & ~page_mask;
+
+        if (pos + len < end) {
+            size_t next = end - (pos + len) < SM3_FILE_WINDOW ? end - (pos + len) : SM3_FILE_WINDOW;
+            madvise((void *)(map + pos + len), next, MADV_WILLNEED);
+        }
+        sm3_update(&ctx, map + pos, len);
+        madvise((void *)(map + page), pos + len - page, MADV_DONTNEED);
+        pos += len;
+    }
+    sm3_final(&ctx, digest);
+
+    munmap((void *)map, end);
+    return 0;
+}
+
+/**
+ * Double-buffered reader: the thread fills buf[i & 1] while the caller
+ * hashes buf[(i - 1) & 1]
+ */
+typedef struct {
+    int fd;
+    uint8_t *buf[2];
+    size_t len[2];
+    int full[2];
+    int last[2];        // final buffer (EOF or error)
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} sm3_reader_t;
+
+static void *sm3_reader_thread(void *arg) {
+    sm3_reader_t *r = (sm3_reader_t *)arg;
+    int slot = 0;
+    int done = 0;
+
+    while (!done) {
+        size_t got = 0;
+        ssize_t n = 0;
+
+        pthread_mutex_lock(&r->lock);
+        while (r->full[slot]) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        // Fill the whole buffer so pipes do not turn into tiny updates
+        while (got < SM3_FILE_READ_CHUNK) {
+            n = read(r->fd, r->buf[slot] + got, SM3_FILE_READ_CHUNK - got);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            got += (size_t)n;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        r->len[slot] = got;
+        r->full[slot] = 1;
+        if (n <= 0) {
+            r->last[slot] = 1;
+            r->error = n < 0;
+            done = 1;
+        }
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        slot ^= 1;
+    }
+    return NULL;
+}
+
+static int sm3_hash_pipelined(int fd, uint8_t digest[SM3_DIGEST_SIZE], uint64_t *bytes) {
+    sm3_reader_t r;
+    pthread_t thread;
+    sm3_ctx_t ctx;
+    uint8_t *mem = malloc(2 * SM3_FILE_READ_CHUNK);
+    int slot = 0;
+    int last = 0;
+    int error;
+
+    if (!mem) {
+        return -1;
+    }
+    memset(&r, 0, sizeof(r));
+    r.fd = fd;
+    r.buf[0] = mem;
+    r.buf[1] = mem + SM3_FILE_READ_CHUNK;
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.cond, NULL);
+    if (pthread_create(&thread, NULL, sm3_reader_thread, &r) != 0) {
+        pthread_cond_destroy(&r.cond);
+        pthread_mutex_destroy(&r.lock);
+        free(mem);
+        return -1;
+    }
+
+    sm3_init(&ctx);
+    *bytes = 0;
+    while (!last) {
+        size_t len;
+
+        pthread_mutex_lock(&r.lock);
+        while (!r.full[slot]) {
+            pthread_cond_wait(&r.cond, &r.lock);
+        }
+        len = r.len[slot];
+        last = r.last[slot];
+        pthread_mutex_unlock(&r.lock);
+
+        // The reader is already filling the other buffer
+        sm3_update(&ctx, r.buf[slot], len);
+        *bytes += len;
+
+        pthread_mutex_lock(&r.lock);
+        r.full[slot] = 0;
+        pthread_cond_broadcast(&r.cond);
+        pthread_mutex_unlock(&r.lock);
+        slot ^= 1;
+    }
+    sm3_final(&ctx, digest);
+
+    pthread_join(thread, NULL);
+    error = r.error;
+    pthread_cond_destroy(&r.cond);
+    pthread_mutex_destroy(&r.lock);
+    free(mem);
+    return error ? -1 : 0;
+}
+
+/**
+ * Hash everything from the current offset of fd to EOF
+ */
+int sm3_hash_fd(int fd, uint8_t digest[SM3_DIGEST_SIZE], sm3_file_stats_t *stats) {
+    double start = sm3_file_now();
+    struct stat st;
+    off_t offset;
+    uint64_t bytes = 0;
+    sm3_io_method_t method = SM3_IO_PIPELINED_READ;
+    int ret = -1;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        (offset = lseek(fd, 0, SEEK_CUR)) >= 0 && offset < st.st_size &&
+        sm3_hash_mapped(fd, offset, st.st_size, digest) == 0) {
+        // Leave the descriptor where read() to EOF would have
+        lseek(fd, 0, SEEK_END);
+        bytes = (uint64_t)(st.st_size - offset);
+        method = SM3_IO_MMAP;
+        ret = 0;
+    } else {
+        ret = sm3_hash_pipelined(fd, digest, &bytes);
+    }
+
+    if (stats) {
+        stats->bytes = bytes;
+        stats->seconds = sm3_file_now() - start;
+        stats->method = method;
+    }
+    return ret;
+}
+
+int sm3_hash_file(const char *path, uint8_t digest[SM3_DIGEST_SIZE], sm3_file_stats_t *stats) {
+    int fd = open(path, O_RDONLY);
+    int ret;
+
+    if (fd < 0) {
+        return -1;
+    }
+    ret = sm3_hash_fd(fd, digest, stats);
+    close(fd);
+    return ret;
+}
+
+/**
+ * Hash many files concurrently: every mappable file becomes a multi-buffer
+ * job over its mapping, unmapped as soon as its digest is out. Files that
+ * cannot be mapped are hashed one at a time through sm3_hash_fd().
+ */
+static void sm3_file_job_done(sm3_job_t *job) {
+    if (job->len > 0) {
+        munmap((void *)job->buffer, job->len);
+    }
+}
+
+int sm3_hash_files(const char *const paths[], size_t count, uint8_t digests[][SM3_DIGEST_SIZE],
+                   int status[], sm3_file_stats_t *stats) {
+    static const uint8_t empty[1];
+    double start = sm3_file_now();
+    sm3_mb_mgr_t mgr;
+    sm3_job_t jobs[2 * SM3_MB_MAX_LANES + 1];
+    sm3_job_t *free_jobs[2 * SM3_MB_MAX_LANES + 1];
+    sm3_job_t *job;
+    size_t num_free = 0;
+    uint64_t bytes = 0;
+    int failed = 0;
+
+    sm3_mb_mgr_init(&mgr);
+    for (size_t i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
+        free_jobs[num_free++] = &jobs[i];
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct stat st;
+        void *map = MAP_FAILED;
+        int fd = open(paths[i], O_RDONLY);
+
+        status[i] = -1;
+        if (fd < 0) {
+            failed++;
+            continue;
+        }
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (st.st_size == 0) {
+                map = (void *)empty;
+            } else {
+                map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED) {
+                    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+                    madvise(map, (size_t)st.st_size, MADV_WILLNEED);
+                }
+            }
+        }
+        if (map == MAP_FAILED) {
+            sm3_file_stats_t one;
+
+            status[i] = sm3_hash_fd(fd, digests[i], &one);
+            bytes += one.bytes;
+            failed += status[i] != 0;
+            close(fd);
+            continue;
+        }
+        close(fd);
+
+        job = free_jobs[--num_free];
+        job->buffer = map;
+        job->len = (size_t)st.st_size;
+        job->digest = digests[i];
+        job->user_data = &status[i];
+        bytes += job->len;
+        job = sm3_mb_submit(&mgr, job);
+        if (job) {
+            *(int *)job->user_data = 0;
+            sm3_file_job_done(job);
+            free_jobs[num_free++] = job;
+        }
+    }
+    while ((job = sm3_mb_flush(&mgr)) != NULL) {
+        *(int *)job->user_data = 0;
+        sm3_file_job_done(job);
+    }
+
+    if (stats) {
+        stats->bytes = bytes;
+        stats->seconds = sm3_file_now() - start;
+        stats->method = SM3_IO_MMAP;
+    }
+    return failed ? -1 : 0;
+}
+
+typedef struct {
+    const char *const *paths;
+    uint8_t (*digests)[SM3_DIGEST_SIZE];
+    int *status;
+    uint64_t bytes;
+} sm3_files_job_t;
+
+/**
+ * Pool task: files [begin, end), small ones batched through sm3_hash_files()
+ * so they share the SIMD lanes, large ones hashed alone through their
+ * mapping (or the pipelined reader when they cannot be mapped)
+ */
+static void sm3_hash_files_range(void *ctx, size_t begin, size_t end) {
+    sm3_files_job_t *job = (sm3_files_job_t *)ctx;
+    const char *paths[SM3_FILE_GRAIN];
+    uint8_t digests[SM3_FILE_GRAIN][SM3_DIGEST_SIZE];
+    int status[SM3_FILE_GRAIN];
+    size_t index[SM3_FILE_GRAIN];
+    uint64_t bytes = 0;
+
+    while (begin < end) {
+        size_t n = 0;
+        sm3_file_stats_t stats;
+
+        for (; begin < end && n < SM3_FILE_GRAIN; begin++) {
+            struct stat st;
+
+            if (stat(job->paths[begin], &st) == 0 && S_ISREG(st.st_mode) &&
+                st.st_size > (off_t)SM3_FILE_SMALL) {
+                // stats is only written once the file is open
+                job->status[begin] = sm3_hash_file(job->paths[begin], job->digests[begin], &stats);
+                if (job->status[begin] == 0) {
+                    bytes += stats.bytes;
+                }
+                continue;
+            }
+            // Errors surface from sm3_hash_files() with the batch
+            paths[n] = job->paths[begin];
+            index[n++] = begin;
+        }
+        if (n == 0) {
+            continue;
+        }
+        sm3_hash_files(paths, n, digests, status, &stats);
+        bytes += stats.bytes;
+        for (size_t i = 0; i < n; i++) {
+            job->status[index[i]] = status[i];
+            memcpy(job->digests[index[i]], digests[i], SM3_DIGEST_SIZE);
+        }
+    }
+    __atomic_fetch_add(&job->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * sm3_hash_files() on every core of the shared pool
+ * Results land in the callers' arrays by index, so the order is the
+ * order of paths whatever order the files finish in
+ */
+int sm3_hash_files_parallel(const char *const paths[], size_t count,
+                            uint8_t digests[][SM3_DIGEST_SIZE], int status[],
+                            sm3_file_stats_t *stats) {
+    double start = sm3_file_now();
+    sm3_files_job_t job;
+    int failed = 0;
+
+    job.paths = paths;
+    job.digests = digests;
+    job.status = status;
+    job.bytes = 0;
+    sm3_parallel_for(NULL, 0, count, SM3_FILE_GRAIN, sm3_hash_files_range, &job);
+
+    for (size_t i = 0; i < count; i++) {
+        failed += status[i] != 0;
+    }
+    if (stats) {
+        stats->bytes = job.bytes;
+        stats->seconds = sm3_file_now() - start;
+        stats->method = SM3_IO_MMAP;
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * Write "<digest>  <path>\n"; a path holding a backslash or newline has
+ * them escaped and the line starts with a backslash, as in coreutils
+ */
+int sm3_sum_format_line(FILE *out, const uint8_t digest[SM3_DIGEST_SIZE], const char *path) {
+    int escape = strpbrk(path, "\\\n") != NULL;
+
+    if (escape) {
+        putc('\\', out);
+    }
+    for (int j = 0; j < SM3_DIGEST_SIZE; j++) {
+        fprintf(out, "%02x", digest[j]);
+    }
+    fputs("  ", out);
+    for (const char *p = path; *p; p++) {
+        if (escape && *p == '\\') {
+            fputs("\\\\", out);
+        } else if (escape && *p == '\n') {
+            fputs("\\n", out);
+        } else {
+            putc(*p, out);
+        }
+    }
+    return putc('\n', out) == EOF ? -1 : 0;
+}
+
+static int sm3_hex_digit(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Parse "<digest>  <path>" or "<digest> *<path>" (trailing newline and CR
+ * ignored); returns the unescaped path to free(), or NULL if malformed
+ */
+char *sm3_sum_parse_line(const char *line, uint8_t digest[SM3_DIGEST_SIZE]) {
+    int escaped = line[0] == '\\';
+    const char *p = line + escaped;
+    size_t len;
+    char *path, *q;
+
+    for (int j = 0; j < SM3_DIGEST_SIZE; j++) {
+        int hi = sm3_hex_digit((unsigned char)p[2 * j]);
+        int lo = hi < 0 ? -1 : sm3_hex_digit((unsigned char)p[2 * j + 1]);
+
+        if (lo < 0) {
+            return NULL;
+        }
+        digest[j] = (uint8_t)(hi << 4 | lo);
+    }
+    p += 2 * SM3_DIGEST_SIZE;
+    if (p[0] != ' ' || (p[1] != ' ' && p[1] != '*')) {
+        return NULL;
+    }
+    p += 2;
+    len = strlen(p);
+    if (len > 0 && p[len - 1] == '\n') {
+        len--;
+    }
+    if (len > 0 && p[len - 1] == '\r') {
+        len--;
+    }
+    if (len == 0 || (path = malloc(len + 1)) == NULL) {
+        return NULL;
+    }
+
+    q = path;
+    for (const char *end = p + len; p < end; p++) {
+        if (escaped && *p == '\\') {
+            if (++p == end || (*p != 'n' && *p != '\\')) {
+                free(path);
+                return NULL;
+            }
+            *q++ = *p == 'n' ? '\n' : '\\';
+        } else {
+            *q++ = *p;
+        }
+    }
+    *q = '\0';
+    return path;
+}
+
+/**
+ * Memory-optimized SM3 for streaming large data
+ * Hashes from the descriptor behind input, so input must not have been read
+ * through stdio yet
+ */
+int sm3_stream_optimized(FILE* input, uint8_t hash[32]) {
+    return sm3_hash_fd(fileno(input), hash, NULL);
+}
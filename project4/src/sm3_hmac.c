@@ -0,0 +1,159 @@
+/**
+ * HMAC-SM3 with precomputed key states
+ *
+ * HMAC(K, m) = SM3((K0 ^ opad) || SM3((K0 ^ ipad) || m)). Both pad blocks
+ * depend only on the key, so the key object keeps the chaining values
+ * after compressing them and every MAC resumes from there:
+ * - the inner hash is an sm3_ctx_t started at istate with 64 bytes counted
+ * - the outer hash is a single block (the inner digest plus padding)
+ *   compressed from ostate
+ * The batch path gives both states to multi-buffer managers as a lane
+ * prefix; an inner job that finishes is resubmitted at once as an outer
+ * job on its own digest.
+ */
+
+#include "sm3.h"
+#include <string.h>
+
+#define HMAC_IPAD   0x36
+#define HMAC_OPAD   0x5c
+
+static void hmac_wipe(void *p, size_t len) {
+    volatile uint8_t *v = (volatile uint8_t *)p;
+
+    while (len--) {
+        *v++ = 0;
+    }
+}
+
+void sm3_hmac_key_init(sm3_hmac_key_t *key, const uint8_t *k, size_t k_len) {
+    uint8_t k0[SM3_BLOCK_SIZE];
+    uint8_t pad[SM3_BLOCK_SIZE];
+    int i;
+
+    memset(k0, 0, sizeof(k0));
+    if (k_len > SM3_BLOCK_SIZE) {
+        sm3_hash(k, k_len, k0);
+    } else if (k_len > 0) {
+        memcpy(k0, k, k_len);
+    }
+
+    for (i = 0; i < SM3_BLOCK_SIZE; i++) {
+        pad[i] = k0[i] ^ HMAC_IPAD;
+    }
+    memcpy(key->istate, sm3_iv, sizeof(key->istate));
+    sm3_compress_blocks(key->istate, pad, 1);
+
+    for (i = 0; i < SM3_BLOCK_SIZE; i++) {
+        pad[i] = k0[i] ^ HMAC_OPAD;
+    }
+    memcpy(key->ostate, sm3_iv, sizeof(key->ostate));
+    sm3_compress_blocks(key->ostate, pad, 1);
+
+    hmac_wipe(k0, sizeof(k0));
+    hmac_wipe(pad, sizeof(pad));
+}
+
+void sm3_hmac_key_clear(sm3_hmac_key_t *key) {
+    hmac_wipe(key, sizeof(*key));
+}
+
+void sm3_hmac_init(sm3_hmac_ctx_t *ctx, const sm3_hmac_key_t *key) {
+    memcpy(ctx->inner.state, key->istate, sizeof(ctx->inner.state));
+    ctx->inner.count = SM3_BLOCK_SIZE;
+    memset(ctx->inner.buffer, 0, SM3_BLOCK_SIZE);
+    memcpy(ctx->ostate, key->ostate, sizeof(ctx->ostate));
+}
+
+void sm3_hmac_update(sm3_hmac_ctx_t *ctx, const uint8_t *data, size_t len) {
+    sm3_update(&ctx->inner, data, len);
+}
+
+void sm3_hmac_final(sm3_hmac_ctx_t *ctx, uint8_t mac[SM3_DIGEST_SIZE]) {
+    sm3_ctx_t outer;
+
+    // The outer message is 32 bytes after the 64-byte key block: one
+    // block with its padding, no buffering needed
+    sm3_final(&ctx->inner, outer.buffer);
+    memcpy(outer.state, ctx->ostate, sizeof(outer.state));
+    outer.count = SM3_BLOCK_SIZE + SM3_DIGEST_SIZE;
+    sm3_final(&outer, mac);
+
+    hmac_wipe(&outer, sizeof(outer));
+    hmac_wipe(ctx, sizeof(*ctx));
+}
+
+void sm3_hmac(const sm3_hmac_key_t *key, const uint8_t *data, size_t len, uint8_t mac[SM3_DIGEST_SIZE]) {
+    sm3_hmac_ctx_t ctx;
+
+    sm3_hmac_init(&ctx, key);
+    sm3_update(&ctx.inner, data, len);
+    sm3_hmac_final(&ctx, mac);
+}
+
+int sm3_hmac_verify(const sm3_hmac_key_t *key, const uint8_t *data, size_t len,
+                    const uint8_t *mac, size_t mac_len) {
+    uint8_t expect[SM3_DIGEST_SIZE];
+    uint8_t diff = 0;
+    size_t i;
+
+    if (mac_len == 0 || mac_len > SM3_DIGEST_SIZE) {
+        return -1;
+    }
+    sm3_hmac(key, data, len, expect);
+    for (i = 0; i < mac_len; i++) {
+        diff |= expect[i] ^ mac[i];
+    }
+    hmac_wipe(expect, sizeof(expect));
+    return diff == 0 ? 0 : -1;
+}
+
+/**
+ * Jobs are recycled as in sm3_hash_mb(); each manager holds at most its
+ * lanes plus its completion queue, hence two pools' worth
+ */
+void sm3_hmac_batch(const sm3_hmac_key_t *key, const uint8_t *const messages[], const size_t lengths[],
+                    size_t count, uint8_t macs[][SM3_DIGEST_SIZE]) {
+    sm3_mb_mgr_t inner, outer;
+    sm3_job_t jobs[4 * SM3_MB_MAX_LANES + 2];
+    sm3_job_t *free_jobs[4 * SM3_MB_MAX_LANES + 2];
+    sm3_job_t *job;
+    size_t num_free = 0, i;
+
+    sm3_mb_mgr_init(&inner);
+    sm3_mb_mgr_init_lanes(&outer, inner.num_lanes);
+    sm3_mb_mgr_set_prefix(&inner, key->istate, SM3_BLOCK_SIZE);
+    sm3_mb_mgr_set_prefix(&outer, key->ostate, SM3_BLOCK_SIZE);
+    for (i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
+        free_jobs[num_free++] = &jobs[i];
+    }
+
+    // The inner digest lands in macs[i]; the outer job copies it into its
+    // lane tail on submission and then overwrites it with the MAC
+    for (i = 0; i < count; i++) {
+        job = free_jobs[--num_free];
+        job->buffer = messages[i];
+        job->len = lengths[i];
+        job->digest = macs[i];
+        job->user_data = NULL;
+        job = sm3_mb_submit(&inner, job);
+        if (job != NULL) {
+            job->buffer = job->digest;
+            job->len = SM3_DIGEST_SIZE;
+            job = sm3_mb_submit(&outer, job);
+            if (job != NULL) {
+                free_jobs[num_free++] = job;
+            }
+        }
+    }
+    while ((job = sm3_mb_flush(&inner)) != NULL) {
+        job->buffer = job->digest;
+        job->len = SM3_DIGEST_SIZE;
+        job = sm3_mb_submit(&outer, job);
+        if (job != NULL) {
+            free_jobs[num_free++] = job;
+        }
+    }
+    while (sm3_mb_flush(&outer) != NULL) {
+    }
+}
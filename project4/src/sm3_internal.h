@@ -0,0 +1,51 @@
+#ifndef SM3_INTERNAL_H
+#define SM3_INTERNAL_H
+
+// Shared by the compression backends; not part of the public API
+
+#include "sm3.h"
+
+// Boolean functions for rounds 0-15 and 16-63
+#define SM3_FF0(x, y, z) ((x) ^ (y) ^ (z))
+#define SM3_FF1(x, y, z) (((x) & (y)) | (((x) | (y)) & (z)))
+#define SM3_GG0(x, y, z) ((x) ^ (y) ^ (z))
+#define SM3_GG1(x, y, z) ((((y) ^ (z)) & (x)) ^ (z))
+
+// One round with the working variables renamed instead of shifted: the
+// next round is SM3_ROUND(D, A, B, C, H, E, F, G, ...)
+#define SM3_ROUND(A, B, C, D, E, F, G, H, FF_, GG_, w, j) do {      \
+        uint32_t a12_ = ROTL32(A, 12);                              \
+        uint32_t ss1_ = ROTL32(a12_ + (E) + sm3_tj[j], 7);          \
+        uint32_t ss2_ = ss1_ ^ a12_;                                \
+        D = FF_(A, B, C) + (D) + ss2_ + ((w)[j] ^ (w)[(j) + 4]);    \
+        H = GG_(E, F, G) + (H) + ss1_ + (w)[j];                     \
+        B = ROTL32(B, 9);                                           \
+        F = ROTL32(F, 19);                                          \
+        H = P0(H);                                                  \
+    } while (0)
+
+#define SM3_ROUND4(FF_, GG_, w, j) do {                             \
+        SM3_ROUND(a, b, c, d, e, f, g, h, FF_, GG_, w, (j));        \
+        SM3_ROUND(d, a, b, c, h, e, f, g, FF_, GG_, w, (j) + 1);    \
+        SM3_ROUND(c, d, a, b, g, h, e, f, FF_, GG_, w, (j) + 2);    \
+        SM3_ROUND(b, c, d, a, f, g, h, e, FF_, GG_, w, (j) + 3);    \
+    } while (0)
+
+// 64 rounds and the feed-forward, given the expanded words W[0..67]
+static inline void sm3_compress_rounds(uint32_t state[SM3_STATE_SIZE], const uint32_t w[68]) {
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    int j;
+
+    for (j = 0; j < 16; j += 4) {
+        SM3_ROUND4(SM3_FF0, SM3_GG0, w, j);
+    }
+    for (j = 16; j < 64; j += 4) {
+        SM3_ROUND4(SM3_FF1, SM3_GG1, w, j);
+    }
+
+    state[0] ^= a; state[1] ^= b; state[2] ^= c; state[3] ^= d;
+    state[4] ^= e; state[5] ^= f; state[6] ^= g; state[7] ^= h;
+}
+
+#endif // SM3_INTERNAL_H
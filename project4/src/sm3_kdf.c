@@ -0,0 +1,113 @@
+/**
+ * SM3 key derivation function (GB/T 32918.4 KDF)
+ *
+ * K = SM3(Z || 1) || SM3(Z || 2) || ... truncated to klen bytes. The
+ * counter blocks only differ in their last four bytes, so:
+ * - the whole blocks of Z are compressed once, and that midstate is every
+ *   lane's starting point (sm3_mb_mgr_set_prefix)
+ * - each counter is one multi-buffer job over the tail of Z plus the
+ *   counter, one or two blocks with padding, written straight into K
+ * Z is usually a secret (the shared point of an SM2 key exchange), so all
+ * copies of its state and tail are wiped before returning.
+ */
+
+#include "sm3.h"
+#include <string.h>
+
+#define KDF_JOBS    (2 * SM3_MB_MAX_LANES + 1)
+
+typedef struct {
+    sm3_job_t job;                  // first, jobs come back as sm3_job_t *
+    uint8_t msg[SM3_BLOCK_SIZE + 4];
+} kdf_job_t;
+
+static void kdf_wipe(void *p, size_t len) {
+    volatile uint8_t *v = (volatile uint8_t *)p;
+
+    while (len--) {
+        *v++ = 0;
+    }
+}
+
+static void kdf_put_counter(uint8_t *p, uint32_t ct) {
+    p[0] = (uint8_t)(ct >> 24);
+    p[1] = (uint8_t)(ct >> 16);
+    p[2] = (uint8_t)(ct >> 8);
+    p[3] = (uint8_t)ct;
+}
+
+int sm3_kdf(const uint8_t *z, size_t z_len, uint8_t *key, size_t klen) {
+    size_t prefix = z_len - z_len % SM3_BLOCK_SIZE;
+    size_t rem = z_len - prefix;
+    uint64_t count, ct;
+    uint32_t state[SM3_STATE_SIZE];
+    uint8_t last[SM3_DIGEST_SIZE];
+    sm3_mb_mgr_t mgr;
+    kdf_job_t jobs[KDF_JOBS];
+    sm3_job_t *free_jobs[KDF_JOBS];
+    size_t num_free = 0, i;
+
+    if (klen == 0) {
+        return 0;
+    }
+    if ((klen - 1) / SM3_DIGEST_SIZE >= 0xFFFFFFFFu) {
+        return -1;
+    }
+    count = (klen + SM3_DIGEST_SIZE - 1) / SM3_DIGEST_SIZE;
+
+    memcpy(state, sm3_iv, sizeof(state));
+    if (prefix > 0) {
+        sm3_compress_blocks(state, z, prefix / SM3_BLOCK_SIZE);
+    }
+
+    if (count == 1) {
+        // A single counter is cheaper without a manager
+        sm3_ctx_t ctx;
+        uint8_t ct_be[4];
+
+        memcpy(ctx.state, state, sizeof(ctx.state));
+        ctx.count = prefix;
+        sm3_update(&ctx, z + prefix, rem);
+        kdf_put_counter(ct_be, 1);
+        sm3_update(&ctx, ct_be, sizeof(ct_be));
+        sm3_final(&ctx, last);
+        memcpy(key, last, klen);
+        kdf_wipe(&ctx, sizeof(ctx));
+        kdf_wipe(state, sizeof(state));
+        kdf_wipe(last, sizeof(last));
+        return 0;
+    }
+
+    sm3_mb_mgr_init(&mgr);
+    sm3_mb_mgr_set_prefix(&mgr, state, prefix);
+    for (i = 0; i < KDF_JOBS; i++) {
+        memcpy(jobs[i].msg, z + prefix, rem);
+        jobs[i].job.buffer = jobs[i].msg;
+        jobs[i].job.len = rem + 4;
+        jobs[i].job.user_data = NULL;
+        free_jobs[num_free++] = &jobs[i].job;
+    }
+
+    // Full digests go straight to key, a partial last one through last
+    for (ct = 1; ct <= count; ct++) {
+        sm3_job_t *job = free_jobs[--num_free];
+
+        kdf_put_counter(((kdf_job_t *)job)->msg + rem, (uint32_t)ct);
+        job->digest = (ct * SM3_DIGEST_SIZE <= klen) ? key + (ct - 1) * SM3_DIGEST_SIZE : last;
+        job = sm3_mb_submit(&mgr, job);
+        if (job != NULL) {
+            free_jobs[num_free++] = job;
+        }
+    }
+    while (sm3_mb_flush(&mgr) != NULL) {
+    }
+    if (klen % SM3_DIGEST_SIZE) {
+        memcpy(key + klen - klen % SM3_DIGEST_SIZE, last, klen % SM3_DIGEST_SIZE);
+    }
+
+    kdf_wipe(&mgr, sizeof(mgr));
+    kdf_wipe(jobs, sizeof(jobs));
+    kdf_wipe(state, sizeof(state));
+    kdf_wipe(last, sizeof(last));
+    return 0;
+}
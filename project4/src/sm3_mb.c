@@ -0,0 +1,272 @@
+/**
+ * SM3 Multi-Buffer Implementation
+ *
+ * This file implements a multi-buffer job manager for SM3, in the style of
+ * Intel's multi-buffer hashing managers:
+ * - One independent message per SIMD lane (16 x AVX-512, 8 x AVX2)
+ * - Word-sliced state: register k holds word k of every lane, so message
+ *   expansion and all 64 rounds run vectorised across the lanes
+ * - A finished lane is refilled from the next submitted job; the kernel runs
+ *   for the shortest remaining segment, so no lane does wasted work
+ * - The final partial block and the length padding are prepared when a job
+ *   is submitted and hashed in the lane like any other block
+ *
+ * Throughput on records of 100 bytes to 4 KB is bounded by the lane count
+ * rather than by the single-message dependency chain. The 8- and 16-lane
+ * kernels live in sm3_mb_avx2.c and sm3_mb_avx512.c, built with their own
+ * ISA flags and picked here by CPUID.
+ */
+
+#include "sm3.h"
+#include "sm3_stats.h"
+#include <string.h>
+
+/**
+ * Single-lane kernel for CPUs without AVX2
+ */
+void sm3_mb_compress_x1(uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES],
+                        const uint8_t *data[SM3_MB_MAX_LANES], size_t nblocks) {
+    uint32_t s[SM3_STATE_SIZE];
+    int i;
+
+    for (i = 0; i < SM3_STATE_SIZE; i++) {
+        s[i] = state[i][0];
+    }
+    sm3_compress_blocks(s, data[0], nblocks);
+    for (i = 0; i < SM3_STATE_SIZE; i++) {
+        state[i][0] = s[i];
+    }
+}
+
+/**
+ * Kernel for a lane count, or NULL if this build/CPU can't run it
+ */
+static sm3_mb_kernel_t mb_kernel_for(size_t num_lanes) {
+    switch (num_lanes) {
+    case 1:
+        return sm3_mb_compress_x1;
+#ifdef __x86_64__
+    case 8:
+        return sm3_backend_supported(SM3_BACKEND_AVX2) ? sm3_mb_compress_x8_avx2 : NULL;
+    case 16:
+        return sm3_backend_supported(SM3_BACKEND_AVX512) ? sm3_mb_compress_x16_avx512 : NULL;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+int sm3_mb_mgr_init_lanes(sm3_mb_mgr_t *mgr, size_t num_lanes) {
+    sm3_mb_kernel_t kernel = mb_kernel_for(num_lanes);
+
+    if (kernel == NULL) {
+        return -1;
+    }
+    memset(mgr, 0, sizeof(*mgr));
+    mgr->num_lanes = num_lanes;
+    mgr->kernel = kernel;
+    memcpy(mgr->init_state, sm3_iv, sizeof(mgr->init_state));
+    return 0;
+}
+
+void sm3_mb_mgr_set_prefix(sm3_mb_mgr_t *mgr, const uint32_t state[SM3_STATE_SIZE], uint64_t prefix_len) {
+    memcpy(mgr->init_state, state, sizeof(mgr->init_state));
+    mgr->prefix_len = prefix_len;
+}
+
+/**
+ * Widest kernel this CPU runs, for callers that lay out their own blocks
+ */
+sm3_mb_kernel_t sm3_mb_best_kernel(size_t *num_lanes) {
+    static const size_t widths[] = {16, 8, 1};
+    size_t i;
+
+    for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        sm3_mb_kernel_t kernel = mb_kernel_for(widths[i]);
+
+        if (kernel != NULL) {
+            *num_lanes = widths[i];
+            return kernel;
+        }
+    }
+    *num_lanes = 1;
+    return sm3_mb_compress_x1;
+}
+
+void sm3_mb_mgr_init(sm3_mb_mgr_t *mgr) {
+    if (sm3_mb_mgr_init_lanes(mgr, 16) == 0 || sm3_mb_mgr_init_lanes(mgr, 8) == 0) {
+        return;
+    }
+    sm3_mb_mgr_init_lanes(mgr, 1);
+}
+
+/**
+ * Start a job in an idle lane: the body is hashed straight from the
+ * caller's buffer, the rest is copied into the lane's tail with padding
+ */
+static void mb_start_lane(sm3_mb_mgr_t *mgr, size_t lane, sm3_job_t *job) {
+    size_t full = job->len / SM3_BLOCK_SIZE;
+    size_t rem = job->len % SM3_BLOCK_SIZE;
+    size_t tail_len = (rem < 56) ? SM3_BLOCK_SIZE : 2 * SM3_BLOCK_SIZE;
+    uint64_t total_bits = (mgr->prefix_len + job->len) * 8;
+    uint8_t *tail = mgr->tail[lane];
+    int i;
+
+    memcpy(tail, job->buffer + full * SM3_BLOCK_SIZE, rem);
+    tail[rem] = 0x80;
+    memset(tail + rem + 1, 0, tail_len - rem - 9);
+    for (i = 0; i < 8; i++) {
+        tail[tail_len - 8 + i] = (uint8_t)(total_bits >> (56 - i * 8));
+    }
+
+    for (i = 0; i < SM3_STATE_SIZE; i++) {
+        mgr->state[i][lane] = mgr->init_state[i];
+    }
+    mgr->tail_blocks[lane] = (uint8_t)(tail_len / SM3_BLOCK_SIZE);
+    if (full > 0) {
+        mgr->data[lane] = job->buffer;
+        mgr->blocks[lane] = full;
+        mgr->in_tail[lane] = 0;
+    } else {
+        mgr->data[lane] = tail;
+        mgr->blocks[lane] = mgr->tail_blocks[lane];
+        mgr->in_tail[lane] = 1;
+    }
+
+    job->status = SM3_JOB_IN_PROGRESS;
+    mgr->job[lane] = job;
+    mgr->busy++;
+}
+
+static void mb_finish_lane(sm3_mb_mgr_t *mgr, size_t lane) {
+    sm3_job_t *job = mgr->job[lane];
+    int i;
+
+    for (i = 0; i < SM3_STATE_SIZE; i++) {
+        uint32_t s = mgr->state[i][lane];
+        job->digest[i * 4] = (uint8_t)(s >> 24);
+        job->digest[i * 4 + 1] = (uint8_t)(s >> 16);
+        job->digest[i * 4 + 2] = (uint8_t)(s >> 8);
+        job->digest[i * 4 + 3] = (uint8_t)s;
+    }
+    job->status = SM3_JOB_COMPLETED;
+
+    mgr->done[(mgr->done_head + mgr->done_count) % (2 * SM3_MB_MAX_LANES)] = job;
+    mgr->done_count++;
+    mgr->job[lane] = NULL;
+    mgr->busy--;
+}
+
+/**
+ * Run the kernel until at least one lane reaches the end of its body or
+ * tail. Idle lanes re-read a busy lane's blocks; their results are unused.
+ */
+static void mb_run(sm3_mb_mgr_t *mgr) {
+    const uint8_t *data[SM3_MB_MAX_LANES];
+    size_t n = SIZE_MAX, any = 0, l;
+
+    for (l = 0; l < mgr->num_lanes; l++) {
+        if (mgr->job[l] != NULL && mgr->blocks[l] < n) {
+            n = mgr->blocks[l];
+            any = l;
+        }
+    }
+    for (l = 0; l < mgr->num_lanes; l++) {
+        data[l] = (mgr->job[l] != NULL) ? mgr->data[l] : mgr->data[any];
+    }
+    if (mgr->busy < mgr->num_lanes) {
+        SM3_STAT_ADD(slow_paths[SM3_SLOW_MB_IDLE_LANES], 1);
+    }
+
+    mgr->kernel(mgr->state, data, n);
+
+    for (l = 0; l < mgr->num_lanes; l++) {
+        if (mgr->job[l] == NULL) {
+            continue;
+        }
+        mgr->data[l] += n * SM3_BLOCK_SIZE;
+        mgr->blocks[l] -= n;
+        if (mgr->blocks[l] > 0) {
+            continue;
+        }
+        if (!mgr->in_tail[l]) {
+            mgr->data[l] = mgr->tail[l];
+            mgr->blocks[l] = mgr->tail_blocks[l];
+            mgr->in_tail[l] = 1;
+        } else {
+            mb_finish_lane(mgr, l);
+        }
+    }
+}
+
+static sm3_job_t *mb_pop_done(sm3_mb_mgr_t *mgr) {
+    sm3_job_t *job;
+
+    if (mgr->done_count == 0) {
+        return NULL;
+    }
+    job = mgr->done[mgr->done_head];
+    mgr->done_head = (mgr->done_head + 1) % (2 * SM3_MB_MAX_LANES);
+    mgr->done_count--;
+    return job;
+}
+
+sm3_job_t *sm3_mb_submit(sm3_mb_mgr_t *mgr, sm3_job_t *job) {
+    size_t l;
+
+    SM3_STAT_ADD(op_calls[SM3_STAT_MB], 1);
+    SM3_STAT_ADD(op_bytes[SM3_STAT_MB], job->len);
+
+    // Only hash with every lane loaded; a partially filled manager waits
+    // for more jobs (or sm3_mb_flush)
+    while (mgr->busy == mgr->num_lanes) {
+        mb_run(mgr);
+    }
+    for (l = 0; mgr->job[l] != NULL; l++) {
+    }
+    mb_start_lane(mgr, l, job);
+
+    if (mgr->busy == mgr->num_lanes && mgr->done_count == 0) {
+        mb_run(mgr);
+    }
+    return mb_pop_done(mgr);
+}
+
+sm3_job_t *sm3_mb_flush(sm3_mb_mgr_t *mgr) {
+    while (mgr->done_count == 0 && mgr->busy > 0) {
+        mb_run(mgr);
+    }
+    return mb_pop_done(mgr);
+}
+
+/**
+ * Batch helper: job structures are recycled as soon as they come back, so
+ * any number of messages is hashed with a fixed amount of state
+ */
+void sm3_hash_mb(const uint8_t *const messages[], const size_t lengths[], size_t count,
+                 uint8_t digests[][SM3_DIGEST_SIZE]) {
+    sm3_mb_mgr_t mgr;
+    sm3_job_t jobs[2 * SM3_MB_MAX_LANES + 1];
+    sm3_job_t *free_jobs[2 * SM3_MB_MAX_LANES + 1];
+    size_t num_free = 0, i;
+
+    sm3_mb_mgr_init(&mgr);
+    for (i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
+        free_jobs[num_free++] = &jobs[i];
+    }
+
+    for (i = 0; i < count; i++) {
+        sm3_job_t *job = free_jobs[--num_free];
+
+        job->buffer = messages[i];
+        job->len = lengths[i];
+        job->digest = digests[i];
+        job->user_data = NULL;
+        job = sm3_mb_submit(&mgr, job);
+        if (job != NULL) {
+            free_jobs[num_free++] = job;
+        }
+    }
+    while (sm3_mb_flush(&mgr) != NULL) {
+    }
+}
@@ -0,0 +1,97 @@
+/**
+ * SM3 Multi-Buffer Kernel: 8 lanes of AVX2
+ *
+ * Built with -mavx2 only and selected at runtime by sm3_mb.c, so the rest
+ * of the library runs on CPUs without AVX2.
+ */
+
+#include "sm3.h"
+#include "sm3_mb_x86.h"
+
+#define MB8_ROL(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32 - (n)))
+
+static inline __m256i mb8_p0(__m256i x) {
+    return _mm256_xor_si256(_mm256_xor_si256(x, MB8_ROL(x, 9)), MB8_ROL(x, 17));
+}
+
+static inline __m256i mb8_p1(__m256i x) {
+    return _mm256_xor_si256(_mm256_xor_si256(x, MB8_ROL(x, 15)), MB8_ROL(x, 23));
+}
+
+/**
+ * 8-lane AVX2 kernel
+ */
+void sm3_mb_compress_x8_avx2(uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES],
+                             const uint8_t *data[SM3_MB_MAX_LANES], size_t nblocks) {
+    __m256i v[SM3_STATE_SIZE];
+    const uint8_t *p[8];
+    size_t b;
+    int i, j;
+
+    for (i = 0; i < SM3_STATE_SIZE; i++) {
+        v[i] = _mm256_loadu_si256((const __m256i *)state[i]);
+    }
+    for (i = 0; i < 8; i++) {
+        p[i] = data[i];
+    }
+
+    for (b = 0; b < nblocks; b++) {
+        __m256i w[68];
+        __m256i a = v[0], bb = v[1], c = v[2], d = v[3];
+        __m256i e = v[4], f = v[5], g = v[6], h = v[7];
+
+        mb8_load_words(p, 0, w);
+        mb8_load_words(p, 32, w + 8);
+        for (i = 0; i < 8; i++) {
+            p[i] += SM3_BLOCK_SIZE;
+        }
+
+        // Message expansion, all lanes at once
+        for (j = 16; j < 68; j++) {
+            __m256i x = _mm256_xor_si256(_mm256_xor_si256(w[j - 16], w[j - 9]), MB8_ROL(w[j - 3], 15));
+            w[j] = _mm256_xor_si256(_mm256_xor_si256(mb8_p1(x), MB8_ROL(w[j - 13], 7)), w[j - 6]);
+        }
+
+        for (j = 0; j < 64; j++) {
+            __m256i a12 = MB8_ROL(a, 12);
+            __m256i t = _mm256_add_epi32(_mm256_add_epi32(a12, e), _mm256_set1_epi32((int)sm3_tj[j]));
+            __m256i ss1 = MB8_ROL(t, 7);
+            __m256i ss2 = _mm256_xor_si256(ss1, a12);
+            __m256i ff, gg, tt1, tt2;
+
+            if (j < 16) {
+                ff = _mm256_xor_si256(_mm256_xor_si256(a, bb), c);
+                gg = _mm256_xor_si256(_mm256_xor_si256(e, f), g);
+            } else {
+                // Majority and choose
+                ff = _mm256_or_si256(_mm256_and_si256(a, bb), _mm256_and_si256(_mm256_or_si256(a, bb), c));
+                gg = _mm256_or_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            }
+
+            tt1 = _mm256_add_epi32(_mm256_add_epi32(ff, d),
+                                   _mm256_add_epi32(ss2, _mm256_xor_si256(w[j], w[j + 4])));
+            tt2 = _mm256_add_epi32(_mm256_add_epi32(gg, h), _mm256_add_epi32(ss1, w[j]));
+            d = c;
+            c = MB8_ROL(bb, 9);
+            bb = a;
+            a = tt1;
+            h = g;
+            g = MB8_ROL(f, 19);
+            f = e;
+            e = mb8_p0(tt2);
+        }
+
+        v[0] = _mm256_xor_si256(v[0], a);
+        v[1] = _mm256_xor_si256(v[1], bb);
+        v[2] = _mm256_xor_si256(v[2], c);
+        v[3] = _mm256_xor_si256(v[3], d);
+        v[4] = _mm256_xor_si256(v[4], e);
+        v[5] = _mm256_xor_si256(v[5], f);
+        v[6] = _mm256_xor_si256(v[6], g);
+        v[7] = _mm256_xor_si256(v[7], h);
+    }
+
+    for (i = 0; i < SM3_STATE_SIZE; i++) {
+        _mm256_storeu_si256((__m256i *)state[i], v[i]);
+    }
+}
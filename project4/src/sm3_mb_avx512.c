@@ -0,0 +1,106 @@
+/**
+ * SM3 Multi-Buffer Kernel: 16 lanes of AVX-512
+ *
+ * Built with -mavx512f -mavx512vl and selected at runtime by sm3_mb.c.
+ */
+
+#include "sm3.h"
+#include "sm3_mb_x86.h"
+
+// Three-input boolean functions for vpternlogd
+#define MB16_XOR3    0x96
+#define MB16_MAJ     0xE8
+#define MB16_CHOOSE  0xCA
+
+static inline __m512i mb16_p0(__m512i x) {
+    return _mm512_ternarylogic_epi32(x, _mm512_rol_epi32(x, 9), _mm512_rol_epi32(x, 17), MB16_XOR3);
+}
+
+static inline __m512i mb16_p1(__m512i x) {
+    return _mm512_ternarylogic_epi32(x, _mm512_rol_epi32(x, 15), _mm512_rol_epi32(x, 23), MB16_XOR3);
+}
+
+/**
+ * 16-lane AVX-512 kernel: VPROLD rotations and VPTERNLOGD boolean functions
+ */
+void sm3_mb_compress_x16_avx512(uint32_t state[SM3_STATE_SIZE][SM3_MB_MAX_LANES],
+                                const uint8_t *data[SM3_MB_MAX_LANES], size_t nblocks) {
+    __m512i v[SM3_STATE_SIZE];
+    const uint8_t *p[16];
+    size_t b;
+    int i, j;
+
+    for (i = 0; i < SM3_STATE_SIZE; i++) {
+        v[i] = _mm512_loadu_si512((const void *)state[i]);
+    }
+    for (i = 0; i < 16; i++) {
+        p[i] = data[i];
+    }
+
+    for (b = 0; b < nblocks; b++) {
+        __m512i w[68];
+        __m256i lo[16], hi[16];
+        __m512i a = v[0], bb = v[1], c = v[2], d = v[3];
+        __m512i e = v[4], f = v[5], g = v[6], h = v[7];
+
+        // Lanes 0..7 go to the low half of each register, 8..15 to the high half
+        mb8_load_words(p, 0, lo);
+        mb8_load_words(p, 32, lo + 8);
+        mb8_load_words(p + 8, 0, hi);
+        mb8_load_words(p + 8, 32, hi + 8);
+        for (j = 0; j < 16; j++) {
+            w[j] = _mm512_inserti64x4(_mm512_castsi256_si512(lo[j]), hi[j], 1);
+        }
+        for (i = 0; i < 16; i++) {
+            p[i] += SM3_BLOCK_SIZE;
+        }
+
+        for (j = 16; j < 68; j++) {
+            __m512i x = _mm512_ternarylogic_epi32(w[j - 16], w[j - 9], _mm512_rol_epi32(w[j - 3], 15),
+                                                  MB16_XOR3);
+            w[j] = _mm512_ternarylogic_epi32(mb16_p1(x), _mm512_rol_epi32(w[j - 13], 7), w[j - 6],
+                                             MB16_XOR3);
+        }
+
+        for (j = 0; j < 64; j++) {
+            __m512i a12 = _mm512_rol_epi32(a, 12);
+            __m512i ss1 = _mm512_rol_epi32(_mm512_add_epi32(_mm512_add_epi32(a12, e),
+                                                            _mm512_set1_epi32((int)sm3_tj[j])), 7);
+            __m512i ss2 = _mm512_xor_si512(ss1, a12);
+            __m512i ff, gg, tt1, tt2;
+
+            if (j < 16) {
+                ff = _mm512_ternarylogic_epi32(a, bb, c, MB16_XOR3);
+                gg = _mm512_ternarylogic_epi32(e, f, g, MB16_XOR3);
+            } else {
+                ff = _mm512_ternarylogic_epi32(a, bb, c, MB16_MAJ);
+                gg = _mm512_ternarylogic_epi32(e, f, g, MB16_CHOOSE);
+            }
+
+            tt1 = _mm512_add_epi32(_mm512_add_epi32(ff, d),
+                                   _mm512_add_epi32(ss2, _mm512_xor_si512(w[j], w[j + 4])));
+            tt2 = _mm512_add_epi32(_mm512_add_epi32(gg, h), _mm512_add_epi32(ss1, w[j]));
+            d = c;
+            c = _mm512_rol_epi32(bb, 9);
+            bb = a;
+            a = tt1;
+            h = g;
+            g = _mm512_rol_epi32(f, 19);
+            f = e;
+            e = mb16_p0(tt2);
+        }
+
+        v[0] = _mm512_xor_si512(v[0], a);
+        v[1] = _mm512_xor_si512(v[1], bb);
+        v[2] = _mm512_xor_si512(v[2], c);
+        v[3] = _mm512_xor_si512(v[3], d);
+        v[4] = _mm512_xor_si512(v[4], e);
+        v[5] = _mm512_xor_si512(v[5], f);
+        v[6] = _mm512_xor_si512(v[6], g);
+        v[7] = _mm512_xor_si512(v[7], h);
+    }
+
+    for (i = 0; i < SM3_STATE_SIZE; i++) {
+        _mm512_storeu_si512((void *)state[i], v[i]);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef SM3_MB_X86_H
+#define SM3_MB_X86_H
+
+// Shared by the 8- and 16-lane multi-buffer kernels; each is built with its
+// own ISA flags, so this only assumes AVX2
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Load 32 bytes at offset off from each of 8 lanes and transpose, so that
+ * out[k] holds big-endian word k of every lane
+ */
+static inline void mb8_load_words(const uint8_t *const data[8], size_t off, __m256i out[8]) {
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i r[8], t[8], u[8];
+    int l;
+
+    for (l = 0; l < 8; l++) {
+        r[l] = _mm256_loadu_si256((const __m256i *)(data[l] + off));
+    }
+    for (l = 0; l < 8; l += 2) {
+        t[l] = _mm256_unpacklo_epi32(r[l], r[l + 1]);
+        t[l + 1] = _mm256_unpackhi_epi32(r[l], r[l + 1]);
+    }
+    for (l = 0; l < 8; l += 4) {
+        u[l] = _mm256_unpacklo_epi64(t[l], t[l + 2]);
+        u[l + 1] = _mm256_unpackhi_epi64(t[l], t[l + 2]);
+        u[l + 2] = _mm256_unpacklo_epi64(t[l + 1], t[l + 3]);
+        u[l + 3] = _mm256_unpackhi_epi64(t[l + 1], t[l + 3]);
+    }
+    for (l = 0; l < 4; l++) {
+        out[l] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[l], u[l + 4], 0x20), bswap);
+        out[l + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[l], u[l + 4], 0x31), bswap);
+    }
+}
+
+#endif // SM3_MB_X86_H
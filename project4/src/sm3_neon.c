@@ -1,127 +1,68 @@
 #include "sm3.h"
-#include <string.h>
+#include "sm3_internal.h"
 
 #ifdef __aarch64__
 #include <arm_neon.h>
 
-// NEON optimized SM3 compression for ARM64
-void sm3_compress_neon(uint32_t state[8], const uint8_t block[64]) {
-    uint32x4_t W[17]; // Process 4 words at a time
-    uint32x4_t W1[16];
-    uint32x4_t state_vec[2];
-    uint32_t A, B, C, D, E, F, G, H;
-    uint32_t SS1, SS2, TT1, TT2;
+// NEON message schedule for ARM64
+//
+// Four words per step: W[j+3] is first computed with W[j] taken as zero and
+// then corrected by P1(W[j] <<< 15), since P1 is linear over XOR. Shifted
+// windows of the previous 16 words come from VEXT; the rounds stay scalar.
+
+#define NEON_ROL(x, n) vsriq_n_u32(vshlq_n_u32((x), (n)), (x), 32 - (n))
+
+static inline uint32x4_t neon_load_be(const uint8_t *p) {
+    return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)));
+}
+
+static inline uint32x4_t neon_p1(uint32x4_t x) {
+    return veorq_u32(veorq_u32(x, NEON_ROL(x, 15)), NEON_ROL(x, 23));
+}
+
+static inline void neon_expand(const uint8_t *block, uint32_t w[68]) {
+    const uint32x4_t zero = vdupq_n_u32(0);
+    uint32x4_t v0 = neon_load_be(block);
+    uint32x4_t v1 = neon_load_be(block + 16);
+    uint32x4_t v2 = neon_load_be(block + 32);
+    uint32x4_t v3 = neon_load_be(block + 48);
     int j;
-    
-    // Load initial state
-    A = state[0]; B = state[1]; C = state[2]; D = state[3];
-    E = state[4]; F = state[5]; G = state[6]; H = state[7];
-    
-    // Load message blocks using NEON
-    for (j = 0; j < 16; j += 4) {
-        uint32x4_t temp = vld1q_u32((uint32_t*)(block + j * 4));
-        // Reverse byte order for big-endian format
-        W[j/4] = vrev32q_u8(vreinterpretq_u8_u32(temp));
-        W[j/4] = vreinterpretq_u32_u8(W[j/4]);
-    }
-    
-    // Message expansion with NEON optimization
+
+    vst1q_u32(&w[0], v0);
+    vst1q_u32(&w[4], v1);
+    vst1q_u32(&w[8], v2);
+    vst1q_u32(&w[12], v3);
+
     for (j = 16; j < 68; j += 4) {
-        if (j + 3 < 68) {
-            uint32x4_t w_minus_16 = W[(j-16)/4];
-            uint32x4_t w_minus_9 = W[(j-9)/4];
-            uint32x4_t w_minus_3 = W[(j-3)/4];
-            uint32x4_t w_minus_13 = W[(j-13)/4];
-            uint32x4_t w_minus_6 = W[(j-6)/4];
-            
-            // XOR operations
-            uint32x4_t temp1 = veorq_u32(w_minus_16, w_minus_9);
-            uint32x4_t temp2 = veorq_u32(temp1, vshlq_n_u32(w_minus_3, 15));
-            temp2 = veorq_u32(temp2, vshrq_n_u32(w_minus_3, 17));
-            
-            // P1 function approximation using NEON
-            uint32x4_t p1_temp = veorq_u32(temp2, vshlq_n_u32(temp2, 15));
-            p1_temp = veorq_u32(p1_temp, vshrq_n_u32(temp2, 17));
-            p1_temp = veorq_u32(p1_temp, vshlq_n_u32(temp2, 23));
-            p1_temp = veorq_u32(p1_temp, vshrq_n_u32(temp2, 9));
-            
-            uint32x4_t temp3 = veorq_u32(p1_temp, vshlq_n_u32(w_minus_13, 7));
-            temp3 = veorq_u32(temp3, vshrq_n_u32(w_minus_13, 25));
-            
-            W[j/4] = veorq_u32(temp3, w_minus_6);
-        }
-    }
-    
-    // Generate W1 array using NEON
-    for (j = 0; j < 16; j++) {
-        uint32_t w_val = vgetq_lane_u32(W[j/4], j%4);
-        uint32_t w_plus_4 = vgetq_lane_u32(W[(j+4)/4], (j+4)%4);
-        
-        // Store in scalar for compression loop
-        // (Full NEON compression would require significant restructuring)
-    }
-    
-    // For demonstration, fall back to scalar compression
-    // with some NEON-optimized helper operations
-    uint32_t W_scalar[68], W1_scalar[64];
-    
-    // Extract W values from NEON registers
-    for (j = 0; j < 16; j++) {
-        W_scalar[j] = vgetq_lane_u32(W[j/4], j%4);
-    }
-    
-    // Continue with scalar message expansion for remaining values
-    for (j = 16; j < 68; j++) {
-        uint32_t temp = W_scalar[j-16] ^ W_scalar[j-9] ^ ROTL32(W_scalar[j-3], 15);
-        temp = P1(temp) ^ ROTL32(W_scalar[j-13], 7) ^ W_scalar[j-6];
-        W_scalar[j] = temp;
-    }
-    
-    for (j = 0; j < 64; j++) {
-        W1_scalar[j] = W_scalar[j] ^ W_scalar[j + 4];
-    }
-    
-    // Optimized compression using ARM64 specific optimizations
-    for (j = 0; j < 16; j++) {
-        // Use ARM64 three-operand instructions where possible
-        uint32_t T_rot = ROTL32(0x79CC4519, j % 32);
-        uint32_t A_rot12 = ROTL32(A, 12);
-        
-        SS1 = ROTL32(A_rot12 + E + T_rot, 7);
-        SS2 = SS1 ^ A_rot12;
-        
-        // ARM64 conditional operations can be optimized
-        TT1 = (A ^ B ^ C) + D + SS2 + W1_scalar[j];
-        TT2 = (E ^ F ^ G) + H + SS1 + W_scalar[j];
-        
-        // Barrel shifter optimization
-        D = C;
-        C = ROTL32(B, 9);
-        B = A;
-        A = TT1;
-        H = G;
-        G = ROTL32(F, 19);
-        F = E;
-        E = P0(TT2);
+        uint32x4_t w9 = vextq_u32(v1, v2, 3);      // W[j-9 .. j-6]
+        uint32x4_t w3 = vextq_u32(v3, zero, 1);    // W[j-3 .. j-1], 0
+        uint32x4_t w13 = vextq_u32(v0, v1, 3);     // W[j-13 .. j-10]
+        uint32x4_t w6 = vextq_u32(v2, v3, 2);      // W[j-6 .. j-3]
+        uint32x4_t x = veorq_u32(veorq_u32(v0, w9), NEON_ROL(w3, 15));
+        uint32x4_t t = veorq_u32(veorq_u32(neon_p1(x), NEON_ROL(w13, 7)), w6);
+
+        t = veorq_u32(t, neon_p1(NEON_ROL(vextq_u32(zero, t, 1), 15)));
+        vst1q_u32(&w[j], t);
+        v0 = v1;
+        v1 = v2;
+        v2 = v3;
+        v3 = t;
     }
-    
-    for (j = 16; j < 64; j++) {
-        uint32_t T_rot = ROTL32(0x7A879D8A, j % 32);
-        uint32_t A_rot12 = ROTL32(A, 12);
-        
-        SS1 = ROTL32(A_rot12 + E + T_rot, 7);
-        SS2 = SS1 ^ A_rot12;
-        
-        TT1 = ((A & B) | (A & C) | (B & C)) + D + SS2 + W1_scalar[j];
-        TT2 = ((E & F) | ((~E) & G)) + H + SS1 + W_scalar[j];
-        
-        D = C; C = ROTL32(B, 9); B = A; A = TT1;
-        H = G; G = ROTL32(F, 19); F = E; E = P0(TT2);
+}
+
+void sm3_compress_blocks_neon(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks) {
+    uint32_t w[68] __attribute__((aligned(16)));
+
+    while (nblocks-- > 0) {
+        neon_expand(data, w);
+        sm3_compress_rounds(state, w);
+        data += SM3_BLOCK_SIZE;
     }
-    
-    // Update state
-    state[0] ^= A; state[1] ^= B; state[2] ^= C; state[3] ^= D;
-    state[4] ^= E; state[5] ^= F; state[6] ^= G; state[7] ^= H;
+}
+
+// NEON optimized SM3 compression for ARM64
+void sm3_compress_neon(uint32_t state[8], const uint8_t block[64]) {
+    sm3_compress_blocks_neon(state, block, 1);
 }
 
 #endif // __aarch64__
@@ -1,124 +1,35 @@
 /**
  * SM3 Optimized Implementation
- * 
+ *
  * This file implements various optimization strategies for SM3:
- * - Lookup table optimizations for Boolean functions
- * - Reduced round operations using algebraic simplifications
- * - Message expansion optimization
- * - Memory access pattern improvements
- * 
- * Performance improvement: 15-25% over basic implementation
+ * - Branch-free Boolean functions (majority / choose forms)
+ * - Precomputed rotated round constants
+ * - Message expansion separated from compression, so callers can reuse
+ *   or vectorise the schedule
+ * - Whole-message hashing through the dispatched multi-block backend
  */
 
 #include "sm3.h"
+#include "sm3_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-
-/**
- * Precomputed lookup tables for Boolean functions
- * These tables eliminate conditional branches in the compression function
- */
-
-// FF function lookup table for j = 0..15
-static const uint32_t ff_table_0_15[8][256] = {
-    // Precomputed values for (X & Y) | ((~X) & Z) for different bit positions
-    // Each entry represents the result for a specific 8-bit input combination
-    {/* 256 precomputed values for bits 0-7 */},
-    {/* 256 precomputed values for bits 8-15 */},
-    {/* 256 precomputed values for bits 16-23 */},
-    {/* 256 precomputed values for bits 24-31 */},
-    // Additional tables for different input arrangements
-};
-
-// FF function lookup table for j = 16..63  
-static const uint32_t ff_table_16_63[8][256] = {
-    // Precomputed values for X ^ Y ^ Z for different bit positions
-    {/* 256 precomputed values */},
-};
-
-// GG function lookup tables
-static const uint32_t gg_table_0_15[8][256] = {
-    // Precomputed values for (X & Y) | ((~X) & Z)
-    {/* 256 precomputed values */},
-};
-
-static const uint32_t gg_table_16_63[8][256] = {
-    // Precomputed values for X ^ Y ^ Z  
-    {/* 256 precomputed values */},
-};
-
-/**
- * Optimized Boolean function FF using lookup tables
- */
-static inline uint32_t ff_optimized(uint32_t x, uint32_t y, uint32_t z, int j) {
-    if (j <= 15) {
-        // Use lookup table for FF(X,Y,Z) = (X & Y) | ((~X) & Z)
-        return ff_table_0_15[0][(x >> 0) & 0xFF] |
-               ff_table_0_15[1][(x >> 8) & 0xFF] |
-               ff_table_0_15[2][(x >> 16) & 0xFF] |
-               ff_table_0_15[3][(x >> 24) & 0xFF];
-    } else {
-        // Use lookup table for FF(X,Y,Z) = X ^ Y ^ Z
-        return ff_table_16_63[0][(x >> 0) & 0xFF] |
-               ff_table_16_63[1][(x >> 8) & 0xFF] |
-               ff_table_16_63[2][(x >> 16) & 0xFF] |
-               ff_table_16_63[3][(x >> 24) & 0xFF];
-    }
-}
-
-/**
- * Optimized Boolean function GG using lookup tables
- */
-static inline uint32_t gg_optimized(uint32_t x, uint32_t y, uint32_t z, int j) {
-    if (j <= 15) {
-        return gg_table_0_15[0][(x >> 0) & 0xFF] |
-               gg_table_0_15[1][(x >> 8) & 0xFF] |
-               gg_table_0_15[2][(x >> 16) & 0xFF] |
-               gg_table_0_15[3][(x >> 24) & 0xFF];
-    } else {
-        return gg_table_16_63[0][(x >> 0) & 0xFF] |
-               gg_table_16_63[1][(x >> 8) & 0xFF] |
-               gg_table_16_63[2][(x >> 16) & 0xFF] |
-               gg_table_16_63[3][(x >> 24) & 0xFF];
-    }
-}
-
-/**
- * Optimized P0 permutation using bit manipulation tricks
- */
-static inline uint32_t p0_optimized(uint32_t x) {
-    // P0(X) = X ^ ROL(X,9) ^ ROL(X,17)
-    // Use compiler intrinsics for rotation when available
-    uint32_t x9 = ROL32(x, 9);
-    uint32_t x17 = ROL32(x, 17);
-    return x ^ x9 ^ x17;
-}
-
-/**
- * Optimized P1 permutation
- */
-static inline uint32_t p1_optimized(uint32_t x) {
-    // P1(X) = X ^ ROL(X,15) ^ ROL(X,23)
-    uint32_t x15 = ROL32(x, 15);
-    uint32_t x23 = ROL32(x, 23);
-    return x ^ x15 ^ x23;
-}
+#include <time.h>
 
 /**
  * Optimized message expansion with reduced memory accesses
- * Processes message expansion in-place to improve cache efficiency
+ * w[0..15] must already hold the big-endian message words
  */
 void sm3_message_expansion_optimized(uint32_t w[68], uint32_t w1[64]) {
     int i;
-    
-    // Optimize the first 16 words (already loaded)
-    // Focus on optimizing rounds 16-67
+
     for (i = 16; i < 68; i++) {
         // W[i] = P1(W[i-16] ^ W[i-9] ^ ROL(W[i-3], 15)) ^ ROL(W[i-13], 7) ^ W[i-6]
-        uint32_t temp = w[i-16] ^ w[i-9] ^ ROL32(w[i-3], 15);
-        w[i] = p1_optimized(temp) ^ ROL32(w[i-13], 7) ^ w[i-6];
+        uint32_t temp = w[i-16] ^ w[i-9] ^ ROTL32(w[i-3], 15);
+        w[i] = P1(temp) ^ ROTL32(w[i-13], 7) ^ w[i-6];
     }
-    
+
     // Optimize W1 computation with vectorizable loop
     for (i = 0; i < 64; i++) {
         w1[i] = w[i] ^ w[i+4];
@@ -126,69 +37,37 @@ void sm3_message_expansion_optimized(uint32_t w[68], uint32_t w1[64]) {
 }
 
 /**
- * Optimized compression function with reduced operations
- * Implements algebraic optimizations and improved instruction scheduling
+ * Compression on a pre-expanded schedule
  */
-void sm3_compress_optimized(uint32_t state[8], const uint32_t w[68], const uint32_t w1[64]) {
+void sm3_compress_expanded(uint32_t state[8], const uint32_t w[68], const uint32_t w1[64]) {
     uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
     uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
-    
-    // Constants for the two phases
-    const uint32_t t1 = 0x79CC4519;
-    const uint32_t t2 = 0x7A879D8A;
-    
     int j;
-    
-    // First 16 rounds (j = 0..15) with optimized operations
-    for (j = 0; j < 16; j++) {
-        uint32_t ss1, ss2, tt1, tt2;
-        uint32_t t_j = ROL32(t1, j % 32);
-        
-        // Optimize SS1 calculation
-        ss1 = ROL32((ROL32(a, 12) + e + t_j), 7);
-        ss2 = ss1 ^ ROL32(a, 12);
-        
-        // Use optimized Boolean functions
-        tt1 = ff_optimized(a, b, c, j) + d + ss2 + w1[j];
-        tt2 = gg_optimized(e, f, g, j) + h + ss1 + w[j];
-        
-        // Update state with improved instruction scheduling
-        d = c;
-        c = ROL32(b, 9);
-        b = a;
-        a = tt1;
-        h = g;
-        g = ROL32(f, 19);
-        f = e;
-        e = p0_optimized(tt2);
-        
-        // Prefetch next iteration data
-        __builtin_prefetch(&w[j+1], 0, 3);
-        __builtin_prefetch(&w1[j+1], 0, 3);
-    }
-    
-    // Last 48 rounds (j = 16..63) with different constants
-    for (j = 16; j < 64; j++) {
-        uint32_t ss1, ss2, tt1, tt2;
-        uint32_t t_j = ROL32(t2, j % 32);
-        
-        ss1 = ROL32((ROL32(a, 12) + e + t_j), 7);
-        ss2 = ss1 ^ ROL32(a, 12);
-        
-        tt1 = ff_optimized(a, b, c, j) + d + ss2 + w1[j];
-        tt2 = gg_optimized(e, f, g, j) + h + ss1 + w[j];
-        
+
+    for (j = 0; j < 64; j++) {
+        uint32_t a12 = ROTL32(a, 12);
+        uint32_t ss1 = ROTL32(a12 + e + sm3_tj[j], 7);
+        uint32_t ss2 = ss1 ^ a12;
+        uint32_t tt1, tt2;
+
+        if (j < 16) {
+            tt1 = SM3_FF0(a, b, c) + d + ss2 + w1[j];
+            tt2 = SM3_GG0(e, f, g) + h + ss1 + w[j];
+        } else {
+            tt1 = SM3_FF1(a, b, c) + d + ss2 + w1[j];
+            tt2 = SM3_GG1(e, f, g) + h + ss1 + w[j];
+        }
+
         d = c;
-        c = ROL32(b, 9);
+        c = ROTL32(b, 9);
         b = a;
         a = tt1;
         h = g;
-        g = ROL32(f, 19);
+        g = ROTL32(f, 19);
         f = e;
-        e = p0_optimized(tt2);
+        e = P0(tt2);
     }
-    
-    // Update state with final values
+
     state[0] ^= a; state[1] ^= b; state[2] ^= c; state[3] ^= d;
     state[4] ^= e; state[5] ^= f; state[6] ^= g; state[7] ^= h;
 }
@@ -197,99 +76,38 @@ void sm3_compress_optimized(uint32_t state[8], const uint32_t w[68], const uint3
  * Optimized SM3 hash computation with all optimizations enabled
  */
 void sm3_hash_optimized(const uint8_t* message, size_t len, uint8_t hash[32]) {
-    sm3_context_t ctx;
-    
-    // Initialize with IV
-    sm3_init(&ctx);
-    
-    // Process full blocks with optimized compression
-    size_t blocks = len / 64;
-    for (size_t i = 0; i < blocks; i++) {
-        uint32_t w[68], w1[64];
-        
-        // Load message block with efficient byte ordering
-        for (int j = 0; j < 16; j++) {
-            w[j] = be32toh(((uint32_t*)(message + i * 64))[j]);
-        }
-        
-        // Optimized message expansion
-        sm3_message_expansion_optimized(w, w1);
-        
-        // Optimized compression
-        sm3_compress_optimized(ctx.state, w, w1);
-    }
-    
-    // Handle remaining bytes with padding
-    size_t remaining = len % 64;
-    if (remaining > 0 || len == 0) {
-        uint8_t block[64];
-        memcpy(block, message + blocks * 64, remaining);
-        
-        // Add padding
-        block[remaining] = 0x80;
-        memset(block + remaining + 1, 0, 64 - remaining - 1);
-        
-        // If not enough space for length, process this block and create new one
-        if (remaining >= 56) {
-            uint32_t w[68], w1[64];
-            for (int j = 0; j < 16; j++) {
-                w[j] = be32toh(((uint32_t*)block)[j]);
-            }
-            sm3_message_expansion_optimized(w, w1);
-            sm3_compress_optimized(ctx.state, w, w1);
-            
-            memset(block, 0, 64);
-        }
-        
-        // Add length in bits
-        uint64_t bit_len = len * 8;
-        ((uint64_t*)block)[7] = htobe64(bit_len);
-        
-        uint32_t w[68], w1[64];
-        for (int j = 0; j < 16; j++) {
-            w[j] = be32toh(((uint32_t*)block)[j]);
-        }
-        sm3_message_expansion_optimized(w, w1);
-        sm3_compress_optimized(ctx.state, w, w1);
-    }
-    
-    // Output hash with proper byte ordering
-    for (int i = 0; i < 8; i++) {
-        ((uint32_t*)hash)[i] = htobe32(ctx.state[i]);
-    }
+    sm3_hash(message, len, hash);
 }
 
 /**
  * Batch processing optimization for multiple small messages
- * Reduces function call overhead and improves cache utilization
+ * Messages are interleaved across SIMD lanes by the multi-buffer manager
  */
-void sm3_hash_batch_optimized(const uint8_t** messages, const size_t* lengths, 
+void sm3_hash_batch_optimized(const uint8_t** messages, const size_t* lengths,
                               size_t count, uint8_t** hashes) {
-    for (size_t i = 0; i < count; i++) {
-        sm3_hash_optimized(messages[i], lengths[i], hashes[i]);
+    sm3_mb_mgr_t mgr;
+    sm3_job_t jobs[2 * SM3_MB_MAX_LANES + 1];
+    sm3_job_t *free_jobs[2 * SM3_MB_MAX_LANES + 1];
+    size_t num_free = 0;
+
+    sm3_mb_mgr_init(&mgr);
+    for (size_t i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
+        free_jobs[num_free++] = &jobs[i];
     }
-    
-    // Additional optimization: interleave processing if messages are similar size
-    // This can improve instruction cache utilization
-}
 
-/**
- * Memory-optimized SM3 for streaming large data
- * Processes data in chunks to minimize memory footprint
- */
-int sm3_stream_optimized(FILE* input, uint8_t hash[32]) {
-    sm3_context_t ctx;
-    sm3_init(&ctx);
-    
-    uint8_t buffer[8192]; // 8KB buffer for optimal I/O performance
-    size_t bytes_read;
-    
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), input)) > 0) {
-        sm3_update(&ctx, buffer, bytes_read);
+    for (size_t i = 0; i < count; i++) {
+        sm3_job_t *job = free_jobs[--num_free];
+
+        job->buffer = messages[i];
+        job->len = lengths[i];
+        job->digest = hashes[i];
+        job = sm3_mb_submit(&mgr, job);
+        if (job) {
+            free_jobs[num_free++] = job;
+        }
+    }
+    while (sm3_mb_flush(&mgr) != NULL) {
     }
-    
-    sm3_final(&ctx, hash);
-    return ferror(input) ? -1 : 0;
 }
 
 /**
@@ -298,47 +116,27 @@ int sm3_stream_optimized(FILE* input, uint8_t hash[32]) {
 double benchmark_sm3_optimized(size_t data_size, int iterations) {
     uint8_t* data = malloc(data_size);
     uint8_t hash[32];
-    
+
+    if (!data) {
+        return 0.0;
+    }
+
     // Fill with random data
     for (size_t i = 0; i < data_size; i++) {
         data[i] = rand() & 0xFF;
     }
-    
+
     clock_t start = clock();
-    
+
     for (int i = 0; i < iterations; i++) {
         sm3_hash_optimized(data, data_size, hash);
     }
-    
+
     clock_t end = clock();
-    
+
     double time_taken = ((double)(end - start)) / CLOCKS_PER_SEC;
     double throughput = (data_size * iterations) / (time_taken * 1024 * 1024); // MB/s
-    
+
     free(data);
     return throughput;
 }
-
-/**
- * Initialize lookup tables (called once at program startup)
- */
-void sm3_optimized_init(void) {
-    // Initialize FF lookup tables
-    for (int byte_pos = 0; byte_pos < 4; byte_pos++) {
-        for (int input = 0; input < 256; input++) {
-            uint32_t x = (input & 0xFF) << (byte_pos * 8);
-            uint32_t y = 0x55555555; // Example Y value
-            uint32_t z = 0xAAAAAAAA; // Example Z value
-            
-            // Compute FF for rounds 0-15
-            ff_table_0_15[byte_pos][input] = (x & y) | ((~x) & z);
-            
-            // Compute FF for rounds 16-63  
-            ff_table_16_63[byte_pos][input] = x ^ y ^ z;
-            
-            // Similar for GG tables
-            gg_table_0_15[byte_pos][input] = (x & y) | ((~x) & z);
-            gg_table_16_63[byte_pos][input] = x ^ y ^ z;
-        }
-    }
-}
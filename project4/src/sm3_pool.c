@@ -0,0 +1,596 @@
+/**
+ * SM3 Work-Stealing Thread Pool
+ *
+ * One persistent pool serves multi-message hashing, SM3-TREE chunks and
+ * Merkle tree levels:
+ * - Each worker owns a deque: it pushes and pops at the bottom, idle
+ *   workers steal from the top, so the common path only touches the
+ *   worker's own, uncontended lock
+ * - Victims on the same NUMA node are tried before remote ones, and the
+ *   shared pool pins its workers one per allowed CPU
+ * - sm3_parallel_for() splits its range in halves down to the grain, so
+ *   thieves take the biggest pieces and a few steals balance the load
+ * - Submitting threads (workers or not) run queued tasks while they wait
+ *
+ * Workers spin briefly before sleeping; wake-ups cost a lock only when
+ * some worker is actually asleep.
+ */
+
+#define _GNU_SOURCE
+
+#include "sm3.h"
+#include "sm3_stats.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define POOL_MAX_WORKERS    256
+#define POOL_MAX_NODES      64
+#define POOL_DEQUE_INIT     256
+#define POOL_SPIN_ROUNDS    64
+
+typedef struct {
+    sm3_range_fn_t range;           // range task, or NULL for a plain task
+    sm3_task_fn_t fn;
+    void *arg;
+    size_t begin;
+    size_t end;
+    size_t grain;
+    sm3_task_group_t *group;
+} pool_task_t;
+
+// Ring buffer: steal at head (top), owner push/pop at tail (bottom)
+typedef struct {
+    pool_task_t *tasks;
+    size_t mask;
+    size_t head;
+    size_t tail;
+    pthread_mutex_t lock;
+} pool_deque_t;
+
+typedef struct pool_worker {
+    struct sm3_pool *pool;
+    pthread_t thread;
+    pool_deque_t deque;
+    int cpu;                        // pinned CPU, -1 if not pinned
+    int node;
+    int *victims;                   // steal order, same node first
+} pool_worker_t;
+
+struct sm3_pool {
+    int num_workers;
+    int num_slots;                  // workers[] entries with a deque
+    int num_started;                // threads to join
+    pool_worker_t *workers;
+    pool_deque_t inject;            // submissions from non-worker threads
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;
+    pthread_cond_t done_cv;
+    int sleepers;
+    int waiters;
+    int shutdown;
+};
+
+static __thread pool_worker_t *tls_worker = NULL;
+
+/**
+ * Deques
+ */
+static int deque_init(pool_deque_t *d) {
+    d->tasks = malloc(POOL_DEQUE_INIT * sizeof(pool_task_t));
+    if (!d->tasks) {
+        return -1;
+    }
+    d->mask = POOL_DEQUE_INIT - 1;
+    d->head = 0;
+    d->tail = 0;
+    pthread_mutex_init(&d->lock, NULL);
+    return 0;
+}
+
+static void deque_destroy(pool_deque_t *d) {
+    pthread_mutex_destroy(&d->lock);
+    free(d->tasks);
+}
+
+// Caller holds d->lock
+static int deque_reserve(pool_deque_t *d, size_t extra) {
+    size_t count = d->tail - d->head;
+    size_t cap = d->mask + 1;
+    pool_task_t *tasks;
+    size_t i;
+
+    if (count + extra <= cap) {
+        return 0;
+    }
+    while (count + extra > cap) {
+        cap *= 2;
+    }
+    tasks = malloc(cap * sizeof(pool_task_t));
+    if (!tasks) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        tasks[i] = d->tasks[(d->head + i) & d->mask];
+    }
+    free(d->tasks);
+    d->tasks = tasks;
+    d->mask = cap - 1;
+    __atomic_store_n(&d->head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->tail, count, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int deque_push(pool_deque_t *d, const pool_task_t *tasks, size_t n) {
+    size_t i;
+
+    pthread_mutex_lock(&d->lock);
+    if (deque_reserve(d, n) != 0) {
+        pthread_mutex_unlock(&d->lock);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        d->tasks[(d->tail + i) & d->mask] = tasks[i];
+    }
+    __atomic_store_n(&d->tail, d->tail + n, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// Newest task first: it is the hottest in cache
+static int deque_pop(pool_deque_t *d, pool_task_t *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->tail != d->head) {
+        __atomic_store_n(&d->tail, d->tail - 1, __ATOMIC_RELAXED);
+        *task = d->tasks[d->tail & d->mask];
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+// Oldest task first: for a split range that is the largest piece
+static int deque_steal(pool_deque_t *d, pool_task_t *task) {
+    int found = 0;
+
+    if (__atomic_load_n(&d->tail, __ATOMIC_RELAXED) == __atomic_load_n(&d->head, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    pthread_mutex_lock(&d->lock);
+    if (d->tail != d->head) {
+        *task = d->tasks[d->head & d->mask];
+        __atomic_store_n(&d->head, d->head + 1, __ATOMIC_RELAXED);
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static int deque_nonempty(pool_deque_t *d) {
+    int nonempty;
+
+    pthread_mutex_lock(&d->lock);
+    nonempty = d->tail != d->head;
+    pthread_mutex_unlock(&d->lock);
+    return nonempty;
+}
+
+/**
+ * Scheduling
+ */
+static pool_worker_t *pool_self(sm3_pool_t *pool) {
+    return (tls_worker && tls_worker->pool == pool) ? tls_worker : NULL;
+}
+
+static int pool_find(sm3_pool_t *pool, pool_worker_t *self, pool_task_t *task) {
+    int i;
+
+    if (self && deque_pop(&self->deque, task)) {
+        return 1;
+    }
+    if (deque_steal(&pool->inject, task)) {
+        return 1;
+    }
+    for (i = 0; i < pool->num_workers; i++) {
+        int v = self ? self->victims[i] : i;
+
+        if (deque_steal(&pool->workers[v].deque, task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Caller holds pool->lock
+static int pool_has_work(sm3_pool_t *pool) {
+    int i;
+
+    if (deque_nonempty(&pool->inject)) {
+        return 1;
+    }
+    for (i = 0; i < pool->num_workers; i++) {
+        if (deque_nonempty(&pool->workers[i].deque)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int pool_push(sm3_pool_t *pool, const pool_task_t *tasks, size_t n) {
+    pool_worker_t *self = pool_self(pool);
+    int sleepers;
+
+    if (deque_push(self ? &self->deque : &pool->inject, tasks, n) != 0) {
+        return -1;
+    }
+    // Pairs with the sleepers++ / rescan in pool_worker_main()
+    sleepers = __atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST);
+    if (sleepers > 0) {
+        pthread_mutex_lock(&pool->lock);
+        if (n > 1) {
+            pthread_cond_broadcast(&pool->work_cv);
+        } else {
+            pthread_cond_signal(&pool->work_cv);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return 0;
+}
+
+static void pool_task_done(sm3_pool_t *pool, sm3_task_group_t *group) {
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&pool->waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done_cv);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void pool_run(sm3_pool_t *pool, pool_task_t *task) {
+    if (task->range) {
+        // Hand the upper half to thieves until the piece is one grain
+        while (task->end - task->begin > task->grain) {
+            pool_task_t half = *task;
+
+            half.begin = task->begin + (task->end - task->begin) / 2;
+            __atomic_add_fetch(&task->group->pending, 1, __ATOMIC_SEQ_CST);
+            if (pool_push(pool, &half, 1) != 0) {
+                __atomic_sub_fetch(&task->group->pending, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            task->end = half.begin;
+        }
+        task->range(task->arg, task->begin, task->end);
+    } else {
+        task->fn(task->arg);
+    }
+    pool_task_done(pool, task->group);
+}
+
+static void *pool_worker_main(void *arg) {
+    pool_worker_t *self = (pool_worker_t *)arg;
+    sm3_pool_t *pool = self->pool;
+    pool_task_t task;
+    int idle = 0;
+
+    tls_worker = self;
+    for (;;) {
+        if (pool_find(pool, self, &task)) {
+            pool_run(pool, &task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < POOL_SPIN_ROUNDS) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (!pool->shutdown && !pool_has_work(pool)) {
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        }
+        __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (pool->shutdown && !pool_has_work(pool)) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        idle = 0;
+    }
+    return NULL;
+}
+
+/**
+ * Topology: NUMA node of a CPU from sysfs (node 0 if unknown)
+ */
+static int pool_cpu_node(int cpu) {
+    char path[64];
+    int node;
+
+    for (node = 0; node < POOL_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, F_OK) == 0) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+static int pool_online_cpus(void) {
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        return CPU_COUNT(&set);
+    }
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+// Worker i runs on the i-th CPU of the affinity mask; victims sorted so the
+// same node comes first, nearest index first within a node
+static void pool_topology(sm3_pool_t *pool, int pin) {
+    cpu_set_t set;
+    int have_set = sched_getaffinity(0, sizeof(set), &set) == 0;
+    int cpu = -1;
+    int i, j, k;
+
+    for (i = 0; i < pool->num_workers; i++) {
+        pool_worker_t *w = &pool->workers[i];
+
+        w->cpu = -1;
+        w->node = 0;
+        if (have_set) {
+            do {
+                cpu++;
+            } while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &set));
+            if (cpu < CPU_SETSIZE) {
+                w->node = pool_cpu_node(cpu);
+                w->cpu = pin ? cpu : -1;
+            }
+        }
+    }
+
+    for (i = 0; i < pool->num_workers; i++) {
+        pool_worker_t *w = &pool->workers[i];
+
+        k = 0;
+        for (j = 1; j < pool->num_workers; j++) {
+            int v = (i + j) % pool->num_workers;
+            if (pool->workers[v].node == w->node) {
+                w->victims[k++] = v;
+            }
+        }
+        for (j = 1; j < pool->num_workers; j++) {
+            int v = (i + j) % pool->num_workers;
+            if (pool->workers[v].node != w->node) {
+                w->victims[k++] = v;
+            }
+        }
+        w->victims[k++] = i;
+    }
+}
+
+static sm3_pool_t *pool_create(int num_threads, int pin) {
+    sm3_pool_t *pool = calloc(1, sizeof(*pool));
+    int i;
+
+    if (!pool) {
+        return NULL;
+    }
+    if (num_threads <= 0) {
+        num_threads = pool_online_cpus();
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if (num_threads > POOL_MAX_WORKERS) {
+        num_threads = POOL_MAX_WORKERS;
+    }
+
+    pool->num_workers = num_threads;
+    pool->workers = calloc((size_t)num_threads, sizeof(pool_worker_t));
+    if (!pool->workers || deque_init(&pool->inject) != 0) {
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+
+    for (i = 0; i < num_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].victims = malloc((size_t)num_threads * sizeof(int));
+        if (!pool->workers[i].victims || deque_init(&pool->workers[i].deque) != 0) {
+            free(pool->workers[i].victims);
+            sm3_pool_destroy(pool);
+            return NULL;
+        }
+        pool->num_slots = i + 1;
+    }
+    pool_topology(pool, pin);
+
+    for (i = 0; i < num_threads; i++) {
+        pool_worker_t *w = &pool->workers[i];
+        pthread_attr_t attr;
+        int rc;
+
+        pthread_attr_init(&attr);
+        if (w->cpu >= 0) {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(w->cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        rc = pthread_create(&w->thread, &attr, pool_worker_main, w);
+        pthread_attr_destroy(&attr);
+        if (rc != 0) {
+            // Running workers already steal from every slot: stop them all
+            sm3_pool_destroy(pool);
+            return NULL;
+        }
+        pool->num_started = i + 1;
+    }
+    return pool;
+}
+
+/**
+ * Public API
+ */
+sm3_pool_t *sm3_pool_create(int num_threads) {
+    return pool_create(num_threads, 0);
+}
+
+void sm3_pool_destroy(sm3_pool_t *pool) {
+    int i;
+
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->num_started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (i = 0; i < pool->num_slots; i++) {
+        deque_destroy(&pool->workers[i].deque);
+        free(pool->workers[i].victims);
+    }
+    deque_destroy(&pool->inject);
+    pthread_cond_destroy(&pool->done_cv);
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+static sm3_pool_t *g_default_pool = NULL;
+static pthread_once_t g_default_pool_once = PTHREAD_ONCE_INIT;
+
+static void default_pool_init(void) {
+    g_default_pool = pool_create(0, 1);
+}
+
+sm3_pool_t *sm3_pool_default(void) {
+    pthread_once(&g_default_pool_once, default_pool_init);
+    return g_default_pool;
+}
+
+int sm3_pool_size(const sm3_pool_t *pool) {
+    return pool ? pool->num_workers : 1;
+}
+
+void sm3_task_group_init(sm3_task_group_t *group) {
+    group->pending = 0;
+}
+
+int sm3_pool_submit_batch(sm3_pool_t *pool, sm3_task_group_t *group,
+                          const sm3_task_t tasks[], size_t count) {
+    pool_task_t local[64];
+    size_t done = 0;
+
+    if (!pool) {
+        for (size_t i = 0; i < count; i++) {
+            tasks[i].fn(tasks[i].arg);
+        }
+        return 0;
+    }
+    // One deque lock and at most one wake-up per 64 tasks
+    while (done < count) {
+        size_t n = count - done < 64 ? count - done : 64;
+
+        for (size_t i = 0; i < n; i++) {
+            local[i].range = NULL;
+            local[i].fn = tasks[done + i].fn;
+            local[i].arg = tasks[done + i].arg;
+            local[i].group = group;
+        }
+        __atomic_add_fetch(&group->pending, n, __ATOMIC_SEQ_CST);
+        if (pool_push(pool, local, n) != 0) {
+            __atomic_sub_fetch(&group->pending, n, __ATOMIC_SEQ_CST);
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+int sm3_pool_submit(sm3_pool_t *pool, sm3_task_group_t *group, sm3_task_fn_t fn, void *arg) {
+    sm3_task_t task;
+
+    task.fn = fn;
+    task.arg = arg;
+    return sm3_pool_submit_batch(pool, group, &task, 1);
+}
+
+void sm3_pool_wait(sm3_pool_t *pool, sm3_task_group_t *group) {
+    pool_worker_t *self;
+    pool_task_t task;
+
+    if (!pool) {
+        return;
+    }
+    self = pool_self(pool);
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        if (pool_find(pool, self, &task)) {
+            pool_run(pool, &task);
+            continue;
+        }
+        // Everything left is running elsewhere
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->waiters, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) > 0) {
+            pthread_cond_wait(&pool->done_cv, &pool->lock);
+        }
+        __atomic_sub_fetch(&pool->waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void sm3_parallel_for(sm3_pool_t *pool, size_t begin, size_t end, size_t grain,
+                      sm3_range_fn_t fn, void *ctx) {
+    sm3_task_group_t group;
+    pool_task_t task;
+    size_t n = end > begin ? end - begin : 0;
+
+    if (n == 0) {
+        return;
+    }
+    if (!pool) {
+        pool = sm3_pool_default();
+    }
+    if (grain == 0) {
+        // A handful of pieces per worker leaves room for stealing
+        grain = n / (8 * (size_t)sm3_pool_size(pool));
+        if (grain == 0) {
+            grain = 1;
+        }
+    }
+    if (!pool || n <= grain) {
+        SM3_STAT_ADD(slow_paths[SM3_SLOW_POOL_INLINE], 1);
+        fn(ctx, begin, end);
+        return;
+    }
+
+    sm3_task_group_init(&group);
+    group.pending = 1;
+    task.range = fn;
+    task.fn = NULL;
+    task.arg = ctx;
+    task.begin = begin;
+    task.end = end;
+    task.grain = grain;
+    task.group = &group;
+    // The caller takes the first piece itself
+    pool_run(pool, &task);
+    sm3_pool_wait(pool, &group);
+}
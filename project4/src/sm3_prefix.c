@@ -0,0 +1,187 @@
+/**
+ * SM3 midstates and a prefix -> midstate cache
+ *
+ * Messages that start with the same domain separator or header share the
+ * compression of those bytes. The cache keeps the context after each
+ * prefix it has seen:
+ * - lookups hash the prefix 8 bytes at a time (much cheaper than SM3 on
+ *   it) to pick a 4-way set, then compare length and bytes
+ * - a hit copies the live part of the stored context to the caller under
+ *   the lock, so entries can be evicted at any time
+ * - a miss compresses the prefix outside the lock and inserts it over the
+ *   least recently used way of its set
+ */
+
+#include "sm3.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PREFIX_CACHE_WAYS   4
+
+typedef struct {
+    uint64_t hash;
+    uint64_t stamp;                 // last use; 0 for an empty way
+    uint8_t *prefix;
+    size_t len;
+    sm3_ctx_t ctx;
+} prefix_entry_t;
+
+struct sm3_prefix_cache {
+    pthread_mutex_t lock;
+    prefix_entry_t *entries;        // num_sets * PREFIX_CACHE_WAYS
+    size_t num_sets;                // a power of two
+    uint64_t clock;
+    sm3_prefix_cache_stats_t stats;
+};
+
+void sm3_ctx_clone(sm3_ctx_t *dst, const sm3_ctx_t *src) {
+    memcpy(dst->state, src->state, sizeof(dst->state));
+    dst->count = src->count;
+    memcpy(dst->buffer, src->buffer, src->count % SM3_BLOCK_SIZE);
+}
+
+void sm3_hash_from(const sm3_ctx_t *midstate, const uint8_t *data, size_t len,
+                   uint8_t digest[SM3_DIGEST_SIZE]) {
+    sm3_ctx_t ctx;
+
+    sm3_ctx_clone(&ctx, midstate);
+    sm3_update(&ctx, data, len);
+    sm3_final(&ctx, digest);
+}
+
+static uint64_t prefix_hash(const uint8_t *p, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+    uint64_t w;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 31;
+    }
+    if (len > 0) {
+        w = 0;
+        memcpy(&w, p, len);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+    }
+    h ^= h >> 29;
+    h *= 0x94D049BB133111EBull;
+    return h ^ (h >> 32);
+}
+
+static prefix_entry_t *prefix_find(prefix_entry_t *set, uint64_t hash,
+                                   const uint8_t *prefix, size_t len) {
+    int i;
+
+    for (i = 0; i < PREFIX_CACHE_WAYS; i++) {
+        if (set[i].stamp && set[i].hash == hash && set[i].len == len &&
+            memcmp(set[i].prefix, prefix, len) == 0) {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+sm3_prefix_cache_t *sm3_prefix_cache_create(size_t capacity) {
+    sm3_prefix_cache_t *cache = calloc(1, sizeof(*cache));
+    size_t sets = 1;
+
+    if (!cache) {
+        return NULL;
+    }
+    while (sets * PREFIX_CACHE_WAYS < capacity) {
+        sets *= 2;
+    }
+    cache->entries = calloc(sets * PREFIX_CACHE_WAYS, sizeof(*cache->entries));
+    if (!cache->entries) {
+        free(cache);
+        return NULL;
+    }
+    cache->num_sets = sets;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void sm3_prefix_cache_destroy(sm3_prefix_cache_t *cache) {
+    size_t i;
+
+    if (!cache) {
+        return;
+    }
+    for (i = 0; i < cache->num_sets * PREFIX_CACHE_WAYS; i++) {
+        free(cache->entries[i].prefix);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache);
+}
+
+int sm3_prefix_cache_init(sm3_prefix_cache_t *cache, sm3_ctx_t *ctx,
+                          const uint8_t *prefix, size_t prefix_len) {
+    prefix_entry_t *set, *e;
+    uint8_t *copy, *old = NULL;
+    uint64_t hash;
+    int i;
+
+    if (prefix_len > SM3_PREFIX_CACHE_MAX_LEN) {
+        sm3_init(ctx);
+        sm3_update(ctx, prefix, prefix_len);
+        return 0;
+    }
+
+    hash = prefix_hash(prefix, prefix_len);
+    set = cache->entries + (hash & (cache->num_sets - 1)) * PREFIX_CACHE_WAYS;
+
+    pthread_mutex_lock(&cache->lock);
+    e = prefix_find(set, hash, prefix, prefix_len);
+    if (e) {
+        e->stamp = ++cache->clock;
+        sm3_ctx_clone(ctx, &e->ctx);
+        cache->stats.hits++;
+        pthread_mutex_unlock(&cache->lock);
+        return 1;
+    }
+    cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    sm3_init(ctx);
+    sm3_update(ctx, prefix, prefix_len);
+    copy = malloc(prefix_len ? prefix_len : 1);
+    if (!copy) {
+        return 0;
+    }
+    memcpy(copy, prefix, prefix_len);
+
+    pthread_mutex_lock(&cache->lock);
+    if (prefix_find(set, hash, prefix, prefix_len)) {
+        // Another thread inserted it meanwhile
+        old = copy;
+    } else {
+        e = &set[0];
+        for (i = 1; i < PREFIX_CACHE_WAYS && e->stamp; i++) {
+            if (set[i].stamp < e->stamp) {
+                e = &set[i];
+            }
+        }
+        if (e->stamp) {
+            old = e->prefix;
+            cache->stats.evictions++;
+        } else {
+            cache->stats.size++;
+        }
+        e->hash = hash;
+        e->stamp = ++cache->clock;
+        e->prefix = copy;
+        e->len = prefix_len;
+        sm3_ctx_clone(&e->ctx, ctx);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    free(old);
+    return 0;
+}
+
+void sm3_prefix_cache_get_stats(sm3_prefix_cache_t *cache, sm3_prefix_cache_stats_t *stats) {
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -1,16 +1,72 @@
 #include "sm3.h"
+#include "sm3_internal.h"
 
 #ifdef __x86_64__
 #include <immintrin.h>
 
-// Simplified SIMD implementation that falls back to basic operations
+// SIMD message schedule for a single message
+//
+// W[j] depends on W[j-3], so a 4-word step computes W[j+3] as if W[j] were
+// zero and then adds P1(W[j] <<< 15) into that lane (P1 is linear over XOR).
+// The window of previous words is kept in registers and shifted with
+// PALIGNR, so no load ever straddles an earlier store. The rounds are
+// inherently serial and stay scalar.
+
+#define SIMD_ROL(x, n) _mm_or_si128(_mm_slli_epi32((x), (n)), _mm_srli_epi32((x), 32 - (n)))
+
+static inline __m128i simd_load_be(const uint8_t *p) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap);
+}
+
+static inline __m128i simd_p1(__m128i x) {
+    return _mm_xor_si128(_mm_xor_si128(x, SIMD_ROL(x, 15)), SIMD_ROL(x, 23));
+}
+
+static inline void simd_expand(const uint8_t *block, uint32_t w[68]) {
+    __m128i v0 = simd_load_be(block);
+    __m128i v1 = simd_load_be(block + 16);
+    __m128i v2 = simd_load_be(block + 32);
+    __m128i v3 = simd_load_be(block + 48);
+    int j;
+
+    _mm_store_si128((__m128i *)&w[0], v0);
+    _mm_store_si128((__m128i *)&w[4], v1);
+    _mm_store_si128((__m128i *)&w[8], v2);
+    _mm_store_si128((__m128i *)&w[12], v3);
+
+    for (j = 16; j < 68; j += 4) {
+        __m128i w9 = _mm_alignr_epi8(v2, v1, 12);     // W[j-9 .. j-6]
+        __m128i w3 = _mm_srli_si128(v3, 4);           // W[j-3 .. j-1], 0
+        __m128i w13 = _mm_alignr_epi8(v1, v0, 12);    // W[j-13 .. j-10]
+        __m128i w6 = _mm_alignr_epi8(v3, v2, 8);      // W[j-6 .. j-3]
+        __m128i x = _mm_xor_si128(_mm_xor_si128(v0, w9), SIMD_ROL(w3, 15));
+        __m128i t = _mm_xor_si128(_mm_xor_si128(simd_p1(x), SIMD_ROL(w13, 7)), w6);
+
+        t = _mm_xor_si128(t, simd_p1(SIMD_ROL(_mm_slli_si128(t, 12), 15)));
+        _mm_store_si128((__m128i *)&w[j], t);
+        v0 = v1;
+        v1 = v2;
+        v2 = v3;
+        v3 = t;
+    }
+}
+
+void sm3_compress_blocks_avx2(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks) {
+    uint32_t w[68] __attribute__((aligned(16)));
+
+    while (nblocks-- > 0) {
+        simd_expand(data, w);
+        sm3_compress_rounds(state, w);
+        data += SM3_BLOCK_SIZE;
+    }
+}
+
 void sm3_compress_simd(uint32_t state[8], const uint8_t block[64]) {
-    // For now, use the basic compression function to avoid compilation issues
-    sm3_compress_basic(state, block);
+    sm3_compress_blocks_avx2(state, block, 1);
 }
 
 void sm3_hash_simd(const uint8_t *input, size_t len, uint8_t output[32]) {
-    // Use basic implementation
     sm3_hash(input, len, output);
 }
 
@@ -18,7 +74,7 @@ void sm3_hash_simd(const uint8_t *input, size_t len, uint8_t output[32]) {
 
 // Non-x86 fallback
 void sm3_compress_simd(uint32_t state[8], const uint8_t block[64]) {
-    sm3_compress_basic(state, block);
+    sm3_compress_blocks_generic(state, block, 1);
 }
 
 void sm3_hash_simd(const uint8_t *input, size_t len, uint8_t output[32]) {
@@ -0,0 +1,62 @@
+/**
+ * SM3 AVX-512 message schedule
+ *
+ * The sm3_simd.c schedule with VPROLD rotations, built with -mavx512f
+ * -mavx512vl on its own so sm3_simd.o stays runnable on AVX2-only CPUs.
+ * sm3_arch_specific.c selects it when CPUID and XCR0 report AVX-512VL.
+ */
+
+#include "sm3.h"
+#include "sm3_internal.h"
+#include <immintrin.h>
+
+static inline __m128i simd_load_be(const uint8_t *p) {
+    const __m128i bswap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap);
+}
+
+// Same schedule with VPROLD and a single VPTERNLOGD per three-way XOR
+#define SIMD_XOR3(a, b, c) _mm_ternarylogic_epi32((a), (b), (c), 0x96)
+
+static inline __m128i simd512_p1(__m128i x) {
+    return SIMD_XOR3(x, _mm_rol_epi32(x, 15), _mm_rol_epi32(x, 23));
+}
+
+static inline void simd512_expand(const uint8_t *block, uint32_t w[68]) {
+    __m128i v0 = simd_load_be(block);
+    __m128i v1 = simd_load_be(block + 16);
+    __m128i v2 = simd_load_be(block + 32);
+    __m128i v3 = simd_load_be(block + 48);
+    int j;
+
+    _mm_store_si128((__m128i *)&w[0], v0);
+    _mm_store_si128((__m128i *)&w[4], v1);
+    _mm_store_si128((__m128i *)&w[8], v2);
+    _mm_store_si128((__m128i *)&w[12], v3);
+
+    for (j = 16; j < 68; j += 4) {
+        __m128i w9 = _mm_alignr_epi8(v2, v1, 12);
+        __m128i w3 = _mm_srli_si128(v3, 4);
+        __m128i w13 = _mm_alignr_epi8(v1, v0, 12);
+        __m128i w6 = _mm_alignr_epi8(v3, v2, 8);
+        __m128i t = SIMD_XOR3(simd512_p1(SIMD_XOR3(v0, w9, _mm_rol_epi32(w3, 15))),
+                              _mm_rol_epi32(w13, 7), w6);
+
+        t = _mm_xor_si128(t, simd512_p1(_mm_rol_epi32(_mm_slli_si128(t, 12), 15)));
+        _mm_store_si128((__m128i *)&w[j], t);
+        v0 = v1;
+        v1 = v2;
+        v2 = v3;
+        v3 = t;
+    }
+}
+
+void sm3_compress_blocks_avx512(uint32_t state[SM3_STATE_SIZE], const uint8_t *data, size_t nblocks) {
+    uint32_t w[68] __attribute__((aligned(16)));
+
+    while (nblocks-- > 0) {
+        simd512_expand(data, w);
+        sm3_compress_rounds(state, w);
+        data += SM3_BLOCK_SIZE;
+    }
+}
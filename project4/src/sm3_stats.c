@@ -0,0 +1,112 @@
+/**
+ * SM3 Runtime Statistics
+ *
+ * Counter slots form a list that only grows; new threads first try to
+ * adopt a slot released by a finished thread, so the list stays as long as
+ * the peak number of counting threads and no counts are dropped. Snapshots
+ * sum all slots with relaxed loads and never block writers.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sm3_stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const sm3_stat_op_names[SM3_STAT_OP_COUNT] = {
+    [SM3_STAT_UPDATE]   = "update",
+    [SM3_STAT_MB]       = "mb",
+    [SM3_STAT_PARALLEL] = "parallel",
+    [SM3_STAT_TREE]     = "tree",
+};
+
+static const char *const sm3_slow_path_names[SM3_SLOW_COUNT] = {
+    [SM3_SLOW_UPDATE_CARRY]  = "update-carry",
+    [SM3_SLOW_MB_IDLE_LANES] = "mb-idle-lanes",
+    [SM3_SLOW_POOL_INLINE]   = "pool-inline",
+};
+
+#ifdef SM3_STATS
+
+__thread sm3_stats_slot_t *sm3_stats_tls = NULL;
+
+static sm3_stats_slot_t *g_stats_head = NULL;
+static pthread_key_t g_stats_key;
+static pthread_once_t g_stats_once = PTHREAD_ONCE_INIT;
+
+static void stats_release(void *arg) {
+    __atomic_store_n(&((sm3_stats_slot_t *)arg)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void stats_key_init(void) {
+    pthread_key_create(&g_stats_key, stats_release);
+}
+
+sm3_stats_slot_t *sm3_stats_acquire(void) {
+    sm3_stats_slot_t *slot;
+    void *mem;
+
+    pthread_once(&g_stats_once, stats_key_init);
+
+    for (slot = __atomic_load_n(&g_stats_head, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        int expected = 0;
+
+        if (__atomic_compare_exchange_n(&slot->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!slot) {
+        if (posix_memalign(&mem, 64, sizeof(*slot)) != 0) {
+            return NULL;
+        }
+        slot = mem;
+        memset(slot, 0, sizeof(*slot));
+        slot->in_use = 1;
+        slot->next = __atomic_load_n(&g_stats_head, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&g_stats_head, &slot->next, slot, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    sm3_stats_tls = slot;
+    pthread_setspecific(g_stats_key, slot);
+    return slot;
+}
+
+#endif // SM3_STATS
+
+int sm3_stats_enabled(void) {
+#ifdef SM3_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void sm3_stats_snapshot(sm3_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+#ifdef SM3_STATS
+    uint64_t *sum = (uint64_t *)stats;
+    const sm3_stats_slot_t *slot;
+    size_t i;
+
+    for (slot = __atomic_load_n(&g_stats_head, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        const uint64_t *counts = (const uint64_t *)&slot->counts;
+
+        for (i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++) {
+            sum[i] += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+        }
+    }
+#endif
+}
+
+const char *sm3_stat_op_name(sm3_stat_op_t op) {
+    return (unsigned)op < SM3_STAT_OP_COUNT ? sm3_stat_op_names[op] : "unknown";
+}
+
+const char *sm3_slow_path_name(sm3_slow_path_t path) {
+    return (unsigned)path < SM3_SLOW_COUNT ? sm3_slow_path_names[path] : "unknown";
+}
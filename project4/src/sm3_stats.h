@@ -0,0 +1,40 @@
+#ifndef SM3_STATS_H
+#define SM3_STATS_H
+
+#include "sm3.h"
+
+// Internal counter hooks. SM3_STAT_ADD(field, n) bumps one sm3_stats_t
+// field in the calling thread's slot and compiles to nothing without
+// SM3_STATS. A thread gets its slot on first use and keeps it in TLS.
+
+#ifdef SM3_STATS
+
+typedef struct sm3_stats_slot {
+    sm3_stats_t counts;
+    struct sm3_stats_slot *next;
+    int in_use;                     // cleared at thread exit for reuse
+} __attribute__((aligned(64))) sm3_stats_slot_t;
+
+extern __thread sm3_stats_slot_t *sm3_stats_tls;
+sm3_stats_slot_t *sm3_stats_acquire(void);
+
+// Single writer per slot: an atomic store (not an RMW) is enough
+static inline void sm3_stat_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+#define SM3_STAT_ADD(field, n) do {                                 \
+        sm3_stats_slot_t *stat_slot_ = sm3_stats_tls;               \
+        if (stat_slot_ == NULL) stat_slot_ = sm3_stats_acquire();   \
+        if (stat_slot_ != NULL) {                                   \
+            sm3_stat_add(&stat_slot_->counts.field, (n));           \
+        }                                                           \
+    } while (0)
+
+#else
+
+#define SM3_STAT_ADD(field, n) ((void)0)
+
+#endif // SM3_STATS
+
+#endif // SM3_STATS_H
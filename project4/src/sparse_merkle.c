@@ -0,0 +1,451 @@
+/**
+ * SM3 Sparse Merkle Tree
+ *
+ * A 2^256-leaf sparse tree keyed by 256-bit keys (normally SM3 digests),
+ * hashed with short-cut leaves:
+ *
+ *   empty subtree of height h        D[h]; D[0] = 0^32, D[h] = SM3(0x01 || D[h-1] || D[h-1])
+ *   subtree holding exactly one key  SM3(0x00 || key || SM3(value)), at any height
+ *   subtree holding two or more      SM3(0x01 || left || right)
+ *
+ * Only subtrees with two or more keys are ever hashed level by level, so
+ * the stored structure is a binary Patricia trie: leaves plus one internal
+ * node per point where two keys part ways. An internal node whose keys all
+ * share the next few bits is lifted through those levels with D[] siblings.
+ * For random keys that leaves ~log2(n) hashes per key instead of 256.
+ *
+ * Hashing the value first keeps a leaf's preimage at 65 bytes, so a proof
+ * that ends at another key's leaf carries that key and its value hash and
+ * the verifier rebuilds the leaf hash, binding the key it claims to see.
+ *
+ * Updates only mark the touched path dirty; the next root or proof request
+ * rehashes every dirty node once, so a batch pays for shared ancestors once.
+ */
+
+#include "merkle_tree.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SMT_NIL     UINT32_MAX
+#define SMT_LEAF    SPARSE_MERKLE_DEPTH     // depth marker of leaves
+#define SMT_NO_TOP  0xFFFF                  // top_hash not computed yet
+
+typedef struct {
+    uint8_t key[32];        // Leaf key, or any key below an internal node
+    uint8_t hash[32];       // Leaf value hash, or subtree hash at the split depth
+    uint8_t top_hash[32];   // hash seen from the parent, at depth top
+    uint32_t child[2];      // SMT_NIL for leaves
+    uint16_t depth;         // Split bit of internal nodes, SMT_LEAF for leaves
+    uint16_t top;           // Depth top_hash is valid for
+    uint8_t dirty;          // hash needs recomputing
+} smt_node_t;
+
+struct sparse_merkle_tree {
+    smt_node_t* nodes;      // Node pool, children are indices
+    size_t count;
+    size_t capacity;
+    size_t num_keys;
+    uint32_t root;
+};
+
+static uint8_t smt_defaults[SPARSE_MERKLE_DEPTH + 1][32];
+static pthread_once_t smt_defaults_once = PTHREAD_ONCE_INIT;
+
+static void smt_init_defaults(void) {
+    memset(smt_defaults[0], 0, 32);
+    for (int h = 1; h <= SPARSE_MERKLE_DEPTH; h++) {
+        hash_nodes(smt_defaults[h - 1], smt_defaults[h - 1], smt_defaults[h]);
+    }
+}
+
+const uint8_t* sparse_merkle_default_hash(int height) {
+    if (height < 0 || height > SPARSE_MERKLE_DEPTH) {
+        return NULL;
+    }
+    pthread_once(&smt_defaults_once, smt_init_defaults);
+    return smt_defaults[height];
+}
+
+static int smt_bit(const uint8_t key[32], int depth) {
+    return (key[depth >> 3] >> (7 - (depth & 7))) & 1;
+}
+
+/**
+ * First bit where two keys differ, SPARSE_MERKLE_DEPTH if equal
+ */
+static int smt_first_diff(const uint8_t a[32], const uint8_t b[32]) {
+    for (int i = 0; i < 32; i++) {
+        uint8_t x = a[i] ^ b[i];
+        if (x) {
+            return i * 8 + __builtin_clz(x) - 24;
+        }
+    }
+    return SPARSE_MERKLE_DEPTH;
+}
+
+static void smt_leaf_hash(const uint8_t key[32], const uint8_t value_hash[32], uint8_t hash[32]) {
+    uint8_t buf[1 + 32 + 32];
+
+    buf[0] = 0x00;
+    memcpy(buf + 1, key, 32);
+    memcpy(buf + 33, value_hash, 32);
+    sm3_hash(buf, sizeof(buf), hash);
+}
+
+/**
+ * Hash of the subtree at depth `from` seen from depth `to` <= from, when all
+ * of its keys follow `key` through the levels in between
+ */
+static void smt_lift(const uint8_t key[32], const uint8_t hash[32], int from, int to,
+                     uint8_t out[32]) {
+    memcpy(out, hash, 32);
+    for (int d = from - 1; d >= to; d--) {
+        if (smt_bit(key, d)) {
+            hash_nodes(smt_defaults[SPARSE_MERKLE_DEPTH - 1 - d], out, out);
+        } else {
+            hash_nodes(out, smt_defaults[SPARSE_MERKLE_DEPTH - 1 - d], out);
+        }
+    }
+}
+
+sparse_merkle_tree_t* sparse_merkle_create(void) {
+    sparse_merkle_tree_t* smt = calloc(1, sizeof(sparse_merkle_tree_t));
+    if (!smt) return NULL;
+
+    pthread_once(&smt_defaults_once, smt_init_defaults);
+    smt->root = SMT_NIL;
+    return smt;
+}
+
+void sparse_merkle_destroy(sparse_merkle_tree_t* smt) {
+    if (!smt) return;
+
+    free(smt->nodes);
+    free(smt);
+}
+
+size_t sparse_merkle_size(const sparse_merkle_tree_t* smt) {
+    return smt->num_keys;
+}
+
+static uint32_t smt_new_leaf(sparse_merkle_tree_t* smt, const uint8_t key[32],
+                             const uint8_t value_hash[32]) {
+    smt_node_t* n = &smt->nodes[smt->count];
+
+    memcpy(n->key, key, 32);
+    memcpy(n->hash, value_hash, 32);
+    n->child[0] = n->child[1] = SMT_NIL;
+    n->depth = SMT_LEAF;
+    n->top = SMT_NO_TOP;
+    n->dirty = 1;
+    smt->num_keys++;
+    return (uint32_t)smt->count++;
+}
+
+/**
+ * Set key's value hash, marking its path dirty; nothing is rehashed yet
+ */
+static int smt_insert(sparse_merkle_tree_t* smt, const uint8_t key[32],
+                      const uint8_t value_hash[32]) {
+    // An insert adds at most a leaf and one internal node
+    if (smt->count + 2 > smt->capacity) {
+        size_t capacity = smt->capacity ? smt->capacity * 2 : 64;
+        smt_node_t* nodes;
+
+        if (capacity > SMT_NIL) {
+            return -1;
+        }
+        nodes = realloc(smt->nodes, capacity * sizeof(smt_node_t));
+        if (!nodes) {
+            return -1;
+        }
+        smt->nodes = nodes;
+        smt->capacity = capacity;
+    }
+
+    uint32_t* slot = &smt->root;
+    while (*slot != SMT_NIL) {
+        uint32_t idx = *slot;
+        smt_node_t* n = &smt->nodes[idx];
+        int diff = smt_first_diff(key, n->key);
+
+        if (diff >= n->depth) {
+            n->dirty = 1;
+            if (n->depth == SMT_LEAF) {
+                memcpy(n->hash, value_hash, 32);
+                return 0;
+            }
+            slot = &n->child[smt_bit(key, n->depth)];
+            continue;
+        }
+
+        // key leaves this node's prefix at bit diff: split the edge there
+        uint32_t leaf = smt_new_leaf(smt, key, value_hash);
+        smt_node_t* split = &smt->nodes[smt->count];
+        int side = smt_bit(key, diff);
+
+        memcpy(split->key, key, 32);
+        split->child[side] = leaf;
+        split->child[!side] = idx;
+        split->depth = (uint16_t)diff;
+        split->top = SMT_NO_TOP;
+        split->dirty = 1;
+        *slot = (uint32_t)smt->count++;
+        return 0;
+    }
+
+    *slot = smt_new_leaf(smt, key, value_hash);
+    return 0;
+}
+
+/**
+ * Recompute dirty hashes below idx and its hash as seen from depth top
+ */
+static void smt_rehash(sparse_merkle_tree_t* smt, uint32_t idx, int top) {
+    smt_node_t* n = &smt->nodes[idx];
+
+    if (n->dirty) {
+        if (n->depth == SMT_LEAF) {
+            // A leaf hashes the same from any depth
+            smt_leaf_hash(n->key, n->hash, n->top_hash);
+        } else {
+            smt_rehash(smt, n->child[0], n->depth + 1);
+            smt_rehash(smt, n->child[1], n->depth + 1);
+            hash_nodes(smt->nodes[n->child[0]].top_hash, smt->nodes[n->child[1]].top_hash,
+                       n->hash);
+        }
+        n->dirty = 0;
+        n->top = SMT_NO_TOP;
+    }
+    if (n->top != top) {
+        if (n->depth != SMT_LEAF) {
+            smt_lift(n->key, n->hash, n->depth, top, n->top_hash);
+        }
+        n->top = (uint16_t)top;
+    }
+}
+
+int sparse_merkle_update(sparse_merkle_tree_t* smt, const uint8_t key[32],
+                         const uint8_t* value, size_t value_len) {
+    uint8_t value_hash[32];
+
+    sm3_hash(value, value_len, value_hash);
+    return smt_insert(smt, key, value_hash);
+}
+
+int sparse_merkle_update_batch(sparse_merkle_tree_t* smt, uint8_t (*keys)[32],
+                               const uint8_t* const values[], const size_t value_lens[],
+                               size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (sparse_merkle_update(smt, keys[i], values[i], value_lens[i]) != 0) {
+            return -1;
+        }
+    }
+    if (smt->root != SMT_NIL) {
+        smt_rehash(smt, smt->root, 0);
+    }
+    return 0;
+}
+
+void sparse_merkle_root(sparse_merkle_tree_t* smt, uint8_t root[32]) {
+    if (smt->root == SMT_NIL) {
+        memcpy(root, smt_defaults[SPARSE_MERKLE_DEPTH], 32);
+        return;
+    }
+    smt_rehash(smt, smt->root, 0);
+    memcpy(root, smt->nodes[smt->root].top_hash, 32);
+}
+
+static void smt_proof_add(sparse_merkle_proof_t* proof, int depth, const uint8_t hash[32]) {
+    proof->bitmap[depth >> 3] |= (uint8_t)(0x80 >> (depth & 7));
+    memcpy(proof->siblings[proof->num_siblings++], hash, 32);
+}
+
+/**
+ * Walk the key's path down to the subtree that decides it: the key's own
+ * leaf, another key's leaf (absent) or an empty subtree (absent)
+ */
+int sparse_merkle_prove(sparse_merkle_tree_t* smt, const uint8_t key[32],
+                        sparse_merkle_proof_t* proof) {
+    uint32_t idx = smt->root;
+    int top = 0;
+
+    memset(proof, 0, sizeof(*proof));
+    memcpy(proof->key, key, 32);
+    proof->terminal = SPARSE_MERKLE_EMPTY;
+    if (idx == SMT_NIL) {
+        return 0;
+    }
+    smt_rehash(smt, idx, 0);
+
+    while (idx != SMT_NIL) {
+        const smt_node_t* n = &smt->nodes[idx];
+        int diff = smt_first_diff(key, n->key);
+
+        if (n->depth == SMT_LEAF) {
+            proof->terminal = diff == SPARSE_MERKLE_DEPTH ? SPARSE_MERKLE_FOUND
+                                                          : SPARSE_MERKLE_OTHER_LEAF;
+            proof->depth = (uint16_t)top;
+            memcpy(proof->leaf_key, n->key, 32);
+            memcpy(proof->leaf_value_hash, n->hash, 32);
+            return 0;
+        }
+        if (diff < n->depth) {
+            // The key's side of bit diff is empty; the node is its sibling
+            uint8_t sibling[32];
+
+            smt_lift(n->key, n->hash, n->depth, diff + 1, sibling);
+            smt_proof_add(proof, diff, sibling);
+            proof->depth = (uint16_t)(diff + 1);
+            return 0;
+        }
+
+        int side = smt_bit(key, n->depth);
+        smt_proof_add(proof, n->depth, smt->nodes[n->child[!side]].top_hash);
+        idx = n->child[side];
+        top = n->depth + 1;
+    }
+    return 0;
+}
+
+/**
+ * Check a proof against a root: with a value it proves key -> value, with
+ * value == NULL it proves the key is absent
+ */
+int sparse_merkle_verify(const sparse_merkle_proof_t* proof, const uint8_t root[32],
+                         const uint8_t* value, size_t value_len) {
+    uint8_t hash[32], value_hash[32];
+    size_t k = proof->num_siblings;
+
+    if (proof->depth > SPARSE_MERKLE_DEPTH || k > SPARSE_MERKLE_DEPTH) {
+        return 0;
+    }
+    pthread_once(&smt_defaults_once, smt_init_defaults);
+
+    if (value) {
+        if (proof->terminal != SPARSE_MERKLE_FOUND ||
+            memcmp(proof->leaf_key, proof->key, 32) != 0) {
+            return 0;
+        }
+        sm3_hash(value, value_len, value_hash);
+        smt_leaf_hash(proof->key, value_hash, hash);
+    } else if (proof->terminal == SPARSE_MERKLE_OTHER_LEAF) {
+        // Another key may only stand for the subtree if it shares the path,
+        // and its leaf is rebuilt from it so the key can't be relabelled
+        if (smt_first_diff(proof->leaf_key, proof->key) < proof->depth ||
+            memcmp(proof->leaf_key, proof->key, 32) == 0) {
+            return 0;
+        }
+        smt_leaf_hash(proof->leaf_key, proof->leaf_value_hash, hash);
+    } else if (proof->terminal == SPARSE_MERKLE_EMPTY) {
+        memcpy(hash, smt_defaults[SPARSE_MERKLE_DEPTH - proof->depth], 32);
+    } else {
+        return 0;
+    }
+
+    for (int d = proof->depth - 1; d >= 0; d--) {
+        const uint8_t* sibling = smt_defaults[SPARSE_MERKLE_DEPTH - 1 - d];
+
+        if (proof->bitmap[d >> 3] & (0x80 >> (d & 7))) {
+            if (k == 0) {
+                return 0;
+            }
+            sibling = proof->siblings[--k];
+        }
+        if (smt_bit(proof->key, d)) {
+            hash_nodes(sibling, hash, hash);
+        } else {
+            hash_nodes(hash, sibling, hash);
+        }
+    }
+
+    return k == 0 && memcmp(hash, root, 32) == 0;
+}
+
+/**
+ * Non-inclusion proof for SM3(query_data)
+ * Returns 0 with the proof filled in, 1 if the key is present, -1 on error
+ */
+int generate_non_inclusion_proof(sparse_merkle_tree_t* smt, const uint8_t* query_data,
+                                 size_t data_len, sparse_merkle_proof_t* proof) {
+    uint8_t key[32];
+
+    sm3_hash(query_data, data_len, key);
+    if (sparse_merkle_prove(smt, key, proof) != 0) {
+        return -1;
+    }
+    return proof->terminal == SPARSE_MERKLE_FOUND ? 1 : 0;
+}
+
+/**
+ * Benchmark batched sparse tree updates and (non-)inclusion proofs
+ */
+void benchmark_sparse_merkle(size_t num_keys) {
+    printf("=== Benchmarking Sparse Merkle Tree with %zu keys ===\n", num_keys);
+
+    sparse_merkle_tree_t* smt = sparse_merkle_create();
+    uint8_t (*keys)[32] = malloc(num_keys * sizeof(*keys));
+    const uint8_t** values = malloc(num_keys * sizeof(*values));
+    size_t* lens = malloc(num_keys * sizeof(*lens));
+    if (!smt || !keys || !values || !lens) {
+        printf("Failed to allocate sparse tree\n");
+        goto out;
+    }
+
+    for (size_t i = 0; i < num_keys; i++) {
+        char data[64];
+        snprintf(data, sizeof(data), "key_%zu", i);
+        sm3_hash((const uint8_t*)data, strlen(data), keys[i]);
+        values[i] = keys[i];    // any bytes will do
+        lens[i] = 16;
+    }
+
+    clock_t start = clock();
+    sparse_merkle_update_batch(smt, keys, values, lens, num_keys);
+    clock_t inserted = clock();
+
+    uint8_t root[32];
+    sparse_merkle_root(smt, root);
+
+    const size_t num_proofs = 100;
+    sparse_merkle_proof_t proof;
+    size_t siblings = 0;
+    int verified = 0;
+    clock_t proofs_start = clock();
+    for (size_t i = 0; i < num_proofs; i++) {
+        size_t k = i * (num_keys / num_proofs);
+        char absent[64];
+
+        if (k < num_keys && sparse_merkle_prove(smt, keys[k], &proof) == 0) {
+            siblings += proof.num_siblings;
+            verified += sparse_merkle_verify(&proof, root, values[k], lens[k]);
+        }
+        snprintf(absent, sizeof(absent), "absent_%zu", i);
+        if (generate_non_inclusion_proof(smt, (const uint8_t*)absent, strlen(absent), &proof) == 0) {
+            verified += sparse_merkle_verify(&proof, root, NULL, 0);
+        }
+    }
+    clock_t proofs_done = clock();
+
+    double insert_time = ((double)(inserted - start)) / CLOCKS_PER_SEC;
+    double proof_time = ((double)(proofs_done - proofs_start)) / CLOCKS_PER_SEC;
+    printf("  Batch insert: %.3f seconds (%.0f keys/sec)\n", insert_time, num_keys / insert_time);
+    printf("  Nodes: %zu (%zu bytes each)\n", smt->count, sizeof(smt_node_t));
+    printf("  Prove + verify: %.3f ms per pair, avg %.1f stored siblings\n",
+           proof_time * 1000.0 / num_proofs, (double)siblings / num_proofs);
+    printf("  Successful verifications: %d/%zu\n", verified, 2 * num_proofs);
+    printf("  Root hash: ");
+    for (int i = 0; i < 32; i++) {
+        printf("%02x", root[i]);
+    }
+    printf("\n");
+
+out:
+    sparse_merkle_destroy(smt);
+    free(keys);
+    free(values);
+    free(lens);
+}
@@ -2,7 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "../src/sm3.h"
+#include "../src/merkle_tree.h"
 
 // SM3 test vectors
 typedef struct {
@@ -44,6 +48,1273 @@ static void bytes_to_hex(const uint8_t *bytes, size_t len, char *hex) {
     }
 }
 
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    uint8_t expected[SM3_DIGEST_SIZE];
+    int stop;
+    int wrong;
+} backend_switch_t;
+
+// Keeps hashing while the main thread switches backends under it
+static void *backend_switch_hasher(void *arg) {
+    backend_switch_t *sw = (backend_switch_t *)arg;
+    uint8_t digest[SM3_DIGEST_SIZE];
+
+    while (!__atomic_load_n(&sw->stop, __ATOMIC_ACQUIRE)) {
+        sm3_hash(sw->data, sw->len, digest);
+        if (memcmp(digest, sw->expected, SM3_DIGEST_SIZE) != 0) {
+            sw->wrong = 1;
+        }
+    }
+    return NULL;
+}
+
+// Every supported compression backend vs. the reference compress function
+static int test_compress_backends(void) {
+    uint8_t data[64 * 37];
+    sm3_backend_t saved = sm3_get_backend();
+    int ok = 1;
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 167 + (i >> 7));
+    }
+
+    // The constant table every kernel uses, against its definition
+    // (ROTL32 by 0 would shift by 32)
+    for (int j = 0; j < 64; j++) {
+        uint32_t t = (j % 32) ? ROTL32(T(j), j % 32) : T(j);
+
+        if (sm3_tj[j] != t) {
+            printf("[sm3_tj[%d] wrong] ", j);
+            ok = 0;
+        }
+    }
+
+    for (int b = 0; b < SM3_BACKEND_COUNT; b++) {
+        sm3_blocks_func_t func = sm3_get_blocks_func((sm3_backend_t)b);
+
+        if (!sm3_backend_supported((sm3_backend_t)b) || !func) {
+            continue;
+        }
+        printf("%s ", sm3_backend_name((sm3_backend_t)b));
+
+        for (size_t nblocks = 1; nblocks <= 37; nblocks += 4) {
+            uint32_t expected[8], state[8];
+
+            for (int i = 0; i < 8; i++) {
+                expected[i] = state[i] = 0x01234567u * (uint32_t)(i + 1);
+            }
+            for (size_t k = 0; k < nblocks; k++) {
+                sm3_compress_basic(expected, data + 64 * k);
+            }
+            func(state, data, nblocks);
+            if (memcmp(state, expected, sizeof(state)) != 0) {
+                printf("[%zu blocks wrong] ", nblocks);
+                ok = 0;
+            }
+        }
+
+        // Through sm3_hash() with the backend selected
+        sm3_set_backend((sm3_backend_t)b);
+        for (size_t i = 0; i < sizeof(test_vectors) / sizeof(test_vectors[0]); i++) {
+            uint8_t computed[SM3_DIGEST_SIZE], expected[SM3_DIGEST_SIZE];
+
+            sm3_hash((const uint8_t *)test_vectors[i].message, strlen(test_vectors[i].message), computed);
+            hex_to_bytes(test_vectors[i].expected_hex, expected);
+            if (memcmp(computed, expected, SM3_DIGEST_SIZE) != 0) {
+                printf("[vector %zu wrong] ", i + 1);
+                ok = 0;
+            }
+        }
+    }
+
+    // sm3_set_backend() while another thread is hashing
+    backend_switch_t sw = {data, sizeof(data), {0}, 0, 0};
+    pthread_t tid;
+
+    sm3_hash(data, sizeof(data), sw.expected);
+    if (pthread_create(&tid, NULL, backend_switch_hasher, &sw) == 0) {
+        for (int k = 0; k < 20000; k++) {
+            sm3_set_backend((sm3_backend_t)(k % SM3_BACKEND_COUNT));
+        }
+        __atomic_store_n(&sw.stop, 1, __ATOMIC_RELEASE);
+        pthread_join(tid, NULL);
+        if (sw.wrong) {
+            printf("[wrong digest while switching] ");
+            ok = 0;
+        }
+    }
+
+    sm3_set_backend(saved);
+    return ok;
+}
+
+// Multi-buffer manager vs. one-shot hashing, for every supported lane count
+static int test_multi_buffer(void) {
+    static const size_t lane_counts[] = {1, 8, 16};
+    enum { NUM_MSGS = 150 };
+    uint8_t *data = malloc(NUM_MSGS * 4096);
+    const uint8_t *msgs[NUM_MSGS];
+    size_t lens[NUM_MSGS];
+    uint8_t digests[NUM_MSGS][SM3_DIGEST_SIZE];
+    uint8_t expected[NUM_MSGS][SM3_DIGEST_SIZE];
+    sm3_job_t jobs[NUM_MSGS];
+    int returned[NUM_MSGS];
+    int ok = 1;
+
+    if (!data) {
+        return 0;
+    }
+    for (size_t i = 0; i < NUM_MSGS * 4096; i++) {
+        data[i] = (uint8_t)(i * 131 + (i >> 9));
+    }
+    for (size_t i = 0; i < NUM_MSGS; i++) {
+        // Every length around the padding boundaries, then 100 B - 4 KB records
+        lens[i] = (i < 130) ? i : 100 + (i * 977) % 3997;
+        msgs[i] = data + i * 4096;
+        sm3_hash(msgs[i], lens[i], expected[i]);
+    }
+
+    for (size_t k = 0; k < sizeof(lane_counts) / sizeof(lane_counts[0]); k++) {
+        sm3_mb_mgr_t mgr;
+        sm3_job_t *job;
+
+        if (sm3_mb_mgr_init_lanes(&mgr, lane_counts[k]) != 0) {
+            printf("(x%zu n/a) ", lane_counts[k]);
+            continue;
+        }
+        memset(digests, 0, sizeof(digests));
+        memset(returned, 0, sizeof(returned));
+        for (size_t i = 0; i < NUM_MSGS; i++) {
+            jobs[i].buffer = msgs[i];
+            jobs[i].len = lens[i];
+            jobs[i].digest = digests[i];
+            jobs[i].user_data = (void *)(uintptr_t)i;
+            job = sm3_mb_submit(&mgr, &jobs[i]);
+            if (job) {
+                returned[(uintptr_t)job->user_data]++;
+            }
+        }
+        while ((job = sm3_mb_flush(&mgr)) != NULL) {
+            returned[(uintptr_t)job->user_data]++;
+        }
+        for (size_t i = 0; i < NUM_MSGS; i++) {
+            if (returned[i] != 1 || jobs[i].status != SM3_JOB_COMPLETED ||
+                memcmp(digests[i], expected[i], SM3_DIGEST_SIZE) != 0) {
+                printf("[x%zu: message %zu (len %zu) wrong] ", lane_counts[k], i, lens[i]);
+                ok = 0;
+                break;
+            }
+        }
+    }
+
+    memset(digests, 0, sizeof(digests));
+    sm3_hash_mb(msgs, lens, NUM_MSGS, digests);
+    if (memcmp(digests, expected, sizeof(expected)) != 0) {
+        printf("[sm3_hash_mb wrong] ");
+        ok = 0;
+    }
+
+    free(data);
+    return ok;
+}
+
+// mmap, pipelined-read and multi-file hashing vs. sm3_hash()
+// HMAC-SM3 straight from the definition, re-hashing the padded key
+static void ref_hmac(const uint8_t *key, size_t key_len, const uint8_t *msg, size_t len,
+                     uint8_t mac[SM3_DIGEST_SIZE]) {
+    uint8_t k0[SM3_BLOCK_SIZE] = {0}, pad[SM3_BLOCK_SIZE], inner[SM3_DIGEST_SIZE];
+    sm3_ctx_t ctx;
+
+    if (key_len > SM3_BLOCK_SIZE) {
+        sm3_hash(key, key_len, k0);
+    } else {
+        memcpy(k0, key, key_len);
+    }
+    for (int i = 0; i < SM3_BLOCK_SIZE; i++) {
+        pad[i] = k0[i] ^ 0x36;
+    }
+    sm3_init(&ctx);
+    sm3_update(&ctx, pad, sizeof(pad));
+    sm3_update(&ctx, msg, len);
+    sm3_final(&ctx, inner);
+    for (int i = 0; i < SM3_BLOCK_SIZE; i++) {
+        pad[i] = k0[i] ^ 0x5c;
+    }
+    sm3_init(&ctx);
+    sm3_update(&ctx, pad, sizeof(pad));
+    sm3_update(&ctx, inner, sizeof(inner));
+    sm3_final(&ctx, mac);
+}
+
+// HMAC-SM3: known answers, cached key states vs. the definition, batch
+static int test_hmac(void) {
+    // HMAC-SM3("abc") under "key" and under 100 x 'k' (OpenSSL)
+    static const char *const kat_hex[2] = {
+        "28e63256e7c5a087b1f073265dc53092163f7b82729735d06f28f10af9d52393",
+        "2d87dd3ffa1452e8e40d9123a02824fb7dd98ae4a52683287245f1736dc610ef"
+    };
+    enum { NUM_MSGS = 150 };
+    uint8_t *data = malloc(NUM_MSGS * 4096);
+    const uint8_t *msgs[NUM_MSGS];
+    size_t lens[NUM_MSGS];
+    uint8_t macs[NUM_MSGS][SM3_DIGEST_SIZE];
+    uint8_t expected[NUM_MSGS][SM3_DIGEST_SIZE];
+    uint8_t long_key[100], mac[SM3_DIGEST_SIZE], kat[SM3_DIGEST_SIZE];
+    sm3_hmac_key_t key;
+    sm3_hmac_ctx_t ctx;
+    int ok = 1;
+
+    if (!data) {
+        return 0;
+    }
+    memset(long_key, 'k', sizeof(long_key));
+    for (int k = 0; k < 2; k++) {
+        sm3_hmac_key_init(&key, k ? long_key : (const uint8_t *)"key", k ? sizeof(long_key) : 3);
+        sm3_hmac(&key, (const uint8_t *)"abc", 3, mac);
+        hex_to_bytes(kat_hex[k], kat);
+        if (memcmp(mac, kat, SM3_DIGEST_SIZE) != 0) {
+            printf("[known answer %d wrong] ", k + 1);
+            ok = 0;
+        }
+    }
+
+    for (size_t i = 0; i < NUM_MSGS * 4096; i++) {
+        data[i] = (uint8_t)(i * 29 + (i >> 11));
+    }
+    for (size_t i = 0; i < NUM_MSGS; i++) {
+        lens[i] = (i < 130) ? i : 100 + (i * 977) % 3997;
+        msgs[i] = data + i * 4096;
+        ref_hmac(long_key, 20, msgs[i], lens[i], expected[i]);
+    }
+    sm3_hmac_key_init(&key, long_key, 20);
+
+    // One-shot and streaming in uneven pieces
+    for (size_t i = 0; i < NUM_MSGS; i++) {
+        size_t half = lens[i] / 3;
+
+        sm3_hmac(&key, msgs[i], lens[i], mac);
+        ok &= memcmp(mac, expected[i], SM3_DIGEST_SIZE) == 0;
+        sm3_hmac_init(&ctx, &key);
+        sm3_hmac_update(&ctx, msgs[i], half);
+        sm3_hmac_update(&ctx, msgs[i] + half, lens[i] - half);
+        sm3_hmac_final(&ctx, mac);
+        ok &= memcmp(mac, expected[i], SM3_DIGEST_SIZE) == 0;
+    }
+    if (!ok) {
+        printf("[single-message HMAC wrong] ");
+    }
+
+    memset(macs, 0, sizeof(macs));
+    sm3_hmac_batch(&key, msgs, lens, NUM_MSGS, macs);
+    if (memcmp(macs, expected, sizeof(expected)) != 0) {
+        printf("[sm3_hmac_batch wrong] ");
+        ok = 0;
+    }
+
+    // Verification, also of a truncated tag and a flipped bit
+    ok &= sm3_hmac_verify(&key, msgs[140], lens[140], expected[140], SM3_DIGEST_SIZE) == 0;
+    ok &= sm3_hmac_verify(&key, msgs[140], lens[140], expected[140], 16) == 0;
+    expected[140][31] ^= 1;
+    ok &= sm3_hmac_verify(&key, msgs[140], lens[140], expected[140], SM3_DIGEST_SIZE) == -1;
+    ok &= sm3_hmac_verify(&key, msgs[140], lens[140], expected[140], 0) == -1;
+
+    sm3_hmac_key_clear(&key);
+    free(data);
+    return ok;
+}
+
+// Midstates: clone / hash_from against one-shot hashing, cache hits,
+// misses and evictions
+static int test_prefix_cache(void) {
+    static const size_t prefix_lens[] = {0, 1, 13, 64, 100, 128, 200, SM3_PREFIX_CACHE_MAX_LEN + 1};
+    uint8_t data[2 * SM3_PREFIX_CACHE_MAX_LEN];
+    uint8_t digest[SM3_DIGEST_SIZE], expected[SM3_DIGEST_SIZE];
+    sm3_prefix_cache_stats_t stats;
+    sm3_prefix_cache_t *cache = sm3_prefix_cache_create(256);
+    sm3_ctx_t mid, ctx;
+    int ok = 1;
+
+    if (!cache) {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 131 + (i >> 8));
+    }
+
+    for (size_t p = 0; p < sizeof(prefix_lens) / sizeof(prefix_lens[0]); p++) {
+        size_t plen = prefix_lens[p];
+
+        sm3_init(&mid);
+        sm3_update(&mid, data, plen);
+        for (size_t len = 0; len < 300; len += 37) {
+            sm3_hash(data, plen + len, expected);
+            sm3_hash_from(&mid, data + plen, len, digest);
+            ok &= memcmp(digest, expected, SM3_DIGEST_SIZE) == 0;
+
+            sm3_ctx_clone(&ctx, &mid);
+            sm3_update(&ctx, data + plen, len);
+            sm3_final(&ctx, digest);
+            ok &= memcmp(digest, expected, SM3_DIGEST_SIZE) == 0;
+
+            // Miss on the first use of each cacheable prefix, hits after
+            ok &= sm3_prefix_cache_init(cache, &ctx, data, plen) ==
+                  (len > 0 && plen <= SM3_PREFIX_CACHE_MAX_LEN);
+            sm3_update(&ctx, data + plen, len);
+            sm3_final(&ctx, digest);
+            ok &= memcmp(digest, expected, SM3_DIGEST_SIZE) == 0;
+        }
+    }
+    if (!ok) {
+        printf("[midstate digest wrong] ");
+    }
+
+    // Same length, different bytes: a separate entry
+    data[5] ^= 1;
+    ok &= sm3_prefix_cache_init(cache, &ctx, data, 13) == 0;
+    data[5] ^= 1;
+    ok &= sm3_prefix_cache_init(cache, &ctx, data, 13) == 1;
+
+    sm3_prefix_cache_get_stats(cache, &stats);
+    ok &= stats.misses == 8 && stats.hits == 7 * 8 + 1 && stats.size == 8;
+
+    // Far more prefixes than ways: the oldest are pushed out
+    for (uint64_t i = 0; i < 1024; i++) {
+        memcpy(data, &i, sizeof(i));
+        ok &= sm3_prefix_cache_init(cache, &ctx, data, 64) == 0;
+    }
+    sm3_prefix_cache_get_stats(cache, &stats);
+    ok &= stats.misses == 8 + 1024 && stats.size <= 256;
+    ok &= stats.evictions == stats.misses - stats.size;
+
+    sm3_prefix_cache_destroy(cache);
+    return ok;
+}
+
+// GB/T 32918.4 KDF: known answers (hashlib SM3) and a serial reference
+// over Z tails on both sides of the one/two-block split
+static int test_kdf(void) {
+    static const char *const kat_hex[2] = {
+        // Z = 00 01 .. 63, klen 100
+        "7256be0931ee006a0c2abf0f301fb3d16be504ed417238dae0bdb3fdfa90a934"
+        "21191b6a9a887b460789f30e9bbeb322289ed0f5900df20d3bb23ca40c6b844d"
+        "2aa736a520a953e7ff9fc85481c32459df2032e1f3f756d658d054dd28dffa19"
+        "c9b864a4",
+        // Z = "abc", klen 19
+        "fe1ea80dac6f100c33537bd24619ec7c72a1e8"
+    };
+    static const size_t z_lens[] = {0, 1, 59, 60, 61, 64, 100, 128, 200};
+    static const size_t klens[] = {1, 31, 32, 33, 64, 100, 1000, 4103};
+    uint8_t z[200], key[4103], expected[4103], kat[100], digest[SM3_DIGEST_SIZE];
+    sm3_ctx_t ctx;
+    int ok = 1;
+
+    for (size_t i = 0; i < sizeof(z); i++) {
+        z[i] = (uint8_t)i;
+    }
+    ok &= sm3_kdf(z, 100, key, 100) == 0;
+    hex_to_bytes(kat_hex[0], kat);
+    ok &= memcmp(key, kat, 100) == 0;
+    ok &= sm3_kdf((const uint8_t *)"abc", 3, key, 19) == 0;
+    hex_to_bytes(kat_hex[1], kat);
+    ok &= memcmp(key, kat, 19) == 0;
+    if (!ok) {
+        printf("[known answer wrong] ");
+    }
+
+    for (size_t a = 0; a < sizeof(z_lens) / sizeof(z_lens[0]); a++) {
+        for (size_t b = 0; b < sizeof(klens) / sizeof(klens[0]); b++) {
+            size_t klen = klens[b];
+
+            for (uint32_t ct = 1; (ct - 1) * SM3_DIGEST_SIZE < klen; ct++) {
+                uint8_t ct_be[4] = {(uint8_t)(ct >> 24), (uint8_t)(ct >> 16),
+                                    (uint8_t)(ct >> 8), (uint8_t)ct};
+                size_t off = (ct - 1) * SM3_DIGEST_SIZE;
+
+                sm3_init(&ctx);
+                sm3_update(&ctx, z, z_lens[a]);
+                sm3_update(&ctx, ct_be, sizeof(ct_be));
+                sm3_final(&ctx, digest);
+                memcpy(expected + off, digest, klen - off < SM3_DIGEST_SIZE ? klen - off : SM3_DIGEST_SIZE);
+            }
+            memset(key, 0xee, sizeof(key));
+            ok &= sm3_kdf(z, z_lens[a], key, klen) == 0;
+            ok &= memcmp(key, expected, klen) == 0;
+            ok &= klen == sizeof(key) || key[klen] == 0xee;
+        }
+    }
+    ok &= sm3_kdf(z, sizeof(z), key, 0) == 0;
+    return ok;
+}
+
+static int test_file_hashing(void) {
+    static const char *const paths[] = {"sm3_test_a.tmp", "sm3_test_empty.tmp", "sm3_test_missing.tmp"};
+    const size_t len = 3 * 1024 * 1024 + 123;        // several mmap windows, odd tail
+    uint8_t *data = malloc(len);
+    uint8_t expected[3][SM3_DIGEST_SIZE];
+    uint8_t digest[SM3_DIGEST_SIZE];
+    uint8_t digests[3][SM3_DIGEST_SIZE];
+    int status[3];
+    sm3_file_stats_t stats;
+    int fds[2];
+    FILE *f;
+    int ok = 1;
+
+    if (!data) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        data[i] = (uint8_t)(i * 7 + (i >> 11));
+    }
+    sm3_hash(data, len, expected[0]);
+    sm3_hash(data, 0, expected[1]);
+    sm3_hash(data, 3000, expected[2]);
+
+    f = fopen(paths[0], "wb");
+    if (f) {
+        fwrite(data, 1, len, f);
+        fclose(f);
+    }
+    f = fopen(paths[1], "wb");
+    if (f) {
+        fclose(f);
+    }
+    remove(paths[2]);
+
+    if (sm3_hash_file(paths[0], digest, &stats) != 0 || stats.method != SM3_IO_MMAP ||
+        stats.bytes != len || memcmp(digest, expected[0], SM3_DIGEST_SIZE) != 0) {
+        printf("[mmap wrong] ");
+        ok = 0;
+    }
+    if (sm3_hash_file(paths[1], digest, NULL) != 0 || memcmp(digest, expected[1], SM3_DIGEST_SIZE) != 0) {
+        printf("[empty file wrong] ");
+        ok = 0;
+    }
+
+    // A pipe cannot be mapped; small enough to fit in the pipe buffer
+    if (pipe(fds) == 0) {
+        if (write(fds[1], data, 3000) != 3000) {
+            ok = 0;
+        }
+        close(fds[1]);
+        if (sm3_hash_fd(fds[0], digest, &stats) != 0 || stats.method != SM3_IO_PIPELINED_READ ||
+            memcmp(digest, expected[2], SM3_DIGEST_SIZE) != 0) {
+            printf("[pipelined read wrong] ");
+            ok = 0;
+        }
+        close(fds[0]);
+    }
+
+    if (sm3_hash_files(paths, 3, digests, status, &stats) != -1 ||
+        status[0] != 0 || status[1] != 0 || status[2] != -1 ||
+        memcmp(digests[0], expected[0], SM3_DIGEST_SIZE) != 0 ||
+        memcmp(digests[1], expected[1], SM3_DIGEST_SIZE) != 0) {
+        printf("[multi-file wrong] ");
+        ok = 0;
+    }
+
+    remove(paths[0]);
+    remove(paths[1]);
+    free(data);
+    return ok;
+}
+
+/**
+ * sm3_hash_files_parallel(): small files across several pool pieces, two
+ * files past the 1 MB batching limit and a missing path, each result at
+ * its own index
+ */
+static int test_files_parallel(void) {
+    enum { FILES = 80 };
+    char names[FILES][32];
+    const char *paths[FILES];
+    uint8_t digests[FILES][SM3_DIGEST_SIZE];
+    uint8_t expected[SM3_DIGEST_SIZE];
+    int status[FILES];
+    size_t len = 1536 * 1024;
+    uint8_t *data = malloc(len);
+    uint64_t bytes = 0;
+    sm3_file_stats_t stats;
+    int ok = data != NULL;
+
+    for (size_t i = 0; ok && i < len; i++) {
+        data[i] = (uint8_t)(i * 13 + (i >> 9));
+    }
+    for (size_t i = 0; ok && i < FILES; i++) {
+        // Large files at 7 and 50, a missing one at 33
+        size_t size = i == 7 || i == 50 ? len - i : (i * 97) % 5000;
+        FILE *f;
+
+        snprintf(names[i], sizeof(names[i]), "sm3_par_%zu.tmp", i);
+        paths[i] = names[i];
+        remove(names[i]);
+        if (i == 33) {
+            continue;
+        }
+        f = fopen(names[i], "wb");
+        ok = f && fwrite(data + i, 1, size, f) == size;
+        if (f) {
+            fclose(f);
+        }
+        bytes += size;
+    }
+
+    ok = ok && sm3_hash_files_parallel(paths, FILES, digests, status, &stats) == -1 &&
+         stats.bytes == bytes;
+    for (size_t i = 0; ok && i < FILES; i++) {
+        int single = sm3_hash_file(paths[i], expected, NULL);
+
+        if (status[i] != single || (single == 0 && memcmp(digests[i], expected, SM3_DIGEST_SIZE) != 0)) {
+            printf("[parallel file %zu] ", i);
+            ok = 0;
+        }
+    }
+    ok = ok && status[33] == -1;
+
+    for (size_t i = 0; i < FILES; i++) {
+        remove(names[i]);
+    }
+    free(data);
+    return ok;
+}
+
+/**
+ * Checksum lines survive a format / parse round trip, escaped names
+ * included, and malformed lines are rejected
+ */
+static int test_sum_lines(void) {
+    static const char *const names[] = {"plain.bin", "dir/with space", "back\\slash", "new\nline", "\\"};
+    static const char *const bad[] = {
+        "", "abc  x", "66c7f0f462eeedd9d1f2d46bdc10e4e24167c4875cf2f7a2297da02b8f4ba8e0 x",
+        "66c7f0f462eeedd9d1f2d46bdc10e4e24167c4875cf2f7a2297da02b8f4ba8e0  \n",
+        "\\66c7f0f462eeedd9d1f2d46bdc10e4e24167c4875cf2f7a2297da02b8f4ba8e0  a\\q",
+        "g6c7f0f462eeedd9d1f2d46bdc10e4e24167c4875cf2f7a2297da02b8f4ba8e0  x",
+    };
+    FILE *f = tmpfile();
+    uint8_t digest[SM3_DIGEST_SIZE], parsed[SM3_DIGEST_SIZE];
+    char line[256];
+    char *path;
+    int ok = f != NULL;
+
+    for (size_t i = 0; ok && i < sizeof(names) / sizeof(names[0]); i++) {
+        sm3_hash((const uint8_t *)names[i], strlen(names[i]), digest);
+        rewind(f);
+        ok = sm3_sum_format_line(f, digest, names[i]) == 0;
+        rewind(f);
+        ok = ok && fgets(line, sizeof(line), f) != NULL;
+        // Escaping keeps every entry on one line
+        ok = ok && strchr(line, '\n') == line + strlen(line) - 1;
+        path = ok ? sm3_sum_parse_line(line, parsed) : NULL;
+        if (!path || strcmp(path, names[i]) != 0 || memcmp(parsed, digest, SM3_DIGEST_SIZE) != 0) {
+            printf("[sum line %zu] ", i);
+            ok = 0;
+        }
+        free(path);
+    }
+    path = sm3_sum_parse_line("66C7F0F462EEEDD9D1F2D46BDC10E4E24167C4875CF2F7A2297DA02B8F4BA8E0 *abc\r\n", parsed);
+    ok = ok && path && strcmp(path, "abc") == 0 && parsed[0] == 0x66;
+    free(path);
+    for (size_t i = 0; ok && i < sizeof(bad) / sizeof(bad[0]); i++) {
+        path = sm3_sum_parse_line(bad[i], parsed);
+        if (path) {
+            printf("[bad sum line %zu accepted] ", i);
+            free(path);
+            ok = 0;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    return ok;
+}
+
+static void tree_reference_node(uint8_t prefix, const uint8_t *a, size_t a_len,
+                                const uint8_t *b, size_t b_len, uint8_t out[SM3_DIGEST_SIZE]) {
+    sm3_ctx_t ctx;
+
+    sm3_init(&ctx);
+    sm3_update(&ctx, &prefix, 1);
+    sm3_update(&ctx, a, a_len);
+    sm3_update(&ctx, b, b_len);
+    sm3_final(&ctx, out);
+}
+
+// SM3-TREE against the construction written out by hand (5 chunks: the
+// last leaf is promoted), and independence from the thread count
+static int test_tree_hash(void) {
+    uint8_t data[200];
+    uint8_t leaf[5][SM3_DIGEST_SIZE];
+    uint8_t n01[SM3_DIGEST_SIZE], n23[SM3_DIGEST_SIZE], n03[SM3_DIGEST_SIZE], root[SM3_DIGEST_SIZE];
+    uint8_t trailer[12] = {0, 0, 0, 0, 0, 0, 0, 200, 0, 0, 0, 48};
+    uint8_t expected[SM3_DIGEST_SIZE], digest[SM3_DIGEST_SIZE];
+    int ok = 1;
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 13 + 1);
+    }
+    for (size_t i = 0; i < 5; i++) {
+        tree_reference_node(0x00, data + i * 48, i < 4 ? 48 : 8, NULL, 0, leaf[i]);
+    }
+    tree_reference_node(0x01, leaf[0], 32, leaf[1], 32, n01);
+    tree_reference_node(0x01, leaf[2], 32, leaf[3], 32, n23);
+    tree_reference_node(0x01, n01, 32, n23, 32, n03);
+    tree_reference_node(0x01, n03, 32, leaf[4], 32, root);
+    tree_reference_node(0x02, trailer, sizeof(trailer), root, 32, expected);
+
+    for (int threads = 1; threads <= 4; threads++) {
+        if (sm3_tree_hash(data, sizeof(data), 48, threads, digest) != 0 ||
+            memcmp(digest, expected, SM3_DIGEST_SIZE) != 0) {
+            printf("[%d threads wrong] ", threads);
+            ok = 0;
+        }
+    }
+
+    // Empty input is a single empty chunk
+    tree_reference_node(0x00, NULL, 0, NULL, 0, root);
+    memset(trailer, 0, sizeof(trailer));
+    trailer[9] = 0x10;                              // 1 MiB default chunk
+    tree_reference_node(0x02, trailer, sizeof(trailer), root, 32, expected);
+    if (sm3_tree_hash(data, 0, 0, 0, digest) != 0 || memcmp(digest, expected, SM3_DIGEST_SIZE) != 0) {
+        printf("[empty input wrong] ");
+        ok = 0;
+    }
+
+    // Not plain SM3, and the chunk size is part of the digest
+    sm3_hash(data, sizeof(data), expected);
+    sm3_tree_hash(data, sizeof(data), 0, 1, digest);
+    if (memcmp(digest, expected, SM3_DIGEST_SIZE) == 0) {
+        ok = 0;
+    }
+    sm3_tree_hash(data, sizeof(data), 64, 1, expected);
+    if (memcmp(digest, expected, SM3_DIGEST_SIZE) == 0) {
+        printf("[chunk size not bound] ");
+        ok = 0;
+    }
+    return ok;
+}
+
+typedef struct {
+    unsigned char *hits;
+    sm3_pool_t *pool;
+} pool_test_t;
+
+static void pool_mark(void *ctx, size_t begin, size_t end) {
+    pool_test_t *t = (pool_test_t *)ctx;
+
+    for (size_t i = begin; i < end; i++) {
+        __atomic_add_fetch(&t->hits[i], 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Nested: every outer piece runs an inner parallel_for of its own
+static void pool_nested(void *ctx, size_t begin, size_t end) {
+    pool_test_t *t = (pool_test_t *)ctx;
+
+    for (size_t i = begin; i < end; i++) {
+        pool_test_t inner = {t->hits + i * 100, t->pool};
+        sm3_parallel_for(t->pool, 0, 100, 7, pool_mark, &inner);
+    }
+}
+
+static void pool_task(void *arg) {
+    __atomic_add_fetch((unsigned char *)arg, 1, __ATOMIC_RELAXED);
+}
+
+// Work-stealing pool: every index exactly once, nested loops, batches,
+// and the pool-backed users (sm3_hash_parallel, Merkle levels)
+static int test_thread_pool(void) {
+    enum { N = 10000, MSGS = 300 };
+    unsigned char *hits = calloc(N, 1);
+    sm3_pool_t *pools[2] = {sm3_pool_create(4), NULL};
+    sm3_task_t tasks[200];
+    uint8_t *data = malloc(MSGS * 64);
+    const uint8_t *msgs[MSGS];
+    size_t lens[MSGS];
+    uint8_t digests[MSGS][SM3_DIGEST_SIZE], *hashes[MSGS], expected[SM3_DIGEST_SIZE];
+    int ok = pools[0] != NULL && hits && data;
+
+    for (int p = 0; ok && p < 2; p++) {
+        pool_test_t t = {hits, pools[p]};
+        sm3_task_group_t group;
+
+        memset(hits, 0, N);
+        sm3_parallel_for(pools[p], 0, N, 0, pool_mark, &t);
+        sm3_parallel_for(pools[p], 0, N / 100, 1, pool_nested, &t);
+        for (size_t i = 0; i < 200; i++) {
+            tasks[i].fn = pool_task;
+            tasks[i].arg = &hits[i * 50];
+        }
+        sm3_task_group_init(&group);
+        sm3_pool_submit_batch(pools[p] ? pools[p] : sm3_pool_default(), &group, tasks, 200);
+        sm3_pool_wait(pools[p] ? pools[p] : sm3_pool_default(), &group);
+        for (size_t i = 0; i < N; i++) {
+            if (hits[i] != 2 + (i % 50 == 0)) {
+                printf("[%s pool: index %zu hit %d times] ", p ? "shared" : "private", i, hits[i]);
+                ok = 0;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; ok && i < MSGS; i++) {
+        memset(data + i * 64, (int)i, 64);
+        msgs[i] = data + i * 64;
+        lens[i] = i % 65;
+        hashes[i] = digests[i];
+    }
+    if (ok) {
+        sm3_hash_parallel(msgs, lens, MSGS, hashes);
+        for (size_t i = 0; i < MSGS; i++) {
+            sm3_hash(msgs[i], lens[i], expected);
+            if (memcmp(digests[i], expected, SM3_DIGEST_SIZE) != 0) {
+                printf("[sm3_hash_parallel wrong] ");
+                ok = 0;
+                break;
+            }
+        }
+    }
+
+    // 5 leaves: MTH = H(1 || H(1 || H(1 || l0 || l1) || H(1 || l2 || l3)) || l4)
+    // (capacity 2 so the leaf array has to grow)
+    if (ok) {
+        merkle_tree_t *tree = merkle_tree_init(2);
+        uint8_t leaf[5][32], n01[32], n23[32], n03[32], root[32];
+
+        for (size_t i = 0; i < 5; i++) {
+            merkle_tree_add_leaf(tree, data + i * 64, 10);
+            hash_leaf(data + i * 64, 10, leaf[i]);
+        }
+        hash_nodes(leaf[0], leaf[1], n01);
+        hash_nodes(leaf[2], leaf[3], n23);
+        hash_nodes(n01, n23, n03);
+        hash_nodes(n03, leaf[4], root);
+        if (merkle_tree_build(tree) != 0 || memcmp(merkle_tree_root(tree), root, 32) != 0) {
+            printf("[Merkle root wrong] ");
+            ok = 0;
+        }
+        for (size_t i = 0; ok && i < 5; i++) {
+            merkle_proof_t *proof = merkle_tree_generate_inclusion_proof(tree, i);
+            if (!merkle_tree_verify_inclusion_proof(proof, leaf[i], root)) {
+                printf("[proof %zu rejected] ", i);
+                ok = 0;
+            }
+            merkle_proof_free(proof);
+        }
+        merkle_tree_free(tree);
+    }
+
+    sm3_pool_destroy(pools[0]);
+    free(hits);
+    free(data);
+    return ok;
+}
+
+/**
+ * Append-only roots must match a full rebuild at every size, including
+ * sizes on both sides of each power of two; bulk adds must match add_leaf
+ */
+static int test_merkle_append(void) {
+    merkle_tree_t *log = merkle_tree_init(1);
+    merkle_tree_t *ref = merkle_tree_init(1);
+    uint8_t root[32], data[8];
+    int ok = log && ref && merkle_tree_current_root(log, root) != 0;
+
+    for (size_t n = 1; ok && n <= 70; n++) {
+        memset(data, (int)n, sizeof(data));
+        merkle_tree_add_leaf(ref, data, sizeof(data));
+        if (merkle_tree_build(ref) != 0) {
+            ok = 0;
+            break;
+        }
+        // Every third leaf goes through add_leaf to test the lazy catch-up
+        if (n % 3 == 0) {
+            merkle_tree_add_leaf(log, data, sizeof(data));
+        } else {
+            merkle_tree_append(log, data, sizeof(data));
+        }
+        if (merkle_tree_current_root(log, root) != 0 ||
+            memcmp(root, merkle_tree_root(ref), 32) != 0) {
+            printf("[size %zu] ", n);
+            ok = 0;
+        }
+    }
+
+    merkle_tree_free(log);
+    merkle_tree_free(ref);
+    
+    // Bulk leaves on top of an existing one: empty, multi-block and
+    // streamed (> 4 KB) leaves, across lane batches and pool pieces
+    enum { BULK = 3000 };
+    static uint8_t big[5000];
+    uint8_t *bytes = malloc(BULK * 8);
+    const uint8_t **datas = malloc(BULK * sizeof(*datas));
+    size_t *lens = malloc(BULK * sizeof(*lens));
+    merkle_tree_t *bulk = merkle_tree_init(1);
+    merkle_tree_t *one = merkle_tree_init(1);
+    
+    ok = ok && bytes && datas && lens && bulk && one;
+    for (size_t i = 0; ok && i < BULK; i++) {
+        memcpy(bytes + 8 * i, &i, 8);
+        datas[i] = i % 7 == 3 ? big : bytes + 8 * i;
+        lens[i] = i % 7 == 3 ? (i * 131) % sizeof(big) : i % 9;
+    }
+    ok = ok && merkle_tree_add_leaf(bulk, big, 100) == 0 &&
+         merkle_tree_add_leaf(one, big, 100) == 0 &&
+         merkle_tree_add_leaves(bulk, datas, lens, BULK) == 0 &&
+         merkle_tree_add_leaves(bulk, datas, lens, 0) == 0;
+    for (size_t i = 0; ok && i < BULK; i++) {
+        merkle_tree_add_leaf(one, datas[i], lens[i]);
+    }
+    if (ok && (bulk->leaf_count != BULK + 1 ||
+               memcmp(bulk->levels[0], one->levels[0], (BULK + 1) * 32) != 0)) {
+        printf("[add_leaves] ");
+        ok = 0;
+    }
+    
+    // Counts whose byte size would wrap size_t are refused, adding nothing
+    if (ok && (merkle_tree_add_leaves(bulk, datas, lens, SIZE_MAX / 16) != -1 ||
+               bulk->leaf_count != BULK + 1 || merkle_tree_init(SIZE_MAX / 16) != NULL)) {
+        printf("[capacity overflow] ");
+        ok = 0;
+    }
+    
+    merkle_tree_free(bulk);
+    merkle_tree_free(one);
+    free(bytes);
+    free(datas);
+    free(lens);
+    return ok;
+}
+
+/**
+ * Consistency proofs between every pair of sizes of a 40-leaf tree, checked
+ * against frontier roots, plus multiproofs for a few leaf sets
+ */
+static int test_merkle_proofs(void) {
+    enum { N = 40 };
+    merkle_tree_t *tree = merkle_tree_init(N);
+    uint8_t roots[N + 1][32], leaves[N][32], data[8];
+    uint8_t path[N * MERKLE_MAX_PATH][32];
+    int dirs[MERKLE_MAX_PATH];
+    size_t len, single;
+    int ok = tree != NULL;
+
+    for (size_t n = 1; ok && n <= N; n++) {
+        memset(data, (int)n, sizeof(data));
+        merkle_tree_append(tree, data, sizeof(data));
+        merkle_tree_current_root(tree, roots[n]);
+        hash_leaf(data, sizeof(data), leaves[n - 1]);
+    }
+    ok = ok && merkle_tree_build(tree) == 0;
+
+    // Batched node hashing, including short lane batches
+    for (size_t count = 1; ok && count <= N / 2; count++) {
+        uint8_t batch[N / 2][32], one[32];
+
+        hash_nodes_batch(leaves, count, batch);
+        for (size_t i = 0; i < count; i++) {
+            hash_nodes(leaves[2 * i], leaves[2 * i + 1], one);
+            if (memcmp(batch[i], one, 32) != 0) {
+                printf("[hash_nodes_batch %zu/%zu] ", i, count);
+                ok = 0;
+                break;
+            }
+        }
+    }
+
+    for (size_t m = 1; ok && m <= N; m++) {
+        for (size_t n = m; ok && n <= N; n++) {
+            if (merkle_tree_consistency_path(tree, m, n, path, MERKLE_MAX_PATH, &len) != 0 ||
+                !merkle_tree_verify_consistency(m, n, roots[m], roots[n], path, len)) {
+                printf("[consistency %zu->%zu] ", m, n);
+                ok = 0;
+            } else if (len > 0) {
+                path[len - 1][0] ^= 1;
+                if (merkle_tree_verify_consistency(m, n, roots[m], roots[n], path, len)) {
+                    printf("[tampered consistency %zu->%zu accepted] ", m, n);
+                    ok = 0;
+                }
+            }
+        }
+    }
+    ok = ok && merkle_tree_consistency_path(tree, 0, 5, path, MERKLE_MAX_PATH, &len) != 0 &&
+         merkle_tree_consistency_path(tree, 6, 5, path, MERKLE_MAX_PATH, &len) != 0;
+
+    static const size_t sets[][6] = {
+        {1, 0}, {1, 39}, {5, 0, 1, 2, 3, 4}, {3, 1, 3, 38}, {4, 7, 8, 31, 32},
+    };
+    for (size_t s = 0; ok && s < sizeof(sets) / sizeof(sets[0]); s++) {
+        size_t count = sets[s][0];
+        const size_t *idx = &sets[s][1];
+        uint8_t hashes[5][32];
+
+        for (size_t i = 0; i < count; i++) {
+            memcpy(hashes[i], leaves[idx[i]], 32);
+        }
+        if (merkle_tree_multiproof(tree, idx, count, path, N * MERKLE_MAX_PATH, &len) != 0 ||
+            !merkle_tree_verify_multiproof(N, idx, hashes, count, path, len, roots[N])) {
+            printf("[multiproof set %zu] ", s);
+            ok = 0;
+            break;
+        }
+        // A lone index costs exactly its audit path
+        if (count == 1 && (merkle_tree_inclusion_path(tree, idx[0], path, dirs, MERKLE_MAX_PATH,
+                                                      &single) != 0 || single != len)) {
+            printf("[multiproof size %zu] ", s);
+            ok = 0;
+        }
+        hashes[0][0] ^= 1;
+        if (merkle_tree_verify_multiproof(N, idx, hashes, count, path, len, roots[N])) {
+            printf("[tampered multiproof %zu accepted] ", s);
+            ok = 0;
+        }
+    }
+
+    // Batch verification: every leaf, a duplicate, a shared sibling
+    // tampered in one proof only, a wrong leaf and a wrong tree size
+    enum { B = N + 4 };
+    merkle_proof_t *proofs[B];
+    uint8_t batch_leaves[B][32];
+    int results[B];
+    for (size_t i = 0; i < B; i++) {
+        size_t leaf = i < N ? i : (i * 7) % N;
+        proofs[i] = merkle_tree_generate_inclusion_proof(tree, leaf);
+        memcpy(batch_leaves[i], leaves[leaf], 32);
+        ok = ok && proofs[i];
+    }
+    if (ok) {
+        proofs[N]->path[proofs[N]->path_length - 1][0] ^= 1;
+        batch_leaves[N + 1][5] ^= 1;
+        proofs[N + 2]->tree_size--;
+        size_t good = merkle_tree_verify_inclusion_batch(N, proofs, batch_leaves, B, roots[N], results);
+        for (size_t i = 0; i < B; i++) {
+            int expected = i < N || i == N + 3;
+            if (results[i] != expected ||
+                (i != N + 2 && merkle_tree_verify_inclusion_proof(proofs[i], batch_leaves[i],
+                                                                  roots[N]) != expected)) {
+                printf("[batch verify %zu] ", i);
+                ok = 0;
+            }
+        }
+        ok = ok && good == N + 1 &&
+             merkle_tree_verify_inclusion_batch(N, proofs, batch_leaves, 0, roots[N], results) == 0;
+    }
+    for (size_t i = 0; i < B; i++) {
+        merkle_proof_free(proofs[i]);
+    }
+
+    // Every leaf at once needs no sibling hashes at all
+    size_t all[N];
+    for (size_t i = 0; i < N; i++) {
+        all[i] = i;
+    }
+    ok = ok && merkle_tree_multiproof(tree, all, N, path, 0, &len) == 0 && len == 0 &&
+         merkle_tree_verify_multiproof(N, all, leaves, N, path, 0, roots[N]);
+
+    merkle_tree_free(tree);
+    return ok;
+}
+
+/**
+ * Persistent Merkle file: roots at every batch boundary across a capacity
+ * doubling, committed vs pending sizes, a torn commit record, and proofs
+ * served from a reopened file matching the in-memory tree
+ */
+static int test_merkle_file(void) {
+    static const char *path = "merkle_test.tmp";
+    enum { N = 2600 };
+    static const size_t batches[] = {1, 1, 5, 64, 1, 700, 3, 1200, 625};
+    merkle_tree_t *ref = merkle_tree_init(N);
+    merkle_tree_t *log = merkle_tree_init(1);
+    merkle_file_t *mf = merkle_file_create(path, 1);
+    merkle_file_t *ro;
+    uint8_t (*hashes)[32] = malloc(N * sizeof(*hashes));
+    uint8_t root[32], committed[32], data[8];
+    uint8_t path_a[MERKLE_MAX_PATH][32], path_b[MERKLE_MAX_PATH][32];
+    int dirs_a[MERKLE_MAX_PATH], dirs_b[MERKLE_MAX_PATH];
+    size_t len_a, len_b, n = 0, committed_size = 0;
+    int ok = ref && log && mf && hashes;
+
+    for (size_t i = 0; ok && i < N; i++) {
+        memcpy(data, &i, sizeof(data));
+        merkle_tree_add_leaf(ref, data, sizeof(data));
+        memcpy(hashes[i], merkle_tree_leaf_hash(ref, i), 32);
+    }
+    for (size_t b = 0; ok && b < sizeof(batches) / sizeof(batches[0]); b++) {
+        if (b == 0) {
+            memset(data, 0, sizeof(data));
+            ok = merkle_file_append(mf, data, sizeof(data)) == 0;
+        } else {
+            ok = merkle_file_append_hashes(mf, hashes + n, batches[b]) == 0;
+        }
+        for (size_t i = n; i < n + batches[b]; i++) {
+            memcpy(data, &i, sizeof(data));
+            merkle_tree_add_leaf(log, data, sizeof(data));
+        }
+        n += batches[b];
+        if (!ok || merkle_tree_current_root(log, root) != 0 ||
+            memcmp(root, merkle_tree_root(merkle_file_tree(mf)), 32) != 0) {
+            printf("[file root at %zu] ", n);
+            ok = 0;
+        }
+        if (b == 7) {
+            ok = ok && merkle_file_commit(mf) == 0;
+            committed_size = n;
+            memcpy(committed, root, 32);
+        }
+    }
+
+    // A reader sees the last commit, not the pending appends
+    ro = merkle_file_open(path, 0);
+    ok = ok && ro && merkle_file_size(ro) == committed_size &&
+         memcmp(merkle_tree_root(merkle_file_tree(ro)), committed, 32) == 0;
+    merkle_file_close(ro);
+    ok = ok && merkle_file_open(path, 1) == NULL;       // one writer at a time
+    ok = ok && merkle_file_close(mf) == 0;
+
+    // Reopened file serves the same proofs as a build of the same leaves
+    ok = ok && n == N && merkle_tree_build(ref) == 0;
+    ro = ok ? merkle_file_open(path, 0) : NULL;
+    ok = ok && ro && merkle_file_size(ro) == N;
+    for (size_t i = 0; ok && i < N; i += 97) {
+        if (merkle_tree_inclusion_path(merkle_file_tree(ro), i, path_a, dirs_a, MERKLE_MAX_PATH, &len_a) != 0 ||
+            merkle_tree_inclusion_path(ref, i, path_b, dirs_b, MERKLE_MAX_PATH, &len_b) != 0 ||
+            len_a != len_b || memcmp(path_a, path_b, len_a * 32) != 0 ||
+            memcmp(dirs_a, dirs_b, len_a * sizeof(int)) != 0 ||
+            merkle_tree_consistency_path(merkle_file_tree(ro), i + 1, N, path_a, MERKLE_MAX_PATH, &len_a) != 0 ||
+            merkle_tree_consistency_path(ref, i + 1, N, path_b, MERKLE_MAX_PATH, &len_b) != 0 ||
+            len_a != len_b || memcmp(path_a, path_b, len_a * 32) != 0) {
+            printf("[file proofs %zu] ", i);
+            ok = 0;
+        }
+    }
+    merkle_file_close(ro);
+
+    // Tearing the newest commit record falls back to the previous commit
+    // (close committed N after the commit at committed_size); either record
+    // may be the newest one
+    int fell_back = 0, kept = 0;
+    for (int rec = 0; ok && rec < 2; rec++) {
+        int fd = open(path, O_RDWR);
+        uint8_t byte;
+        off_t off = 64 + rec * 128 + 20;
+
+        ok = fd >= 0 && lseek(fd, off, SEEK_SET) == off && read(fd, &byte, 1) == 1;
+        byte ^= 1;
+        ok = ok && lseek(fd, off, SEEK_SET) == off && write(fd, &byte, 1) == 1;
+        ro = ok ? merkle_file_open(path, 0) : NULL;
+        if (ro && merkle_file_size(ro) == committed_size &&
+            memcmp(merkle_tree_root(merkle_file_tree(ro)), committed, 32) == 0) {
+            fell_back++;
+        } else if (ro && merkle_file_size(ro) == N) {
+            kept++;
+        }
+        merkle_file_close(ro);
+        byte ^= 1;
+        ok = ok && lseek(fd, off, SEEK_SET) == off && write(fd, &byte, 1) == 1;
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    ok = ok && fell_back == 1 && kept == 1;
+
+    // Saving a built tree gives the same file contents
+    ok = ok && merkle_file_save(ref, path) == 0;
+    ro = ok ? merkle_file_open(path, 1) : NULL;
+    ok = ok && ro && memcmp(merkle_tree_root(merkle_file_tree(ro)), merkle_tree_root(ref), 32) == 0;
+    merkle_file_close(ro);
+
+    // A capacity field that is not a power of two, or so large that the
+    // file length would wrap size_t, is rejected before anything is mapped
+    static const uint64_t capacities[] = {3, (uint64_t)1 << 58, (uint64_t)1 << 62, (uint64_t)1 << 63};
+    for (size_t c = 0; ok && c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        int fd = open(path, O_RDWR);
+        uint8_t field[8];
+
+        for (int b = 0; b < 8; b++) {
+            field[b] = (uint8_t)(capacities[c] >> (8 * b));
+        }
+        ok = fd >= 0 && lseek(fd, 16, SEEK_SET) == 16 && write(fd, field, 8) == 8;
+        if (fd >= 0) {
+            close(fd);
+        }
+        ro = ok ? merkle_file_open(path, 0) : NULL;
+        if (ro) {
+            printf("[capacity %llu accepted] ", (unsigned long long)capacities[c]);
+            merkle_file_close(ro);
+            ok = 0;
+        }
+    }
+
+    remove(path);
+    free(hashes);
+    merkle_tree_free(ref);
+    merkle_tree_free(log);
+    return ok;
+}
+
+/**
+ * Sparse Merkle tree: hand-built roots for tiny trees, order independence,
+ * and inclusion / non-inclusion proofs for present and absent keys
+ */
+static int test_sparse_merkle(void) {
+    enum { KEYS = 200 };
+    sparse_merkle_tree_t *a = sparse_merkle_create();
+    sparse_merkle_tree_t *b = sparse_merkle_create();
+    uint8_t keys[KEYS][32], root[32], expected[32], la[32], lb[32], buf[1 + 32 + 32], value;
+    const uint8_t *values[KEYS];
+    size_t lens[KEYS];
+    sparse_merkle_proof_t proof;
+    int ok = a && b;
+
+    // Empty tree: D[256]; one key: its leaf, whatever its position
+    sparse_merkle_root(a, root);
+    ok = ok && memcmp(root, sparse_merkle_default_hash(SPARSE_MERKLE_DEPTH), 32) == 0;
+
+    // 00... and 01... part at bit 1: H(H(leaf_a || leaf_b) || D[255])
+    memset(keys[0], 0x00, 32);
+    memset(keys[1], 0x40, 32);
+    for (int i = 0; ok && i < 2; i++) {
+        value = (uint8_t)i;
+        buf[0] = 0x00;
+        memcpy(buf + 1, keys[i], 32);
+        sm3_hash(&value, 1, buf + 33);
+        sm3_hash(buf, sizeof(buf), i ? lb : la);
+        sparse_merkle_update(a, keys[i], &value, 1);
+        sparse_merkle_root(a, root);
+        if (i == 0 && memcmp(root, la, 32) != 0) {
+            printf("[single key root] ");
+            ok = 0;
+        }
+    }
+    hash_nodes(la, lb, expected);
+    hash_nodes(expected, sparse_merkle_default_hash(SPARSE_MERKLE_DEPTH - 1), expected);
+    if (ok && memcmp(root, expected, 32) != 0) {
+        printf("[two key root] ");
+        ok = 0;
+    }
+
+    // A present key's own leaf relabelled as some other key sharing its path
+    // must not pass as a non-inclusion proof for it
+    ok = ok && sparse_merkle_prove(a, keys[0], &proof) == 0 && proof.terminal == SPARSE_MERKLE_FOUND;
+    proof.terminal = SPARSE_MERKLE_OTHER_LEAF;
+    proof.leaf_key[31] ^= 1;
+    if (ok && sparse_merkle_verify(&proof, root, NULL, 0)) {
+        printf("[relabelled leaf] ");
+        ok = 0;
+    }
+    // An honest other-leaf proof stops verifying once the leaf's key leaves
+    // the proven prefix
+    memset(expected, 0x00, 32);
+    expected[31] = 1;
+    ok = ok && sparse_merkle_prove(a, expected, &proof) == 0 &&
+         proof.terminal == SPARSE_MERKLE_OTHER_LEAF && sparse_merkle_verify(&proof, root, NULL, 0);
+    proof.leaf_key[0] ^= 0x80;
+    if (ok && sparse_merkle_verify(&proof, root, NULL, 0)) {
+        printf("[other leaf off the path] ");
+        ok = 0;
+    }
+    sparse_merkle_destroy(a);
+    a = sparse_merkle_create();
+
+    // Same keys as one batch and one at a time in reverse order
+    for (size_t i = 0; i < KEYS; i++) {
+        uint8_t seed[2] = {(uint8_t)i, (uint8_t)(i >> 8)};
+        sm3_hash(seed, sizeof(seed), keys[i]);
+        // Clustered keys too, so internal nodes get lifted over shared bits
+        if (i % 4 == 0) {
+            keys[i][0] = 0xA5;
+            keys[i][1] = 0x5A;
+        }
+        values[i] = keys[i];
+        lens[i] = 1 + i % 32;
+    }
+    ok = ok && a && sparse_merkle_update_batch(a, keys, values, lens, KEYS) == 0;
+    for (size_t i = KEYS; ok && i-- > 0;) {
+        sparse_merkle_update(b, keys[i], values[i], lens[i]);
+        if (i % 50 == 0) {
+            sparse_merkle_root(b, root);
+        }
+    }
+    sparse_merkle_root(a, root);
+    sparse_merkle_root(b, expected);
+    if (ok && (memcmp(root, expected, 32) != 0 || sparse_merkle_size(a) != KEYS)) {
+        printf("[batch and single roots differ] ");
+        ok = 0;
+    }
+
+    for (size_t i = 0; ok && i < KEYS; i++) {
+        uint8_t absent[32];
+
+        if (sparse_merkle_prove(a, keys[i], &proof) != 0 ||
+            !sparse_merkle_verify(&proof, root, values[i], lens[i]) ||
+            sparse_merkle_verify(&proof, root, values[i], lens[i] - 1) ||
+            sparse_merkle_verify(&proof, root, NULL, 0)) {
+            printf("[inclusion %zu] ", i);
+            ok = 0;
+        }
+        // Near misses of present keys end at that key's leaf or next to it
+        memcpy(absent, keys[i], 32);
+        absent[31 - i % 32] ^= 1;
+        if (sparse_merkle_prove(a, absent, &proof) != 0 || proof.terminal == SPARSE_MERKLE_FOUND ||
+            !sparse_merkle_verify(&proof, root, NULL, 0) ||
+            sparse_merkle_verify(&proof, expected, values[i], lens[i])) {
+            printf("[non-inclusion %zu] ", i);
+            ok = 0;
+        }
+    }
+
+    // An update changes the root and invalidates old proofs
+    ok = ok && sparse_merkle_prove(a, keys[7], &proof) == 0;
+    sparse_merkle_update(a, keys[7], (const uint8_t *)"new", 3);
+    sparse_merkle_root(a, expected);
+    if (ok && (memcmp(root, expected, 32) == 0 ||
+               sparse_merkle_verify(&proof, expected, values[7], lens[7]))) {
+        printf("[update] ");
+        ok = 0;
+    }
+    ok = ok && generate_non_inclusion_proof(a, (const uint8_t *)"missing", 7, &proof) == 0 &&
+         sparse_merkle_verify(&proof, expected, NULL, 0);
+
+    sparse_merkle_destroy(a);
+    sparse_merkle_destroy(b);
+    return ok;
+}
+
+// Counter deltas for a known workload; all zero when built without SM3_STATS
+static int test_stats(void) {
+    static const uint8_t msg[200] = {1};
+    const uint8_t *msgs[3] = {msg, msg, msg};
+    const size_t lens[3] = {10, 150, 200};
+    uint8_t digests[3][SM3_DIGEST_SIZE];
+    sm3_backend_t backend = sm3_get_backend();
+    sm3_stats_t before, after;
+    sm3_ctx_t ctx;
+    size_t lanes;
+
+    sm3_mb_best_kernel(&lanes);
+    sm3_stats_snapshot(&before);
+    sm3_init(&ctx);
+    sm3_update(&ctx, msg, 10);
+    sm3_update(&ctx, msg, 190);     // completes the buffered block, then 2 more
+    sm3_final(&ctx, digests[0]);
+    sm3_hash_mb(msgs, lens, 3, digests);
+    sm3_stats_snapshot(&after);
+
+    if (!sm3_stats_enabled()) {
+        static const sm3_stats_t zero;
+        return memcmp(&after, &zero, sizeof(zero)) == 0;
+    }
+#define DELTA(field) (after.field - before.field)
+    return DELTA(op_calls[SM3_STAT_UPDATE]) >= 3 && DELTA(op_bytes[SM3_STAT_UPDATE]) >= 200 &&
+           DELTA(slow_paths[SM3_SLOW_UPDATE_CARRY]) >= 1 &&
+           DELTA(op_calls[SM3_STAT_MB]) == 3 && DELTA(op_bytes[SM3_STAT_MB]) == 360 &&
+           DELTA(backend_blocks[backend]) >= 3 && DELTA(backend_calls[backend]) >= 2 &&
+           (DELTA(slow_paths[SM3_SLOW_MB_IDLE_LANES]) >= 1 || lanes <= 3);
+#undef DELTA
+}
+
 int main(void) {
     printf("SM3 Algorithm Test Suite\n");
     printf("========================\n\n");
@@ -118,5 +1389,80 @@ int main(void) {
         printf("SKIP (memory allocation failed)\n");
     }
     
-    return (passed == total_tests) ? 0 : 1;
+    // Test compression backends
+    printf("Compression backends test: ");
+    int backends_ok = test_compress_backends();
+    printf("%s\n", backends_ok ? "PASS" : "FAIL");
+    
+    // Test multi-buffer hashing
+    printf("Multi-buffer hashing test: ");
+    int mb_ok = test_multi_buffer();
+    printf("%s\n", mb_ok ? "PASS" : "FAIL");
+    
+    // Test HMAC-SM3
+    printf("HMAC-SM3 test: ");
+    int hmac_ok = test_hmac();
+    printf("%s\n", hmac_ok ? "PASS" : "FAIL");
+    
+    // Test midstates and the prefix cache
+    printf("SM3 prefix cache test: ");
+    int prefix_ok = test_prefix_cache();
+    printf("%s\n", prefix_ok ? "PASS" : "FAIL");
+    
+    // Test the SM3 KDF
+    printf("SM3 KDF test: ");
+    int kdf_ok = test_kdf();
+    printf("%s\n", kdf_ok ? "PASS" : "FAIL");
+    
+    // Test file hashing
+    printf("File hashing test: ");
+    int file_ok = test_file_hashing();
+    printf("%s\n", file_ok ? "PASS" : "FAIL");
+    
+    // Test parallel multi-file hashing
+    printf("Parallel file hashing test: ");
+    int files_ok = test_files_parallel();
+    printf("%s\n", files_ok ? "PASS" : "FAIL");
+    
+    // Test checksum line format
+    printf("Checksum line test: ");
+    int sum_ok = test_sum_lines();
+    printf("%s\n", sum_ok ? "PASS" : "FAIL");
+    
+    // Test SM3-TREE mode
+    printf("Tree hashing test: ");
+    int tree_ok = test_tree_hash();
+    printf("%s\n", tree_ok ? "PASS" : "FAIL");
+    
+    // Test append-only Merkle roots
+    printf("Merkle append test: ");
+    int append_ok = test_merkle_append();
+    printf("%s\n", append_ok ? "PASS" : "FAIL");
+    
+    // Test consistency proofs and multiproofs
+    printf("Merkle proofs test: ");
+    int proofs_ok = test_merkle_proofs();
+    printf("%s\n", proofs_ok ? "PASS" : "FAIL");
+    
+    // Test the persistent Merkle file
+    printf("Merkle file test: ");
+    int mfile_ok = test_merkle_file();
+    printf("%s\n", mfile_ok ? "PASS" : "FAIL");
+    
+    // Test sparse Merkle tree
+    printf("Sparse Merkle test: ");
+    int sparse_ok = test_sparse_merkle();
+    printf("%s\n", sparse_ok ? "PASS" : "FAIL");
+    
+    // Test work-stealing pool
+    printf("Thread pool test: ");
+    int pool_ok = test_thread_pool();
+    printf("%s\n", pool_ok ? "PASS" : "FAIL");
+    
+    // Test runtime statistics counters
+    printf("Statistics test (%s): ", sm3_stats_enabled() ? "counting" : "compiled out");
+    int stats_ok = test_stats();
+    printf("%s\n", stats_ok ? "PASS" : "FAIL");
+    
+    return (passed == total_tests && backends_ok && mb_ok && hmac_ok && prefix_ok && kdf_ok && file_ok && files_ok && sum_ok && tree_ok && append_ok && proofs_ok && mfile_ok && sparse_ok && pool_ok && stats_ok) ? 0 : 1;
 }